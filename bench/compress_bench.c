@@ -0,0 +1,138 @@
+/* PS5 Web Manager - on-the-fly compression benchmark
+ * Runs the streaming gzip encoder in main.c over synthetic /api/list JSON,
+ * log text and random bytes (plus any files given on the command line) and
+ * reports wire bytes, ratio and CPU cost per MB. Every result is inflated
+ * back with the server's decoder and compared with the input.
+ *
+ * make compressbench
+ * ./bench/compress_bench [file...]
+ */
+
+#define WEB_MANAGER_NO_MAIN
+#include "../main.c"
+
+typedef struct {
+    unsigned char *data;
+    size_t len, cap;
+} bench_buf_t;
+
+static int bench_buf_write(void *ctx, const unsigned char *buf, size_t len) {
+    bench_buf_t *b = ctx;
+    if (b->len + len > b->cap) {
+        b->cap = (b->len + len) * 2;
+        b->data = realloc(b->data, b->cap);
+        if (!b->data) return -1;
+    }
+    memcpy(b->data + b->len, buf, len);
+    b->len += len;
+    return 0;
+}
+
+// Inflate side: compressed input in, decoded output appended to back
+typedef struct {
+    const unsigned char *data;
+    size_t len, pos;
+    bench_buf_t back;
+} bench_check_t;
+
+static ssize_t bench_check_read(void *ctx, unsigned char *buf, size_t len) {
+    bench_check_t *c = ctx;
+    if (len > c->len - c->pos) len = c->len - c->pos;
+    memcpy(buf, c->data + c->pos, len);
+    c->pos += len;
+    return len;
+}
+
+static int bench_check_write(void *ctx, const unsigned char *buf, size_t len) {
+    return bench_buf_write(&((bench_check_t *)ctx)->back, buf, len);
+}
+
+static double cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *name, const unsigned char *data, size_t len) {
+    static deflate_t z;
+    bench_buf_t out = {0};
+    double start = cpu_seconds();
+    deflate_init(&z, DEFLATE_GZIP, bench_buf_write, &out);
+    // Feed in socket-sized pieces, as the server does
+    for (size_t off = 0; off < len; off += 65536) deflate_write(&z, data + off, len - off < 65536 ? len - off : 65536);
+    deflate_finish(&z);
+    double cpu = cpu_seconds() - start;
+    
+    // Verify: strip the gzip header and trailer, inflate the rest
+    static inflate_t in;
+    bench_check_t check = { out.data + 10, out.len - 18, 0, {0} };
+    inflate_init(&in, bench_check_read, bench_check_write, &check);
+    int ok = out.len >= 18 && inflate_run(&in) == 0 && check.back.len == len &&
+             (len == 0 || memcmp(check.back.data, data, len) == 0) && le32(out.data + out.len - 8) == crc32_ieee(0, data, len);
+    
+    double mb = len / 1e6;
+    printf("%-14s %10zu -> %10zu bytes  %5.1f%%  %7.1f MB/s  %6.2f ms CPU/MB  %s\n",
+           name, len, out.len, len ? 100.0 * out.len / len : 0, cpu > 0 ? mb / cpu : 0,
+           mb > 0 ? cpu * 1000 / mb : 0, ok ? "ok" : "MISMATCH");
+    free(out.data);
+    free(check.back.data);
+}
+
+int main(int argc, char **argv) {
+    // /api/list response for a 20000-entry directory
+    size_t cap = 8 * 1024 * 1024, len = 0;
+    char *json = malloc(cap);
+    len += snprintf(json + len, cap - len, "{\"path\":\"/data/games\",\"files\":[");
+    for (int i = 0; i < 20000; i++) {
+        len += snprintf(json + len, cap - len, "%s{\"name\":\"CUSA%05d-app%d.pkg\",\"type\":\"%s\",\"size\":%d,\"mtime\":%ld}",
+                        i ? "," : "", (i * 7919) % 100000, i % 13, i % 10 ? "file" : "dir",
+                        (i * 2654435761u) % 50000000, 1760000000L + i * 37L);
+    }
+    len += snprintf(json + len, cap - len, "]}");
+    run("list-json", (unsigned char *)json, len);
+    
+    // Server log
+    char *log = malloc(cap);
+    size_t log_len = 0;
+    static const char *routes[] = { "/api/list", "/api/download", "/api/sysinfo", "/api/upload", "/" };
+    for (int i = 0; log_len < 4 * 1024 * 1024; i++) {
+        log_len += snprintf(log + log_len, cap - log_len,
+            "{\"ts\":\"2026-01-18T12:%02d:%02d.%06d\",\"ip\":\"192.168.0.%d\",\"method\":\"GET\",\"route\":\"%s\","
+            "\"status\":%d,\"bytes\":%d,\"duration_us\":%d}\n",
+            (i / 60) % 60, i % 60, (i * 7717) % 1000000, 2 + i % 40, routes[i % 5],
+            i % 17 ? 200 : 404, (i * 131) % 100000, (i * 37) % 5000);
+    }
+    run("access-log", (unsigned char *)log, log_len);
+    
+    // Incompressible input, which the download path sends with sendfile instead
+    unsigned char *rnd = malloc(4 * 1024 * 1024);
+    uint64_t x = 88172645463325252ULL;
+    for (size_t i = 0; i < 4 * 1024 * 1024; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        rnd[i] = x;
+    }
+    run("random", rnd, 4 * 1024 * 1024);
+    run("empty", rnd, 0);
+    
+    for (int i = 1; i < argc; i++) {
+        int fd = open(argv[i], O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            perror(argv[i]);
+            continue;
+        }
+        unsigned char *data = malloc(st.st_size ? st.st_size : 1);
+        if (data && pread_full(fd, data, st.st_size, 0) == st.st_size) {
+            const char *slash = strrchr(argv[i], '/');
+            run(slash ? slash + 1 : argv[i], data, st.st_size);
+        }
+        free(data);
+        close(fd);
+    }
+    free(json);
+    free(log);
+    free(rnd);
+    return 0;
+}
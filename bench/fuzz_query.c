@@ -0,0 +1,178 @@
+/* PS5 Web Manager - query string / URL decoding fuzz harness
+ * Checks url_decode_n, query_parse and query_get from main.c against simple
+ * scalar reference implementations.
+ *
+ * Standalone:  make fuzz [FUZZ_ITERATIONS=n]   (random inputs under ASan/UBSan)
+ * libFuzzer:   clang -g -fsanitize=fuzzer,address -DFUZZ_LIBFUZZER -DHOST_BUILD bench/fuzz_query.c
+ */
+
+#define WEB_MANAGER_NO_MAIN
+#include "../main.c"
+
+#define FUZZ_MAX_INPUT 4096
+
+static void fail(const char *what, const unsigned char *data, size_t len) {
+    fprintf(stderr, "fuzz_query: %s\ninput (%zu bytes): ", what, len);
+    for (size_t i = 0; i < len; i++) fprintf(stderr, "%02x", data[i]);
+    fprintf(stderr, "\n");
+    abort();
+}
+
+// One byte at a time, straight from the spec the fast path must match
+static size_t reference_decode(char *dst, const char *src, size_t len) {
+    size_t o = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (src[i] == '%' && i + 2 < len && isxdigit((unsigned char)src[i + 1]) &&
+            isxdigit((unsigned char)src[i + 2])) {
+            char hex[3] = { src[i + 1], src[i + 2], 0 };
+            dst[o++] = (char)strtol(hex, NULL, 16);
+            i += 2;
+        } else if (src[i] == '+') {
+            dst[o++] = ' ';
+        } else {
+            dst[o++] = src[i];
+        }
+    }
+    return o;
+}
+
+static void check_decode(const unsigned char *data, size_t len) {
+    static char expected[FUZZ_MAX_INPUT + 1], actual[FUZZ_MAX_INPUT + 1];
+    size_t expected_len = reference_decode(expected, (const char *)data, len);
+    
+    // Every destination size from "too small" to "plenty" must either fit exactly or fail
+    size_t sizes[] = { 0, 1, expected_len, expected_len + 1, len + 1 };
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        size_t dst_len = sizes[k];
+        memset(actual, 0x5a, sizeof(actual));
+        size_t n = url_decode_n(actual, dst_len, (const char *)data, len);
+        if (expected_len + 1 > dst_len) {
+            if (n != (size_t)-1) fail("decode reported success into a short buffer", data, len);
+            if (dst_len < sizeof(actual) && (unsigned char)actual[dst_len] != 0x5a)
+                fail("decode wrote past the destination", data, len);
+            continue;
+        }
+        if (n != expected_len) fail("decoded length differs from reference", data, len);
+        if (memcmp(actual, expected, n) != 0) fail("decoded bytes differ from reference", data, len);
+        if (actual[n] != '\0') fail("decoded output not NUL-terminated", data, len);
+    }
+}
+
+static int is_end(char c) {
+    return c == '\0' || c == ' ' || c == '#' || c == '\r' || c == '\n';
+}
+
+static void check_query(const unsigned char *data, size_t len) {
+    static char text[FUZZ_MAX_INPUT + 1], expected[FUZZ_MAX_INPUT + 1], actual[FUZZ_MAX_INPUT + 1];
+    memcpy(text, data, len);
+    text[len] = '\0';
+    
+    query_t q;
+    query_parse(&q, text);
+    
+    // Reference split: walk segments between '&' up to the first terminator
+    const char *p = text + (text[0] == '?');
+    int count = 0;
+    while (!is_end(*p) && count < QUERY_MAX_PARAMS) {
+        const char *start = p;
+        while (!is_end(*p) && *p != '&') p++;
+        if (p > start) {
+            const char *eq = memchr(start, '=', p - start);
+            size_t key_len = (eq ? eq : p) - start;
+            query_param_t *param = &q.params[count];
+            if (count >= q.count) fail("parser found fewer parameters", data, len);
+            if (param->key != start || param->key_len != key_len)
+                fail("parameter key view differs", data, len);
+            if (eq ? (param->value != eq + 1 || param->value_len != (size_t)(p - eq - 1)) : param->value != NULL)
+                fail("parameter value view differs", data, len);
+            count++;
+        }
+        if (*p == '&') p++;
+    }
+    if (count != q.count) fail("parser found a different number of parameters", data, len);
+    
+    // Lookups return the first exact key match, decoded
+    for (int i = 0; i < q.count; i++) {
+        char name[FUZZ_MAX_INPUT + 1];
+        memcpy(name, q.params[i].key, q.params[i].key_len);
+        name[q.params[i].key_len] = '\0';
+        int first = i;
+        for (int j = 0; j < i; j++) {
+            if (q.params[j].key_len == q.params[i].key_len &&
+                memcmp(q.params[j].key, name, q.params[i].key_len) == 0) {
+                first = j;
+                break;
+            }
+        }
+        char *v = query_get(&q, name, actual, sizeof(actual));
+        if (!q.params[first].value) {
+            if (v) fail("lookup returned a value for a bare key", data, len);
+            continue;
+        }
+        size_t n = reference_decode(expected, q.params[first].value, q.params[first].value_len);
+        expected[n] = '\0';
+        if (!v || strcmp(v, expected) != 0) fail("lookup value differs from reference", data, len);
+    }
+}
+
+static void check_input(const unsigned char *data, size_t len) {
+    if (len > FUZZ_MAX_INPUT) len = FUZZ_MAX_INPUT;
+    check_decode(data, len);
+    check_query(data, len);
+}
+
+#ifdef FUZZ_LIBFUZZER
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t len) {
+    check_input(data, len);
+    return 0;
+}
+#else
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+static unsigned long long rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+int main(int argc, char **argv) {
+    static const char alphabet[] = "%+&=?#aAfF09gz/._- ";
+    static unsigned char buf[FUZZ_MAX_INPUT + 16];
+    unsigned long long iterations = argc > 1 ? strtoull(argv[1], NULL, 10) : 100000;
+    if (argc > 2) rng_state = strtoull(argv[2], NULL, 10) | 1;
+    
+    // Known regressions of the old strstr-based lookup
+    const char *fixed[] = {
+        "?xpath=/etc&path=/data", "path", "path=", "?=&&=&path=%2", "path=%zz%4", "a=1&a=2",
+        "path=/data/a%20b+c%2Fd", "?path=/data/x y", "old=%41%42&new=%61%62#frag",
+    };
+    for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+        check_input((const unsigned char *)fixed[i], strlen(fixed[i]));
+    }
+    query_t q;
+    char value[64];
+    query_parse(&q, "?xpath=/etc&path=/data");
+    if (!query_get(&q, "path", value, sizeof(value)) || strcmp(value, "/data") != 0) {
+        fprintf(stderr, "fuzz_query: 'path' matched inside 'xpath'\n");
+        return 1;
+    }
+    
+    for (unsigned long long it = 0; it < iterations; it++) {
+        // Mostly short, sometimes long enough to exercise many SIMD blocks;
+        // a random offset keeps loads unaligned
+        size_t len = (rng() % 8 == 0) ? rng() % FUZZ_MAX_INPUT : rng() % 96;
+        size_t offset = rng() % 16;
+        int mode = rng() % 3;
+        for (size_t i = 0; i < len; i++) {
+            unsigned long long r = rng();
+            if (mode == 0) buf[offset + i] = (unsigned char)r;
+            else if (mode == 1) buf[offset + i] = alphabet[r % (sizeof(alphabet) - 1)];
+            else buf[offset + i] = (r % 16 == 0) ? alphabet[r % 6] : 'a' + (r >> 8) % 26;
+        }
+        check_input(buf + offset, len);
+    }
+    printf("fuzz_query: %llu random inputs OK\n", iterations);
+    return 0;
+}
+#endif
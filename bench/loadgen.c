@@ -0,0 +1,375 @@
+/* PS5 Web Manager - HTTP load generator
+ * Drives /api/list, /api/download, /api/upload and /api/sysinfo at a fixed
+ * concurrency and reports requests/sec, MB/s and latency percentiles.
+ *
+ * Expects the tree created by bench/run_bench.sh under -r <root>:
+ *   <root>/list/      directory listed by the list workload
+ *   <root>/files/     file_0.bin .. file_<N-1>.bin fetched by the download workload
+ *   <root>/uploads/   target of the upload workload
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_WORKERS 256
+#define IO_BUFFER (256 * 1024)
+
+typedef enum { OP_LIST, OP_DOWNLOAD, OP_UPLOAD, OP_SYSINFO, OP_COUNT } op_t;
+
+static const char *op_names[OP_COUNT] = { "list", "download", "upload", "sysinfo" };
+
+typedef struct {
+    unsigned long long requests;
+    unsigned long long errors;
+    unsigned long long bytes;       // body bytes moved (response body, or upload payload)
+    unsigned long long *lat_us;
+    size_t lat_count;
+    size_t lat_cap;
+} op_stats_t;
+
+typedef struct {
+    int id;
+    op_stats_t stats[OP_COUNT];
+} worker_t;
+
+// Options
+static const char *opt_host = "127.0.0.1";
+static int opt_port = 8080;
+static int opt_concurrency = 8;
+static int opt_duration = 10;
+static const char *opt_root = "/tmp/ps5wm_bench";
+static int opt_files = 16;
+static int opt_upload_kb = 256;
+static int opt_json = 0;
+static int opt_wait = 0;
+static op_t mix[OP_COUNT];
+static int mix_count = 0;
+
+static struct sockaddr_in server;
+static volatile int stop_flag = 0;
+
+static unsigned long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Percent-encode a query value
+static void url_encode(char *dst, size_t dst_len, const char *src) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t o = 0;
+    for (; *src && o + 4 < dst_len; src++) {
+        unsigned char c = (unsigned char)*src;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+            c == '-' || c == '_' || c == '.' || c == '~') {
+            dst[o++] = c;
+        } else {
+            dst[o++] = '%';
+            dst[o++] = hex[c >> 4];
+            dst[o++] = hex[c & 15];
+        }
+    }
+    dst[o] = '\0';
+}
+
+static int connect_server(void) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    int flag = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    struct timeval tv = { 30, 0 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (connect(sock, (struct sockaddr *)&server, sizeof(server)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static int send_all(int sock, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t s = send(sock, buf, len, MSG_NOSIGNAL);
+        if (s < 0 && errno == EINTR) continue;
+        if (s <= 0) return -1;
+        buf += s;
+        len -= s;
+    }
+    return 0;
+}
+
+// Read one response; returns the status code and stores the body size. Reads
+// exactly Content-Length bytes when given so the server's linger isn't measured.
+static int read_response(int sock, char *buf, unsigned long long *body_bytes) {
+    size_t have = 0;
+    char *headers_end = NULL;
+    while (!headers_end) {
+        if (have >= IO_BUFFER - 1) return -1;
+        ssize_t r = recv(sock, buf + have, IO_BUFFER - 1 - have, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        have += r;
+        buf[have] = '\0';
+        headers_end = strstr(buf, "\r\n\r\n");
+    }
+    int status = 0;
+    if (sscanf(buf, "HTTP/1.%*d %d", &status) != 1) return -1;
+    
+    size_t header_len = headers_end + 4 - buf;
+    long long content_length = -1;
+    char *cl = strcasestr(buf, "\r\nContent-Length:");
+    if (cl && cl < headers_end) content_length = atoll(cl + 17);
+    
+    unsigned long long got = have - header_len;
+    while (content_length < 0 || got < (unsigned long long)content_length) {
+        ssize_t r = recv(sock, buf, IO_BUFFER, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return -1;
+        if (r == 0) break;
+        got += r;
+    }
+    if (content_length >= 0 && got < (unsigned long long)content_length) return -1;
+    *body_bytes = got;
+    return status;
+}
+
+static void record(op_stats_t *st, unsigned long long us) {
+    if (st->lat_count == st->lat_cap) {
+        size_t cap = st->lat_cap ? st->lat_cap * 2 : 4096;
+        unsigned long long *p = realloc(st->lat_us, cap * sizeof(*p));
+        if (!p) return;
+        st->lat_us = p;
+        st->lat_cap = cap;
+    }
+    st->lat_us[st->lat_count++] = us;
+}
+
+// Perform one request of the given kind
+static int do_request(worker_t *w, op_t op, unsigned long long seq, char *buf, const char *upload_body) {
+    char path[1024], encoded[1024], request[2048];
+    int sock = connect_server();
+    if (sock < 0) return -1;
+    
+    int ok = 0;
+    unsigned long long body = 0;
+    int len = 0;
+    switch (op) {
+        case OP_LIST:
+            snprintf(path, sizeof(path), "%s/list", opt_root);
+            url_encode(encoded, sizeof(encoded), path);
+            len = snprintf(request, sizeof(request), "GET /api/list?path=%s HTTP/1.1\r\nHost: bench\r\n\r\n", encoded);
+            ok = send_all(sock, request, len) == 0;
+            break;
+        case OP_DOWNLOAD:
+            snprintf(path, sizeof(path), "%s/files/file_%llu.bin", opt_root, seq % opt_files);
+            url_encode(encoded, sizeof(encoded), path);
+            len = snprintf(request, sizeof(request), "GET /api/download?path=%s HTTP/1.1\r\nHost: bench\r\n\r\n", encoded);
+            ok = send_all(sock, request, len) == 0;
+            break;
+        case OP_SYSINFO:
+            len = snprintf(request, sizeof(request), "GET /api/sysinfo HTTP/1.1\r\nHost: bench\r\n\r\n");
+            ok = send_all(sock, request, len) == 0;
+            break;
+        case OP_UPLOAD: {
+            const char *boundary = "----LoadgenBoundary7MA4YWxkTrZu0gW";
+            char part_head[512], part_tail[128];
+            int head_len = snprintf(part_head, sizeof(part_head),
+                "--%s\r\nContent-Disposition: form-data; name=\"file\"; filename=\"up_%d_%llu.bin\"\r\n"
+                "Content-Type: application/octet-stream\r\n\r\n", boundary, w->id, seq % 64);
+            int tail_len = snprintf(part_tail, sizeof(part_tail), "\r\n--%s--\r\n", boundary);
+            size_t payload = (size_t)opt_upload_kb * 1024;
+            snprintf(path, sizeof(path), "%s/uploads", opt_root);
+            url_encode(encoded, sizeof(encoded), path);
+            len = snprintf(request, sizeof(request),
+                "POST /api/upload?path=%s HTTP/1.1\r\nHost: bench\r\n"
+                "Content-Type: multipart/form-data; boundary=%s\r\nContent-Length: %zu\r\n\r\n",
+                encoded, boundary, head_len + payload + tail_len);
+            ok = send_all(sock, request, len) == 0 &&
+                 send_all(sock, part_head, head_len) == 0 &&
+                 send_all(sock, upload_body, payload) == 0 &&
+                 send_all(sock, part_tail, tail_len) == 0;
+            break;
+        }
+        default:
+            break;
+    }
+    
+    int status = ok ? read_response(sock, buf, &body) : -1;
+    close(sock);
+    if (status < 200 || status >= 300) return -1;
+    w->stats[op].bytes += (op == OP_UPLOAD) ? (unsigned long long)opt_upload_kb * 1024 : body;
+    return 0;
+}
+
+static void* worker_thread(void *arg) {
+    worker_t *w = (worker_t *)arg;
+    char *buf = malloc(IO_BUFFER);
+    char *upload_body = malloc((size_t)opt_upload_kb * 1024 + 1);
+    if (!buf || !upload_body) return NULL;
+    for (size_t i = 0; i < (size_t)opt_upload_kb * 1024; i++) upload_body[i] = (char)(i * 31 + w->id);
+    
+    unsigned long long seq = w->id;
+    while (!stop_flag) {
+        op_t op = mix[seq % mix_count];
+        unsigned long long t0 = now_us();
+        int r = do_request(w, op, seq, buf, upload_body);
+        unsigned long long t1 = now_us();
+        w->stats[op].requests++;
+        if (r != 0) w->stats[op].errors++;
+        else record(&w->stats[op], t1 - t0);
+        seq += opt_concurrency;
+    }
+    free(buf);
+    free(upload_body);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+static unsigned long long percentile(const unsigned long long *v, size_t n, double p) {
+    if (n == 0) return 0;
+    size_t i = (size_t)(p * (n - 1));
+    return v[i];
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [-h host] [-p port] [-c concurrency] [-d seconds] [-r root]\n"
+        "          [-m list,download,upload,sysinfo] [-f files] [-u upload_kb] [-w] [-j]\n"
+        "  -w  wait up to 10s for the server to accept connections\n"
+        "  -j  print one JSON object per workload instead of a table\n", prog);
+    exit(2);
+}
+
+static void parse_mix(const char *arg) {
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s", arg);
+    mix_count = 0;
+    for (char *tok = strtok(tmp, ","); tok && mix_count < OP_COUNT; tok = strtok(NULL, ",")) {
+        int found = 0;
+        for (int i = 0; i < OP_COUNT; i++) {
+            if (strcmp(tok, op_names[i]) == 0) {
+                mix[mix_count++] = (op_t)i;
+                found = 1;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "unknown workload: %s\n", tok);
+            exit(2);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int c;
+    parse_mix("list,download,upload,sysinfo");
+    while ((c = getopt(argc, argv, "h:p:c:d:r:m:f:u:wj")) != -1) {
+        switch (c) {
+            case 'h': opt_host = optarg; break;
+            case 'p': opt_port = atoi(optarg); break;
+            case 'c': opt_concurrency = atoi(optarg); break;
+            case 'd': opt_duration = atoi(optarg); break;
+            case 'r': opt_root = optarg; break;
+            case 'm': parse_mix(optarg); break;
+            case 'f': opt_files = atoi(optarg); break;
+            case 'u': opt_upload_kb = atoi(optarg); break;
+            case 'w': opt_wait = 1; break;
+            case 'j': opt_json = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (opt_concurrency < 1 || opt_concurrency > MAX_WORKERS || opt_duration < 1 ||
+        opt_files < 1 || opt_upload_kb < 1 || mix_count == 0) {
+        usage(argv[0]);
+    }
+    
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(opt_port);
+    if (inet_pton(AF_INET, opt_host, &server.sin_addr) != 1) {
+        fprintf(stderr, "bad host address: %s\n", opt_host);
+        return 2;
+    }
+    
+    if (opt_wait) {
+        int sock = -1;
+        for (int i = 0; i < 100 && sock < 0; i++) {
+            sock = connect_server();
+            if (sock < 0) usleep(100000);
+        }
+        if (sock < 0) {
+            fprintf(stderr, "server did not come up on %s:%d\n", opt_host, opt_port);
+            return 1;
+        }
+        close(sock);
+    }
+    
+    worker_t *workers = calloc(opt_concurrency, sizeof(worker_t));
+    pthread_t *threads = calloc(opt_concurrency, sizeof(pthread_t));
+    if (!workers || !threads) return 1;
+    
+    unsigned long long start = now_us();
+    for (int i = 0; i < opt_concurrency; i++) {
+        workers[i].id = i;
+        pthread_create(&threads[i], NULL, worker_thread, &workers[i]);
+    }
+    sleep(opt_duration);
+    stop_flag = 1;
+    for (int i = 0; i < opt_concurrency; i++) pthread_join(threads[i], NULL);
+    double elapsed = (now_us() - start) / 1e6;
+    
+    if (!opt_json) {
+        printf("%-9s %9s %7s %10s %9s %9s %9s %9s %9s\n",
+               "workload", "requests", "errors", "req/s", "MB/s", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    }
+    for (int k = 0; k < mix_count; k++) {
+        op_t op = mix[k];
+        op_stats_t total;
+        memset(&total, 0, sizeof(total));
+        for (int i = 0; i < opt_concurrency; i++) {
+            op_stats_t *st = &workers[i].stats[op];
+            total.requests += st->requests;
+            total.errors += st->errors;
+            total.bytes += st->bytes;
+            total.lat_count += st->lat_count;
+        }
+        total.lat_us = malloc((total.lat_count ? total.lat_count : 1) * sizeof(unsigned long long));
+        size_t n = 0;
+        for (int i = 0; i < opt_concurrency; i++) {
+            op_stats_t *st = &workers[i].stats[op];
+            memcpy(total.lat_us + n, st->lat_us, st->lat_count * sizeof(unsigned long long));
+            n += st->lat_count;
+        }
+        qsort(total.lat_us, n, sizeof(unsigned long long), compare_u64);
+        
+        double rps = total.requests / elapsed;
+        double mbs = total.bytes / elapsed / (1024.0 * 1024.0);
+        double p50 = percentile(total.lat_us, n, 0.50) / 1000.0;
+        double p90 = percentile(total.lat_us, n, 0.90) / 1000.0;
+        double p99 = percentile(total.lat_us, n, 0.99) / 1000.0;
+        double max = n ? total.lat_us[n - 1] / 1000.0 : 0;
+        if (opt_json) {
+            printf("{\"workload\":\"%s\",\"concurrency\":%d,\"seconds\":%.2f,\"requests\":%llu,\"errors\":%llu,"
+                   "\"req_s\":%.1f,\"mb_s\":%.2f,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f}\n",
+                   op_names[op], opt_concurrency, elapsed, total.requests, total.errors,
+                   rps, mbs, p50, p90, p99, max);
+        } else {
+            printf("%-9s %9llu %7llu %10.1f %9.2f %9.3f %9.3f %9.3f %9.3f\n",
+                   op_names[op], total.requests, total.errors, rps, mbs, p50, p90, p99, max);
+        }
+        free(total.lat_us);
+    }
+    return 0;
+}
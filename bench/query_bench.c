@@ -0,0 +1,148 @@
+/* PS5 Web Manager - query parsing microbenchmark
+ * Compares the split-once parser and SSE2 decoder in main.c with the
+ * previous strstr-based get_query_param and byte-at-a-time url_decode.
+ *
+ * make microbench
+ */
+
+#define WEB_MANAGER_NO_MAIN
+#include "../main.c"
+
+// Previous implementations, kept verbatim for comparison
+static void legacy_url_decode(char *dst, const char *src) {
+    char a, b;
+    while (*src) {
+        if ((*src == '%') && ((a = src[1]) && (b = src[2])) && 
+            (isxdigit(a) && isxdigit(b))) {
+            if (a >= 'a') a -= 'a'-'A';
+            if (a >= 'A') a -= ('A' - 10);
+            else a -= '0';
+            if (b >= 'a') b -= 'a'-'A';
+            if (b >= 'A') b -= ('A' - 10);
+            else b -= '0';
+            *dst++ = 16*a+b;
+            src+=3;
+        } else if (*src == '+') {
+            *dst++ = ' ';
+            src++;
+        } else {
+            *dst++ = *src++;
+        }
+    }
+    *dst++ = '\0';
+}
+
+static char* legacy_get_query_param(const char *query, const char *param_name) {
+    if (!query) return NULL;
+    char *param = strstr(query, param_name);
+    if (!param) return NULL;
+    param += strlen(param_name);
+    if (*param != '=') return NULL;
+    param++;
+    
+    static char result1[MAX_PATH];
+    static char result2[MAX_PATH];
+    static int use_buffer = 0;
+    
+    char *result = (use_buffer == 0) ? result1 : result2;
+    use_buffer = 1 - use_buffer;
+    
+    int i = 0;
+    while (param[i] && param[i] != '&' && param[i] != ' ' && i < MAX_PATH - 1) {
+        result[i] = param[i];
+        i++;
+    }
+    result[i] = '\0';
+    return result;
+}
+
+typedef struct {
+    const char *name;
+    const char *query;
+    const char *keys[5];
+} bench_case_t;
+
+static const bench_case_t cases[] = {
+    { "short path", "?path=/data",
+      { "path" } },
+    { "long plain path", "?path=/mnt/usb0/games/PPSA01234-app/sce_sys/about/right/texture/background_image_large.png",
+      { "path" } },
+    { "escaped path", "?path=%2Fdata%2Fmy%20games%2Fsave%20data%20%28backup%29%2Fslot%2001%2Fsavedata0.bin",
+      { "path" } },
+    { "rename", "?old=%2Fdata%2Fold%20name.txt&new=%2Fdata%2Fnew%20name.txt",
+      { "old", "new" } },
+    { "bench 5 params", "?path=%2Fmnt%2Fusb0&size=256&block=1024&qd=4&direct=1",
+      { "path", "size", "block", "qd", "direct" } },
+};
+
+static volatile size_t sink;
+
+static double elapsed_ns(struct timespec a, struct timespec b) {
+    return (b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec);
+}
+
+int main(int argc, char **argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 2000000;
+    char out[MAX_PATH];
+    struct timespec t0, t1;
+    
+    printf("%-16s %12s %12s %8s   (ns per request: lookup + decode of every key)\n",
+           "case", "legacy", "current", "speedup");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        const bench_case_t *bc = &cases[c];
+        
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (long it = 0; it < iterations; it++) {
+            for (int k = 0; k < 5 && bc->keys[k]; k++) {
+                char *v = legacy_get_query_param(bc->query, bc->keys[k]);
+                if (v) {
+                    legacy_url_decode(out, v);
+                    sink += out[0];
+                }
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double legacy = elapsed_ns(t0, t1) / iterations;
+        
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (long it = 0; it < iterations; it++) {
+            query_t q;
+            query_parse(&q, bc->query);
+            for (int k = 0; k < 5 && bc->keys[k]; k++) {
+                char *v = query_get(&q, bc->keys[k], out, sizeof(out));
+                if (v) sink += v[0];
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double current = elapsed_ns(t0, t1) / iterations;
+        
+        printf("%-16s %12.1f %12.1f %7.2fx\n", bc->name, legacy, current, legacy / current);
+    }
+    
+    // Decoder alone on a 2 KB value: mostly plain text vs. fully escaped
+    static char plain[MAX_PATH], escaped[MAX_PATH];
+    for (int i = 0; i < MAX_PATH - 1; i++) plain[i] = 'a' + i % 26;
+    for (int i = 0; i + 3 < MAX_PATH; i += 3) memcpy(escaped + i, "%41", 3);
+    const char *inputs[2] = { plain, escaped };
+    const char *labels[2] = { "decode 2K plain", "decode 2K %XX" };
+    for (int d = 0; d < 2; d++) {
+        size_t len = strlen(inputs[d]);
+        long n = iterations / 20 + 1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (long it = 0; it < n; it++) {
+            legacy_url_decode(out, inputs[d]);
+            sink += out[it % 64];
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double legacy = elapsed_ns(t0, t1) / n;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (long it = 0; it < n; it++) {
+            url_decode_n(out, sizeof(out), inputs[d], len);
+            sink += out[it % 64];
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double current = elapsed_ns(t0, t1) / n;
+        printf("%-16s %12.1f %12.1f %7.2fx\n", labels[d], legacy, current, legacy / current);
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+#!/bin/sh
+# End-to-end HTTP benchmark of the host build.
+# Builds a temp tree, starts ps5_web_manager_host on a spare port and runs
+# bench/loadgen against each workload, then against the full mix.
+#
+# Tunables (environment): BENCH_PORT, BENCH_DURATION, BENCH_CONCURRENCY,
+# BENCH_FILES, BENCH_FILE_KB, BENCH_LIST_ENTRIES, BENCH_UPLOAD_KB, BENCH_JSON=1
+
+set -e
+
+PORT=${BENCH_PORT:-18080}
+DURATION=${BENCH_DURATION:-5}
+CONCURRENCY=${BENCH_CONCURRENCY:-16}
+FILES=${BENCH_FILES:-16}
+FILE_KB=${BENCH_FILE_KB:-1024}
+LIST_ENTRIES=${BENCH_LIST_ENTRIES:-500}
+UPLOAD_KB=${BENCH_UPLOAD_KB:-256}
+JSON_FLAG=""
+[ "${BENCH_JSON:-0}" = "1" ] && JSON_FLAG="-j"
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+SERVER="$HERE/../ps5_web_manager_host"
+LOADGEN="$HERE/loadgen"
+
+ROOT=$(mktemp -d "${TMPDIR:-/tmp}/ps5wm_bench.XXXXXX")
+mkdir -p "$ROOT/list" "$ROOT/files" "$ROOT/uploads"
+
+i=0
+while [ $i -lt "$LIST_ENTRIES" ]; do
+    : > "$ROOT/list/entry_$i.txt"
+    i=$((i + 1))
+done
+i=0
+while [ $i -lt "$FILES" ]; do
+    head -c $((FILE_KB * 1024)) /dev/urandom > "$ROOT/files/file_$i.bin"
+    i=$((i + 1))
+done
+
+WEB_MANAGER_PORT=$PORT "$SERVER" > "$ROOT/server.log" 2>&1 &
+SERVER_PID=$!
+trap 'kill $SERVER_PID 2>/dev/null; rm -rf "$ROOT"' EXIT INT TERM
+
+echo "root=$ROOT port=$PORT concurrency=$CONCURRENCY duration=${DURATION}s files=${FILES}x${FILE_KB}KB upload=${UPLOAD_KB}KB"
+WAIT="-w"
+for mix in list download upload sysinfo list,download,upload,sysinfo; do
+    [ -z "$JSON_FLAG" ] && echo "--- $mix"
+    "$LOADGEN" $WAIT $JSON_FLAG -p "$PORT" -c "$CONCURRENCY" -d "$DURATION" -r "$ROOT" \
+        -m "$mix" -f "$FILES" -u "$UPLOAD_KB"
+    WAIT=""
+done
@@ -0,0 +1,153 @@
+/* PS5 Web Manager - large-file write benchmark
+ * Writes several files at once (like parallel uploads or copies), first the
+ * way handle_copy used to (O_TRUNC, grow write by write with 1MB buffers) and
+ * then through file_writer_t in main.c (free-space check, preallocation,
+ * aligned 4MB buffers, write-behind). For each it reports sustained write
+ * MB/s including the final fsync, extents per file, and the MB/s of reading
+ * the files back with the page cache dropped.
+ *
+ * make writebench
+ * ./bench/write_bench [dir] [MB per file] [files]
+ */
+
+#define WEB_MANAGER_NO_MAIN
+#include "../main.c"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+typedef struct {
+    char path[MAX_PATH];
+    unsigned long long size;
+    int err;
+} write_job_t;
+
+static unsigned char *pattern;
+
+static void* legacy_writer(void *arg) {
+    write_job_t *job = arg;
+    int fd = open(job->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        job->err = errno;
+        return NULL;
+    }
+    for (unsigned long long off = 0; off < job->size && !job->err; off += BUFFER_SIZE) {
+        size_t n = job->size - off < BUFFER_SIZE ? job->size - off : BUFFER_SIZE;
+        if (write_full(fd, (const char *)pattern, n) != 0) job->err = errno;
+    }
+    if (fsync(fd) != 0 && !job->err) job->err = errno;
+    close(fd);
+    return NULL;
+}
+
+static void* prealloc_writer(void *arg) {
+    write_job_t *job = arg;
+    const char *slash = strrchr(job->path, '/');
+    char dir[MAX_PATH];
+    snprintf(dir, sizeof(dir), "%.*s", (int)(slash - job->path), job->path);
+    file_writer_t w;
+    job->err = write_space_check(dir, job->size);
+    if (!job->err) job->err = file_writer_open(&w, job->path, job->size);
+    if (job->err) return NULL;
+    // Socket-sized pieces, as uploads arrive
+    for (unsigned long long off = 0; off < job->size && !job->err; off += 65536) {
+        size_t n = job->size - off < 65536 ? job->size - off : 65536;
+        job->err = file_writer_write(&w, pattern + off % BUFFER_SIZE, n);
+    }
+    if (!job->err) job->err = file_writer_finish(&w);
+    if (fsync(w.fd) != 0 && !job->err) job->err = errno;
+    file_writer_close(&w);
+    return NULL;
+}
+
+// Extents of a file, -1 where FIEMAP isn't available
+static long extent_count(const char *path) {
+#ifdef FS_IOC_FIEMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct fiemap fm;
+    memset(&fm, 0, sizeof(fm));
+    fm.fm_length = ~0ULL;
+    fm.fm_flags = FIEMAP_FLAG_SYNC;
+    long count = ioctl(fd, FS_IOC_FIEMAP, &fm) == 0 ? (long)fm.fm_mapped_extents : -1;
+    close(fd);
+    return count;
+#else
+    (void)path;
+    return -1;
+#endif
+}
+
+static double read_back(write_job_t *jobs, int files) {
+    unsigned char *buf = malloc(BUFFER_SIZE);
+    unsigned long long total = 0, start = monotonic_us();
+    for (int i = 0; i < files; i++) {
+        int fd = open(jobs[i].path, O_RDONLY);
+        if (fd < 0) continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ssize_t n;
+        while ((n = read(fd, buf, BUFFER_SIZE)) > 0) total += n;
+        close(fd);
+    }
+    free(buf);
+    unsigned long long us = monotonic_us() - start;
+    return us ? total / (double)us : 0;
+}
+
+static void run(const char *name, const char *dir, unsigned long long size, int files, int prealloc) {
+    write_job_t jobs[64];
+    pthread_t threads[64];
+    for (int i = 0; i < files; i++) {
+        snprintf(jobs[i].path, sizeof(jobs[i].path), "%s/.ps5wm_writebench_%d", dir, i);
+        unlink(jobs[i].path);
+        jobs[i].size = size;
+        jobs[i].err = 0;
+    }
+    sync();
+    unsigned long long start = monotonic_us();
+    for (int i = 0; i < files; i++) pthread_create(&threads[i], NULL, prealloc ? prealloc_writer : legacy_writer, &jobs[i]);
+    for (int i = 0; i < files; i++) pthread_join(threads[i], NULL);
+    unsigned long long us = monotonic_us() - start;
+    
+    long extents = 0;
+    int err = 0;
+    for (int i = 0; i < files; i++) {
+        long e = extent_count(jobs[i].path);
+        extents = (e < 0 || extents < 0) ? -1 : extents + e;
+        if (jobs[i].err) err = jobs[i].err;
+    }
+    double read_mbs = read_back(jobs, files);
+    char extents_str[32] = "n/a";
+    if (extents >= 0) snprintf(extents_str, sizeof(extents_str), "%.1f", extents / (double)files);
+    printf("%-10s write %8.1f MB/s   extents/file %6s   read back %8.1f MB/s%s%s\n", name,
+           us ? size * files / (double)us : 0, extents_str, read_mbs, err ? "   error: " : "", err ? strerror(err) : "");
+    for (int i = 0; i < files; i++) unlink(jobs[i].path);
+}
+
+int main(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : "/tmp";
+    unsigned long long size = (argc > 2 ? strtoull(argv[2], NULL, 10) : 256) * 1024 * 1024;
+    int files = argc > 3 ? atoi(argv[3]) : 4;
+    if (files < 1 || files > 64 || size == 0) {
+        fprintf(stderr, "usage: %s [dir] [MB per file] [files (1-64)]\n", argv[0]);
+        return 2;
+    }
+    const char *write_behind_env = getenv("WEB_MANAGER_WRITE_BEHIND_MB");
+    if (write_behind_env) write_behind_bytes = strtoull(write_behind_env, NULL, 10) * 1024 * 1024;
+    pattern = malloc(BUFFER_SIZE + 65536);
+    uint64_t x = 88172645463325252ULL;
+    for (size_t i = 0; i < BUFFER_SIZE + 65536; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        pattern[i] = x;
+    }
+    printf("%d files x %llu MB in %s, write-behind %llu MB\n", files, size >> 20, dir, write_behind_bytes >> 20);
+    run("legacy", dir, size, files, 0);
+    run("prealloc", dir, size, files, 1);
+    free(pattern);
+    return 0;
+}
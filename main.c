@@ -1,9 +1,19 @@
 /* PS5 Web-Based File Manager + System Monitor
  * By Manos
  * HTTP Server with REST API for file operations and system monitoring
+ *
+ * Build with -DHOST_BUILD to run on a plain Linux box (make host)
  */
 
+#ifdef HOST_BUILD
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -18,21 +28,346 @@
 #include <dirent.h>
 #include <pthread.h>
 #include <time.h>
+#include <sys/time.h>
 #include <sys/statvfs.h>
+#include <sys/mman.h>
 #include <ifaddrs.h>
-#include <sys/sysctl.h>
 #include <sys/types.h>
+#include <net/if.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+#ifdef HOST_BUILD
+#include <signal.h>
+#include <sys/sysinfo.h>
+#include <sys/sendfile.h>
+#else
+#include <sys/sysctl.h>
+#endif
 
 #define HTTP_PORT 8080
 #define BUFFER_SIZE (1 * 1024 * 1024)
 #define MAX_PATH 2048
 
+// Connection deadlines, kept on a hierarchical timer wheel (TIMER_WHEEL_LEVELS
+// levels of TIMER_WHEEL_SLOTS slots, one TIMER_TICK_MS tick per level-0 slot)
+#define TIMER_TICK_MS 100
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+#define CONN_HEADER_TIMEOUT_MS 10000        // request line and headers
+#define CONN_REQUEST_TIMEOUT_MS 120000      // whole request, including a buffered POST body
+#define CONN_BODY_IDLE_MS 30000             // a recv() without a byte for this long
+#define CONN_SEND_IDLE_MS 60000             // a send() or sendfile() without progress for this long
+#define CONN_KEEPALIVE_MS 2000              // after the response, for the client to read it and close
+
+// Bandwidth shaping (see Bandwidth shaper); rates come from WEB_MANAGER_RATE_MBIT
+// and WEB_MANAGER_CLIENT_RATE_MBIT, unset or 0 for unlimited
+#define SHAPER_QUANTUM (64 * 1024)          // bytes a queued download sends per turn
+#define SHAPER_BURST_US 20000               // bucket depth, as time at the configured rate
+#define SHAPER_MAX_WAIT_US 10000            // longest sleep before a queued download looks again
+#define SHAPER_CLIENT_SLOTS 64              // client addresses tracked at once; the rest share one bucket
+
+// Background metrics sampler: 1 s resolution for 10 minutes, 1 min resolution for 24 h
+#define SAMPLER_INTERVAL_MS 1000
+#define SAMPLER_FINE_SLOTS 600
+#define SAMPLER_COARSE_EVERY 60
+#define SAMPLER_COARSE_SLOTS 1440
+#define SAMPLER_NETWORK_EVERY 10
+
+// Live System Monitor stream (/api/sysinfo/stream)
+#define SSE_MAX_VIEWERS 16
+#define SSE_KEEPALIVE_MS 15000
+
+// Network interfaces and active transfers
+#define MAX_IFACES 16
+#define TRANSFER_SLOTS 64
+#define TRANSFER_CHUNK (4 * 1024 * 1024)   // sendfile chunk between progress updates
+
+// Storage benchmark (/api/bench/disk)
+#define BENCH_ALIGN 4096
+#define BENCH_MAX_QD 32
+#define BENCH_MAX_SIZE (8ULL * 1024 * 1024 * 1024)
+#define BENCH_MAX_OPS (1024 * 1024)
+#define BENCH_RAND_OPS 65536
+#define BENCH_TEST_SECONDS 20
+
+// Access log (rotated at ACCESS_LOG_MAX_BYTES, ACCESS_LOG_KEEP old files kept)
+#define ACCESS_LOG_DIR "/data/ps5_web_manager"
+#define ACCESS_LOG_PATH ACCESS_LOG_DIR "/access.log"
+#define ACCESS_LOG_MAX_BYTES (4 * 1024 * 1024)
+#define ACCESS_LOG_KEEP 3
+#define ACCESS_LOG_SLOTS 2048   // must be a power of two
+#define ACCESS_LOG_BATCH_BYTES (64 * 1024)
+#define ACCESS_LOG_FLUSH_MS 200
+
+// File hashing (/api/hash) and background jobs (/api/jobs)
+#define HASH_CHUNK (4 * 1024 * 1024)        // read size and tree leaf size
+#define HASH_WORKERS 4
+#define HASH_PIPE_DEPTH 4                   // SHA-256 read-ahead buffers
+#define HASH_ASYNC_THRESHOLD (1024ULL * 1024 * 1024)
+#define HASH_DIGEST_MAX 65                  // hex digest + NUL
+#define HASH_CACHE_SLOTS 4096
+#define HASH_CACHE_BUCKETS 1024               // (dev, ino) index over the table, power of two
+#define HASH_CACHE_PATH ACCESS_LOG_DIR "/hash_cache"
+#define JOB_SLOTS 16
+#define JOB_RESULT_MAX 1024
+#define UPLOAD_PART_HEADERS_MAX (64 * 1024)
+#define DEDUP_MAX_CANDIDATES 64
+#define DUP_PARTITION_BITS 6
+#define DUP_PARTITIONS (1 << DUP_PARTITION_BITS)
+#define DUP_PARTIAL (64 * 1024)                 // bytes hashed at each end of a candidate
+#define DUP_GROUP_PATHS 64                      // paths listed per group (count has the total)
+#define DUP_PAGE (512 * 1024)                   // must exceed the longest group line
+#define PREVIEW_WINDOW (256 * 1024)             // read granularity of the preview cache
+#define PREVIEW_CACHE_SLOTS 32
+#define PREVIEW_TEXT_LENGTH (32 * 1024)
+#define PREVIEW_HEX_LENGTH 4096
+#define PREVIEW_MAX_LENGTH (64 * 1024)
+#define HOT_FILE_SLOTS 128                      // open fds kept by the download cache
+#define HOT_FILE_MEM_DEFAULT (64 * 1024)        // files up to this size are kept in memory
+#define INFLATE_IN_BUF (64 * 1024)
+#define INFLATE_WINDOW 65536                    // ring: 32KB history + unflushed output
+#define INFLATE_FLUSH 32768
+#define INFLATE_FAST_BITS 10
+#define ARCHIVE_CACHE_SLOTS 8
+#define ARCHIVE_CD_MAX (256 * 1024 * 1024)      // largest zip central directory we will read
+#define EXTRACT_WRITERS 3
+#define EXTRACT_CHUNK (512 * 1024)
+#define EXTRACT_BUFFERS 8                       // in flight per extraction: 4MB
+#define DEFLATE_WSIZE 32768
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_CHAIN 32                        // hash chain entries tried per position
+#define DEFLATE_NICE 128                        // stop searching at a match this long
+#define DEFLATE_SYMS 16384                      // symbols per block
+#define DEFLATE_OUT 16384
+#define COMPRESS_MIN 1024                       // smaller bodies go out as they are
+#define COMPRESS_SAMPLE (32 * 1024)             // prefix test-compressed before a download
+#define COMPRESS_READ (64 * 1024)
+#define BATCH_MAX_OPS 4096
+#define BATCH_WORKERS 8                         // most threads one batch group runs on
+#define BATCH_DEFAULT_PARALLEL 4
+#define DELTA_BLOCK_MIN 1024
+#define DELTA_BLOCK_MAX (128 * 1024)            // default block sizes stop here (about sqrt of the file)
+#define DELTA_MAX_BLOCKS (1 << 22)
+#define DELTA_READ (1024 * 1024)
+#define DELTA_LITERAL_MAX (256 * 1024)          // longest literal run held before it is sent
+#define MANIFEST_SLACK_NS 2000000000LL          // since tokens reach back this far for coarse fs timestamps
+#define WRITE_BUFFER (4 * 1024 * 1024)          // staging buffer of upload/copy destinations
+#define WRITE_ALIGN 4096
+#define WRITE_PREALLOC_MIN (1024 * 1024)        // smaller files are not preallocated
+#define WRITE_SPACE_RESERVE (8ULL * 1024 * 1024) // free space left over after a write
+#define WRITE_BEHIND_DEFAULT (32ULL * 1024 * 1024)
+
+// Metrics registry
+// Counters are sharded per thread (one cache line per shard) so concurrent
+// increments don't bounce a single line between cores; reads sum the shards.
+#define METRIC_SHARDS 16
+#define METRIC_CACHE_LINE 64
+
+typedef struct {
+    _Atomic unsigned long long value;
+    char pad[METRIC_CACHE_LINE - sizeof(unsigned long long)];
+} metric_cell_t;
+
+typedef struct {
+    metric_cell_t shards[METRIC_SHARDS];
+} metric_counter_t;
+
+typedef struct {
+    _Atomic long long value;
+} metric_gauge_t;
+
+// Latency histogram upper bounds in microseconds (+Inf bucket is implicit)
+static const unsigned long long latency_bounds_us[] = {
+    500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+    250000, 500000, 1000000, 2500000, 5000000, 10000000, 30000000
+};
+#define LATENCY_BUCKETS (sizeof(latency_bounds_us) / sizeof(latency_bounds_us[0]))
+
+typedef struct {
+    metric_counter_t buckets[LATENCY_BUCKETS + 1];
+    metric_counter_t sum_us;
+} metric_histogram_t;
+
+// Routes dispatched by handle_request
+typedef enum {
+    ROUTE_INDEX,
+    ROUTE_STATIC,
+    ROUTE_LIST,
+    ROUTE_DOWNLOAD,
+    ROUTE_DELETE,
+    ROUTE_SYSINFO,
+    ROUTE_SYSINFO_HISTORY,
+    ROUTE_SYSINFO_STREAM,
+    ROUTE_RENAME,
+    ROUTE_COPY,
+    ROUTE_UPLOAD,
+    ROUTE_UPLOAD_PREFLIGHT,
+    ROUTE_METRICS,
+    ROUTE_ACCESS_LOG,
+    ROUTE_TRANSFERS,
+    ROUTE_BENCH_DISK,
+    ROUTE_HASH,
+    ROUTE_JOBS,
+    ROUTE_DUPLICATES,
+    ROUTE_PREVIEW,
+    ROUTE_BATCH,
+    ROUTE_DELTA,
+    ROUTE_MANIFEST,
+    ROUTE_NOT_FOUND,
+    ROUTE_COUNT
+} route_id_t;
+
+static const char *route_names[ROUTE_COUNT] = {
+    "/",
+    "/static",
+    "/api/list",
+    "/api/download",
+    "/api/delete",
+    "/api/sysinfo",
+    "/api/sysinfo/history",
+    "/api/sysinfo/stream",
+    "/api/rename",
+    "/api/copy",
+    "/api/upload",
+    "/api/upload/preflight",
+    "/metrics",
+    "/api/accesslog",
+    "/api/transfers",
+    "/api/bench/disk",
+    "/api/hash",
+    "/api/jobs",
+    "/api/duplicates",
+    "/api/preview",
+    "/api/batch",
+    "/api/delta",
+    "/api/manifest",
+    "unmatched",
+};
+
+// Status classes 1xx..5xx
+#define STATUS_CLASSES 5
+
+// Why the timer wheel closed a connection
+typedef enum {
+    CONN_TIMEOUT_HEADER,
+    CONN_TIMEOUT_REQUEST,
+    CONN_TIMEOUT_BODY_IDLE,
+    CONN_TIMEOUT_SEND_IDLE,
+    CONN_TIMEOUT_KEEPALIVE,
+    CONN_TIMEOUT_REASONS
+} conn_timeout_t;
+
+static const char *conn_timeout_names[CONN_TIMEOUT_REASONS] = {
+    "header", "request", "body_idle", "send_idle", "keepalive"
+};
+
 // Server statistics (global)
-static unsigned long total_requests = 0;
-static unsigned long total_files_transferred = 0;
-static unsigned long long total_bytes_transferred = 0;
-static int active_connections = 0;
+static metric_counter_t total_requests;
+static metric_counter_t conn_timeouts[CONN_TIMEOUT_REASONS];
+static metric_counter_t total_files_transferred;
+static metric_counter_t total_bytes_transferred;
+static metric_gauge_t active_connections;
+static metric_counter_t route_responses[ROUTE_COUNT][STATUS_CLASSES];
+static metric_histogram_t route_latency[ROUTE_COUNT];
+
+// Pick this thread's shard (hash of the thread id, stable for the thread's lifetime)
+static inline int metric_shard(void) {
+    uintptr_t id = (uintptr_t)pthread_self();
+    return (int)(((id >> 4) * 0x9E3779B97F4A7C15ULL) >> 60) % METRIC_SHARDS;
+}
+
+static inline void metric_counter_add(metric_counter_t *c, unsigned long long n) {
+    atomic_fetch_add_explicit(&c->shards[metric_shard()].value, n, memory_order_relaxed);
+}
+
+unsigned long long metric_counter_read(metric_counter_t *c) {
+    unsigned long long sum = 0;
+    for (int i = 0; i < METRIC_SHARDS; i++) {
+        sum += atomic_load_explicit(&c->shards[i].value, memory_order_relaxed);
+    }
+    return sum;
+}
+
+static inline void metric_gauge_add(metric_gauge_t *g, long long n) {
+    atomic_fetch_add_explicit(&g->value, n, memory_order_relaxed);
+}
+
+static inline long long metric_gauge_read(metric_gauge_t *g) {
+    return atomic_load_explicit(&g->value, memory_order_relaxed);
+}
+
+void metric_histogram_observe(metric_histogram_t *h, unsigned long long us) {
+    size_t b = 0;
+    while (b < LATENCY_BUCKETS && us > latency_bounds_us[b]) b++;
+    metric_counter_add(&h->buckets[b], 1);
+    metric_counter_add(&h->sum_us, us);
+}
+
+// Monotonic clock in microseconds
+unsigned long long monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Record one finished request
+void metrics_record_request(route_id_t route, int status, unsigned long long us) {
+    int cls = status / 100 - 1;
+    if (cls < 0 || cls >= STATUS_CLASSES) cls = STATUS_CLASSES - 1;
+    metric_counter_add(&route_responses[route][cls], 1);
+    metric_histogram_observe(&route_latency[route], us);
+}
+
+#ifdef HOST_BUILD
+// Host build: stand-ins for the PS5/FreeBSD-only APIs
+#ifndef TCP_NOPUSH
+#define TCP_NOPUSH TCP_CORK
+#endif
+#ifndef CLOCK_UPTIME
+#define CLOCK_UPTIME CLOCK_BOOTTIME
+#endif
 
+void send_notification(const char *msg) {
+    printf("[notify] %s\n", msg);
+    fflush(stdout);
+}
+
+// The sysctls read by the sampler, answered from sysinfo(2)
+int sysctlbyname(const char *name, void *oldp, size_t *oldlenp, const void *newp, size_t newlen) {
+    (void)newp;
+    (void)newlen;
+    struct sysinfo si;
+    if (sysinfo(&si) != 0) return -1;
+    unsigned long page_size = sysconf(_SC_PAGESIZE);
+    
+    if (strcmp(name, "hw.physmem") == 0 && *oldlenp == sizeof(unsigned long long)) {
+        *(unsigned long long *)oldp = (unsigned long long)si.totalram * si.mem_unit;
+        return 0;
+    }
+    if (strcmp(name, "hw.pagesize") == 0 && *oldlenp == sizeof(unsigned long)) {
+        *(unsigned long *)oldp = page_size;
+        return 0;
+    }
+    if (strcmp(name, "vm.stats.vm.v_free_count") == 0 && *oldlenp == sizeof(unsigned long)) {
+        *(unsigned long *)oldp = (unsigned long long)(si.freeram + si.bufferram) * si.mem_unit / page_size;
+        return 0;
+    }
+    if (strcmp(name, "kern.boottime") == 0 && *oldlenp == sizeof(struct timeval)) {
+        struct timeval *tv = (struct timeval *)oldp;
+        tv->tv_sec = time(NULL) - si.uptime;
+        tv->tv_usec = 0;
+        return 0;
+    }
+    errno = ENOENT;
+    return -1;
+}
+#else
 typedef struct notify_request {
     char useless1[45];
     char message[3075];
@@ -46,50 +381,894 @@ void send_notification(const char *msg) {
     strncpy(req.message, msg, sizeof(req.message) - 1);
     sceKernelSendNotificationRequest(0, &req, sizeof(req), 0);
 }
+#endif
+
+// Phases of a connection, each with its own deadline
+typedef enum { CONN_PHASE_HEADERS, CONN_PHASE_BODY, CONN_PHASE_HANDLER, CONN_PHASE_KEEPALIVE } conn_phase_t;
+
+// A connection's entry on the timer wheel (see Connection timer wheel)
+typedef struct conn_timer {
+    struct conn_timer *next, *prev;
+    struct conn_timer **slot;           // list head it is on, NULL when not queued
+    unsigned long long expires;         // tick
+    int sock;
+    conn_phase_t phase;
+    unsigned long long started;         // tick the connection was accepted
+    unsigned long long deadline;        // tick the phase must end by, 0 for none
+    _Atomic unsigned long long recv_since;  // tick a blocked recv() started or last moved, 0 if none
+    _Atomic unsigned long long send_since;  // same for send()/sendfile()
+    int expired;
+} conn_timer_t;
 
 typedef struct {
     int client_sock;
     struct sockaddr_in client_addr;
+    int status;     // status code of the response sent on this connection
+    unsigned long long start_us;         // when the connection was accepted
+    unsigned long long first_byte_us;    // when the first response byte went out
+    unsigned long long bytes_sent;
+    unsigned long long bytes_received;
+    size_t request_len;   // bytes of the request in the buffer passed to handle_request
+    int transfer;   // active transfer registry slot, -1 if none
+    int head_only;  // HEAD request: the header block goes out, the body is dropped
+    int head_sent;  // header block of a HEAD response already sent
+    conn_timer_t timer;
+    int shaping;    // sending a download through the shaper queue
+    int shaper_slot;    // shaper client slot while shaping (SHAPER_CLIENT_SLOTS: the shared overflow slot)
+    double shaper_finish;   // virtual finish time of the last grant
 } client_info_t;
 
+// Connection info of the client served by the current thread
+static pthread_key_t client_key;
+
+client_info_t *current_client(void) {
+    return (client_info_t *)pthread_getspecific(client_key);
+}
+
+// Current timer wheel tick; starts at 1 so 0 can mean "not blocked"
+static _Atomic unsigned long long timer_now = 1;
+
+// Stamp the start (or progress) of a blocking recv/send for the idle deadlines,
+// and clear it once the call is over
+static inline void conn_io_mark(client_info_t *client, int sending) {
+    if (!client) return;
+    unsigned long long now = atomic_load_explicit(&timer_now, memory_order_relaxed);
+    atomic_store_explicit(sending ? &client->timer.send_since : &client->timer.recv_since, now, memory_order_relaxed);
+}
+
+static inline void conn_io_done(client_info_t *client, int sending) {
+    if (!client) return;
+    atomic_store_explicit(sending ? &client->timer.send_since : &client->timer.recv_since, 0, memory_order_relaxed);
+}
+
+// Remember the response status for metrics
+void note_response_status(int code) {
+    client_info_t *client = current_client();
+    if (client) client->status = code;
+}
+
+unsigned long long monotonic_us(void);
+
+// Account response bytes for the access log
+void note_bytes_sent(size_t n) {
+    client_info_t *client = current_client();
+    if (!client || n == 0) return;
+    if (client->first_byte_us == 0) client->first_byte_us = monotonic_us();
+    client->bytes_sent += n;
+}
+
+// Bandwidth shaper
+// Download bodies go through token buckets, one global and one per client
+// address. A download asks for up to SHAPER_QUANTUM bytes at a time and waits
+// in a queue ordered by virtual finish time (weighted fair queuing); each
+// client's share is split between its concurrent downloads, so opening eight
+// streams doesn't buy eight shares. Everything else (API responses, headers,
+// small cached files) skips the queue and is only charged to the buckets, so
+// with the global rate a little under the link rate the backlog waits here
+// rather than in the NIC queue, where it would delay the UI. Once every
+// client slot has an active download, further clients share one overflow
+// slot (and its per-client rate) rather than going unshaped.
+typedef struct {
+    double tokens;                      // bytes; negative after unqueued sends
+    double rate;                        // bytes per microsecond, 0 for unlimited
+    unsigned long long updated_us;
+} token_bucket_t;
+
+typedef struct {
+    in_addr_t addr;
+    int downloads;                      // shaped downloads from this address
+    unsigned long long last_us;         // last use, 0 if never; idle slots are reused LRU
+    token_bucket_t bucket;
+} shaper_client_t;
+
+typedef struct shaper_waiter {
+    struct shaper_waiter *next;
+    int slot;                           // client slot
+    double finish;                      // virtual finish time
+} shaper_waiter_t;
+
+static double shaper_rate, shaper_client_rate;     // bytes per second, 0 for unlimited
+static token_bucket_t shaper_global;
+static shaper_client_t shaper_clients[SHAPER_CLIENT_SLOTS + 1];   // + the overflow slot
+static shaper_waiter_t *shaper_queue;   // sorted by finish
+static double shaper_vtime;
+static pthread_mutex_t shaper_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shaper_cond;
+static metric_counter_t shaper_waits, shaper_wait_us;
+
+static void bucket_reset(token_bucket_t *b, double rate, unsigned long long now) {
+    b->rate = rate / 1e6;
+    b->tokens = SHAPER_QUANTUM;
+    b->updated_us = now;
+}
+
+// Refill for the time elapsed; the level, which is > 0 when sending is allowed
+static double bucket_level(token_bucket_t *b, unsigned long long now) {
+    if (b->rate <= 0) return 1;
+    double depth = b->rate * SHAPER_BURST_US;
+    if (depth < SHAPER_QUANTUM) depth = SHAPER_QUANTUM;
+    b->tokens += (now - b->updated_us) * b->rate;
+    if (b->tokens > depth) b->tokens = depth;
+    b->updated_us = now;
+    return b->tokens;
+}
+
+static void bucket_take(token_bucket_t *b, size_t n, unsigned long long now) {
+    if (b->rate <= 0) return;
+    bucket_level(b, now);
+    b->tokens -= n;
+}
+
+// Rates in bytes per second (0 for unlimited); call once before serving
+void shaper_init(double rate, double client_rate) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&shaper_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    shaper_rate = rate;
+    shaper_client_rate = client_rate;
+    unsigned long long now = monotonic_us();
+    bucket_reset(&shaper_global, rate, now);
+    bucket_reset(&shaper_clients[SHAPER_CLIENT_SLOTS].bucket, client_rate, now);
+}
+
+static inline int shaper_enabled(void) {
+    return shaper_rate > 0 || shaper_client_rate > 0;
+}
+
+// Caller holds shaper_lock
+static int shaper_client_find(in_addr_t addr) {
+    for (int i = 0; i < SHAPER_CLIENT_SLOTS; i++) {
+        if (shaper_clients[i].last_us && shaper_clients[i].addr == addr) return i;
+    }
+    return -1;
+}
+
+// Queue the current download's body sends from here on
+void shaper_join(client_info_t *client) {
+    if (!client || client->shaping || !shaper_enabled()) return;
+    in_addr_t addr = client->client_addr.sin_addr.s_addr;
+    unsigned long long now = monotonic_us();
+    pthread_mutex_lock(&shaper_lock);
+    int slot = shaper_client_find(addr);
+    if (slot < 0) {
+        for (int i = 0; i < SHAPER_CLIENT_SLOTS; i++) {
+            if (shaper_clients[i].downloads) continue;
+            if (slot < 0 || shaper_clients[i].last_us < shaper_clients[slot].last_us) slot = i;
+        }
+        if (slot >= 0) {
+            shaper_clients[slot].addr = addr;
+            bucket_reset(&shaper_clients[slot].bucket, shaper_client_rate, now);
+        } else {
+            slot = SHAPER_CLIENT_SLOTS;
+        }
+    }
+    shaper_clients[slot].downloads++;
+    shaper_clients[slot].last_us = now;
+    client->shaping = 1;
+    client->shaper_slot = slot;
+    client->shaper_finish = 0;
+    pthread_mutex_unlock(&shaper_lock);
+}
+
+void shaper_leave(client_info_t *client) {
+    if (!client || !client->shaping) return;
+    pthread_mutex_lock(&shaper_lock);
+    shaper_clients[client->shaper_slot].downloads--;
+    shaper_clients[client->shaper_slot].last_us = monotonic_us();
+    client->shaping = 0;
+    pthread_mutex_unlock(&shaper_lock);
+}
+
+// Wait for this download's turn; returns how many of len bytes it may send now
+size_t shaper_acquire(client_info_t *client, size_t len) {
+    if (!client || !client->shaping) return len;
+    conn_io_done(client, 1);    // waiting for a turn isn't send idle
+    size_t grant = len < SHAPER_QUANTUM ? len : SHAPER_QUANTUM;
+    unsigned long long begin = monotonic_us(), now = begin;
+    pthread_mutex_lock(&shaper_lock);
+    shaper_client_t *c = &shaper_clients[client->shaper_slot];
+    shaper_waiter_t w;
+    w.slot = client->shaper_slot;
+    double start = client->shaper_finish > shaper_vtime ? client->shaper_finish : shaper_vtime;
+    w.finish = start + (double)grant * (c->downloads > 1 ? c->downloads : 1);
+    shaper_waiter_t **link = &shaper_queue;
+    while (*link && (*link)->finish <= w.finish) link = &(*link)->next;
+    w.next = *link;
+    *link = &w;
+    
+    for (;;) {
+        // First queued download whose client still has tokens
+        shaper_waiter_t *next = shaper_queue;
+        while (next && bucket_level(&shaper_clients[next->slot].bucket, now) <= 0) next = next->next;
+        double wait_us = SHAPER_MAX_WAIT_US;
+        if (next == &w) {
+            double level = bucket_level(&shaper_global, now);
+            if (level > 0) break;
+            wait_us = -level / shaper_global.rate;
+        } else if (!next) {
+            wait_us = -c->bucket.tokens / c->bucket.rate;
+        }
+        if (wait_us > SHAPER_MAX_WAIT_US) wait_us = SHAPER_MAX_WAIT_US;
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_nsec += (long)(wait_us * 1000) + 1000;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&shaper_cond, &shaper_lock, &ts);
+        now = monotonic_us();
+    }
+    
+    for (link = &shaper_queue; *link != &w; link = &(*link)->next) {}
+    *link = w.next;
+    shaper_vtime = start;
+    client->shaper_finish = w.finish;
+    bucket_take(&shaper_global, grant, now);
+    bucket_take(&c->bucket, grant, now);
+    c->last_us = now;
+    pthread_cond_broadcast(&shaper_cond);
+    pthread_mutex_unlock(&shaper_lock);
+    if (now > begin) {
+        metric_counter_add(&shaper_waits, 1);
+        metric_counter_add(&shaper_wait_us, now - begin);
+    }
+    return grant;
+}
+
+// Charge bytes sent outside the queue to the buckets they count against
+void shaper_charge(client_info_t *client, size_t n) {
+    if (!client || !n || !shaper_enabled()) return;
+    unsigned long long now = monotonic_us();
+    pthread_mutex_lock(&shaper_lock);
+    bucket_take(&shaper_global, n, now);
+    int slot = shaper_client_find(client->client_addr.sin_addr.s_addr);
+    if (slot >= 0) bucket_take(&shaper_clients[slot].bucket, n, now);
+    pthread_mutex_unlock(&shaper_lock);
+}
+
+// Send a whole buffer, retrying on short writes. For HEAD only the bytes up to
+// the end of the header block are sent; body bytes report as unsent, which
+// stops the handler like a closed connection would.
+ssize_t client_send(int sock, const void *buf, size_t len) {
+    size_t sent = 0;
+    client_info_t *client = current_client();
+    if (client && client->head_only) {
+        if (client->head_sent) return 0;
+        const char *end = memmem(buf, len, "\r\n\r\n", 4);
+        if (end) {
+            len = end + 4 - (const char *)buf;
+            client->head_sent = 1;
+        }
+    }
+    while (sent < len) {
+        size_t want = shaper_acquire(client, len - sent);
+        conn_io_mark(client, 1);
+        ssize_t s = send(sock, (const char *)buf + sent, want, 0);
+        if (s < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (s == 0) break;
+        sent += s;
+        note_bytes_sent(s);
+    }
+    conn_io_done(client, 1);
+    if (client && !client->shaping) shaper_charge(client, sent);
+    return sent;
+}
+
+// Whether the current request is a HEAD
+int request_is_head(void) {
+    client_info_t *client = current_client();
+    return client && client->head_only;
+}
+
+// Hash algorithms (see File hashing)
+typedef enum { HASH_SHA256, HASH_CRC32C, HASH_XXH64TREE, HASH_ALGO_COUNT } hash_algo_t;
+
 // Forward declarations
-char* get_query_param(const char *query, const char *param_name);
-
-// URL decode helper
-void url_decode(char *dst, const char *src) {
-    char a, b;
-    while (*src) {
-        if ((*src == '%') && ((a = src[1]) && (b = src[2])) && 
-            (isxdigit(a) && isxdigit(b))) {
-            if (a >= 'a') a -= 'a'-'A';
-            if (a >= 'A') a -= ('A' - 10);
-            else a -= '0';
-            if (b >= 'a') b -= 'a'-'A';
-            if (b >= 'A') b -= ('A' - 10);
-            else b -= '0';
-            *dst++ = 16*a+b;
-            src+=3;
-        } else if (*src == '+') {
-            *dst++ = ' ';
-            src++;
+void send_http_response(int sock, int code, const char *content_type, const char *body, size_t body_len);
+int accepts_encoding(const char *accept, const char *coding);
+int etag_list_matches(const char *list, const char *etag);
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+int hash_cache_lookup(const struct stat *st, int algo, char *digest);
+int hash_cache_peek(const struct stat *st, char (*digests)[HASH_DIGEST_MAX]);
+void hash_cache_store(const struct stat *st, int algo, const char *digest, const char *path);
+ssize_t pread_full(int fd, void *buf, size_t len, off_t offset);
+int copy_file_atomic(const char *src, const char *dst);
+uint64_t xxh64(const void *input, size_t len, uint64_t seed);
+int archive_split(const char *path, char *archive, char *inner);
+void handle_list_archive(int sock, const char *path, const char *archive, int type, const char *inner,
+                         const char *request);
+void send_compressible_response(int sock, const char *request, int code, const char *content_type,
+                                const char *body, size_t body_len);
+void handle_download_archive_member(int sock, const char *path, const char *archive, int type, const char *inner);
+
+// Escape src_len bytes (NULs included) for embedding in a JSON string literal
+// (always NUL-terminates)
+size_t json_escape_n(char *dst, size_t dst_len, const char *src, size_t src_len) {
+    static const char hex[] = "0123456789abcdef";
+    size_t o = 0;
+    if (dst_len == 0) return 0;
+    for (const char *end = src + src_len; src < end; src++) {
+        unsigned char c = (unsigned char)*src;
+        char esc = 0;
+        switch (c) {
+            case '"': esc = '"'; break;
+            case '\\': esc = '\\'; break;
+            case '\n': esc = 'n'; break;
+            case '\r': esc = 'r'; break;
+            case '\t': esc = 't'; break;
+        }
+        if (esc) {
+            if (o + 2 >= dst_len) break;
+            dst[o++] = '\\';
+            dst[o++] = esc;
+        } else if (c < 0x20) {
+            if (o + 6 >= dst_len) break;
+            dst[o++] = '\\'; dst[o++] = 'u'; dst[o++] = '0'; dst[o++] = '0';
+            dst[o++] = hex[c >> 4];
+            dst[o++] = hex[c & 15];
         } else {
-            *dst++ = *src++;
+            if (o + 1 >= dst_len) break;
+            dst[o++] = c;
         }
     }
-    *dst++ = '\0';
+    dst[o] = '\0';
+    return o;
 }
 
-// Send HTTP response
-void send_http_response(int sock, int code, const char *content_type, const char *body, size_t body_len) {
-    char header[1024];
-    const char *status;
+// Escape a string for embedding in a JSON string literal (always NUL-terminates)
+size_t json_escape(char *dst, size_t dst_len, const char *src) {
+    return json_escape_n(dst, dst_len, src, strlen(src));
+}
+
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Standard base64 with padding; dst needs 4 * ((len + 2) / 3) + 1 bytes
+size_t base64_encode(char *dst, const unsigned char *src, size_t len) {
+    size_t o = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)src[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)src[i + 1] << 8;
+        if (i + 2 < len) v |= src[i + 2];
+        dst[o++] = base64_chars[(v >> 18) & 63];
+        dst[o++] = base64_chars[(v >> 12) & 63];
+        dst[o++] = i + 1 < len ? base64_chars[(v >> 6) & 63] : '=';
+        dst[o++] = i + 2 < len ? base64_chars[v & 63] : '=';
+    }
+    dst[o] = '\0';
+    return o;
+}
+
+// Decode len characters of base64 (stops at '='); returns bytes written or -1
+int base64_decode(unsigned char *dst, size_t dst_len, const char *src, size_t len) {
+    uint32_t acc = 0;
+    int bits = 0;
+    size_t o = 0;
+    for (size_t i = 0; i < len && src[i] != '='; i++) {
+        const char *c = strchr(base64_chars, src[i]);
+        if (!c || !src[i]) return -1;
+        acc = (acc << 6) | (uint32_t)(c - base64_chars);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (o >= dst_len) return -1;
+            dst[o++] = (unsigned char)(acc >> bits);
+        }
+    }
+    return (int)o;
+}
+
+// Copy the value of request header name (case-insensitive) into out.
+// Returns out, or NULL if the header is absent.
+char* http_header(const char *request, const char *name, char *out, size_t out_len) {
+    size_t name_len = strlen(name);
+    const char *end = strstr(request, "\r\n\r\n");
+    const char *line = strstr(request, "\r\n");
+    while (line && end && line < end) {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char *v = line + name_len + 1;
+            while (*v == ' ' || *v == '\t') v++;
+            size_t n = strcspn(v, "\r\n");
+            if (n >= out_len) n = out_len - 1;
+            memcpy(out, v, n);
+            out[n] = '\0';
+            return out;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return NULL;
+}
+
+// Access log
+// Request threads push fixed-size records into a bounded lock-free MPSC ring
+// (per-slot sequence numbers); a single writer thread drains it in batches.
+// When the ring is full the record is dropped and counted, never blocking.
+typedef struct {
+    long long timestamp_us;         // wall clock at completion
+    char ip[INET_ADDRSTRLEN];
+    char method[8];
+    char path[192];
+    route_id_t route;
+    int status;
+    unsigned long long bytes_sent;
+    unsigned long long bytes_received;
+    unsigned long long duration_us;
+    unsigned long long ttfb_us;
+} access_record_t;
+
+typedef struct {
+    _Atomic size_t sequence;
+    access_record_t record;
+} access_slot_t;
+
+static access_slot_t access_slots[ACCESS_LOG_SLOTS];
+static _Atomic size_t access_enqueue_pos;
+static size_t access_dequeue_pos;   // writer thread only
+static metric_counter_t access_log_dropped;
+
+void access_log_init(void) {
+    for (size_t i = 0; i < ACCESS_LOG_SLOTS; i++) {
+        atomic_store_explicit(&access_slots[i].sequence, i, memory_order_relaxed);
+    }
+}
+
+// Push a record (any thread). Returns 0 if the ring is full.
+int access_log_push(const access_record_t *rec) {
+    size_t pos = atomic_load_explicit(&access_enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        access_slot_t *slot = &access_slots[pos & (ACCESS_LOG_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&access_enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                slot->record = *rec;
+                atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+                return 1;
+            }
+        } else if (diff < 0) {
+            metric_counter_add(&access_log_dropped, 1);
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&access_enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+// Pop a record (writer thread only). Returns 0 if the ring is empty.
+int access_log_pop(access_record_t *out) {
+    access_slot_t *slot = &access_slots[access_dequeue_pos & (ACCESS_LOG_SLOTS - 1)];
+    size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if ((intptr_t)seq - (intptr_t)(access_dequeue_pos + 1) < 0) return 0;
+    *out = slot->record;
+    atomic_store_explicit(&slot->sequence, access_dequeue_pos + ACCESS_LOG_SLOTS, memory_order_release);
+    access_dequeue_pos++;
+    return 1;
+}
+
+// Build and queue the record for the request that just finished
+void access_log_request(const char *method, const char *path, route_id_t route) {
+    client_info_t *client = current_client();
+    if (!client) return;
+    
+    access_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    rec.timestamp_us = (long long)tv.tv_sec * 1000000LL + tv.tv_usec;
+    inet_ntop(AF_INET, &client->client_addr.sin_addr, rec.ip, sizeof(rec.ip));
+    strncpy(rec.method, method, sizeof(rec.method) - 1);
+    strncpy(rec.path, path, sizeof(rec.path) - 1);
+    rec.route = route;
+    rec.status = client->status;
+    rec.bytes_sent = client->bytes_sent;
+    rec.bytes_received = client->bytes_received;
+    unsigned long long now = monotonic_us();
+    rec.duration_us = now - client->start_us;
+    rec.ttfb_us = client->first_byte_us ? client->first_byte_us - client->start_us : 0;
+    access_log_push(&rec);
+}
+
+// Format one record as a JSON line
+int access_log_format(char *out, size_t out_len, const access_record_t *rec) {
+    char stamp[32];
+    time_t secs = rec->timestamp_us / 1000000LL;
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    
+    char path[400];
+    json_escape(path, sizeof(path), rec->path);
+    char method[16];
+    json_escape(method, sizeof(method), rec->method);
+    
+    return snprintf(out, out_len,
+        "{\"time\":\"%s.%06lldZ\",\"ip\":\"%s\",\"method\":\"%s\",\"route\":\"%s\",\"path\":\"%s\","
+        "\"status\":%d,\"bytes_sent\":%llu,\"bytes_received\":%llu,\"duration_us\":%llu,\"ttfb_us\":%llu}\n",
+        stamp, rec->timestamp_us % 1000000LL, rec->ip, method, route_names[rec->route], path,
+        rec->status, rec->bytes_sent, rec->bytes_received, rec->duration_us, rec->ttfb_us);
+}
+
+// Shift access.log -> access.log.1 -> ... -> access.log.N
+void access_log_rotate(void) {
+    char from[MAX_PATH], to[MAX_PATH];
+    for (int i = ACCESS_LOG_KEEP - 1; i >= 1; i--) {
+        snprintf(from, sizeof(from), "%s.%d", ACCESS_LOG_PATH, i);
+        snprintf(to, sizeof(to), "%s.%d", ACCESS_LOG_PATH, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", ACCESS_LOG_PATH);
+    rename(ACCESS_LOG_PATH, to);
+}
+
+// Writer thread: drains the ring and appends batches to the log file
+void* access_log_thread(void* arg) {
+    (void)arg;
+    char *batch = malloc(ACCESS_LOG_BATCH_BYTES);
+    if (!batch) return NULL;
+    
+    int fd = -1;
+    off_t file_size = 0;
+    
+    while (1) {
+        size_t used = 0;
+        access_record_t rec;
+        while (used + 1024 < ACCESS_LOG_BATCH_BYTES && access_log_pop(&rec)) {
+            int len = access_log_format(batch + used, ACCESS_LOG_BATCH_BYTES - used, &rec);
+            if (len > 0) used += len;
+        }
+        
+        if (used == 0) {
+            usleep(ACCESS_LOG_FLUSH_MS * 1000);
+            continue;
+        }
+        
+        if (fd >= 0 && file_size + (off_t)used > ACCESS_LOG_MAX_BYTES) {
+            close(fd);
+            fd = -1;
+            access_log_rotate();
+        }
+        if (fd < 0) {
+            mkdir(ACCESS_LOG_DIR, 0755);
+            fd = open(ACCESS_LOG_PATH, O_WRONLY | O_CREAT | O_APPEND, 0644);
+            struct stat st;
+            file_size = (fd >= 0 && fstat(fd, &st) == 0) ? st.st_size : 0;
+        }
+        if (fd >= 0) {
+            ssize_t w = write(fd, batch, used);
+            if (w > 0) file_size += w;
+        }
+    }
+    return NULL;
+}
+
+// Return the last lines of the access log
+void handle_access_log(int sock, const char *lines_str) {
+    int lines = lines_str ? atoi(lines_str) : 100;
+    if (lines <= 0) lines = 100;
+    if (lines > 5000) lines = 5000;
+    
+    int fd = open(ACCESS_LOG_PATH, O_RDONLY);
+    if (fd < 0) {
+        send_http_response(sock, 200, "application/x-ndjson", "", 0);
+        return;
+    }
+    
+    struct stat st;
+    fstat(fd, &st);
+    
+    // Walk backwards in blocks until enough newlines are found
+    off_t end = st.st_size;
+    off_t start = end;
+    int newlines = 0;
+    char block[8192];
+    while (start > 0 && newlines <= lines) {
+        off_t chunk = start >= (off_t)sizeof(block) ? (off_t)sizeof(block) : start;
+        start -= chunk;
+        ssize_t r = pread(fd, block, chunk, start);
+        if (r <= 0) break;
+        for (ssize_t i = r - 1; i >= 0; i--) {
+            if (block[i] == '\n' && start + i != end - 1) {
+                if (++newlines == lines) {
+                    start += i + 1;
+                    break;
+                }
+            }
+        }
+        if (newlines == lines) break;
+    }
+    
+    size_t len = end - start;
+    char *out = malloc(len ? len : 1);
+    if (!out) {
+        close(fd);
+        send_http_response(sock, 500, "text/plain", "Memory error", 12);
+        return;
+    }
+    ssize_t got = pread(fd, out, len, start);
+    close(fd);
+    send_http_response(sock, 200, "application/x-ndjson", out, got > 0 ? got : 0);
+    free(out);
+}
+
+// Active transfer registry
+// Slots are claimed/released under transfer_lock; the owning thread bumps the
+// byte count atomically and the sampler derives rates once per tick.
+typedef struct {
+    int in_use;
+    unsigned int id;
+    int direction;                      // TRANSFER_DOWNLOAD / TRANSFER_UPLOAD
+    char client[INET_ADDRSTRLEN];
+    char path[256];
+    unsigned long long total;
+    _Atomic unsigned long long bytes;
+    unsigned long long start_us;
+    unsigned long long last_bytes;      // sampler only
+    unsigned long long rate;            // bytes/sec over the last tick, sampler only
+} transfer_t;
+
+#define TRANSFER_DOWNLOAD 0
+#define TRANSFER_UPLOAD 1
+
+static transfer_t transfers[TRANSFER_SLOTS];
+static unsigned int transfer_next_id = 1;
+static pthread_mutex_t transfer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Copy a path, keeping its tail (the file name) when it doesn't fit
+void copy_path_tail(char *dst, size_t dst_len, const char *src) {
+    size_t len = strlen(src);
+    if (len >= dst_len) src += len - (dst_len - 1);
+    memcpy(dst, src, strlen(src) + 1);
+}
+
+// Register a transfer for the current client. Returns the slot or -1 when full.
+int transfer_begin(int direction, const char *path, unsigned long long total) {
+    client_info_t *client = current_client();
+    int slot = -1;
+    pthread_mutex_lock(&transfer_lock);
+    for (int i = 0; i < TRANSFER_SLOTS; i++) {
+        if (!transfers[i].in_use) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot >= 0) {
+        transfer_t *t = &transfers[slot];
+        t->in_use = 1;
+        t->id = transfer_next_id++;
+        t->direction = direction;
+        t->client[0] = '\0';
+        if (client) inet_ntop(AF_INET, &client->client_addr.sin_addr, t->client, sizeof(t->client));
+        copy_path_tail(t->path, sizeof(t->path), path);
+        t->total = total;
+        atomic_store_explicit(&t->bytes, 0, memory_order_relaxed);
+        t->start_us = monotonic_us();
+        t->last_bytes = 0;
+        t->rate = 0;
+    }
+    pthread_mutex_unlock(&transfer_lock);
+    if (direction == TRANSFER_DOWNLOAD) shaper_join(client);
+    return slot;
+}
+
+static inline void transfer_progress(int slot, unsigned long long n) {
+    if (slot >= 0) atomic_fetch_add_explicit(&transfers[slot].bytes, n, memory_order_relaxed);
+}
+
+void transfer_end(int slot) {
+    shaper_leave(current_client());
+    if (slot < 0) return;
+    pthread_mutex_lock(&transfer_lock);
+    transfers[slot].in_use = 0;
+    pthread_mutex_unlock(&transfer_lock);
+}
+
+// Update per-transfer rates (sampler thread, once per tick)
+void transfer_update_rates(unsigned long long interval_ms) {
+    pthread_mutex_lock(&transfer_lock);
+    for (int i = 0; i < TRANSFER_SLOTS; i++) {
+        transfer_t *t = &transfers[i];
+        if (!t->in_use) continue;
+        unsigned long long bytes = atomic_load_explicit(&t->bytes, memory_order_relaxed);
+        t->rate = (bytes - t->last_bytes) * 1000 / interval_ms;
+        t->last_bytes = bytes;
+    }
+    pthread_mutex_unlock(&transfer_lock);
+}
+
+// Active transfers as a JSON array
+int format_transfers_json(char *out, size_t out_len) {
+    unsigned long long now = monotonic_us();
+    int pos = snprintf(out, out_len, "[");
+    int emitted = 0;
+    pthread_mutex_lock(&transfer_lock);
+    for (int i = 0; i < TRANSFER_SLOTS && (size_t)pos + 512 < out_len; i++) {
+        transfer_t *t = &transfers[i];
+        if (!t->in_use) continue;
+        char path[512];
+        json_escape(path, sizeof(path), t->path);
+        unsigned long long bytes = atomic_load_explicit(&t->bytes, memory_order_relaxed);
+        unsigned long long elapsed_ms = (now - t->start_us) / 1000;
+        pos += snprintf(out + pos, out_len - pos,
+            "%s{\"id\":%u,\"direction\":\"%s\",\"client\":\"%s\",\"path\":\"%s\",\"bytes\":%llu,\"total\":%llu,"
+            "\"rate\":%llu,\"avg_rate\":%llu,\"elapsed_ms\":%llu}",
+            emitted ? "," : "", t->id, t->direction == TRANSFER_UPLOAD ? "upload" : "download",
+            t->client, path, bytes, t->total, t->rate,
+            elapsed_ms ? bytes * 1000 / elapsed_ms : 0, elapsed_ms);
+        emitted++;
+    }
+    pthread_mutex_unlock(&transfer_lock);
+    pos += snprintf(out + pos, out_len - pos, "]");
+    return pos;
+}
+
+// URL decoding
+// '+' becomes a space and valid %XX escapes become bytes; malformed escapes are
+// copied through unchanged. The SSE2 path copies 16-byte runs that contain no
+// '%' or '+' in one step, so plain path segments cost a compare and a store.
+static const unsigned char hex_table[256] = {    // digit value + 1, 0 if not hex
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5, ['5'] = 6, ['6'] = 7, ['7'] = 8,
+    ['8'] = 9, ['9'] = 10, ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+};
+
+// Decode src[0..src_len) into dst (always NUL-terminated on success).
+// Returns the decoded length, or (size_t)-1 if the result does not fit.
+size_t url_decode_n(char *dst, size_t dst_len, const char *src, size_t src_len) {
+    const unsigned char *in = (const unsigned char *)src;
+    size_t i = 0, o = 0;
+    if (dst_len == 0) return (size_t)-1;
+#ifdef __SSE2__
+    const __m128i percent = _mm_set1_epi8('%');
+    const __m128i plus = _mm_set1_epi8('+');
+#endif
+    
+    while (i < src_len) {
+        size_t limit = src_len;
+#ifdef __SSE2__
+        while (i + 16 <= src_len && o + 16 < dst_len) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+            int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, percent), _mm_cmpeq_epi8(v, plus)));
+            if (mask == 0) {
+                _mm_storeu_si128((__m128i *)(dst + o), v);
+                i += 16;
+                o += 16;
+                continue;
+            }
+            // Copy up to the first escape, then decode the rest of the block byte-wise
+            int run = __builtin_ctz(mask);
+            memcpy(dst + o, in + i, run);
+            limit = i + 16;
+            i += run;
+            o += run;
+            break;
+        }
+#endif
+        while (i < limit) {
+            if (o + 1 >= dst_len) return (size_t)-1;
+            unsigned char c = in[i];
+            if (c == '%' && i + 2 < src_len && hex_table[in[i + 1]] && hex_table[in[i + 2]]) {
+                dst[o++] = (char)((hex_table[in[i + 1]] - 1) * 16 + hex_table[in[i + 2]] - 1);
+                i += 3;
+            } else {
+                dst[o++] = (c == '+') ? ' ' : (char)c;
+                i++;
+            }
+        }
+    }
+    dst[o] = '\0';
+    return o;
+}
+
+// Query string parsing
+// The query is split once into key/value views pointing into the request
+// line; values are decoded on lookup into caller-owned buffers, so parsing is
+// reentrant and keys must match exactly ("path" never matches "xpath=").
+#define QUERY_MAX_PARAMS 32
+
+typedef struct {
+    const char *key;
+    const char *value;          // NULL when the parameter has no '='
+    size_t key_len;
+    size_t value_len;
+} query_param_t;
+
+typedef struct {
+    query_param_t params[QUERY_MAX_PARAMS];
+    int count;
+} query_t;
+
+static inline int query_end(char c) {
+    return c == '\0' || c == ' ' || c == '#' || c == '\r' || c == '\n';
+}
+
+// Split "?a=1&b=2" (leading '?' optional, NULL allowed) into q
+void query_parse(query_t *q, const char *query) {
+    q->count = 0;
+    if (!query) return;
+    if (*query == '?') query++;
     
+    // strcspn is vectorized in libc, so long values are skipped a block at a time
+    const char *p = query;
+    while (!query_end(*p) && q->count < QUERY_MAX_PARAMS) {
+        const char *start = p, *eq = NULL;
+        p += strcspn(p, "&= #\r\n");
+        if (*p == '=') {
+            eq = p;
+            p += strcspn(p, "& #\r\n");
+        }
+        if (p > start) {
+            query_param_t *param = &q->params[q->count++];
+            param->key = start;
+            param->key_len = (eq ? eq : p) - start;
+            param->value = eq ? eq + 1 : NULL;
+            param->value_len = eq ? (size_t)(p - eq - 1) : 0;
+        }
+        if (*p == '&') p++;
+    }
+}
+
+// Decode the first value named name into dst.
+// Returns dst, or NULL if the parameter is missing, has no value or does not fit.
+char* query_get(const query_t *q, const char *name, char *dst, size_t dst_len) {
+    size_t name_len = strlen(name);
+    for (int i = 0; i < q->count; i++) {
+        const query_param_t *param = &q->params[i];
+        if (param->key_len != name_len || memcmp(param->key, name, name_len) != 0) continue;
+        if (!param->value) return NULL;
+        if (url_decode_n(dst, dst_len, param->value, param->value_len) == (size_t)-1) return NULL;
+        return dst;
+    }
+    return NULL;
+}
+
+// Reason phrase for a status code
+const char* http_status_text(int code) {
     switch(code) {
-        case 200: status = "OK"; break;
-        case 404: status = "Not Found"; break;
-        case 500: status = "Internal Server Error"; break;
-        default: status = "Unknown"; break;
+        case 200: return "OK";
+        case 202: return "Accepted";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        case 507: return "Insufficient Storage";
+        default: return "Unknown";
     }
+}
+
+// Send HTTP response
+void send_http_response(int sock, int code, const char *content_type, const char *body, size_t body_len) {
+    char header[1024];
+    const char *status = http_status_text(code);
     
     int header_len = snprintf(header, sizeof(header),
         "HTTP/1.1 %d %s\r\n"
@@ -100,9 +1279,10 @@ void send_http_response(int sock, int code, const char *content_type, const char
         "\r\n",
         code, status, content_type, body_len);
     
-    send(sock, header, header_len, 0);
+    note_response_status(code);
+    client_send(sock, header, header_len);
     if (body && body_len > 0) {
-        send(sock, body, body_len, 0);
+        client_send(sock, body, body_len);
     }
 }
 
@@ -128,12 +1308,15 @@ int compare_entries(const void *a, const void *b) {
 }
 
 // Get file list as JSON
-void handle_list_files(int sock, const char *path) {
-    char decoded_path[MAX_PATH];
-    url_decode(decoded_path, path);
-    
-    DIR *dir = opendir(decoded_path);
+void handle_list_files(int sock, const char *path, const char *request) {
+    DIR *dir = opendir(path);
     if (!dir) {
+        char archive[MAX_PATH], inner[MAX_PATH];
+        int type = archive_split(path, archive, inner);
+        if (type) {
+            handle_list_archive(sock, path, archive, type, inner, request);
+            return;
+        }
         const char *error_msg = "{\"error\":\"Directory not found\"}";
         send_http_response(sock, 404, "application/json", error_msg, strlen(error_msg));
         return;
@@ -162,7 +1345,7 @@ void handle_list_files(int sock, const char *path) {
         if (strcmp(entry->d_name, ".") == 0) continue;
         
         char fullpath[MAX_PATH];
-        snprintf(fullpath, MAX_PATH, "%s/%s", decoded_path, entry->d_name);
+        snprintf(fullpath, MAX_PATH, "%s/%s", path, entry->d_name);
         
         struct stat st;
         if (stat(fullpath, &st) == 0) {
@@ -188,7 +1371,7 @@ void handle_list_files(int sock, const char *path) {
         return;
     }
     
-    int pos = sprintf(json, "{\"path\":\"%s\",\"files\":[", decoded_path);
+    int pos = sprintf(json, "{\"path\":\"%s\",\"files\":[", path);
     
     for (int i = 0; i < idx; i++) {
         if (i > 0) pos += sprintf(json + pos, ",");
@@ -202,985 +1385,7987 @@ void handle_list_files(int sock, const char *path) {
     
     pos += sprintf(json + pos, "]}");
     
-    send_http_response(sock, 200, "application/json", json, pos);
+    send_compressible_response(sock, request, 200, "application/json", json, pos);
     free(json);
     free(entries);
 }
 
-// Download file
-void handle_download_file(int sock, const char *path) {
-    char decoded_path[MAX_PATH];
-    url_decode(decoded_path, path);
-    
-    int fd = open(decoded_path, O_RDONLY);
-    if (fd < 0) {
-        send_http_response(sock, 404, "text/plain", "File not found", 14);
-        return;
+// Send fd as a chunked body, CRC32C-ing each buffer on its way to the socket,
+// then the digest as a trailer. Returns file bytes sent.
+unsigned long long send_file_chunked_crc(int sock, int fd, const char *path, const struct stat *st,
+                                         int transfer) {
+    char *buffer = malloc(BUFFER_SIZE);
+    if (!buffer) return 0;
+    uint32_t crc = 0;
+    unsigned long long sent_total = 0;
+    int ok = 1;
+    ssize_t n;
+    while (ok && (n = read(fd, buffer, BUFFER_SIZE)) > 0) {
+        crc = crc32c(crc, buffer, n);
+        char size_line[32];
+        int size_len = snprintf(size_line, sizeof(size_line), "%zx\r\n", (size_t)n);
+        ok = client_send(sock, size_line, size_len) == size_len &&
+             client_send(sock, buffer, n) == n &&
+             client_send(sock, "\r\n", 2) == 2;
+        if (ok) {
+            sent_total += n;
+            transfer_progress(transfer, n);
+        }
     }
+    free(buffer);
+    if (!ok || sent_total != (unsigned long long)st->st_size) return sent_total;
     
-    struct stat st;
-    fstat(fd, &st);
-    
-    // Set socket options for optimal download performance
-    int no_sigpipe = 1;
-    setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &no_sigpipe, sizeof(no_sigpipe));
-    
-    int nopush = 1;
-    setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
-    
-    char header[1024];
-    int header_len = snprintf(header, sizeof(header),
-        "HTTP/1.1 200 OK\r\n"
-        "Content-Type: application/octet-stream\r\n"
-        "Content-Length: %lld\r\n"
-        "Content-Disposition: attachment; filename=\"%s\"\r\n"
-        "Connection: close\r\n"
-        "\r\n",
-        (long long)st.st_size,
-        strrchr(decoded_path, '/') ? strrchr(decoded_path, '/') + 1 : decoded_path);
-    
-    send(sock, header, header_len, 0);
+    unsigned char be[4] = { crc >> 24, crc >> 16, crc >> 8, crc };
+    char b64[16], trailer[64], hex[16];
+    base64_encode(b64, be, 4);
+    int trailer_len = snprintf(trailer, sizeof(trailer), "0\r\nContent-Digest: crc32c=:%s:\r\n\r\n", b64);
+    client_send(sock, trailer, trailer_len);
     
+    struct stat after;
+    if (fstat(fd, &after) == 0 && after.st_size == st->st_size &&
+        after.st_mtim.tv_sec == st->st_mtim.tv_sec && after.st_mtim.tv_nsec == st->st_mtim.tv_nsec) {
+        snprintf(hex, sizeof(hex), "%08x", crc);
+        hash_cache_store(st, HASH_CRC32C, hex, path);
+    }
+    return sent_total;
+}
+
+// Content-Digest value for a file from the hash cache ("" if nothing is cached)
+void format_content_digest(char *out, size_t out_len, const struct stat *st) {
+    char digests[HASH_ALGO_COUNT][HASH_DIGEST_MAX], b64[64];
+    unsigned char raw[32];
+    int pos = 0;
+    out[0] = '\0';
+    int found = hash_cache_peek(st, digests);
+    if (found & (1 << HASH_SHA256)) {
+        for (int i = 0; i < 32; i++) sscanf(digests[HASH_SHA256] + i * 2, "%2hhx", &raw[i]);
+        base64_encode(b64, raw, 32);
+        pos += snprintf(out + pos, out_len - pos, "sha-256=:%s:", b64);
+    }
+    if (found & (1 << HASH_CRC32C)) {
+        uint32_t crc = (uint32_t)strtoul(digests[HASH_CRC32C], NULL, 16);
+        unsigned char be[4] = { crc >> 24, crc >> 16, crc >> 8, crc };
+        base64_encode(b64, be, 4);
+        snprintf(out + pos, out_len - pos, "%scrc32c=:%s:", pos ? ", " : "", b64);
+    }
+}
+
+// Send len bytes of fd starting at offset; returns the bytes sent.
+// sendfile where available, read/send otherwise or if sendfile fails.
+unsigned long long send_file_range(int sock, int fd, off_t start, unsigned long long len, int transfer) {
     unsigned long long bytes_sent = 0;
+    if (request_is_head()) return 0;
+    client_info_t *client = current_client();
+    off_t offset = start;
+    off_t end = start + len;
     
-    #ifdef __FreeBSD__
-    // PS5 uses FreeBSD - use sendfile for zero-copy transfer
-    off_t offset = 0;
-    off_t sbytes = 0;
-    int sf_result = sendfile(fd, sock, offset, st.st_size, NULL, &sbytes, 0);
-    bytes_sent = sbytes;
-    
-    if (sf_result == 0 || (sf_result < 0 && errno == EAGAIN)) {
-        // sendfile succeeded
-        nopush = 0;
-        setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
-        close(fd);
-        total_files_transferred++;
-        total_bytes_transferred += bytes_sent;
-        return;
+    #if defined(__FreeBSD__) || defined(HOST_BUILD)
+    // PS5 uses FreeBSD - use sendfile for zero-copy transfer (Linux sendfile on host builds)
+    // Sent in chunks so the transfer registry sees progress
+    int sf_ok = 1;
+    while (offset < end) {
+        size_t chunk = end - offset;
+        if (chunk > TRANSFER_CHUNK) chunk = TRANSFER_CHUNK;
+        chunk = shaper_acquire(client, chunk);
+        conn_io_mark(client, 1);
+        #ifdef HOST_BUILD
+        off_t file_pos = offset;
+        ssize_t sf_sent = sendfile(sock, fd, &file_pos, chunk);
+        off_t sbytes = sf_sent > 0 ? sf_sent : 0;
+        int sf_result = sf_sent < 0 ? -1 : 0;
+        #else
+        off_t sbytes = 0;
+        int sf_result = sendfile(fd, sock, offset, chunk, NULL, &sbytes, 0);
+        #endif
+        if (sf_result == 0 && sbytes == 0) break;   // file shrank underneath us
+        offset += sbytes;
+        bytes_sent += sbytes;
+        note_bytes_sent(sbytes);
+        transfer_progress(transfer, sbytes);
+        if (sf_result < 0 && errno != EAGAIN && errno != EINTR) {
+            sf_ok = 0;
+            break;
+        }
+        if (sf_result < 0 && sbytes == 0 && errno == EAGAIN) {
+            // Send timeout with no progress - client is gone
+            break;
+        }
     }
+    conn_io_done(client, 1);
+    if (sf_ok) return bytes_sent;
     #endif
     
     // Fallback to traditional read/write
     char *buffer = malloc(BUFFER_SIZE);
     if (buffer) {
-        ssize_t n;
-        while ((n = read(fd, buffer, BUFFER_SIZE)) > 0) {
+        while (offset < end) {
+            size_t want = end - offset < BUFFER_SIZE ? (size_t)(end - offset) : BUFFER_SIZE;
+            ssize_t n = pread(fd, buffer, want, offset);
+            if (n <= 0) break;
             ssize_t sent = 0;
             while (sent < n) {
-                ssize_t s = send(sock, buffer + sent, n - sent, 0);
+                size_t want = shaper_acquire(client, n - sent);
+                conn_io_mark(client, 1);
+                ssize_t s = send(sock, buffer + sent, want, 0);
                 if (s < 0) {
                     if (errno == EINTR) continue;
                     break;
                 }
                 if (s == 0) break;
                 sent += s;
+                note_bytes_sent(s);
+                transfer_progress(transfer, s);
             }
+            conn_io_done(client, 1);
             bytes_sent += sent;
+            offset += sent;
+            if (sent < n) break;
         }
         free(buffer);
     }
-    
-    nopush = 0;
-    setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
-    
-    close(fd);
-    
-    total_files_transferred++;
-    total_bytes_transferred += bytes_sent;
+    return bytes_sent;
 }
 
-// Delete file/directory
-void handle_delete(int sock, const char *path) {
-    char decoded_path[MAX_PATH];
-    url_decode(decoded_path, path);
-    
-    struct stat st;
-    if (stat(decoded_path, &st) != 0) {
-        send_http_response(sock, 404, "application/json", "{\"error\":\"Not found\"}", 21);
+// DEFLATE decoder (RFC 1951)
+// Blocking and pull-based: compressed bytes come from a read callback and the
+// output is handed to a write callback INFLATE_FLUSH bytes at a time, so
+// callers can stream from a file or socket with a fixed amount of memory.
+// The ring holds the 32KB history plus output not yet flushed.
+typedef struct {
+    uint16_t count[16];                     // codes per length
+    uint16_t symbol[288];                   // symbols ordered by code
+    uint16_t fast[1 << INFLATE_FAST_BITS];  // (length << 9) | symbol for short codes, 0 otherwise
+} inflate_huff_t;
+
+typedef struct {
+    ssize_t (*read)(void *ctx, unsigned char *buf, size_t len);
+    int (*write)(void *ctx, const unsigned char *buf, size_t len);
+    void *ctx;
+    unsigned char in[INFLATE_IN_BUF];
+    size_t in_pos, in_len;
+    uint64_t bits;
+    int bit_count;
+    int error;                              // INFLATE_EDATA / INFLATE_EIO once set
+    unsigned long long out, flushed;        // bytes produced / handed to write
+    unsigned char window[INFLATE_WINDOW];
+    inflate_huff_t lit, dist;
+} inflate_t;
+
+#define INFLATE_EDATA -1                    // corrupt or truncated stream
+#define INFLATE_EIO -2                      // read or write callback failed
+
+static const uint16_t inflate_len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t inflate_len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t inflate_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+    4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t inflate_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+void inflate_init(inflate_t *z, ssize_t (*read_fn)(void *, unsigned char *, size_t),
+                  int (*write_fn)(void *, const unsigned char *, size_t), void *ctx) {
+    z->read = read_fn;
+    z->write = write_fn;
+    z->ctx = ctx;
+    z->in_pos = z->in_len = 0;
+    z->bits = 0;
+    z->bit_count = 0;
+    z->error = 0;
+    z->out = z->flushed = 0;
+}
+
+// Top up the bit buffer to at least n bits; -1 at end of input
+static int inflate_fill(inflate_t *z, int n) {
+    while (z->bit_count < n) {
+        if (z->in_pos == z->in_len) {
+            ssize_t r = z->read(z->ctx, z->in, sizeof(z->in));
+            if (r < 0) z->error = INFLATE_EIO;
+            if (r <= 0) return -1;
+            z->in_len = r;
+            z->in_pos = 0;
+        }
+        z->bits |= (uint64_t)z->in[z->in_pos++] << z->bit_count;
+        z->bit_count += 8;
+    }
+    return 0;
+}
+
+static unsigned inflate_bits(inflate_t *z, int n) {
+    if (inflate_fill(z, n) != 0) {
+        if (!z->error) z->error = INFLATE_EDATA;
+        return 0;
+    }
+    unsigned v = z->bits & ((1u << n) - 1);
+    z->bits >>= n;
+    z->bit_count -= n;
+    return v;
+}
+
+// Build a canonical code from code lengths. Returns -1 if over-subscribed.
+static int inflate_build(inflate_huff_t *h, const uint8_t *lengths, int n) {
+    uint16_t offs[16];
+    memset(h->count, 0, sizeof(h->count));
+    for (int i = 0; i < n; i++) h->count[lengths[i]]++;
+    int left = 1;
+    for (int len = 1; len < 16; len++) {
+        left = (left << 1) - h->count[len];
+        if (left < 0) return -1;
+    }
+    offs[1] = 0;
+    for (int len = 1; len < 15; len++) offs[len + 1] = offs[len] + h->count[len];
+    for (int sym = 0; sym < n; sym++) {
+        if (lengths[sym]) h->symbol[offs[lengths[sym]]++] = sym;
+    }
+    // Short codes resolve with one lookup on the (bit-reversed) next bits
+    memset(h->fast, 0, sizeof(h->fast));
+    unsigned code = 0;
+    int index = 0;
+    for (int len = 1; len <= INFLATE_FAST_BITS; len++) {
+        for (int k = 0; k < h->count[len]; k++, index++, code++) {
+            unsigned rev = 0;
+            for (int b = 0; b < len; b++) rev |= ((code >> b) & 1) << (len - 1 - b);
+            for (unsigned i = rev; i < (1u << INFLATE_FAST_BITS); i += 1u << len) {
+                h->fast[i] = len << 9 | h->symbol[index];
+            }
+        }
+        code <<= 1;
+    }
+    return 0;
+}
+
+static int inflate_decode(inflate_t *z, const inflate_huff_t *h) {
+    inflate_fill(z, 15);    // may come up short at the very end of the input
+    unsigned e = h->fast[z->bits & ((1u << INFLATE_FAST_BITS) - 1)];
+    if (e) {
+        int len = e >> 9;
+        if (len > z->bit_count) {
+            if (!z->error) z->error = INFLATE_EDATA;
+            return -1;
+        }
+        z->bits >>= len;
+        z->bit_count -= len;
+        return e & 511;
+    }
+    // Long code: walk the canonical code one bit at a time
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; len++) {
+        code |= inflate_bits(z, 1);
+        int count = h->count[len];
+        if (code - count < first) return h->symbol[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    if (!z->error) z->error = INFLATE_EDATA;
+    return -1;
+}
+
+static void inflate_flush(inflate_t *z) {
+    while (z->flushed < z->out && !z->error) {
+        size_t start = z->flushed & (INFLATE_WINDOW - 1);
+        size_t n = z->out - z->flushed;
+        if (n > INFLATE_WINDOW - start) n = INFLATE_WINDOW - start;
+        if (z->write(z->ctx, z->window + start, n) != 0) z->error = INFLATE_EIO;
+        z->flushed += n;
+    }
+}
+
+static void inflate_stored(inflate_t *z) {
+    // Drop to a byte boundary; LEN and NLEN follow
+    z->bits >>= z->bit_count & 7;
+    z->bit_count -= z->bit_count & 7;
+    unsigned len = inflate_bits(z, 16);
+    unsigned nlen = inflate_bits(z, 16);
+    if (z->error) return;
+    if (len != (~nlen & 0xFFFF)) {
+        z->error = INFLATE_EDATA;
         return;
     }
-    
-    int result;
-    if (S_ISDIR(st.st_mode)) {
-        result = rmdir(decoded_path);
-    } else {
-        result = unlink(decoded_path);
+    while (len > 0 && z->bit_count >= 8) {
+        z->window[z->out++ & (INFLATE_WINDOW - 1)] = inflate_bits(z, 8);
+        len--;
     }
-    
-    const char *success_msg = "{\"success\":true}";
-    const char *error_msg = "{\"error\":\"Delete failed\"}";
-    if (result == 0) {
-        send_http_response(sock, 200, "application/json", success_msg, strlen(success_msg));
-    } else {
-        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+    while (len > 0 && !z->error) {
+        if (z->in_pos == z->in_len && inflate_fill(z, 8) != 0) {
+            if (!z->error) z->error = INFLATE_EDATA;
+            return;
+        }
+        if (z->bit_count) {
+            // inflate_fill pulled one byte into the bit buffer
+            z->window[z->out++ & (INFLATE_WINDOW - 1)] = inflate_bits(z, 8);
+            len--;
+        }
+        size_t n = z->in_len - z->in_pos;
+        size_t room = INFLATE_WINDOW - (z->out & (INFLATE_WINDOW - 1));
+        if (n > len) n = len;
+        if (n > room) n = room;
+        if (n > INFLATE_FLUSH) n = INFLATE_FLUSH;
+        memcpy(z->window + (z->out & (INFLATE_WINDOW - 1)), z->in + z->in_pos, n);
+        z->in_pos += n;
+        z->out += n;
+        len -= n;
+        if (z->out - z->flushed >= INFLATE_FLUSH) inflate_flush(z);
     }
 }
 
-// Get system info as JSON
-void handle_system_info(int sock) {
-    char json[8192];
-    
-    // Storage - /data partition
-    struct statvfs vfs_data;
-    statvfs("/data", &vfs_data);
-    unsigned long long data_total = vfs_data.f_blocks * vfs_data.f_frsize;
-    unsigned long long data_free = vfs_data.f_bfree * vfs_data.f_frsize;
-    unsigned long long data_used = data_total - data_free;
-    
-    // Storage - /system partition
-    struct statvfs vfs_system;
-    unsigned long long sys_total = 0, sys_free = 0, sys_used = 0;
-    if (statvfs("/system", &vfs_system) == 0) {
-        sys_total = vfs_system.f_blocks * vfs_system.f_frsize;
-        sys_free = vfs_system.f_bfree * vfs_system.f_frsize;
-        sys_used = sys_total - sys_free;
+static void inflate_codes(inflate_t *z) {
+    while (!z->error) {
+        int sym = inflate_decode(z, &z->lit);
+        if (sym < 0) return;
+        if (sym < 256) {
+            z->window[z->out++ & (INFLATE_WINDOW - 1)] = sym;
+        } else if (sym == 256) {
+            return;
+        } else {
+            sym -= 257;
+            if (sym >= 29) {
+                z->error = INFLATE_EDATA;
+                return;
+            }
+            unsigned len = inflate_len_base[sym] + inflate_bits(z, inflate_len_extra[sym]);
+            int dsym = inflate_decode(z, &z->dist);
+            if (dsym < 0 || dsym >= 30) {
+                if (!z->error) z->error = INFLATE_EDATA;
+                return;
+            }
+            unsigned dist = inflate_dist_base[dsym] + inflate_bits(z, inflate_dist_extra[dsym]);
+            if (z->error || dist > z->out) {
+                if (!z->error) z->error = INFLATE_EDATA;
+                return;
+            }
+            for (; len > 0; len--, z->out++) {
+                z->window[z->out & (INFLATE_WINDOW - 1)] = z->window[(z->out - dist) & (INFLATE_WINDOW - 1)];
+            }
+        }
+        if (z->out - z->flushed >= INFLATE_FLUSH) inflate_flush(z);
     }
-    
-    // RAM info - PS5 specific memory detection
-    unsigned long long ram_total = 16ULL * 1024 * 1024 * 1024;  // PS5 has 16GB
-    unsigned long long ram_free = 0;
-    unsigned long long ram_used = 0;
-    
-    // Try multiple methods to get actual RAM usage
-    size_t len = sizeof(ram_total);
-    
-    // Method 1: Try hw.physmem for total
-    if (sysctlbyname("hw.physmem", &ram_total, &len, NULL, 0) != 0) {
-        ram_total = 16ULL * 1024 * 1024 * 1024;
+}
+
+static void inflate_fixed(inflate_t *z) {
+    uint8_t lengths[288 + 30];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    memset(lengths + 288, 5, 30);
+    inflate_build(&z->lit, lengths, 288);
+    inflate_build(&z->dist, lengths + 288, 30);
+    inflate_codes(z);
+}
+
+static void inflate_dynamic(inflate_t *z) {
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    uint8_t lengths[320];
+    int nlen = inflate_bits(z, 5) + 257;
+    int ndist = inflate_bits(z, 5) + 1;
+    int ncode = inflate_bits(z, 4) + 4;
+    if (z->error || nlen > 286 || ndist > 30) {
+        if (!z->error) z->error = INFLATE_EDATA;
+        return;
     }
-    
-    // Method 2: Try to get memory stats
-    unsigned long page_size = 4096;
-    unsigned long free_pages = 0;
-    unsigned long inactive_pages = 0;
-    unsigned long cache_pages = 0;
-    
-    len = sizeof(page_size);
-    sysctlbyname("hw.pagesize", &page_size, &len, NULL, 0);
-    
-    // Get various memory page counts
-    len = sizeof(free_pages);
-    int got_free = (sysctlbyname("vm.stats.vm.v_free_count", &free_pages, &len, NULL, 0) == 0);
-    
-    len = sizeof(inactive_pages);
-    int got_inactive = (sysctlbyname("vm.stats.vm.v_inactive_count", &inactive_pages, &len, NULL, 0) == 0);
-    
-    len = sizeof(cache_pages);
-    int got_cache = (sysctlbyname("vm.stats.vm.v_cache_count", &cache_pages, &len, NULL, 0) == 0);
-    
-    if (got_free || got_inactive || got_cache) {
-        // Calculate available memory (free + inactive + cache)
-        unsigned long available_pages = free_pages + inactive_pages + cache_pages;
-        ram_free = (unsigned long long)available_pages * page_size;
-        ram_used = ram_total - ram_free;
-    } else {
-        // Fallback: Use /proc/meminfo style estimate
-        ram_used = ram_total * 0.6;
-        ram_free = ram_total - ram_used;
+    memset(lengths, 0, 19);
+    for (int i = 0; i < ncode; i++) lengths[order[i]] = inflate_bits(z, 3);
+    if (inflate_build(&z->lit, lengths, 19) != 0) {
+        z->error = INFLATE_EDATA;
+        return;
     }
-    
-    // Uptime - Get actual system uptime
-    struct timespec uptime_ts;
-    time_t uptime_seconds = 0;
-    
-    // Try to get system boot time
-    struct timeval boottime;
-    size_t boottime_len = sizeof(boottime);
-    if (sysctlbyname("kern.boottime", &boottime, &boottime_len, NULL, 0) == 0) {
-        uptime_seconds = time(NULL) - boottime.tv_sec;
-    } else {
-        // Fallback: try clock_gettime
-        if (clock_gettime(CLOCK_UPTIME, &uptime_ts) == 0) {
-            uptime_seconds = uptime_ts.tv_sec;
+    for (int index = 0; index < nlen + ndist && !z->error; ) {
+        int sym = inflate_decode(z, &z->lit);
+        if (sym < 0) return;
+        if (sym < 16) {
+            lengths[index++] = sym;
+            continue;
+        }
+        int len = 0, repeat;
+        if (sym == 16) {
+            if (index == 0) {
+                z->error = INFLATE_EDATA;
+                return;
+            }
+            len = lengths[index - 1];
+            repeat = 3 + inflate_bits(z, 2);
+        } else if (sym == 17) {
+            repeat = 3 + inflate_bits(z, 3);
         } else {
-            uptime_seconds = 0;
+            repeat = 11 + inflate_bits(z, 7);
+        }
+        if (index + repeat > nlen + ndist) {
+            z->error = INFLATE_EDATA;
+            return;
         }
+        while (repeat--) lengths[index++] = len;
     }
-    
-    int days = uptime_seconds / 86400;
-    int hours = (uptime_seconds % 86400) / 3600;
-    int minutes = (uptime_seconds % 3600) / 60;
-    int seconds = uptime_seconds % 60;
-    
-    // Network info - Get IP address
-    char hostname[256] = "PS5";
-    char ip_address[INET_ADDRSTRLEN] = "192.168.0.160";
-    
-    gethostname(hostname, sizeof(hostname));
-    
-    // Try to get actual IP address
-    struct ifaddrs *ifaddr, *ifa;
-    if (getifaddrs(&ifaddr) == 0) {
-        for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
-            if (ifa->ifa_addr == NULL) continue;
-            if (ifa->ifa_addr->sa_family == AF_INET) {
-                struct sockaddr_in *addr = (struct sockaddr_in *)ifa->ifa_addr;
-                inet_ntop(AF_INET, &addr->sin_addr, ip_address, INET_ADDRSTRLEN);
-                if (strcmp(ip_address, "127.0.0.1") != 0) {
-                    break;
-                }
+    if (z->error) return;
+    if (lengths[256] == 0 || inflate_build(&z->lit, lengths, nlen) != 0 ||
+        inflate_build(&z->dist, lengths + nlen, ndist) != 0) {
+        z->error = INFLATE_EDATA;
+        return;
+    }
+    inflate_codes(z);
+}
+
+// Decode one complete DEFLATE stream. Returns 0, INFLATE_EDATA or INFLATE_EIO;
+// z->out holds the number of bytes produced.
+int inflate_run(inflate_t *z) {
+    int last;
+    do {
+        last = inflate_bits(z, 1);
+        int type = inflate_bits(z, 2);
+        if (z->error) break;
+        if (type == 0) inflate_stored(z);
+        else if (type == 1) inflate_fixed(z);
+        else if (type == 2) inflate_dynamic(z);
+        else z->error = INFLATE_EDATA;
+    } while (!last && !z->error);
+    inflate_flush(z);
+    return z->error;
+}
+
+// Input read past the end of the stream (a gzip trailer, the next zip header):
+// whole bytes still in the bit buffer, then the unread part of in[]. dst must
+// hold INFLATE_IN_BUF + 8 bytes. Returns the count.
+size_t inflate_unused(inflate_t *z, unsigned char *dst) {
+    size_t n = 0;
+    int partial = z->bit_count & 7;
+    z->bits >>= partial;
+    z->bit_count -= partial;
+    while (z->bit_count >= 8) {
+        dst[n++] = z->bits & 0xFF;
+        z->bits >>= 8;
+        z->bit_count -= 8;
+    }
+    memcpy(dst + n, z->in + z->in_pos, z->in_len - z->in_pos);
+    n += z->in_len - z->in_pos;
+    z->in_pos = z->in_len;
+    return n;
+}
+
+// CRC-32 (IEEE 802.3, as stored by gzip and zip); chain from 0 like crc32c()
+static uint32_t crc32_table[8][256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void crc32_init_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c >> 1) ^ (0xEDB88320u & -(c & 1));
+        crc32_table[0][i] = c;
+    }
+    for (int t = 1; t < 8; t++) {
+        for (int i = 0; i < 256; i++) {
+            crc32_table[t][i] = (crc32_table[t - 1][i] >> 8) ^ crc32_table[0][crc32_table[t - 1][i] & 0xFF];
+        }
+    }
+}
+
+uint32_t crc32_ieee(uint32_t crc, const void *buf, size_t len) {
+    pthread_once(&crc32_once, crc32_init_table);
+    const unsigned char *p = buf;
+    crc = ~crc;
+    while (len >= 8) {
+        uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        crc = crc32_table[7][lo & 0xFF] ^ crc32_table[6][(lo >> 8) & 0xFF] ^
+              crc32_table[5][(lo >> 16) & 0xFF] ^ crc32_table[4][lo >> 24] ^
+              crc32_table[3][p[4]] ^ crc32_table[2][p[5]] ^ crc32_table[1][p[6]] ^ crc32_table[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = (crc >> 8) ^ crc32_table[0][(crc ^ *p++) & 0xFF];
+    return ~crc;
+}
+
+// DEFLATE encoder (RFC 1951) with gzip (RFC 1952) or zlib (RFC 1950) framing
+// Streaming and bounded: input goes through a 64KB window (32KB of history
+// plus lookahead), matches are found through 3-byte hash chains with a fixed
+// search budget and one step of lazy evaluation, and every DEFLATE_SYMS
+// symbols become a dynamic Huffman block. Output is handed to a write
+// callback DEFLATE_OUT bytes at a time.
+typedef struct {
+    int (*write)(void *ctx, const unsigned char *buf, size_t len);
+    void *ctx;
+    int format;
+    unsigned char window[2 * DEFLATE_WSIZE];
+    size_t window_len;
+    size_t pos;                             // next byte to encode
+    size_t ins;                             // next position to enter in the hash chains
+    uint16_t head[1 << DEFLATE_HASH_BITS];  // newest position per hash, 0 for none
+    uint16_t prev[DEFLATE_WSIZE];           // previous position with the same hash
+    uint32_t syms[DEFLATE_SYMS];            // literal, or DEFLATE_MATCH | (length - 3) << 16 | distance
+    int sym_count;
+    long long block_start;                  // window offset of the pending block's input, < 0 once slid out
+    uint64_t bits;
+    int bit_count;
+    unsigned char out[DEFLATE_OUT];
+    size_t out_len;
+    uint32_t check;                         // CRC-32 (gzip) or Adler-32 (zlib) of the input
+    unsigned long long in_total, out_total;
+    int error;
+} deflate_t;
+
+#define DEFLATE_RAW 0
+#define DEFLATE_GZIP 1
+#define DEFLATE_ZLIB 2
+#define DEFLATE_MATCH 0x80000000u
+#define DEFLATE_LOOKAHEAD (258 + 3)
+#define DEFLATE_INSERT_MAX 32               // longer matches skip hashing their interior
+
+static uint8_t deflate_len_code[256];       // length - 3 -> code - 257
+static uint8_t deflate_dist_code[512];      // see deflate_dist_index
+static pthread_once_t deflate_once = PTHREAD_ONCE_INIT;
+static const uint8_t deflate_cl_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static void deflate_init_tables(void) {
+    for (int c = 0; c < 29; c++) {
+        for (int l = inflate_len_base[c]; l < inflate_len_base[c] + (1 << inflate_len_extra[c]) && l <= 258; l++) {
+            deflate_len_code[l - 3] = c;
+        }
+    }
+    for (int c = 0; c < 30; c++) {
+        for (int d = inflate_dist_base[c]; d < inflate_dist_base[c] + (1 << inflate_dist_extra[c]); d++) {
+            if (d <= 256) deflate_dist_code[d - 1] = c;
+            else deflate_dist_code[256 + ((d - 1) >> 7)] = c;
+        }
+    }
+}
+
+static inline int deflate_dist_index(unsigned dist) {
+    return dist <= 256 ? deflate_dist_code[dist - 1] : deflate_dist_code[256 + ((dist - 1) >> 7)];
+}
+
+static void deflate_flush_out(deflate_t *z) {
+    if (z->out_len && !z->error && z->write(z->ctx, z->out, z->out_len) != 0) z->error = -1;
+    z->out_total += z->out_len;
+    z->out_len = 0;
+}
+
+static inline void deflate_byte(deflate_t *z, unsigned char b) {
+    z->out[z->out_len++] = b;
+    if (z->out_len == DEFLATE_OUT) deflate_flush_out(z);
+}
+
+static inline void deflate_put(deflate_t *z, uint32_t value, int n) {
+    z->bits |= (uint64_t)value << z->bit_count;
+    z->bit_count += n;
+    while (z->bit_count >= 8) {
+        deflate_byte(z, z->bits & 0xFF);
+        z->bits >>= 8;
+        z->bit_count -= 8;
+    }
+}
+
+static uint32_t adler32(uint32_t adler, const unsigned char *p, size_t len) {
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (len > 0) {
+        size_t n = len < 5552 ? len : 5552;
+        len -= n;
+        while (n--) {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return b << 16 | a;
+}
+
+void deflate_init(deflate_t *z, int format, int (*write_fn)(void *, const unsigned char *, size_t), void *ctx) {
+    pthread_once(&deflate_once, deflate_init_tables);
+    z->write = write_fn;
+    z->ctx = ctx;
+    z->format = format;
+    z->window_len = z->pos = z->ins = 0;
+    memset(z->head, 0, sizeof(z->head));
+    z->sym_count = 0;
+    z->block_start = 0;
+    z->bits = 0;
+    z->bit_count = 0;
+    z->out_len = 0;
+    z->in_total = z->out_total = 0;
+    z->error = 0;
+    z->check = format == DEFLATE_ZLIB ? 1 : 0;
+    if (format == DEFLATE_GZIP) {
+        static const unsigned char gzip_header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+        memcpy(z->out, gzip_header, sizeof(gzip_header));
+        z->out_len = sizeof(gzip_header);
+    } else if (format == DEFLATE_ZLIB) {
+        z->out[0] = 0x78;
+        z->out[1] = 0x9c;
+        z->out_len = 2;
+    }
+}
+
+// Huffman code lengths for freq[0..n), none longer than limit. Frequencies
+// are halved and the tree rebuilt until it fits, which costs little on real
+// data and keeps the builder to a plain two-queue construction.
+static int deflate_freq_cmp(const void *a, const void *b) {
+    uint32_t fa = *(const uint32_t *)a >> 9, fb = *(const uint32_t *)b >> 9;
+    return fa < fb ? -1 : fa > fb;
+}
+
+static void deflate_build_lengths(const uint32_t *freq_in, int n, int limit, uint8_t *lengths) {
+    uint32_t freq[286], leaves[286];            // leaves: freq << 9 | symbol
+    uint32_t weight[2 * 286];
+    uint16_t parent[2 * 286];
+    uint8_t depth[2 * 286];
+    memcpy(freq, freq_in, n * sizeof(uint32_t));
+    while (1) {
+        int m = 0;
+        memset(lengths, 0, n);
+        for (int i = 0; i < n; i++) if (freq[i]) leaves[m++] = freq[i] << 9 | i;
+        if (m == 0) return;
+        if (m == 1) {
+            lengths[leaves[0] & 511] = 1;
+            return;
+        }
+        qsort(leaves, m, sizeof(uint32_t), deflate_freq_cmp);
+        for (int i = 0; i < m; i++) weight[i] = leaves[i] >> 9;
+        int next_leaf = 0, next_node = m;
+        for (int k = m; k < 2 * m - 1; k++) {
+            int pick[2];
+            for (int t = 0; t < 2; t++) {
+                if (next_leaf < m && (next_node >= k || weight[next_leaf] <= weight[next_node])) pick[t] = next_leaf++;
+                else pick[t] = next_node++;
             }
+            weight[k] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = parent[pick[1]] = k;
         }
-        freeifaddrs(ifaddr);
+        depth[2 * m - 2] = 0;
+        int max = 0;
+        for (int k = 2 * m - 3; k >= 0; k--) {
+            depth[k] = depth[parent[k]] + 1;
+            if (k < m && depth[k] > max) max = depth[k];
+        }
+        if (max <= limit) {
+            for (int i = 0; i < m; i++) lengths[leaves[i] & 511] = depth[i];
+            return;
+        }
+        for (int i = 0; i < n; i++) if (freq[i]) freq[i] = (freq[i] >> 1) | 1;
     }
+}
+
+// Canonical codes, bit-reversed for LSB-first output
+static void deflate_build_codes(const uint8_t *lengths, int n, uint16_t *codes) {
+    uint16_t count[16] = {0}, next[16];
+    for (int i = 0; i < n; i++) count[lengths[i]]++;
+    count[0] = 0;
+    uint16_t code = 0;
+    for (int bits = 1; bits < 16; bits++) {
+        code = (code + count[bits - 1]) << 1;
+        next[bits] = code;
+    }
+    for (int i = 0; i < n; i++) {
+        int len = lengths[i];
+        if (!len) continue;
+        uint16_t c = next[len]++, r = 0;
+        for (int b = 0; b < len; b++) r |= ((c >> b) & 1) << (len - 1 - b);
+        codes[i] = r;
+    }
+}
+
+// Make sure at least two codes exist, as some decoders reject a lone code
+static void deflate_two_codes(uint32_t *freq) {
+    int used = 0;
+    for (int i = 0; i < 30 && used < 2; i++) used += freq[i] != 0;
+    for (int i = 0; used < 2; i++) {
+        if (!freq[i]) {
+            freq[i] = 1;
+            used++;
+        }
+    }
+}
+
+// Emit the input of the pending block as stored blocks (BTYPE 00)
+static void deflate_stored(deflate_t *z, const unsigned char *p, size_t len, int last) {
+    do {
+        size_t n = len < 65535 ? len : 65535;
+        len -= n;
+        deflate_put(z, last && len == 0, 3);
+        if (z->bit_count > 0) deflate_put(z, 0, 8 - z->bit_count);
+        deflate_put(z, n | (uint32_t)(n ^ 0xFFFF) << 16, 32);
+        for (size_t i = 0; i < n; i++) deflate_byte(z, p[i]);
+        p += n;
+    } while (len > 0);
+}
+
+// Emit the pending symbols as one dynamic Huffman block, or as stored blocks
+// when those come out no larger (incompressible input)
+static void deflate_block(deflate_t *z, int last) {
+    if (z->sym_count == 0) {
+        // Empty fixed block: header, then end-of-block (seven zero bits)
+        deflate_put(z, last | 1 << 1, 3);
+        deflate_put(z, 0, 7);
+        return;
+    }
+    uint32_t lit_freq[286] = {0}, dist_freq[30] = {0};
+    size_t raw_len = 0;
+    for (int i = 0; i < z->sym_count; i++) {
+        uint32_t s = z->syms[i];
+        if (s & DEFLATE_MATCH) {
+            lit_freq[257 + deflate_len_code[(s >> 16) & 0xFF]]++;
+            dist_freq[deflate_dist_index(s & 0xFFFF)]++;
+            raw_len += ((s >> 16) & 0xFF) + 3;
+        } else {
+            lit_freq[s]++;
+            raw_len++;
+        }
+    }
+    long long block_start = z->block_start;
+    z->block_start += raw_len;
+    lit_freq[256] = 1;
+    deflate_two_codes(dist_freq);
+    uint8_t lengths[286 + 30], lit_len[286], dist_len[30], cl_len[19];
+    uint16_t lit_code[286], dist_code[30], cl_code[19];
+    deflate_build_lengths(lit_freq, 286, 15, lit_len);
+    deflate_build_lengths(dist_freq, 30, 15, dist_len);
+    deflate_build_codes(lit_len, 286, lit_code);
+    deflate_build_codes(dist_len, 30, dist_code);
+    int hlit = 286, hdist = 30;
+    while (hlit > 257 && !lit_len[hlit - 1]) hlit--;
+    while (hdist > 1 && !dist_len[hdist - 1]) hdist--;
+    memcpy(lengths, lit_len, hlit);
+    memcpy(lengths + hlit, dist_len, hdist);
     
-    // Build JSON
-    int pos = sprintf(json, "{");
-    
-    // Storage info
-    pos += sprintf(json + pos, "\"storage\":{");
-    pos += sprintf(json + pos, "\"data\":{\"total\":%llu,\"used\":%llu,\"free\":%llu},", 
-                   data_total, data_used, data_free);
-    if (sys_total > 0) {
-        pos += sprintf(json + pos, "\"system\":{\"total\":%llu,\"used\":%llu,\"free\":%llu}", 
-                       sys_total, sys_used, sys_free);
+    // Run-length code the lengths: 16 repeats the previous 3-6 times, 17/18 are zero runs
+    uint8_t rle[286 + 30], rle_extra[286 + 30];
+    uint32_t cl_freq[19] = {0};
+    int rle_count = 0, total = hlit + hdist;
+    for (int i = 0; i < total; ) {
+        int len = lengths[i], run = 1;
+        while (i + run < total && lengths[i + run] == len) run++;
+        i += run;
+        if (len == 0) {
+            while (run >= 11) {
+                int r = run < 138 ? run : 138;
+                rle[rle_count] = 18;
+                rle_extra[rle_count++] = r - 11;
+                run -= r;
+            }
+            if (run >= 3) {
+                rle[rle_count] = 17;
+                rle_extra[rle_count++] = run - 3;
+                run = 0;
+            }
+        } else {
+            rle[rle_count++] = len;
+            run--;
+            while (run >= 3) {
+                int r = run < 6 ? run : 6;
+                rle[rle_count] = 16;
+                rle_extra[rle_count++] = r - 3;
+                run -= r;
+            }
+        }
+        while (run-- > 0) rle[rle_count++] = len;
     }
-    pos += sprintf(json + pos, "},");
+    for (int i = 0; i < rle_count; i++) cl_freq[rle[i]]++;
+    deflate_build_lengths(cl_freq, 19, 7, cl_len);
+    deflate_build_codes(cl_len, 19, cl_code);
+    int hclen = 19;
+    while (hclen > 4 && !cl_len[deflate_cl_order[hclen - 1]]) hclen--;
     
-    // RAM info
-    pos += sprintf(json + pos, "\"ram\":{\"total\":%llu,\"used\":%llu,\"free\":%llu},", 
-                   ram_total, ram_used, ram_free);
+    // Compare sizes in bits; a stored block pads to a byte and adds LEN/NLEN
+    // every 65535 bytes. Only possible while the input is still in the window.
+    if (block_start >= 0) {
+        uint64_t huff = 3 + 5 + 5 + 4 + 3 * hclen;
+        static const uint8_t rle_bits[3] = { 2, 3, 7 };
+        for (int i = 0; i < rle_count; i++) huff += cl_len[rle[i]] + (rle[i] >= 16 ? rle_bits[rle[i] - 16] : 0);
+        for (int i = 0; i < 286; i++) {
+            huff += (uint64_t)lit_freq[i] * lit_len[i];
+            if (i >= 257 && i < 257 + 29) huff += (uint64_t)lit_freq[i] * inflate_len_extra[i - 257];
+        }
+        for (int i = 0; i < 30; i++) {
+            if (dist_len[i]) huff += (uint64_t)dist_freq[i] * (dist_len[i] + inflate_dist_extra[i]);
+        }
+        uint64_t stored = (uint64_t)(raw_len + (raw_len + 65534) / 65535 * 5) * 8 + 8;
+        if (stored <= huff) {
+            deflate_stored(z, z->window + block_start, raw_len, last);
+            z->sym_count = 0;
+            return;
+        }
+    }
     
-    // Uptime
-    pos += sprintf(json + pos, "\"uptime\":{\"seconds\":%ld,\"days\":%d,\"hours\":%d,\"minutes\":%d,\"secs\":%d},", 
-                   (long)uptime_seconds, days, hours, minutes, seconds);
+    deflate_put(z, last | 2 << 1, 3);
+    deflate_put(z, hlit - 257, 5);
+    deflate_put(z, hdist - 1, 5);
+    deflate_put(z, hclen - 4, 4);
+    for (int i = 0; i < hclen; i++) deflate_put(z, cl_len[deflate_cl_order[i]], 3);
+    for (int i = 0; i < rle_count; i++) {
+        deflate_put(z, cl_code[rle[i]], cl_len[rle[i]]);
+        if (rle[i] == 16) deflate_put(z, rle_extra[i], 2);
+        else if (rle[i] == 17) deflate_put(z, rle_extra[i], 3);
+        else if (rle[i] == 18) deflate_put(z, rle_extra[i], 7);
+    }
+    for (int i = 0; i < z->sym_count; i++) {
+        uint32_t s = z->syms[i];
+        if (!(s & DEFLATE_MATCH)) {
+            deflate_put(z, lit_code[s], lit_len[s]);
+            continue;
+        }
+        int len = ((s >> 16) & 0xFF) + 3, dist = s & 0xFFFF;
+        int lc = deflate_len_code[len - 3], dc = deflate_dist_index(dist);
+        deflate_put(z, lit_code[257 + lc], lit_len[257 + lc]);
+        if (inflate_len_extra[lc]) deflate_put(z, len - inflate_len_base[lc], inflate_len_extra[lc]);
+        deflate_put(z, dist_code[dc], dist_len[dc]);
+        if (inflate_dist_extra[dc]) deflate_put(z, dist - inflate_dist_base[dc], inflate_dist_extra[dc]);
+    }
+    deflate_put(z, lit_code[256], lit_len[256]);
+    z->sym_count = 0;
+}
+
+static inline void deflate_sym(deflate_t *z, uint32_t sym) {
+    z->syms[z->sym_count++] = sym;
+    if (z->sym_count == DEFLATE_SYMS) deflate_block(z, 0);
+}
+
+static inline unsigned deflate_hash(const unsigned char *p) {
+    uint32_t v = p[0] | p[1] << 8 | p[2] << 16;
+    return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+static void deflate_insert_upto(deflate_t *z, size_t target) {
+    while (z->ins < target && z->ins + 3 <= z->window_len) {
+        unsigned h = deflate_hash(z->window + z->ins);
+        z->prev[z->ins & (DEFLATE_WSIZE - 1)] = z->head[h];
+        z->head[h] = z->ins;
+        z->ins++;
+    }
+}
+
+// Longest earlier match for the bytes at pos (0 if shorter than 3)
+static size_t deflate_longest(deflate_t *z, size_t pos, size_t *dist) {
+    if (pos + 3 > z->window_len) return 0;
+    size_t max = z->window_len - pos < 258 ? z->window_len - pos : 258;
+    deflate_insert_upto(z, pos);
+    size_t limit = pos > DEFLATE_WSIZE ? pos - DEFLATE_WSIZE : 0;
+    const unsigned char *cur = z->window + pos;
+    size_t cand = z->head[deflate_hash(cur)], best = 2;
+    for (int chain = DEFLATE_CHAIN; cand > limit && cand < pos && chain > 0; chain--) {
+        const unsigned char *m = z->window + cand;
+        if (m[best] == cur[best] && m[0] == cur[0] && m[1] == cur[1]) {
+            size_t n = 0;
+            while (n + 8 <= max) {
+                uint64_t a, b;
+                memcpy(&a, m + n, 8);
+                memcpy(&b, cur + n, 8);
+                if (a != b) {
+                    n += __builtin_ctzll(a ^ b) >> 3;
+                    break;
+                }
+                n += 8;
+            }
+            if (n + 8 > max) {
+                while (n < max && m[n] == cur[n]) n++;
+            }
+            if (n > best) {
+                best = n;
+                *dist = pos - cand;
+                if (n >= DEFLATE_NICE || n == max) break;
+            }
+        }
+        size_t next = z->prev[cand & (DEFLATE_WSIZE - 1)];
+        if (next >= cand) break;
+        cand = next;
+    }
+    return best >= 3 ? best : 0;
+}
+
+// Encode buffered input, keeping DEFLATE_LOOKAHEAD bytes back unless finishing
+static void deflate_compress(deflate_t *z, int finish) {
+    size_t keep = finish ? 0 : DEFLATE_LOOKAHEAD;
+    while (z->pos + keep < z->window_len) {
+        size_t dist = 0, len = deflate_longest(z, z->pos, &dist);
+        if (len && len < DEFLATE_NICE) {
+            // Lazy: a longer match one byte on beats this one
+            size_t dist2 = 0, len2 = deflate_longest(z, z->pos + 1, &dist2);
+            if (len2 > len) {
+                deflate_sym(z, z->window[z->pos++]);
+                len = len2;
+                dist = dist2;
+            }
+        }
+        if (len) {
+            deflate_sym(z, DEFLATE_MATCH | (uint32_t)(len - 3) << 16 | (uint32_t)dist);
+            if (len > DEFLATE_INSERT_MAX && z->ins < z->pos + len) z->ins = z->pos + len;
+            z->pos += len;
+        } else {
+            deflate_sym(z, z->window[z->pos++]);
+        }
+    }
+}
+
+// Drop the older half of the window
+static void deflate_slide(deflate_t *z) {
+    memmove(z->window, z->window + DEFLATE_WSIZE, z->window_len - DEFLATE_WSIZE);
+    z->window_len -= DEFLATE_WSIZE;
+    z->pos -= DEFLATE_WSIZE;
+    z->ins -= DEFLATE_WSIZE;
+    z->block_start -= DEFLATE_WSIZE;
+    for (size_t i = 0; i < sizeof(z->head) / sizeof(z->head[0]); i++) {
+        z->head[i] = z->head[i] >= DEFLATE_WSIZE ? z->head[i] - DEFLATE_WSIZE : 0;
+    }
+    for (size_t i = 0; i < DEFLATE_WSIZE; i++) {
+        z->prev[i] = z->prev[i] >= DEFLATE_WSIZE ? z->prev[i] - DEFLATE_WSIZE : 0;
+    }
+}
+
+// Compress more input. Returns 0, or -1 once the write callback has failed.
+int deflate_write(deflate_t *z, const void *data, size_t len) {
+    const unsigned char *p = data;
+    if (z->format == DEFLATE_GZIP) z->check = crc32_ieee(z->check, p, len);
+    else if (z->format == DEFLATE_ZLIB) z->check = adler32(z->check, p, len);
+    z->in_total += len;
+    while (len > 0 && !z->error) {
+        if (z->window_len == sizeof(z->window)) deflate_slide(z);
+        size_t n = sizeof(z->window) - z->window_len;
+        if (n > len) n = len;
+        memcpy(z->window + z->window_len, p, n);
+        z->window_len += n;
+        p += n;
+        len -= n;
+        deflate_compress(z, 0);
+    }
+    return z->error;
+}
+
+// Encode the rest, close the stream and flush it with the format's trailer
+int deflate_finish(deflate_t *z) {
+    deflate_compress(z, 1);
+    deflate_block(z, 1);
+    if (z->bit_count > 0) deflate_put(z, 0, 8 - z->bit_count);
+    if (z->format == DEFLATE_GZIP) {
+        for (int i = 0; i < 4; i++) deflate_byte(z, z->check >> (8 * i));
+        for (int i = 0; i < 4; i++) deflate_byte(z, (uint32_t)z->in_total >> (8 * i));
+    } else if (z->format == DEFLATE_ZLIB) {
+        for (int i = 3; i >= 0; i--) deflate_byte(z, z->check >> (8 * i));
+    }
+    deflate_flush_out(z);
+    return z->error;
+}
+
+// On-the-fly response compression
+// Bodies of at least COMPRESS_MIN bytes go out gzip- or zlib-framed per
+// Accept-Encoding, as a chunked stream: each buffer the encoder fills becomes
+// one chunk, so memory per connection is one deflate_t however big the body.
+static metric_counter_t compress_bytes_in;
+static metric_counter_t compress_bytes_out;
+
+// Content-Encoding to use for this request, NULL for identity
+const char* compress_negotiate(const char *request) {
+    char accept[256];
+    if (!http_header(request, "Accept-Encoding", accept, sizeof(accept))) return NULL;
+    if (accepts_encoding(accept, "gzip")) return "gzip";
+    if (accepts_encoding(accept, "deflate")) return "deflate";
+    return NULL;
+}
+
+// Send buf as one chunk of a chunked body; 0 or -1
+int send_chunk(int sock, const void *buf, size_t len) {
+    char size_line[32];
+    int size_len = snprintf(size_line, sizeof(size_line), "%zx\r\n", len);
+    if (client_send(sock, size_line, size_len) != size_len || client_send(sock, buf, len) != (ssize_t)len ||
+        client_send(sock, "\r\n", 2) != 2) return -1;
+    return 0;
+}
+
+// deflate_t write callback: one chunk of a chunked body
+static int chunk_sink_write(void *ctx, const unsigned char *buf, size_t len) {
+    if (send_chunk(*(int *)ctx, buf, len) != 0) return -1;
+    metric_counter_add(&compress_bytes_out, len);
+    return 0;
+}
+
+// deflate_t write callback that only counts, for trial compression
+static int count_sink_write(void *ctx, const unsigned char *buf, size_t len) {
+    (void)ctx;
+    (void)buf;
+    (void)len;
+    return 0;
+}
+
+// Start a compressed response: headers, then an encoder writing chunks to sock.
+// extra_headers is inserted as is ("" for none). NULL if out of memory.
+deflate_t* compress_begin(int sock, int *sock_ctx, int code, const char *coding, const char *content_type,
+                          const char *extra_headers) {
+    deflate_t *z = malloc(sizeof(deflate_t));
+    if (!z) return NULL;
+    char header[1024];
+    int header_len = snprintf(header, sizeof(header),
+        "HTTP/1.1 %d %s\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Encoding: %s\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "Vary: Accept-Encoding\r\n"
+        "%s"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Connection: close\r\n"
+        "\r\n",
+        code, http_status_text(code), content_type, coding, extra_headers);
+    note_response_status(code);
+    client_send(sock, header, header_len);
+    *sock_ctx = sock;
+    deflate_init(z, strcmp(coding, "gzip") == 0 ? DEFLATE_GZIP : DEFLATE_ZLIB, chunk_sink_write, sock_ctx);
+    return z;
+}
+
+// Finish the stream and the chunked body; returns the encoder's error state
+int compress_end(int sock, deflate_t *z) {
+    int err = deflate_finish(z);
+    if (!err) err = client_send(sock, "0\r\n\r\n", 5) == 5 ? 0 : -1;
+    metric_counter_add(&compress_bytes_in, z->in_total);
+    free(z);
+    return err;
+}
+
+// send_http_response, compressed when the client allows it and the body is
+// big enough to gain from it
+void send_compressible_response(int sock, const char *request, int code, const char *content_type,
+                                const char *body, size_t body_len) {
+    const char *coding = body_len >= COMPRESS_MIN ? compress_negotiate(request) : NULL;
+    int sock_ctx;
+    deflate_t *z = coding ? compress_begin(sock, &sock_ctx, code, coding, content_type, "") : NULL;
+    if (!z) {
+        send_http_response(sock, code, content_type, body, body_len);
+        return;
+    }
+    int nopush = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+    deflate_write(z, body, body_len);
+    compress_end(sock, z);
+    nopush = 0;
+    setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+}
+
+// Whether a download is worth compressing: a text-like extension, and the
+// first COMPRESS_SAMPLE bytes shrink below 90%. Everything else keeps sendfile.
+int compress_download_worthwhile(int fd, const char *path, const struct stat *st) {
+    static const char *text_exts[] = {
+        "txt", "log", "json", "xml", "csv", "tsv", "ini", "cfg", "conf", "md", "html", "htm", "css", "js",
+        "svg", "sh", "c", "h", "cpp", "py", "lua", "yml", "yaml", "toml", "sql", "srt", "plist"
+    };
+    if (st->st_size < COMPRESS_MIN) return 0;
+    const char *base = strrchr(path, '/');
+    const char *dot = strrchr(base ? base : path, '.');
+    int text = 0;
+    for (size_t i = 0; dot && i < sizeof(text_exts) / sizeof(text_exts[0]); i++) {
+        if (strcasecmp(dot + 1, text_exts[i]) == 0) text = 1;
+    }
+    if (!text) return 0;
+    
+    unsigned char *sample = malloc(COMPRESS_SAMPLE);
+    deflate_t *z = malloc(sizeof(deflate_t));
+    ssize_t n = sample && z ? pread_full(fd, sample, COMPRESS_SAMPLE, 0) : -1;
+    int worthwhile = 0;
+    if (n > 0) {
+        deflate_init(z, DEFLATE_RAW, count_sink_write, NULL);
+        deflate_write(z, sample, n);
+        deflate_finish(z);
+        worthwhile = z->out_total < (unsigned long long)n * 9 / 10;
+    }
+    free(sample);
+    free(z);
+    return worthwhile;
+}
+
+// Stream fd through the encoder as a chunked, Content-Encoding'd download.
+// validators holds the ETag/Last-Modified header lines.
+void send_file_compressed(int sock, int fd, const char *path, const struct stat *st, const char *coding,
+                          const char *validators) {
+    char extra[MAX_PATH + 256];
+    snprintf(extra, sizeof(extra), "Content-Disposition: attachment; filename=\"%s\"\r\n%s",
+             strrchr(path, '/') ? strrchr(path, '/') + 1 : path, validators);
+    char *buffer = malloc(COMPRESS_READ);
+    int sock_ctx;
+    deflate_t *z = buffer ? compress_begin(sock, &sock_ctx, 200, coding, "application/octet-stream", extra) : NULL;
+    if (!z || request_is_head()) {
+        free(z);
+        free(buffer);
+        if (z) return;
+        const char *error_msg = "{\"error\":\"Memory error\"}";
+        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    
+    int transfer = transfer_begin(TRANSFER_DOWNLOAD, path, st->st_size);
+    unsigned long long sent_total = 0;
+    ssize_t n;
+    while ((n = read(fd, buffer, COMPRESS_READ)) > 0) {
+        if (deflate_write(z, buffer, n) != 0) break;
+        sent_total += n;
+        transfer_progress(transfer, n);
+    }
+    if (n == 0) compress_end(sock, z);
+    else free(z);
+    free(buffer);
+    transfer_end(transfer);
+    metric_counter_add(&total_files_transferred, 1);
+    metric_counter_add(&total_bytes_transferred, sent_total);
+}
+
+// Archives as virtual directories
+// A path that runs through a .zip or .tar file ("/data/x.zip/dir/file") is
+// served from the archive. Zip members come from the central directory, found
+// by reading the end of the file (zip64 included); tar members from a scan of
+// the 512-byte headers. Either way the member table is built once per
+// (dev, ino, size, mtime) and kept in a small LRU of parsed indexes.
+#define ARCHIVE_ZIP 1
+#define ARCHIVE_TAR 2
+
+typedef struct {
+    char *name;                     // path inside the archive, no leading or trailing '/'
+    unsigned long long offset;      // zip: local header, tar: member data
+    unsigned long long size;        // uncompressed bytes
+    unsigned long long csize;       // zip: compressed bytes
+    long mtime;
+    uint32_t crc32;                 // zip: CRC-32 of the uncompressed data
+    uint16_t method;                // zip: 0 stored, 8 deflated
+    uint16_t flags;                 // zip: general purpose flags
+    uint8_t is_dir;
+} archive_member_t;
+
+typedef struct {
+    unsigned long long dev, ino, size;
+    long long mtime_sec;
+    long mtime_nsec;
+    int type;
+    archive_member_t *members;      // sorted by name
+    int count;
+    char *names;                    // storage for member names
+    int refs;                       // guarded by archive_lock
+    int cached;
+    unsigned long long last_used;
+} archive_index_t;
+
+static archive_index_t *archive_cache[ARCHIVE_CACHE_SLOTS];
+static unsigned long long archive_clock;
+static pthread_mutex_t archive_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+    archive_member_t *members;
+    int count, cap;
+    char *names;
+    size_t names_len, names_cap;
+} archive_builder_t;
+
+static int archive_type_of(const char *name, size_t len) {
+    if (len > 4 && strncasecmp(name + len - 4, ".zip", 4) == 0) return ARCHIVE_ZIP;
+    if (len > 4 && strncasecmp(name + len - 4, ".tar", 4) == 0) return ARCHIVE_TAR;
+    return 0;
+}
+
+// Split "/dir/a.zip/inner/path" into the archive file and the inner path
+// (without surrounding slashes). Returns the archive type, or 0.
+int archive_split(const char *path, char *archive, char *inner) {
+    size_t len = strlen(path);
+    for (size_t i = 1; i <= len; i++) {
+        if (path[i] != '/' && path[i] != '\0') continue;
+        if (!archive_type_of(path, i) || i >= MAX_PATH) continue;
+        memcpy(archive, path, i);
+        archive[i] = '\0';
+        struct stat st;
+        if (stat(archive, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        const char *rest = path + i;
+        while (*rest == '/') rest++;
+        snprintf(inner, MAX_PATH, "%s", rest);
+        size_t inner_len = strlen(inner);
+        while (inner_len > 0 && inner[inner_len - 1] == '/') inner[--inner_len] = '\0';
+        return archive_type_of(path, i);
+    }
+    return 0;
+}
+
+static int archive_add(archive_builder_t *b, const char *name, size_t name_len, int is_dir,
+                       unsigned long long offset, unsigned long long size, unsigned long long csize,
+                       long mtime, int method, int flags, uint32_t crc) {
+    // Normalize: no "./" or "/" prefix, forward slashes, no trailing '/'
+    while (name_len > 0 && (name[name_len - 1] == '/' || name[name_len - 1] == '\\')) {
+        name_len--;
+        is_dir = 1;
+    }
+    while (name_len > 0) {
+        if (name[0] == '/') {
+            name++;
+            name_len--;
+        } else if (name_len > 1 && name[0] == '.' && name[1] == '/') {
+            name += 2;
+            name_len -= 2;
+        } else {
+            break;
+        }
+    }
+    if (name_len == 0 || name_len >= MAX_PATH || (name_len == 1 && name[0] == '.')) return 0;
+    if (b->count == b->cap) {
+        int cap = b->cap ? b->cap * 2 : 256;
+        archive_member_t *m = realloc(b->members, cap * sizeof(archive_member_t));
+        if (!m) return -1;
+        b->members = m;
+        b->cap = cap;
+    }
+    if (b->names_len + name_len + 1 > b->names_cap) {
+        size_t cap = b->names_cap ? b->names_cap * 2 : 16384;
+        while (cap < b->names_len + name_len + 1) cap *= 2;
+        char *n = realloc(b->names, cap);
+        if (!n) return -1;
+        b->names = n;
+        b->names_cap = cap;
+    }
+    char *dst = b->names + b->names_len;
+    for (size_t i = 0; i < name_len; i++) dst[i] = name[i] == '\\' ? '/' : name[i];
+    dst[name_len] = '\0';
+    archive_member_t *m = &b->members[b->count++];
+    m->name = (char *)(uintptr_t)b->names_len;     // turned into a pointer once names stops moving
+    m->offset = offset;
+    m->size = size;
+    m->csize = csize;
+    m->mtime = mtime;
+    m->crc32 = crc;
+    m->method = method;
+    m->flags = flags;
+    m->is_dir = is_dir;
+    b->names_len += name_len + 1;
+    return 0;
+}
+
+static uint16_t le16(const unsigned char *p) { return p[0] | p[1] << 8; }
+static uint32_t le32(const unsigned char *p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24; }
+static uint64_t le64(const unsigned char *p) { return le32(p) | (uint64_t)le32(p + 4) << 32; }
+
+// Seconds since the epoch for a civil date (proleptic Gregorian, UTC)
+static long days_from_civil(int y, int m, int d) {
+    y -= m <= 2;
+    long era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static long dos_time_to_epoch(uint16_t date, uint16_t time) {
+    int month = (date >> 5) & 15, day = date & 31;
+    if (month < 1 || month > 12 || day < 1) return 0;
+    return days_from_civil((date >> 9) + 1980, month, day) * 86400 +
+           (time >> 11) * 3600 + ((time >> 5) & 63) * 60 + (time & 31) * 2;
+}
+
+static int zip_index(int fd, unsigned long long size, archive_builder_t *b) {
+    // End of central directory: 22 bytes plus up to 64KB of comment
+    size_t tail = size < 65535 + 22 ? size : 65535 + 22;
+    unsigned char *buf = malloc(tail);
+    if (!buf || pread_full(fd, buf, tail, size - tail) != (ssize_t)tail) {
+        free(buf);
+        return EIO;
+    }
+    ssize_t eocd = -1;
+    for (ssize_t i = (ssize_t)tail - 22; i >= 0; i--) {
+        if (le32(buf + i) == 0x06054b50) {
+            eocd = i;
+            break;
+        }
+    }
+    if (eocd < 0) {
+        free(buf);
+        return EINVAL;
+    }
+    unsigned long long entries = le16(buf + eocd + 10);
+    unsigned long long cd_size = le32(buf + eocd + 12);
+    unsigned long long cd_offset = le32(buf + eocd + 16);
+    if (entries == 0xFFFF || cd_size == 0xFFFFFFFF || cd_offset == 0xFFFFFFFF) {
+        // zip64: the locator sits just before the classic record
+        unsigned char rec[56];
+        if (eocd < 20 || le32(buf + eocd - 20) != 0x07064b50 ||
+            pread_full(fd, rec, sizeof(rec), le64(buf + eocd - 20 + 8)) != sizeof(rec) || le32(rec) != 0x06064b50) {
+            free(buf);
+            return EINVAL;
+        }
+        entries = le64(rec + 32);
+        cd_size = le64(rec + 40);
+        cd_offset = le64(rec + 48);
+    }
+    free(buf);
+    if (cd_size > ARCHIVE_CD_MAX || cd_offset + cd_size > size) return EINVAL;
+    
+    unsigned char *cd = malloc(cd_size ? cd_size : 1);
+    if (!cd) return ENOMEM;
+    if (pread_full(fd, cd, cd_size, cd_offset) != (ssize_t)cd_size) {
+        free(cd);
+        return EIO;
+    }
+    int err = 0;
+    size_t pos = 0;
+    for (unsigned long long i = 0; i < entries && !err; i++) {
+        if (pos + 46 > cd_size || le32(cd + pos) != 0x02014b50) {
+            err = EINVAL;
+            break;
+        }
+        const unsigned char *e = cd + pos;
+        size_t name_len = le16(e + 28), extra_len = le16(e + 30), comment_len = le16(e + 32);
+        if (pos + 46 + name_len + extra_len + comment_len > cd_size) {
+            err = EINVAL;
+            break;
+        }
+        unsigned long long csize = le32(e + 20), usize = le32(e + 24), offset = le32(e + 42);
+        // zip64 extra field carries whichever of these overflowed, in this order
+        const unsigned char *x = e + 46 + name_len, *x_end = x + extra_len;
+        while (x + 4 <= x_end) {
+            size_t field_len = le16(x + 2);
+            if (le16(x) == 0x0001) {
+                const unsigned char *v = x + 4, *v_end = v + field_len;
+                if (usize == 0xFFFFFFFF && v + 8 <= v_end) { usize = le64(v); v += 8; }
+                if (csize == 0xFFFFFFFF && v + 8 <= v_end) { csize = le64(v); v += 8; }
+                if (offset == 0xFFFFFFFF && v + 8 <= v_end) { offset = le64(v); v += 8; }
+            }
+            x += 4 + field_len;
+        }
+        const char *name = (const char *)e + 46;
+        int is_dir = name_len > 0 && name[name_len - 1] == '/';
+        if (archive_add(b, name, name_len, is_dir, offset, usize, csize,
+                        dos_time_to_epoch(le16(e + 14), le16(e + 12)), le16(e + 10), le16(e + 8),
+                        le32(e + 16)) != 0) {
+            err = ENOMEM;
+        }
+        pos += 46 + name_len + extra_len + comment_len;
+    }
+    free(cd);
+    return err;
+}
+
+// Tar numeric field: octal text, or base-256 when the high bit is set
+static unsigned long long tar_number(const unsigned char *p, size_t len) {
+    unsigned long long v = 0;
+    if (p[0] & 0x80) {
+        v = p[0] & 0x7F;
+        for (size_t i = 1; i < len; i++) v = v << 8 | p[i];
+        return v;
+    }
+    size_t i = 0;
+    while (i < len && (p[i] == ' ' || p[i] == '\0')) i++;
+    for (; i < len && p[i] >= '0' && p[i] <= '7'; i++) v = v * 8 + (p[i] - '0');
+    return v;
+}
+
+// Header checksum: all bytes summed with the checksum field read as spaces
+static int tar_header_valid(const unsigned char *h) {
+    unsigned long sum = 0;
+    for (int i = 0; i < 512; i++) sum += (i >= 148 && i < 156) ? ' ' : h[i];
+    return sum == tar_number(h + 148, 8);
+}
+
+// Apply a GNU long name ('L') or pax extended header ('x') to the member that follows
+static void tar_apply_ext(char type, char *ext, size_t n, char *long_name, size_t name_cap,
+                          unsigned long long *pax_size, int *has_pax_size) {
+    ext[n] = '\0';
+    if (type == 'L') {
+        snprintf(long_name, name_cap, "%s", ext);
+        return;
+    }
+    // Records are "<len> key=value\n"
+    for (char *rec = ext; rec < ext + n; ) {
+        char *end;
+        unsigned long rec_len = strtoul(rec, &end, 10);
+        if (rec_len == 0 || rec + rec_len > ext + n || *end != ' ') break;
+        char *key = end + 1, *eq = memchr(key, '=', rec + rec_len - key);
+        if (eq) {
+            size_t value_len = rec + rec_len - 1 - (eq + 1);
+            if (eq - key == 4 && strncmp(key, "path", 4) == 0 && value_len < name_cap) {
+                memcpy(long_name, eq + 1, value_len);
+                long_name[value_len] = '\0';
+            } else if (eq - key == 4 && strncmp(key, "size", 4) == 0) {
+                *pax_size = strtoull(eq + 1, NULL, 10);
+                *has_pax_size = 1;
+            }
+        }
+        rec += rec_len;
+    }
+}
+
+// Member name: the long name if one preceded the header, else ustar prefix + name
+static void tar_member_name(const unsigned char *h, const char *long_name, char *name, size_t name_cap) {
+    if (long_name[0]) {
+        snprintf(name, name_cap, "%s", long_name);
+    } else if (memcmp(h + 257, "ustar", 5) == 0 && h[345]) {
+        snprintf(name, name_cap, "%.155s/%.100s", (const char *)h + 345, (const char *)h);
+    } else {
+        snprintf(name, name_cap, "%.100s", (const char *)h);
+    }
+}
+
+static int tar_index(int fd, unsigned long long size, archive_builder_t *b) {
+    unsigned char h[512];
+    char long_name[MAX_PATH] = "";
+    unsigned long long pax_size = 0;
+    int has_pax_size = 0;
+    unsigned long long offset = 0;
+    while (offset + 512 <= size) {
+        if (pread_full(fd, h, 512, offset) != 512) return EIO;
+        int zero = 1;
+        for (int i = 0; i < 512 && zero; i++) zero = h[i] == 0;
+        if (zero) break;
+        if (!tar_header_valid(h)) return b->count ? 0 : EINVAL;
+        
+        unsigned long long member_size = has_pax_size ? pax_size : tar_number(h + 124, 12);
+        unsigned long long data = offset + 512;
+        unsigned long long next = data + ((member_size + 511) & ~511ULL);
+        char type = h[156];
+        if (type == 'L' || type == 'x') {
+            // GNU long name, or pax extended header for the next member
+            size_t n = member_size < 65536 ? member_size : 65536;
+            char *ext = malloc(n + 1);
+            if (!ext || pread_full(fd, ext, n, data) != (ssize_t)n) {
+                free(ext);
+                return EIO;
+            }
+            tar_apply_ext(type, ext, n, long_name, sizeof(long_name), &pax_size, &has_pax_size);
+            free(ext);
+            offset = next;
+            continue;
+        }
+        if (type == '0' || type == '\0' || type == '7' || type == '5') {
+            char name[MAX_PATH];
+            tar_member_name(h, long_name, name, sizeof(name));
+            if (archive_add(b, name, strlen(name), type == '5', data, type == '5' ? 0 : member_size,
+                            member_size, (long)tar_number(h + 136, 12), 0, 0, 0) != 0) {
+                return ENOMEM;
+            }
+        }
+        long_name[0] = '\0';
+        has_pax_size = 0;
+        offset = next;
+    }
+    return 0;
+}
+
+static int archive_cmp_name(const void *a, const void *b) {
+    return strcmp(((const archive_member_t *)a)->name, ((const archive_member_t *)b)->name);
+}
+
+static void archive_free(archive_index_t *idx) {
+    free(idx->members);
+    free(idx->names);
+    free(idx);
+}
+
+// Parsed index of an archive, from the cache when the file is unchanged.
+// Release with archive_release(). NULL on failure with *err set.
+archive_index_t* archive_open(const char *path, int type, int *err) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        *err = errno;
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    pthread_mutex_lock(&archive_lock);
+    for (int i = 0; i < ARCHIVE_CACHE_SLOTS; i++) {
+        archive_index_t *idx = archive_cache[i];
+        if (idx && idx->ino == (unsigned long long)st.st_ino && idx->dev == (unsigned long long)st.st_dev &&
+            idx->size == (unsigned long long)st.st_size && idx->mtime_sec == (long long)st.st_mtim.tv_sec &&
+            idx->mtime_nsec == st.st_mtim.tv_nsec) {
+            idx->refs++;
+            idx->last_used = ++archive_clock;
+            pthread_mutex_unlock(&archive_lock);
+            close(fd);
+            return idx;
+        }
+    }
+    pthread_mutex_unlock(&archive_lock);
+    
+    archive_builder_t b;
+    memset(&b, 0, sizeof(b));
+    *err = type == ARCHIVE_ZIP ? zip_index(fd, st.st_size, &b) : tar_index(fd, st.st_size, &b);
+    close(fd);
+    archive_index_t *idx = *err ? NULL : calloc(1, sizeof(archive_index_t));
+    if (!idx) {
+        if (!*err) *err = ENOMEM;
+        free(b.members);
+        free(b.names);
+        return NULL;
+    }
+    for (int i = 0; i < b.count; i++) b.members[i].name = b.names + (uintptr_t)b.members[i].name;
+    qsort(b.members, b.count, sizeof(archive_member_t), archive_cmp_name);
+    idx->dev = st.st_dev;
+    idx->ino = st.st_ino;
+    idx->size = st.st_size;
+    idx->mtime_sec = st.st_mtim.tv_sec;
+    idx->mtime_nsec = st.st_mtim.tv_nsec;
+    idx->type = type;
+    idx->members = b.members;
+    idx->count = b.count;
+    idx->names = b.names;
+    idx->refs = 1;
+    
+    // Take the least recently used idle slot; if every slot is busy, don't cache
+    pthread_mutex_lock(&archive_lock);
+    int victim = -1;
+    for (int i = 0; i < ARCHIVE_CACHE_SLOTS; i++) {
+        archive_index_t *old = archive_cache[i];
+        if (!old) {
+            victim = i;
+            break;
+        }
+        if (old->refs == 0 && (victim < 0 || old->last_used < archive_cache[victim]->last_used)) victim = i;
+    }
+    if (victim >= 0) {
+        if (archive_cache[victim]) archive_free(archive_cache[victim]);
+        archive_cache[victim] = idx;
+        idx->cached = 1;
+        idx->last_used = ++archive_clock;
+    }
+    pthread_mutex_unlock(&archive_lock);
+    return idx;
+}
+
+void archive_release(archive_index_t *idx) {
+    pthread_mutex_lock(&archive_lock);
+    int drop = --idx->refs == 0 && !idx->cached;
+    pthread_mutex_unlock(&archive_lock);
+    if (drop) archive_free(idx);
+}
+
+static archive_member_t* archive_find(archive_index_t *idx, const char *name) {
+    archive_member_t key;
+    key.name = (char *)name;
+    return bsearch(&key, idx->members, idx->count, sizeof(archive_member_t), archive_cmp_name);
+}
+
+static int file_entry_cmp_name(const void *a, const void *b) {
+    return strcmp(((const file_entry_t *)a)->name, ((const file_entry_t *)b)->name);
+}
+
+// First member whose name sorts at or after key
+static int archive_lower_bound(const archive_index_t *idx, const char *key) {
+    int lo = 0, hi = idx->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strcmp(idx->members[mid].name, key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// List one directory level inside an archive, in the /api/list format.
+// Directories that only exist as prefixes of member names are listed too.
+// Members are sorted by name, so the directory's contents are one contiguous
+// range and each subdirectory's contents are skipped with another search.
+void handle_list_archive(int sock, const char *path, const char *archive, int type, const char *inner,
+                         const char *request) {
+    int err;
+    archive_index_t *idx = archive_open(archive, type, &err);
+    if (!idx) {
+        char error_msg[256];
+        snprintf(error_msg, sizeof(error_msg), "{\"error\":\"Cannot read archive: %s\"}",
+                 err == EINVAL ? "unrecognized format" : strerror(err));
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    size_t prefix_len = strlen(inner);
+    archive_member_t *self = prefix_len ? archive_find(idx, inner) : NULL;
+    if (self && !self->is_dir) {
+        archive_release(idx);
+        const char *error_msg = "{\"error\":\"Not a directory\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    
+    // key holds "inner/" to find the range, then "inner/child0" ('0' follows '/')
+    // to find the first member past a subdirectory
+    char key[MAX_PATH + 2];
+    int i = 0;
+    if (prefix_len) {
+        if (prefix_len + 1 >= sizeof(key)) i = idx->count;
+        else {
+            memcpy(key, inner, prefix_len);
+            key[prefix_len] = '/';
+            key[prefix_len + 1] = '\0';
+            i = archive_lower_bound(idx, key);
+        }
+    }
+    
+    int count = 0, cap = 64, matched = self != NULL;
+    file_entry_t *entries = malloc(cap * sizeof(file_entry_t));
+    while (i < idx->count && entries) {
+        const archive_member_t *m = &idx->members[i];
+        if (prefix_len && (strncmp(m->name, inner, prefix_len) != 0 || m->name[prefix_len] != '/')) break;
+        matched = 1;
+        const char *child = m->name + (prefix_len ? prefix_len + 1 : 0);
+        size_t child_len = strcspn(child, "/");
+        size_t end = child - m->name + child_len;
+        int next = i + 1;
+        if (child[child_len] == '/' && end + 1 < sizeof(key)) {
+            memcpy(key, m->name, end);
+            key[end] = '0';
+            key[end + 1] = '\0';
+            next = archive_lower_bound(idx, key);
+        }
+        i = next;
+        if (child_len == 0 || child_len >= sizeof(entries[0].name)) continue;
+        if (count == cap) {
+            file_entry_t *grown = realloc(entries, cap * 2 * sizeof(file_entry_t));
+            if (!grown) break;
+            entries = grown;
+            cap *= 2;
+        }
+        file_entry_t *e = &entries[count++];
+        memcpy(e->name, child, child_len);
+        e->name[child_len] = '\0';
+        e->is_dir = m->is_dir || child[child_len] == '/';
+        e->size = e->is_dir ? 0 : m->size;
+        e->mtime = m->mtime;
+    }
+    archive_release(idx);
+    if (!entries) {
+        const char *error_msg = "{\"error\":\"Memory error\"}";
+        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    if (!matched) {
+        free(entries);
+        const char *error_msg = "{\"error\":\"Directory not found\"}";
+        send_http_response(sock, 404, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    
+    // Collapse the entries that implicit directories produced, then sort as /api/list does
+    qsort(entries, count, sizeof(file_entry_t), file_entry_cmp_name);
+    int unique = 0;
+    for (int i = 0; i < count; i++) {
+        if (unique && strcmp(entries[unique - 1].name, entries[i].name) == 0) {
+            entries[unique - 1].is_dir |= entries[i].is_dir;
+            continue;
+        }
+        entries[unique++] = entries[i];
+    }
+    qsort(entries, unique, sizeof(file_entry_t), compare_entries);
+    
+    size_t json_cap = (size_t)unique * (sizeof(entries[0].name) * 2 + 96) + MAX_PATH * 2 + 64;
+    char *json = malloc(json_cap);
+    if (!json) {
+        free(entries);
+        const char *error_msg = "{\"error\":\"Memory error\"}";
+        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    char escaped[MAX_PATH * 2];
+    json_escape(escaped, sizeof(escaped), path);
+    int pos = snprintf(json, json_cap, "{\"path\":\"%s\",\"archive\":\"%s\",\"files\":[", escaped,
+                       type == ARCHIVE_ZIP ? "zip" : "tar");
+    for (int i = 0; i < unique; i++) {
+        json_escape(escaped, sizeof(escaped), entries[i].name);
+        pos += snprintf(json + pos, json_cap - pos, "%s{\"name\":\"%s\",\"type\":\"%s\",\"size\":%lld,\"mtime\":%ld}",
+                        i ? "," : "", escaped, entries[i].is_dir ? "dir" : "file", entries[i].size, entries[i].mtime);
+    }
+    pos += snprintf(json + pos, json_cap - pos, "]}");
+    send_compressible_response(sock, request, 200, "application/json", json, pos);
+    free(json);
+    free(entries);
+}
+
+// Compressed input for a deflated member: the member's bytes, read with pread.
+// The latest inflated piece is held back until the CRC-32 has been checked.
+typedef struct {
+    int fd;
+    unsigned long long pos, end;
+    int sock;
+    int transfer;
+    unsigned long long sent;
+    uint32_t crc;
+    unsigned char *held;            // INFLATE_WINDOW bytes
+    size_t held_len;
+} archive_stream_t;
+
+static metric_counter_t archive_crc_failures;
+
+static ssize_t archive_stream_read(void *ctx, unsigned char *buf, size_t len) {
+    archive_stream_t *s = (archive_stream_t *)ctx;
+    if (len > s->end - s->pos) len = s->end - s->pos;
+    if (len == 0) return 0;
+    ssize_t n = pread(s->fd, buf, len, s->pos);
+    if (n > 0) s->pos += n;
+    return n;
+}
+
+static int archive_stream_send(archive_stream_t *s) {
+    if (s->held_len == 0) return 0;
+    ssize_t n = client_send(s->sock, s->held, s->held_len);
+    if (n > 0) {
+        s->sent += n;
+        transfer_progress(s->transfer, n);
+    }
+    return n == (ssize_t)s->held_len ? 0 : -1;
+}
+
+static int archive_stream_write(void *ctx, const unsigned char *buf, size_t len) {
+    archive_stream_t *s = (archive_stream_t *)ctx;
+    s->crc = crc32_ieee(s->crc, buf, len);
+    if (archive_stream_send(s) != 0) return -1;
+    memcpy(s->held, buf, len);
+    s->held_len = len;
+    return 0;
+}
+
+// Download one archive member. Stored zip entries and tar members go out with
+// sendfile straight from the archive; deflated zip entries are inflated on the fly.
+void handle_download_archive_member(int sock, const char *path, const char *archive, int type, const char *inner) {
+    int err;
+    archive_index_t *idx = archive_open(archive, type, &err);
+    archive_member_t *found = idx ? archive_find(idx, inner) : NULL;
+    if (!found || found->is_dir) {
+        if (idx) archive_release(idx);
+        send_http_response(sock, 404, "text/plain", "File not found", 14);
+        return;
+    }
+    archive_member_t m = *found;
+    archive_release(idx);
+    
+    const char *error_msg = NULL;
+    unsigned long long data = m.offset;
+    int fd = open(archive, O_RDONLY);
+    if (fd < 0) {
+        send_http_response(sock, 404, "text/plain", "File not found", 14);
+        return;
+    }
+    if (type == ARCHIVE_ZIP) {
+        unsigned char local[30];
+        if (m.flags & 1) {
+            error_msg = "{\"error\":\"Encrypted zip entries are not supported\"}";
+        } else if (m.method != 0 && m.method != 8) {
+            error_msg = "{\"error\":\"Unsupported compression method\"}";
+        } else if (pread_full(fd, local, sizeof(local), m.offset) != sizeof(local) || le32(local) != 0x04034b50) {
+            error_msg = "{\"error\":\"Corrupt zip entry\"}";
+        } else {
+            data = m.offset + 30 + le16(local + 26) + le16(local + 28);
+        }
+    }
+    if (error_msg) {
+        close(fd);
+        send_http_response(sock, 415, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    
+    int nopush = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+    char header[1024];
+    int header_len = snprintf(header, sizeof(header),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/octet-stream\r\n"
+        "Content-Disposition: attachment; filename=\"%s\"\r\n"
+        "Connection: close\r\n"
+        "Content-Length: %llu\r\n\r\n",
+        strrchr(path, '/') ? strrchr(path, '/') + 1 : path, m.size);
+    note_response_status(200);
+    client_send(sock, header, header_len);
+    
+    int transfer = transfer_begin(TRANSFER_DOWNLOAD, path, m.size);
+    unsigned long long bytes_sent = 0;
+    if (type == ARCHIVE_TAR || m.method == 0) {
+        bytes_sent = send_file_range(sock, fd, data, m.size, transfer);
+    } else {
+        // A member that fails its CRC (or inflates to the wrong size) loses its
+        // last piece, so the client sees a body short of Content-Length
+        inflate_t *z = malloc(sizeof(inflate_t));
+        archive_stream_t s = { fd, data, data + m.csize, sock, transfer, 0, 0, malloc(INFLATE_WINDOW), 0 };
+        if (z && s.held) {
+            inflate_init(z, archive_stream_read, archive_stream_write, &s);
+            int rc = inflate_run(z);
+            if (rc == 0 && s.crc == m.crc32 && s.sent + s.held_len == m.size) {
+                archive_stream_send(&s);
+            } else if (rc != INFLATE_EIO) {
+                metric_counter_add(&archive_crc_failures, 1);
+            }
+        }
+        free(z);
+        free(s.held);
+        bytes_sent = s.sent;
+    }
+    nopush = 0;
+    setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+    close(fd);
+    transfer_end(transfer);
+    metric_counter_add(&total_files_transferred, 1);
+    metric_counter_add(&total_bytes_transferred, bytes_sent);
+}
+
+// Download file
+// A digest already in the hash cache goes out as a Content-Digest header and
+// the body stays on sendfile. Otherwise clients that send "TE: trailers" get a
+// chunked body with CRC32C computed over the bytes as they are sent and
+// delivered as a Content-Digest trailer (and cached for next time).
+// IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT") for Last-Modified
+void http_date_format(char *out, size_t out_len, time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(out, out_len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// Seconds since the epoch for an IMF-fixdate, -1 if it isn't one
+long long http_date_parse(const char *s) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month[4];
+    int day, year, hour, min, sec;
+    if (sscanf(s, "%*3s, %d %3s %d %d:%d:%d GMT", &day, month, &year, &hour, &min, &sec) != 6) return -1;
+    const char *m = strstr(months, month);
+    if (strlen(month) != 3 || !m || (m - months) % 3 != 0) return -1;
+    return (long long)days_from_civil(year, (m - months) / 3 + 1, day) * 86400 + hour * 3600 + min * 60 + sec;
+}
+
+// Strong validator for a file: inode, size and mtime (ns), plus the coding
+// for a compressed representation
+void file_etag(char *out, size_t out_len, const struct stat *st, const char *coding) {
+    snprintf(out, out_len, "\"%llx-%llx-%llx%s%s\"", (unsigned long long)st->st_ino, (unsigned long long)st->st_size,
+             (unsigned long long)st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec,
+             coding ? "-" : "", coding ? coding : "");
+}
+
+// If-None-Match, or failing that If-Modified-Since, says the client's copy is current
+int download_not_modified(const char *request, const char *etag, time_t mtime) {
+    char value[512];
+    if (http_header(request, "If-None-Match", value, sizeof(value))) return etag_list_matches(value, etag);
+    if (http_header(request, "If-Modified-Since", value, sizeof(value))) {
+        long long since = http_date_parse(value);
+        return since >= 0 && (long long)mtime <= since;
+    }
+    return 0;
+}
+
+// Hot-file cache
+// Repeated downloads of the same small files (cover art, configs) skip the
+// open/fstat/close and header formatting: an entry keeps the open fd, its
+// stat data and the rendered 200 and 304 headers, and files of up to
+// hot_file_mem_max bytes are also read into one buffer right after their
+// header, so a hit is a stat() to revalidate plus a single send(). The copy
+// is private rather than a mapping, so a file truncated underneath can't
+// fault the sender. Entries are pinned while in use and replaced LRU;
+// handlers that change files drop them with hot_file_invalidate(), which
+// also closes fds that would keep deleted files' space allocated. Requests
+// needing compression or a CRC trailer take the regular download path.
+typedef struct {
+    char *path;
+    uint64_t path_hash;
+    int fd;
+    struct stat st;
+    char etag[96];
+    char *header;                   // 200 header, followed by the body when held in memory
+    size_t header_len;
+    int in_memory;
+    char *not_modified;             // 304 header
+    size_t not_modified_len;
+    int has_digest;                 // header carries Content-Digest
+    int compressible;               // compress_download_worthwhile() said yes
+    int dead;                       // invalidated while pinned; freed on release
+    int refs;
+    unsigned long long last_used;   // 0 marks a free slot
+} hot_file_t;
+
+static hot_file_t hot_files[HOT_FILE_SLOTS];
+static unsigned long long hot_file_clock;
+static pthread_mutex_t hot_file_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t hot_file_mem_max = HOT_FILE_MEM_DEFAULT;
+static metric_counter_t hot_file_hits;
+static metric_counter_t hot_file_loads;
+
+static int hot_file_current(const hot_file_t *e, const struct stat *st) {
+    return e->st.st_ino == st->st_ino && e->st.st_dev == st->st_dev && e->st.st_size == st->st_size &&
+           e->st.st_mtim.tv_sec == st->st_mtim.tv_sec && e->st.st_mtim.tv_nsec == st->st_mtim.tv_nsec &&
+           e->st.st_ctim.tv_sec == st->st_ctim.tv_sec && e->st.st_ctim.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+static void hot_file_free(hot_file_t *e) {
+    close(e->fd);
+    free(e->path);
+    free(e->header);
+    free(e->not_modified);
+    memset(e, 0, sizeof(*e));
+}
+
+// Caller holds hot_file_lock
+static void hot_file_drop_locked(hot_file_t *e) {
+    if (e->refs) e->dead = 1;
+    else hot_file_free(e);
+}
+
+static void hot_file_release(hot_file_t *e) {
+    pthread_mutex_lock(&hot_file_lock);
+    if (--e->refs == 0 && e->dead) hot_file_free(e);
+    pthread_mutex_unlock(&hot_file_lock);
+}
+
+// Forget path and everything below it
+void hot_file_invalidate(const char *path) {
+    size_t len = strlen(path);
+    pthread_mutex_lock(&hot_file_lock);
+    for (int i = 0; i < HOT_FILE_SLOTS; i++) {
+        hot_file_t *e = &hot_files[i];
+        if (e->last_used && !e->dead && strncmp(e->path, path, len) == 0 && (e->path[len] == '\0' || e->path[len] == '/')) {
+            hot_file_drop_locked(e);
+        }
+    }
+    pthread_mutex_unlock(&hot_file_lock);
+}
+
+// Open path into e and render its headers; 0 or -1
+static int hot_file_load(hot_file_t *e, const char *path, uint64_t path_hash) {
+    memset(e, 0, sizeof(*e));
+    e->fd = open(path, O_RDONLY);
+    if (e->fd < 0) return -1;
+    if (fstat(e->fd, &e->st) != 0 || !S_ISREG(e->st.st_mode) || !(e->path = strdup(path))) {
+        hot_file_free(e);
+        return -1;
+    }
+    e->path_hash = path_hash;
+    e->compressible = compress_download_worthwhile(e->fd, path, &e->st);
+    char digest[160], last_modified[64], header[1024];
+    format_content_digest(digest, sizeof(digest), &e->st);
+    e->has_digest = digest[0] != '\0';
+    file_etag(e->etag, sizeof(e->etag), &e->st, NULL);
+    http_date_format(last_modified, sizeof(last_modified), e->st.st_mtime);
+    
+    // Same headers handle_download_file sends
+    int n = snprintf(header, sizeof(header),
+        "HTTP/1.1 304 Not Modified\r\n"
+        "ETag: %s\r\nLast-Modified: %s\r\n"
+        "Connection: close\r\n"
+        "\r\n",
+        e->etag, last_modified);
+    e->not_modified = malloc(n);
+    if (e->not_modified) memcpy(e->not_modified, header, n);
+    e->not_modified_len = n;
+    n = snprintf(header, sizeof(header),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/octet-stream\r\n"
+        "Content-Disposition: attachment; filename=\"%s\"\r\n"
+        "ETag: %s\r\nLast-Modified: %s\r\n"
+        "Connection: close\r\n"
+        "Content-Length: %lld\r\n%s%s%s\r\n",
+        strrchr(path, '/') ? strrchr(path, '/') + 1 : path, e->etag, last_modified, (long long)e->st.st_size,
+        digest[0] ? "Content-Digest: " : "", digest, digest[0] ? "\r\n" : "");
+    if ((size_t)n >= sizeof(header)) n = sizeof(header) - 1;
+    e->header_len = n;
+    e->in_memory = (unsigned long long)e->st.st_size <= hot_file_mem_max;
+    e->header = malloc(n + (e->in_memory ? e->st.st_size : 0));
+    if (e->header && e->in_memory && pread_full(e->fd, e->header + n, e->st.st_size, 0) != e->st.st_size) {
+        e->in_memory = 0;
+    }
+    if (!e->header || !e->not_modified) {
+        hot_file_free(e);
+        return -1;
+    }
+    memcpy(e->header, header, n);
+    return 0;
+}
+
+// Pinned, current entry for path, loading it on a miss; NULL if path isn't a
+// regular file or every slot is pinned
+static hot_file_t* hot_file_acquire(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        hot_file_invalidate(path);
+        return NULL;
+    }
+    uint64_t path_hash = xxh64(path, strlen(path), 0);
+    hot_file_t *victim = NULL;
+    pthread_mutex_lock(&hot_file_lock);
+    for (int i = 0; i < HOT_FILE_SLOTS; i++) {
+        hot_file_t *e = &hot_files[i];
+        if (e->last_used && !e->dead && e->path_hash == path_hash && strcmp(e->path, path) == 0) {
+            if (hot_file_current(e, &st)) {
+                e->refs++;
+                e->last_used = ++hot_file_clock;
+                pthread_mutex_unlock(&hot_file_lock);
+                metric_counter_add(&hot_file_hits, 1);
+                return e;
+            }
+            hot_file_drop_locked(e);
+        }
+        if (e->refs == 0 && (!victim || e->last_used < victim->last_used)) victim = e;
+    }
+    pthread_mutex_unlock(&hot_file_lock);
+    if (!victim) return NULL;
+    
+    // Load outside the lock, then claim a slot (the victim may have been taken meanwhile)
+    hot_file_t loaded;
+    if (hot_file_load(&loaded, path, path_hash) != 0) return NULL;
+    metric_counter_add(&hot_file_loads, 1);
+    pthread_mutex_lock(&hot_file_lock);
+    victim = NULL;
+    for (int i = 0; i < HOT_FILE_SLOTS; i++) {
+        hot_file_t *e = &hot_files[i];
+        if (e->refs == 0 && (!victim || e->last_used < victim->last_used)) victim = e;
+    }
+    if (victim) {
+        if (victim->last_used) hot_file_free(victim);
+        *victim = loaded;
+        victim->refs = 1;
+        victim->last_used = ++hot_file_clock;
+    }
+    pthread_mutex_unlock(&hot_file_lock);
+    if (!victim) hot_file_free(&loaded);
+    return victim;
+}
+
+// Serve a plain download from the cache. 0 if the request needs the full
+// download path (archive member, compressed body, CRC trailer).
+static int hot_file_serve(int sock, const char *path, const char *request) {
+    hot_file_t *e = hot_file_acquire(path);
+    if (!e) return 0;
+    char te[64];
+    if ((e->compressible && compress_negotiate(request)) ||
+        (!e->has_digest && http_header(request, "TE", te, sizeof(te)) && strstr(te, "trailers"))) {
+        hot_file_release(e);
+        return 0;
+    }
+    if (download_not_modified(request, e->etag, e->st.st_mtime)) {
+        note_response_status(304);
+        client_send(sock, e->not_modified, e->not_modified_len);
+        hot_file_release(e);
+        return 1;
+    }
+    note_response_status(200);
+    unsigned long long bytes_sent = 0;
+    if (e->in_memory) {
+        ssize_t n = client_send(sock, e->header, e->header_len + e->st.st_size);
+        if (n > (ssize_t)e->header_len) bytes_sent = n - e->header_len;
+    } else {
+        int nopush = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+        client_send(sock, e->header, e->header_len);
+        int transfer = transfer_begin(TRANSFER_DOWNLOAD, path, e->st.st_size);
+        bytes_sent = send_file_range(sock, e->fd, 0, e->st.st_size, transfer);
+        transfer_end(transfer);
+        nopush = 0;
+        setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+    }
+    hot_file_release(e);
+    if (!request_is_head()) metric_counter_add(&total_files_transferred, 1);
+    metric_counter_add(&total_bytes_transferred, bytes_sent);
+    return 1;
+}
+
+void handle_download_file(int sock, const char *path, const char *request) {
+    if (hot_file_serve(sock, path, request)) return;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        char archive[MAX_PATH], inner[MAX_PATH];
+        int type = archive_split(path, archive, inner);
+        if (type) {
+            handle_download_archive_member(sock, path, archive, type, inner);
+            return;
+        }
+        send_http_response(sock, 404, "text/plain", "File not found", 14);
+        return;
+    }
+    
+    struct stat st;
+    fstat(fd, &st);
+    
+    // Set socket options for optimal download performance
+    #ifdef SO_NOSIGPIPE
+    int no_sigpipe = 1;
+    setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &no_sigpipe, sizeof(no_sigpipe));
+    #endif
+    
+    int nopush = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+    
+    char digest[160], te[64];
+    format_content_digest(digest, sizeof(digest), &st);
+    int chunked = !digest[0] && http_header(request, "TE", te, sizeof(te)) && strstr(te, "trailers");
+    const char *coding = chunked ? NULL : compress_negotiate(request);
+    
+    // Revalidation and HEAD are answered before the trial compression (a read
+    // and a deflate); a file that turns out not worth compressing is checked
+    // again under its identity ETag
+    char etag[96], last_modified[64], validators[192];
+    file_etag(etag, sizeof(etag), &st, coding);
+    int not_modified = download_not_modified(request, etag, st.st_mtime);
+    if (!not_modified && coding && (request_is_head() || !compress_download_worthwhile(fd, path, &st))) {
+        coding = NULL;
+        file_etag(etag, sizeof(etag), &st, NULL);
+        not_modified = download_not_modified(request, etag, st.st_mtime);
+    }
+    http_date_format(last_modified, sizeof(last_modified), st.st_mtime);
+    snprintf(validators, sizeof(validators), "ETag: %s\r\nLast-Modified: %s\r\n", etag, last_modified);
+    char header[1024];
+    int header_len;
+    
+    if (not_modified) {
+        header_len = snprintf(header, sizeof(header),
+            "HTTP/1.1 304 Not Modified\r\n"
+            "%s%s"
+            "Connection: close\r\n"
+            "\r\n",
+            validators, coding ? "Vary: Accept-Encoding\r\n" : "");
+        note_response_status(304);
+        client_send(sock, header, header_len);
+        nopush = 0;
+        setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+        close(fd);
+        return;
+    }
+    
+    if (coding) {
+        send_file_compressed(sock, fd, path, &st, coding, validators);
+        nopush = 0;
+        setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+        close(fd);
+        return;
+    }
+    
+    header_len = snprintf(header, sizeof(header),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/octet-stream\r\n"
+        "Content-Disposition: attachment; filename=\"%s\"\r\n"
+        "%s"
+        "Connection: close\r\n",
+        strrchr(path, '/') ? strrchr(path, '/') + 1 : path, validators);
+    if (chunked) {
+        header_len += snprintf(header + header_len, sizeof(header) - header_len,
+            "Transfer-Encoding: chunked\r\nTrailer: Content-Digest\r\n\r\n");
+    } else {
+        header_len += snprintf(header + header_len, sizeof(header) - header_len,
+            "Content-Length: %lld\r\n%s%s%s\r\n", (long long)st.st_size,
+            digest[0] ? "Content-Digest: " : "", digest, digest[0] ? "\r\n" : "");
+    }
+    
+    note_response_status(200);
+    client_send(sock, header, header_len);
+    if (request_is_head()) {
+        nopush = 0;
+        setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+        close(fd);
+        return;
+    }
+    
+    unsigned long long bytes_sent = 0;
+    int transfer = transfer_begin(TRANSFER_DOWNLOAD, path, st.st_size);
+    
+    if (chunked) {
+        bytes_sent = send_file_chunked_crc(sock, fd, path, &st, transfer);
+        nopush = 0;
+        setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+        close(fd);
+        transfer_end(transfer);
+        metric_counter_add(&total_files_transferred, 1);
+        metric_counter_add(&total_bytes_transferred, bytes_sent);
+        return;
+    }
+    
+    bytes_sent = send_file_range(sock, fd, 0, st.st_size, transfer);
+    
+    nopush = 0;
+    setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+    
+    close(fd);
+    transfer_end(transfer);
+    
+    metric_counter_add(&total_files_transferred, 1);
+    metric_counter_add(&total_bytes_transferred, bytes_sent);
+}
+
+// File preview
+// Pages come out of a small cache of windows, PREVIEW_WINDOW bytes each and
+// keyed by (dev, ino, size, mtime, window), so paging through a huge file
+// reads only the windows actually looked at and repeated views of the same
+// region cost no I/O. Windows are private copies read with pread rather than
+// mappings, so a file truncated underneath can't fault the reader. Windows in
+// use are pinned; the least recently used idle window is refilled when a new
+// one is needed, and the read happens outside preview_lock.
+typedef struct {
+    unsigned long long dev, ino, size;
+    long long mtime_sec;
+    long mtime_nsec;
+    unsigned long long index;       // window number within the file
+    unsigned char *data;            // PREVIEW_WINDOW bytes once allocated, kept across reuse
+    size_t len;
+    int refs;
+    unsigned long long last_used;   // 0 marks a free slot
+} preview_window_t;
+
+static preview_window_t preview_windows[PREVIEW_CACHE_SLOTS];
+static unsigned long long preview_clock;
+static pthread_mutex_t preview_lock = PTHREAD_MUTEX_INITIALIZER;
+static metric_counter_t preview_window_hits;
+static metric_counter_t preview_window_loads;
+
+// Pin the window holding byte index * PREVIEW_WINDOW; NULL if it cannot be read
+static preview_window_t* preview_acquire(int fd, const struct stat *st, unsigned long long index) {
+    preview_window_t *victim = NULL;
+    pthread_mutex_lock(&preview_lock);
+    for (int i = 0; i < PREVIEW_CACHE_SLOTS; i++) {
+        preview_window_t *w = &preview_windows[i];
+        if (w->last_used && w->index == index && w->ino == (unsigned long long)st->st_ino &&
+            w->dev == (unsigned long long)st->st_dev && w->size == (unsigned long long)st->st_size &&
+            w->mtime_sec == (long long)st->st_mtim.tv_sec && w->mtime_nsec == st->st_mtim.tv_nsec) {
+            w->refs++;
+            w->last_used = ++preview_clock;
+            pthread_mutex_unlock(&preview_lock);
+            metric_counter_add(&preview_window_hits, 1);
+            return w;
+        }
+        if (w->refs == 0 && (!victim || w->last_used < victim->last_used)) victim = w;
+    }
+    if (!victim) {
+        pthread_mutex_unlock(&preview_lock);
+        return NULL;
+    }
+    // Claim the slot: pinned so nobody evicts it, free so nobody matches it
+    victim->last_used = 0;
+    victim->refs = 1;
+    pthread_mutex_unlock(&preview_lock);
+    
+    unsigned long long start = index * PREVIEW_WINDOW;
+    size_t len = st->st_size - start < PREVIEW_WINDOW ? st->st_size - start : PREVIEW_WINDOW;
+    if (!victim->data) victim->data = malloc(PREVIEW_WINDOW);
+    if (!victim->data || pread_full(fd, victim->data, len, start) != (ssize_t)len) {
+        pthread_mutex_lock(&preview_lock);
+        victim->refs = 0;
+        pthread_mutex_unlock(&preview_lock);
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&preview_lock);
+    victim->dev = st->st_dev;
+    victim->ino = st->st_ino;
+    victim->size = st->st_size;
+    victim->mtime_sec = st->st_mtim.tv_sec;
+    victim->mtime_nsec = st->st_mtim.tv_nsec;
+    victim->index = index;
+    victim->len = len;
+    victim->last_used = ++preview_clock;
+    pthread_mutex_unlock(&preview_lock);
+    metric_counter_add(&preview_window_loads, 1);
+    return victim;
+}
+
+static void preview_release(preview_window_t *w) {
+    pthread_mutex_lock(&preview_lock);
+    w->refs--;
+    pthread_mutex_unlock(&preview_lock);
+}
+
+// Copy [offset, offset + len) through the window cache, falling back to pread
+static int preview_read(int fd, const struct stat *st, unsigned long long offset, unsigned char *dst, size_t len) {
+    while (len > 0) {
+        unsigned long long index = offset / PREVIEW_WINDOW;
+        size_t in_window = offset % PREVIEW_WINDOW;
+        size_t n = PREVIEW_WINDOW - in_window < len ? PREVIEW_WINDOW - in_window : len;
+        preview_window_t *w = preview_acquire(fd, st, index);
+        if (w) {
+            memcpy(dst, w->data + in_window, n);
+            preview_release(w);
+        } else if (pread_full(fd, dst, n, offset) != (ssize_t)n) {
+            return -1;
+        }
+        dst += n;
+        offset += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Length of the UTF-8 sequence led by c; 0 for a byte that cannot lead one
+static size_t utf8_seq_len(unsigned char c) {
+    return c < 0x80 ? 1 : c >= 0xC2 && c <= 0xDF ? 2 : (c & 0xF0) == 0xE0 ? 3 : c >= 0xF0 && c <= 0xF4 ? 4 : 0;
+}
+
+// Length of a well-formed UTF-8 sequence at s, 0 if invalid, or (size_t)-1
+// if it is well-formed so far but cut short by len
+static size_t utf8_check(const unsigned char *s, size_t len) {
+    size_t n = utf8_seq_len(s[0]);
+    if (n == 0) return 0;
+    for (size_t k = 1; k < n; k++) {
+        if (k >= len) return (size_t)-1;
+        if ((s[k] & 0xC0) != 0x80) return 0;
+    }
+    return n;
+}
+
+// Append code point cp as UTF-8
+static size_t utf8_put(char *dst, unsigned int cp) {
+    if (cp < 0x80) { dst[0] = cp; return 1; }
+    if (cp < 0x800) { dst[0] = 0xC0 | cp >> 6; dst[1] = 0x80 | (cp & 0x3F); return 2; }
+    if (cp < 0x10000) {
+        dst[0] = 0xE0 | cp >> 12; dst[1] = 0x80 | ((cp >> 6) & 0x3F); dst[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    dst[0] = 0xF0 | cp >> 18; dst[1] = 0x80 | ((cp >> 12) & 0x3F);
+    dst[2] = 0x80 | ((cp >> 6) & 0x3F); dst[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+// Preview one page of a file.
+// mode=text: the page is trimmed to whole lines (and whole characters) and
+// converted to UTF-8; encoding is taken from a BOM, else guessed from the
+// page (ascii, utf-8, latin1, or binary when it holds NUL bytes).
+// mode=hex: the raw bytes as a hex string.
+// "next" is the offset of the following page.
+void handle_preview(int sock, const char *path, const char *offset_str, const char *length_str, const char *mode) {
+    int hex = mode && strcmp(mode, "hex") == 0;
+    if (!path || !*path) {
+        const char *msg = "{\"error\":\"Path required\"}";
+        send_http_response(sock, 400, "application/json", msg, strlen(msg));
+        return;
+    }
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        const char *msg = "{\"error\":\"Not a readable file\"}";
+        send_http_response(sock, 404, "application/json", msg, strlen(msg));
+        return;
+    }
+    unsigned long long size = st.st_size;
+    unsigned long long offset = offset_str && *offset_str ? strtoull(offset_str, NULL, 10) : 0;
+    size_t length = length_str && *length_str ? strtoul(length_str, NULL, 10)
+                                              : hex ? PREVIEW_HEX_LENGTH : PREVIEW_TEXT_LENGTH;
+    if (length == 0 || length > PREVIEW_MAX_LENGTH) length = PREVIEW_MAX_LENGTH;
+    if (offset > size) offset = size;
+    if (length > size - offset) length = size - offset;
+    
+    // Text needs the BOM, which lives at the start of the file
+    unsigned char bom[3] = {0};
+    const char *encoding = "ascii";
+    size_t bom_len = 0;
+    int utf16 = 0;
+    if (!hex && size >= 2 && preview_read(fd, &st, 0, bom, size >= 3 ? 3 : 2) == 0) {
+        if (size >= 3 && bom[0] == 0xEF && bom[1] == 0xBB && bom[2] == 0xBF) {
+            encoding = "utf-8";
+            bom_len = 3;
+        } else if (bom[0] == 0xFF && bom[1] == 0xFE) {
+            encoding = "utf-16le";
+            bom_len = 2;
+            utf16 = 1;
+        } else if (bom[0] == 0xFE && bom[1] == 0xFF) {
+            encoding = "utf-16be";
+            bom_len = 2;
+            utf16 = 2;
+        }
+        if (offset < bom_len) {
+            length -= length > bom_len - offset ? bom_len - offset : length;
+            offset = bom_len;
+        }
+        if (utf16) {
+            // Stay on code unit boundaries
+            if ((offset - bom_len) & 1) offset++, length -= length ? 1 : 0;
+            length &= ~(size_t)1;
+        }
+    }
+    
+    unsigned char *page = malloc(length + 1);
+    // Worst case: every byte becomes a 3-byte character, each byte escaped as \u00XX
+    size_t cap = (hex ? length * 2 : length * 18) + MAX_PATH * 2 + 512;
+    char *json = malloc(cap);
+    char *text = hex ? NULL : malloc(length * 3 + 1);
+    if (!page || !json || (!hex && !text) || preview_read(fd, &st, offset, page, length) != 0) {
+        close(fd);
+        free(page);
+        free(json);
+        free(text);
+        const char *msg = "{\"error\":\"Read failed\"}";
+        send_http_response(sock, 500, "application/json", msg, strlen(msg));
+        return;
+    }
+    // Text pages that begin mid-line skip to the next line
+    int mid_line = 0;
+    if (!hex && offset > bom_len) {
+        unsigned char prev[2];
+        size_t unit = utf16 ? 2 : 1;
+        if (preview_read(fd, &st, offset - unit, prev, unit) == 0) {
+            mid_line = utf16 == 1 ? !(prev[0] == '\n' && prev[1] == 0) :
+                       utf16 == 2 ? !(prev[0] == 0 && prev[1] == '\n') : prev[0] != '\n';
+        }
+    }
+    close(fd);
+    
+    char escaped[MAX_PATH * 2];
+    json_escape(escaped, sizeof(escaped), path);
+    int len = snprintf(json, cap, "{\"path\":\"%s\",\"size\":%llu,\"mode\":\"%s\"", escaped, size, hex ? "hex" : "text");
+    size_t start = 0, end = length;
+    if (hex) {
+        static const char digits[] = "0123456789abcdef";
+        len += snprintf(json + len, cap - len, ",\"offset\":%llu,\"length\":%zu,\"hex\":\"", offset, length);
+        for (size_t i = 0; i < length; i++) {
+            json[len++] = digits[page[i] >> 4];
+            json[len++] = digits[page[i] & 15];
+        }
+        json[len++] = '"';
+    } else {
+        int at_eof = offset + length >= size;
+        size_t unit = utf16 ? 2 : 1;
+        #define PREVIEW_IS_NL(i) (utf16 == 1 ? page[i] == '\n' && page[(i) + 1] == 0 : \
+                                  utf16 == 2 ? page[i] == 0 && page[(i) + 1] == '\n' : page[i] == '\n')
+        // Start on a line boundary when dropped mid-line (offsets from "next" already are)
+        if (mid_line) {
+            for (size_t i = 0; i + unit <= end; i += unit) {
+                if (PREVIEW_IS_NL(i)) {
+                    if (i + unit < end) start = i + unit;
+                    break;
+                }
+            }
+        }
+        // End after the last complete line unless the page reaches EOF or has no newline
+        if (!at_eof) {
+            for (size_t i = end; i >= start + unit; i -= unit) {
+                if (PREVIEW_IS_NL(i - unit)) {
+                    end = i;
+                    break;
+                }
+            }
+        }
+        #undef PREVIEW_IS_NL
+        
+        size_t o = 0;
+        int lines = 0;
+        if (utf16) {
+            for (size_t i = start; i + 1 < end; i += 2) {
+                unsigned int cu = utf16 == 1 ? page[i] | page[i + 1] << 8 : page[i] << 8 | page[i + 1];
+                if (cu >= 0xD800 && cu < 0xDC00 && i + 3 < end) {
+                    unsigned int lo = utf16 == 1 ? page[i + 2] | page[i + 3] << 8 : page[i + 2] << 8 | page[i + 3];
+                    if (lo >= 0xDC00 && lo < 0xE000) {
+                        cu = 0x10000 + ((cu - 0xD800) << 10) + (lo - 0xDC00);
+                        i += 2;
+                    } else {
+                        cu = 0xFFFD;
+                    }
+                } else if (cu >= 0xD800 && cu < 0xE000) {
+                    if (cu < 0xDC00 && !at_eof) {
+                        end = i;    // high surrogate split across pages
+                        break;
+                    }
+                    cu = 0xFFFD;
+                }
+                lines += cu == '\n';
+                o += utf8_put(text + o, cu);
+            }
+        } else {
+            // Classify: NUL bytes mean binary, otherwise UTF-8 unless a sequence is malformed
+            int has_nul = memchr(page + start, 0, end - start) != NULL;
+            int high = 0, invalid = 0;
+            for (size_t i = start; i < end && !has_nul; ) {
+                if (page[i] < 0x80) {
+                    i++;
+                    continue;
+                }
+                high = 1;
+                size_t n = utf8_check(page + i, end - i);
+                if (n == (size_t)-1) {
+                    // A character cut by the page end stays for the next page
+                    if (!at_eof && i > start) end = i;
+                    else invalid = 1;
+                    break;
+                }
+                if (n == 0) {
+                    invalid = 1;
+                    break;
+                }
+                i += n;
+            }
+            if (!bom_len) encoding = has_nul ? "binary" : invalid ? "latin1" : high ? "utf-8" : "ascii";
+            int bytes_as_latin1 = has_nul || (invalid && !bom_len);
+            for (size_t i = start; i < end; ) {
+                size_t n = page[i] < 0x80 ? 1 : bytes_as_latin1 ? 0 : utf8_check(page + i, end - i);
+                lines += page[i] == '\n';
+                if (n == 1) {
+                    text[o++] = page[i++];
+                } else if (n == 0 || n == (size_t)-1) {
+                    o += utf8_put(text + o, bytes_as_latin1 ? page[i] : 0xFFFD);
+                    i++;
+                } else {
+                    memcpy(text + o, page + i, n);
+                    o += n;
+                    i += n;
+                }
+            }
+        }
+        len += snprintf(json + len, cap - len, ",\"offset\":%llu,\"length\":%zu,\"encoding\":\"%s\",\"lines\":%d,\"text\":\"",
+                        offset + start, end - start, encoding, lines);
+        len += json_escape_n(json + len, cap - len, text, o);
+        json[len++] = '"';
+    }
+    len += snprintf(json + len, cap - len, ",\"next\":%llu,\"eof\":%s}", offset + end,
+                    offset + end >= size ? "true" : "false");
+    send_http_response(sock, 200, "application/json", json, len);
+    free(page);
+    free(json);
+    free(text);
+}
+
+// Delete file/directory
+void handle_delete(int sock, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        send_http_response(sock, 404, "application/json", "{\"error\":\"Not found\"}", 21);
+        return;
+    }
+    
+    int result;
+    if (S_ISDIR(st.st_mode)) {
+        result = rmdir(path);
+    } else {
+        result = unlink(path);
+    }
+    
+    const char *success_msg = "{\"success\":true}";
+    const char *error_msg = "{\"error\":\"Delete failed\"}";
+    if (result == 0) {
+        hot_file_invalidate(path);
+        send_http_response(sock, 200, "application/json", success_msg, strlen(success_msg));
+    } else {
+        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+    }
+}
+
+// System metrics sample (one point in the history)
+typedef struct {
+    time_t timestamp;
+    unsigned long long data_total, data_used, data_free;
+    unsigned long long sys_total, sys_used, sys_free;
+    unsigned long long ram_total, ram_used, ram_free;
+    unsigned long long uptime_seconds;
+    unsigned long long total_requests;
+    unsigned long long files_transferred;
+    unsigned long long bytes_transferred;
+    unsigned long long active_connections;
+} sys_sample_t;
+
+// Named metrics available through /api/sysinfo/history
+typedef struct {
+    const char *name;
+    size_t offset;
+} sys_metric_t;
+
+static const sys_metric_t sys_metrics[] = {
+    { "data_used",          offsetof(sys_sample_t, data_used) },
+    { "data_free",          offsetof(sys_sample_t, data_free) },
+    { "system_used",        offsetof(sys_sample_t, sys_used) },
+    { "system_free",        offsetof(sys_sample_t, sys_free) },
+    { "ram_used",           offsetof(sys_sample_t, ram_used) },
+    { "ram_free",           offsetof(sys_sample_t, ram_free) },
+    { "uptime",             offsetof(sys_sample_t, uptime_seconds) },
+    { "total_requests",     offsetof(sys_sample_t, total_requests) },
+    { "files_transferred",  offsetof(sys_sample_t, files_transferred) },
+    { "bytes_transferred",  offsetof(sys_sample_t, bytes_transferred) },
+    { "active_connections", offsetof(sys_sample_t, active_connections) },
+};
+
+#define SYS_METRIC_COUNT (sizeof(sys_metrics) / sizeof(sys_metrics[0]))
+
+// Fixed-size ring of samples
+typedef struct {
+    sys_sample_t *slots;
+    int capacity;
+    int head;   // next slot to write
+    int count;
+} sample_ring_t;
+
+static sys_sample_t fine_slots[SAMPLER_FINE_SLOTS];
+static sys_sample_t coarse_slots[SAMPLER_COARSE_SLOTS];
+static sample_ring_t fine_ring = { fine_slots, SAMPLER_FINE_SLOTS, 0, 0 };
+static sample_ring_t coarse_ring = { coarse_slots, SAMPLER_COARSE_SLOTS, 0, 0 };
+
+// Latest sample and network identity, served by /api/sysinfo without syscalls
+static sys_sample_t latest_sample;
+static char latest_hostname[256] = "PS5";
+static char latest_ip[INET_ADDRSTRLEN] = "0.0.0.0";
+static int sampler_ready = 0;
+static unsigned long long sampler_generation = 0;   // bumped on every new sample
+static _Atomic int sse_viewers = 0;
+static pthread_mutex_t sampler_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sampler_cond = PTHREAD_COND_INITIALIZER;
+
+void sample_ring_push(sample_ring_t *ring, const sys_sample_t *sample) {
+    ring->slots[ring->head] = *sample;
+    ring->head = (ring->head + 1) % ring->capacity;
+    if (ring->count < ring->capacity) ring->count++;
+}
+
+// Get the i-th oldest sample in the ring
+const sys_sample_t *sample_ring_at(const sample_ring_t *ring, int i) {
+    int start = (ring->head - ring->count + ring->capacity) % ring->capacity;
+    return &ring->slots[(start + i) % ring->capacity];
+}
+
+// Collect storage, RAM, uptime and server counters
+void collect_system_sample(sys_sample_t *s) {
+    memset(s, 0, sizeof(*s));
+    s->timestamp = time(NULL);
+    
+    // Storage - /data partition
+    struct statvfs vfs_data;
+    if (statvfs("/data", &vfs_data) == 0) {
+        s->data_total = (unsigned long long)vfs_data.f_blocks * vfs_data.f_frsize;
+        s->data_free = (unsigned long long)vfs_data.f_bfree * vfs_data.f_frsize;
+        s->data_used = s->data_total - s->data_free;
+    }
+    
+    // Storage - /system partition
+    struct statvfs vfs_system;
+    if (statvfs("/system", &vfs_system) == 0) {
+        s->sys_total = (unsigned long long)vfs_system.f_blocks * vfs_system.f_frsize;
+        s->sys_free = (unsigned long long)vfs_system.f_bfree * vfs_system.f_frsize;
+        s->sys_used = s->sys_total - s->sys_free;
+    }
+    
+    // RAM info - PS5 specific memory detection
+    unsigned long long ram_total = 16ULL * 1024 * 1024 * 1024;  // PS5 has 16GB
+    size_t len = sizeof(ram_total);
+    
+    // Method 1: Try hw.physmem for total
+    if (sysctlbyname("hw.physmem", &ram_total, &len, NULL, 0) != 0) {
+        ram_total = 16ULL * 1024 * 1024 * 1024;
+    }
+    
+    // Method 2: Try to get memory stats
+    unsigned long page_size = 4096;
+    unsigned long free_pages = 0;
+    unsigned long inactive_pages = 0;
+    unsigned long cache_pages = 0;
+    
+    len = sizeof(page_size);
+    sysctlbyname("hw.pagesize", &page_size, &len, NULL, 0);
+    
+    // Get various memory page counts
+    len = sizeof(free_pages);
+    int got_free = (sysctlbyname("vm.stats.vm.v_free_count", &free_pages, &len, NULL, 0) == 0);
+    
+    len = sizeof(inactive_pages);
+    int got_inactive = (sysctlbyname("vm.stats.vm.v_inactive_count", &inactive_pages, &len, NULL, 0) == 0);
+    
+    len = sizeof(cache_pages);
+    int got_cache = (sysctlbyname("vm.stats.vm.v_cache_count", &cache_pages, &len, NULL, 0) == 0);
+    
+    s->ram_total = ram_total;
+    if (got_free || got_inactive || got_cache) {
+        // Calculate available memory (free + inactive + cache)
+        unsigned long available_pages = free_pages + inactive_pages + cache_pages;
+        s->ram_free = (unsigned long long)available_pages * page_size;
+        s->ram_used = ram_total - s->ram_free;
+    } else {
+        // Fallback: Use /proc/meminfo style estimate
+        s->ram_used = ram_total * 0.6;
+        s->ram_free = ram_total - s->ram_used;
+    }
+    
+    // Uptime - Get actual system uptime
+    struct timeval boottime;
+    size_t boottime_len = sizeof(boottime);
+    if (sysctlbyname("kern.boottime", &boottime, &boottime_len, NULL, 0) == 0) {
+        s->uptime_seconds = s->timestamp - boottime.tv_sec;
+    } else {
+        // Fallback: try clock_gettime
+        struct timespec uptime_ts;
+        if (clock_gettime(CLOCK_UPTIME, &uptime_ts) == 0) {
+            s->uptime_seconds = uptime_ts.tv_sec;
+        }
+    }
+    
+    // Server statistics
+    s->total_requests = metric_counter_read(&total_requests);
+    s->files_transferred = metric_counter_read(&total_files_transferred);
+    s->bytes_transferred = metric_counter_read(&total_bytes_transferred);
+    s->active_connections = metric_gauge_read(&active_connections);
+}
+
+// Network info - hostname and first non-loopback IPv4 address
+void collect_network_identity(char *hostname, size_t hostname_len, char *ip_address) {
+    gethostname(hostname, hostname_len);
+    
+    struct ifaddrs *ifaddr, *ifa;
+    if (getifaddrs(&ifaddr) == 0) {
+        for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
+            if (ifa->ifa_addr == NULL) continue;
+            if (ifa->ifa_addr->sa_family == AF_INET) {
+                struct sockaddr_in *addr = (struct sockaddr_in *)ifa->ifa_addr;
+                inet_ntop(AF_INET, &addr->sin_addr, ip_address, INET_ADDRSTRLEN);
+                if (strcmp(ip_address, "127.0.0.1") != 0) {
+                    break;
+                }
+            }
+        }
+        freeifaddrs(ifaddr);
+    }
+}
+
+// Per-interface traffic counters
+typedef struct {
+    char name[32];
+    unsigned long long rx_bytes;
+    unsigned long long tx_bytes;
+    unsigned long long rx_rate;     // bytes/sec over the last tick
+    unsigned long long tx_rate;
+} iface_stats_t;
+
+static iface_stats_t latest_ifaces[MAX_IFACES];
+static int latest_iface_count = 0;
+
+// Read cumulative rx/tx byte counters of every non-loopback interface
+int collect_interface_counters(iface_stats_t *out, int max) {
+    int count = 0;
+#ifdef __FreeBSD__
+    // AF_LINK entries carry the interface's struct if_data
+    struct ifaddrs *ifaddr, *ifa;
+    if (getifaddrs(&ifaddr) != 0) return 0;
+    for (ifa = ifaddr; ifa != NULL && count < max; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_LINK) continue;
+        if (ifa->ifa_data == NULL || (ifa->ifa_flags & IFF_LOOPBACK)) continue;
+        struct if_data *ifd = (struct if_data *)ifa->ifa_data;
+        memset(&out[count], 0, sizeof(out[count]));
+        strncpy(out[count].name, ifa->ifa_name, sizeof(out[count].name) - 1);
+        out[count].rx_bytes = ifd->ifi_ibytes;
+        out[count].tx_bytes = ifd->ifi_obytes;
+        count++;
+    }
+    freeifaddrs(ifaddr);
+#else
+    // Linux host build: /proc/net/dev
+    FILE *f = fopen("/proc/net/dev", "r");
+    if (!f) return 0;
+    char line[512];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f) && count < max) {
+        if (++lineno <= 2) continue;   // two header lines
+        char *colon = strchr(line, ':');
+        if (!colon) continue;
+        *colon = '\0';
+        char *name = line;
+        while (*name == ' ') name++;
+        if (strcmp(name, "lo") == 0) continue;
+        unsigned long long rx = 0, tx = 0, skip;
+        if (sscanf(colon + 1, "%llu %llu %llu %llu %llu %llu %llu %llu %llu",
+                   &rx, &skip, &skip, &skip, &skip, &skip, &skip, &skip, &tx) != 9) continue;
+        memset(&out[count], 0, sizeof(out[count]));
+        snprintf(out[count].name, sizeof(out[count].name), "%.31s", name);
+        out[count].rx_bytes = rx;
+        out[count].tx_bytes = tx;
+        count++;
+    }
+    fclose(f);
+#endif
+    return count;
+}
+
+// Fill rx/tx rates from the previous counters of the same interface
+void compute_interface_rates(iface_stats_t *cur, int n, const iface_stats_t *prev, int prev_n,
+                             unsigned long long interval_ms) {
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < prev_n; j++) {
+            if (strcmp(cur[i].name, prev[j].name) != 0) continue;
+            if (cur[i].rx_bytes >= prev[j].rx_bytes)
+                cur[i].rx_rate = (cur[i].rx_bytes - prev[j].rx_bytes) * 1000 / interval_ms;
+            if (cur[i].tx_bytes >= prev[j].tx_bytes)
+                cur[i].tx_rate = (cur[i].tx_bytes - prev[j].tx_bytes) * 1000 / interval_ms;
+            break;
+        }
+    }
+}
+
+// Interfaces of the latest sample as a JSON array (caller holds sampler_lock)
+int format_interfaces_json(char *out, size_t out_len) {
+    int pos = snprintf(out, out_len, "[");
+    for (int i = 0; i < latest_iface_count && (size_t)pos + 200 < out_len; i++) {
+        const iface_stats_t *f = &latest_ifaces[i];
+        pos += snprintf(out + pos, out_len - pos,
+            "%s{\"name\":\"%s\",\"rx_bytes\":%llu,\"tx_bytes\":%llu,\"rx_rate\":%llu,\"tx_rate\":%llu}",
+            i ? "," : "", f->name, f->rx_bytes, f->tx_bytes, f->rx_rate, f->tx_rate);
+    }
+    pos += snprintf(out + pos, out_len - pos, "]");
+    return pos;
+}
+
+// Average a run of fine samples into one coarse sample
+void average_samples(const sample_ring_t *ring, int first, int n, sys_sample_t *out) {
+    memset(out, 0, sizeof(*out));
+    if (n <= 0) return;
+    for (size_t m = 0; m < SYS_METRIC_COUNT; m++) {
+        unsigned long long sum = 0;
+        for (int i = 0; i < n; i++) {
+            const sys_sample_t *s = sample_ring_at(ring, first + i);
+            sum += *(const unsigned long long *)((const char *)s + sys_metrics[m].offset);
+        }
+        *(unsigned long long *)((char *)out + sys_metrics[m].offset) = sum / n;
+    }
+    const sys_sample_t *last = sample_ring_at(ring, first + n - 1);
+    out->timestamp = last->timestamp;
+    out->data_total = last->data_total;
+    out->sys_total = last->sys_total;
+    out->ram_total = last->ram_total;
+}
+
+// Sampler thread: collects metrics at a fixed interval into the history rings
+void* sampler_thread(void* arg) {
+    (void)arg;
+    unsigned long tick = 0;
+    iface_stats_t prev_ifaces[MAX_IFACES];
+    int prev_iface_count = 0;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    
+    while (1) {
+        sys_sample_t sample;
+        collect_system_sample(&sample);
+        
+        char hostname[256] = "PS5";
+        char ip_address[INET_ADDRSTRLEN] = "0.0.0.0";
+        int refresh_network = (tick % SAMPLER_NETWORK_EVERY) == 0;
+        if (refresh_network) {
+            collect_network_identity(hostname, sizeof(hostname), ip_address);
+        }
+        
+        iface_stats_t ifaces[MAX_IFACES];
+        int iface_count = collect_interface_counters(ifaces, MAX_IFACES);
+        compute_interface_rates(ifaces, iface_count, prev_ifaces, prev_iface_count, SAMPLER_INTERVAL_MS);
+        memcpy(prev_ifaces, ifaces, sizeof(ifaces));
+        prev_iface_count = iface_count;
+        
+        transfer_update_rates(SAMPLER_INTERVAL_MS);
+        
+        pthread_mutex_lock(&sampler_lock);
+        memcpy(latest_ifaces, ifaces, sizeof(ifaces));
+        latest_iface_count = iface_count;
+        latest_sample = sample;
+        if (refresh_network) {
+            memcpy(latest_hostname, hostname, sizeof(latest_hostname));
+            memcpy(latest_ip, ip_address, sizeof(latest_ip));
+        }
+        sample_ring_push(&fine_ring, &sample);
+        tick++;
+        if (tick % SAMPLER_COARSE_EVERY == 0) {
+            sys_sample_t coarse;
+            average_samples(&fine_ring, fine_ring.count - SAMPLER_COARSE_EVERY,
+                            SAMPLER_COARSE_EVERY, &coarse);
+            sample_ring_push(&coarse_ring, &coarse);
+        }
+        sampler_ready = 1;
+        sampler_generation++;
+        pthread_cond_broadcast(&sampler_cond);
+        pthread_mutex_unlock(&sampler_lock);
+        
+        // Sleep until the next tick (absolute schedule avoids drift)
+        next.tv_nsec += SAMPLER_INTERVAL_MS * 1000000L;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long wait_ns = (long long)(next.tv_sec - now.tv_sec) * 1000000000LL + (next.tv_nsec - now.tv_nsec);
+        if (wait_ns > 0) {
+            struct timespec ts = { wait_ns / 1000000000LL, wait_ns % 1000000000LL };
+            nanosleep(&ts, NULL);
+        } else {
+            next = now;
+        }
+    }
+    return NULL;
+}
+
+// Get a consistent copy of the latest sample (waits for the first one)
+void get_latest_sample(sys_sample_t *sample, char *hostname, char *ip_address,
+                       char *ifaces_json, size_t ifaces_len) {
+    pthread_mutex_lock(&sampler_lock);
+    while (!sampler_ready) {
+        pthread_cond_wait(&sampler_cond, &sampler_lock);
+    }
+    *sample = latest_sample;
+    if (ifaces_json) format_interfaces_json(ifaces_json, ifaces_len);
+    if (hostname) memcpy(hostname, latest_hostname, sizeof(latest_hostname));
+    if (ip_address) memcpy(ip_address, latest_ip, sizeof(latest_ip));
+    pthread_mutex_unlock(&sampler_lock);
+}
+
+// Get system info as JSON (served from the latest sample)
+void handle_system_info(int sock) {
+    char json[16384];
+    sys_sample_t s;
+    char hostname[256];
+    char ip_address[INET_ADDRSTRLEN];
+    char ifaces_json[4096];
+    get_latest_sample(&s, hostname, ip_address, ifaces_json, sizeof(ifaces_json));
+    
+    int days = s.uptime_seconds / 86400;
+    int hours = (s.uptime_seconds % 86400) / 3600;
+    int minutes = (s.uptime_seconds % 3600) / 60;
+    int seconds = s.uptime_seconds % 60;
+    
+    // Build JSON
+    int pos = sprintf(json, "{");
+    
+    // Storage info
+    pos += sprintf(json + pos, "\"storage\":{");
+    pos += sprintf(json + pos, "\"data\":{\"total\":%llu,\"used\":%llu,\"free\":%llu}", 
+                   s.data_total, s.data_used, s.data_free);
+    if (s.sys_total > 0) {
+        pos += sprintf(json + pos, ",\"system\":{\"total\":%llu,\"used\":%llu,\"free\":%llu}", 
+                       s.sys_total, s.sys_used, s.sys_free);
+    }
+    pos += sprintf(json + pos, "},");
+    
+    // RAM info
+    pos += sprintf(json + pos, "\"ram\":{\"total\":%llu,\"used\":%llu,\"free\":%llu},", 
+                   s.ram_total, s.ram_used, s.ram_free);
+    
+    // Uptime
+    pos += sprintf(json + pos, "\"uptime\":{\"seconds\":%llu,\"days\":%d,\"hours\":%d,\"minutes\":%d,\"secs\":%d},", 
+                   s.uptime_seconds, days, hours, minutes, seconds);
+    
+    // Network info
+    pos += sprintf(json + pos, "\"network\":{\"hostname\":\"%s\",\"ip\":\"%s\",\"interfaces\":%s},",
+                   hostname, ip_address, ifaces_json);
+    
+    // Server statistics (live counters, no syscalls)
+    unsigned long long timeouts = 0;
+    for (int i = 0; i < CONN_TIMEOUT_REASONS; i++) timeouts += metric_counter_read(&conn_timeouts[i]);
+    pos += sprintf(json + pos, "\"server\":{\"total_requests\":%llu,\"files_transferred\":%llu,\"bytes_transferred\":%llu,\"active_connections\":%lld,\"timeouts\":%llu},", 
+                   metric_counter_read(&total_requests), metric_counter_read(&total_files_transferred),
+                   metric_counter_read(&total_bytes_transferred), metric_gauge_read(&active_connections), timeouts);
+    
+    pos += sprintf(json + pos, "\"sampled_at\":%ld", (long)s.timestamp);
+    pos += sprintf(json + pos, "}");
+    
+    send_http_response(sock, 200, "application/json", json, pos);
+}
+
+// Append "name":value pairs for every metric that differs from prev (all if prev is NULL)
+int format_sample_fields(char *out, size_t out_len, const sys_sample_t *s, const sys_sample_t *prev) {
+    int pos = 0;
+    for (size_t i = 0; i < SYS_METRIC_COUNT; i++) {
+        unsigned long long v = *(const unsigned long long *)((const char *)s + sys_metrics[i].offset);
+        if (prev && v == *(const unsigned long long *)((const char *)prev + sys_metrics[i].offset)) continue;
+        pos += snprintf(out + pos, out_len - pos, ",\"%s\":%llu", sys_metrics[i].name, v);
+    }
+    return pos;
+}
+
+// Live system info as Server-Sent Events
+// Every viewer waits on the sampler's broadcast, so viewers share one producer and
+// add no syscalls. The first event is a full snapshot, later events carry only the
+// metrics (and hostname/IP, interface and transfer tables) that changed since the
+// previous event.
+void handle_system_stream(int sock, const char *interval_str) {
+    int interval_ms = interval_str ? atoi(interval_str) : SAMPLER_INTERVAL_MS;
+    if (interval_ms < SAMPLER_INTERVAL_MS) interval_ms = SAMPLER_INTERVAL_MS;
+    if (interval_ms > 60000) interval_ms = 60000;
+    unsigned long long ticks = (interval_ms + SAMPLER_INTERVAL_MS - 1) / SAMPLER_INTERVAL_MS;
+    
+    if (atomic_fetch_add(&sse_viewers, 1) >= SSE_MAX_VIEWERS) {
+        atomic_fetch_sub(&sse_viewers, 1);
+        const char *error_msg = "{\"error\":\"Too many live viewers\"}";
+        send_http_response(sock, 503, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    
+    size_t table_cap = 4096 + TRANSFER_SLOTS * 640;
+    size_t event_cap = 4096 + 2 * table_cap;
+    char *event = malloc(event_cap);
+    char *ifaces = malloc(table_cap);
+    char *prev_ifaces = malloc(table_cap);
+    char *xfers = malloc(table_cap);
+    char *prev_xfers = malloc(table_cap);
+    if (!event || !ifaces || !prev_ifaces || !xfers || !prev_xfers) {
+        free(event); free(ifaces); free(prev_ifaces); free(xfers); free(prev_xfers);
+        atomic_fetch_sub(&sse_viewers, 1);
+        send_http_response(sock, 500, "text/plain", "Memory error", 12);
+        return;
+    }
+    prev_ifaces[0] = '\0';
+    prev_xfers[0] = '\0';
+    
+    const char *header =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "retry: 3000\n\n";
+    note_response_status(200);
+    int ok = client_send(sock, header, strlen(header)) == (ssize_t)strlen(header);
+    
+    sys_sample_t prev, cur;
+    char hostname[256], ip_address[INET_ADDRSTRLEN];
+    char prev_hostname[256], prev_ip[INET_ADDRSTRLEN];
+    unsigned long long seen = 0;
+    int first = 1;
+    int idle = 0;
+    
+    while (ok) {
+        pthread_mutex_lock(&sampler_lock);
+        while (!sampler_ready || (!first && sampler_generation < seen + ticks)) {
+            pthread_cond_wait(&sampler_cond, &sampler_lock);
+        }
+        seen = sampler_generation;
+        cur = latest_sample;
+        memcpy(hostname, latest_hostname, sizeof(hostname));
+        memcpy(ip_address, latest_ip, sizeof(ip_address));
+        format_interfaces_json(ifaces, table_cap);
+        pthread_mutex_unlock(&sampler_lock);
+        format_transfers_json(xfers, table_cap);
+        
+        int len;
+        if (first) {
+            len = snprintf(event, event_cap,
+                "event: snapshot\ndata: {\"t\":%ld,\"data_total\":%llu,\"system_total\":%llu,\"ram_total\":%llu,"
+                "\"hostname\":\"%s\",\"ip\":\"%s\"",
+                (long)cur.timestamp, cur.data_total, cur.sys_total, cur.ram_total, hostname, ip_address);
+            len += format_sample_fields(event + len, event_cap - len, &cur, NULL);
+            len += snprintf(event + len, event_cap - len, ",\"interfaces\":%s,\"transfers\":%s}\n\n", ifaces, xfers);
+            first = 0;
+        } else {
+            len = snprintf(event, event_cap, "data: {\"t\":%ld", (long)cur.timestamp);
+            int fields = format_sample_fields(event + len, event_cap - len, &cur, &prev);
+            if (strcmp(hostname, prev_hostname) != 0) {
+                fields += snprintf(event + len + fields, event_cap - len - fields, ",\"hostname\":\"%s\"", hostname);
+            }
+            if (strcmp(ip_address, prev_ip) != 0) {
+                fields += snprintf(event + len + fields, event_cap - len - fields, ",\"ip\":\"%s\"", ip_address);
+            }
+            if (strcmp(ifaces, prev_ifaces) != 0) {
+                fields += snprintf(event + len + fields, event_cap - len - fields, ",\"interfaces\":%s", ifaces);
+            }
+            if (strcmp(xfers, prev_xfers) != 0) {
+                fields += snprintf(event + len + fields, event_cap - len - fields, ",\"transfers\":%s", xfers);
+            }
+            if (fields == 0) {
+                // Nothing changed - send a comment now and then so proxies keep the stream open
+                if (++idle * interval_ms < SSE_KEEPALIVE_MS) continue;
+                len = snprintf(event, event_cap, ": keepalive\n\n");
+            } else {
+                len += fields;
+                len += snprintf(event + len, event_cap - len, "}\n\n");
+            }
+        }
+        idle = 0;
+        prev = cur;
+        memcpy(prev_hostname, hostname, sizeof(prev_hostname));
+        memcpy(prev_ip, ip_address, sizeof(prev_ip));
+        strcpy(prev_ifaces, ifaces);
+        strcpy(prev_xfers, xfers);
+        
+        if (client_send(sock, event, len) != len) break;
+    }
+    
+    free(event);
+    free(ifaces);
+    free(prev_ifaces);
+    free(xfers);
+    free(prev_xfers);
+    atomic_fetch_sub(&sse_viewers, 1);
+}
+
+// Active transfers and interface rates as JSON
+void handle_transfers(int sock) {
+    size_t cap = 4096 + TRANSFER_SLOTS * 640;
+    char *json = malloc(cap);
+    if (!json) {
+        const char *error_msg = "{\"error\":\"Memory error\"}";
+        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    int pos = snprintf(json, cap, "{\"interfaces\":");
+    pthread_mutex_lock(&sampler_lock);
+    pos += format_interfaces_json(json + pos, cap - pos);
+    pthread_mutex_unlock(&sampler_lock);
+    pos += snprintf(json + pos, cap - pos, ",\"transfers\":");
+    pos += format_transfers_json(json + pos, cap - pos - 2);
+    pos += snprintf(json + pos, cap - pos, "}");
+    send_http_response(sock, 200, "application/json", json, pos);
+    free(json);
+}
+
+// Get downsampled metric history as JSON
+// metric: one of sys_metrics, range: seconds back from now, points: max points returned
+void handle_system_history(int sock, const char *metric, const char *range_str, const char *points_str) {
+    const sys_metric_t *m = NULL;
+    for (size_t i = 0; i < SYS_METRIC_COUNT; i++) {
+        if (metric && strcmp(metric, sys_metrics[i].name) == 0) {
+            m = &sys_metrics[i];
+            break;
+        }
+    }
+    if (!m) {
+        const char *error_msg = "{\"error\":\"Unknown metric\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    
+    long range = range_str ? atol(range_str) : 600;
+    if (range <= 0) range = 600;
+    long max_range = (long)SAMPLER_COARSE_SLOTS * SAMPLER_COARSE_EVERY * SAMPLER_INTERVAL_MS / 1000;
+    if (range > max_range) range = max_range;
+    
+    int max_points = points_str ? atoi(points_str) : 300;
+    if (max_points <= 0) max_points = 300;
+    if (max_points > 1440) max_points = 1440;
+    
+    // Pick the finest ring that covers the requested range
+    long fine_span = (long)SAMPLER_FINE_SLOTS * SAMPLER_INTERVAL_MS / 1000;
+    const sample_ring_t *ring = (range <= fine_span) ? &fine_ring : &coarse_ring;
+    long step_seconds = (ring == &fine_ring) ? SAMPLER_INTERVAL_MS / 1000
+                                             : (long)SAMPLER_COARSE_EVERY * SAMPLER_INTERVAL_MS / 1000;
+    if (step_seconds <= 0) step_seconds = 1;
+    
+    size_t cap = 256 + (size_t)max_points * 48;
+    char *json = malloc(cap);
+    if (!json) {
+        const char *error_msg = "{\"error\":\"Memory error\"}";
+        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    
+    pthread_mutex_lock(&sampler_lock);
+    int wanted = range / step_seconds;
+    if (wanted > ring->count) wanted = ring->count;
+    int first = ring->count - wanted;
+    int per_point = (wanted + max_points - 1) / max_points;
+    if (per_point < 1) per_point = 1;
+    
+    int pos = snprintf(json, cap, "{\"metric\":\"%s\",\"range\":%ld,\"step\":%ld,\"points\":[",
+                       m->name, range, step_seconds * per_point);
+    int emitted = 0;
+    for (int i = first; i < ring->count; i += per_point) {
+        int n = (i + per_point <= ring->count) ? per_point : ring->count - i;
+        unsigned long long sum = 0;
+        for (int k = 0; k < n; k++) {
+            const sys_sample_t *s = sample_ring_at(ring, i + k);
+            sum += *(const unsigned long long *)((const char *)s + m->offset);
+        }
+        const sys_sample_t *last = sample_ring_at(ring, i + n - 1);
+        pos += snprintf(json + pos, cap - pos, "%s[%ld,%llu]",
+                        emitted ? "," : "", (long)last->timestamp, sum / n);
+        emitted++;
+    }
+    pthread_mutex_unlock(&sampler_lock);
+    
+    pos += snprintf(json + pos, cap - pos, "]}");
+    send_http_response(sock, 200, "application/json", json, pos);
+    free(json);
+}
+
+// Handle rename
+void handle_rename(int sock, const char *old_path, const char *new_path) {
+    const char *success_msg = "{\"success\":true}";
+    const char *error_msg = "{\"error\":\"Rename failed\"}";
+    if (rename(old_path, new_path) == 0) {
+        hot_file_invalidate(old_path);
+        hot_file_invalidate(new_path);
+        send_http_response(sock, 200, "application/json", success_msg, strlen(success_msg));
+    } else {
+        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+    }
+}
+
+// Handle copy
+void handle_copy(int sock, const char *src_path, const char *dst_path) {
+    struct stat src_stat;
+    if (stat(src_path, &src_stat) != 0) {
+        char error_msg[256];
+        snprintf(error_msg, sizeof(error_msg), "{\"error\":\"Source not found: %s\"}", src_path);
+        send_http_response(sock, 404, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    
+    // Through a preallocated temp file, so a failed copy never leaves a partial dst
+    int err = copy_file_atomic(src_path, dst_path);
+    if (err == ENOSPC) {
+        const char *error_msg = "{\"error\":\"Not enough free space\"}";
+        send_http_response(sock, 507, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    if (err) {
+        char error_msg[256];
+        snprintf(error_msg, sizeof(error_msg), "{\"error\":\"Cannot create: %s (%s)\"}", dst_path, strerror(err));
+        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    
+    const char *success_msg = "{\"success\":true}";
+    send_http_response(sock, 200, "application/json", success_msg, strlen(success_msg));
+}
+
+// Storage benchmark
+#define BENCH_SEQ_WRITE 0
+#define BENCH_SEQ_READ 1
+#define BENCH_RAND_READ 2
+
+typedef struct {
+    int fd;
+    int mode;
+    size_t block;
+    unsigned long long ops;              // total ops to issue
+    unsigned long long span_blocks;      // random reads pick a block in [0, span_blocks)
+    _Atomic unsigned long long *next;    // shared op counter
+    unsigned long long *lat_us;          // latency of op i, shared
+    unsigned long long deadline_us;
+    unsigned long long seed;
+    unsigned long long bytes;
+    int error;
+} bench_worker_t;
+
+typedef struct {
+    unsigned long long ops;
+    unsigned long long bytes;
+    unsigned long long elapsed_us;
+    unsigned long long p50, p90, p99, p999, max;
+    int error;
+} bench_result_t;
+
+static pthread_mutex_t bench_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void* bench_worker_thread(void* arg) {
+    bench_worker_t *w = (bench_worker_t *)arg;
+    void *buf = NULL;
+    if (posix_memalign(&buf, BENCH_ALIGN, w->block) != 0) {
+        w->error = ENOMEM;
+        return NULL;
+    }
+    // Non-repeating pattern so compressing/deduplicating storage can't cheat
+    unsigned long long x = w->seed | 1;
+    for (size_t i = 0; i < w->block / sizeof(unsigned long long); i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        ((unsigned long long *)buf)[i] = x;
+    }
+    
+    while (1) {
+        unsigned long long op = atomic_fetch_add_explicit(w->next, 1, memory_order_relaxed);
+        if (op >= w->ops) break;
+        
+        off_t offset;
+        if (w->mode == BENCH_RAND_READ) {
+            w->seed ^= w->seed << 13; w->seed ^= w->seed >> 7; w->seed ^= w->seed << 17;
+            offset = (off_t)(w->seed % w->span_blocks) * w->block;
+        } else {
+            offset = (off_t)op * w->block;
+        }
+        
+        unsigned long long t0 = monotonic_us();
+        ssize_t r = (w->mode == BENCH_SEQ_WRITE) ? pwrite(w->fd, buf, w->block, offset)
+                                                 : pread(w->fd, buf, w->block, offset);
+        unsigned long long t1 = monotonic_us();
+        if (r != (ssize_t)w->block) {
+            w->error = r < 0 ? errno : EIO;
+            break;
+        }
+        w->lat_us[op] = t1 - t0 + 1;   // +1 marks the slot as completed
+        w->bytes += r;
+        if (t1 > w->deadline_us) break;
+    }
+    
+    free(buf);
+    return NULL;
+}
+
+int compare_u64(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Run one test with queue_depth worker threads
+void bench_run(int fd, int mode, size_t block, unsigned long long ops, unsigned long long span_blocks,
+               int queue_depth, unsigned long long *lat_us, bench_result_t *res) {
+    memset(res, 0, sizeof(*res));
+    _Atomic unsigned long long next = 0;
+    bench_worker_t workers[BENCH_MAX_QD];
+    pthread_t threads[BENCH_MAX_QD];
+    int started = 0;
+    
+    memset(lat_us, 0, ops * sizeof(unsigned long long));
+    unsigned long long start = monotonic_us();
+    for (int i = 0; i < queue_depth; i++) {
+        bench_worker_t *w = &workers[i];
+        memset(w, 0, sizeof(*w));
+        w->fd = fd;
+        w->mode = mode;
+        w->block = block;
+        w->ops = ops;
+        w->span_blocks = span_blocks;
+        w->next = &next;
+        w->lat_us = lat_us;
+        w->deadline_us = start + BENCH_TEST_SECONDS * 1000000ULL;
+        w->seed = (start ^ ((unsigned long long)i * 0x9E3779B97F4A7C15ULL)) | 1;
+        if (pthread_create(&threads[i], NULL, bench_worker_thread, w) == 0) started++;
+        else break;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        res->bytes += workers[i].bytes;
+        if (workers[i].error && !res->error) res->error = workers[i].error;
+    }
+    if (mode == BENCH_SEQ_WRITE) fsync(fd);
+    res->elapsed_us = monotonic_us() - start;
+    if (started == 0) res->error = EAGAIN;
+    
+    // Compact the completed ops (non-zero slots)
+    unsigned long long done = 0;
+    for (unsigned long long i = 0; i < ops; i++) {
+        if (lat_us[i]) lat_us[done++] = lat_us[i] - 1;
+    }
+    res->ops = res->bytes / block;
+    if (done == 0) return;
+    qsort(lat_us, done, sizeof(unsigned long long), compare_u64);
+    res->p50 = lat_us[done * 50 / 100];
+    res->p90 = lat_us[done * 90 / 100];
+    res->p99 = lat_us[done * 99 / 100];
+    res->p999 = lat_us[done * 999 / 1000];
+    res->max = lat_us[done - 1];
+}
+
+int format_bench_result(char *out, size_t out_len, const char *name, const bench_result_t *r) {
+    double secs = r->elapsed_us ? r->elapsed_us / 1e6 : 1e-6;
+    return snprintf(out, out_len,
+        "\"%s\":{\"mb_s\":%.1f,\"iops\":%.0f,\"ops\":%llu,\"bytes\":%llu,\"seconds\":%.3f,"
+        "\"lat_us\":{\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu},\"error\":%d}",
+        name, r->bytes / secs / (1024.0 * 1024.0), r->ops / secs, r->ops, r->bytes, secs,
+        r->p50, r->p90, r->p99, r->p999, r->max, r->error);
+}
+
+// Sequential write, sequential read and random 4K read against a temp file
+// path: directory on the mount to test, size: test file size (MB),
+// block: sequential block size (KB), qd: worker threads, direct: bypass the cache
+void handle_disk_bench(int sock, const char *path, const char *size_str, const char *block_str,
+                       const char *qd_str, const char *direct_str) {
+    char dir[MAX_PATH];
+    snprintf(dir, sizeof(dir), "%s", (path && *path) ? path : "/data");
+    char file[MAX_PATH];
+    if (snprintf(file, sizeof(file), "%s/.ps5wm_bench_%d.tmp", dir, (int)getpid()) >= (int)sizeof(file)) {
+        const char *error_msg = "{\"error\":\"Path too long\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    
+    // Empty form fields fall back to the defaults
+    unsigned long long size = ((size_str && *size_str) ? strtoull(size_str, NULL, 10) : 256) * 1024ULL * 1024ULL;
+    size_t block = ((block_str && *block_str) ? strtoul(block_str, NULL, 10) : 1024) * 1024;
+    int queue_depth = (qd_str && *qd_str) ? atoi(qd_str) : 4;
+    int direct = (direct_str && *direct_str) ? atoi(direct_str) != 0 : 1;
+    
+    if (block < BENCH_ALIGN || block > 16 * 1024 * 1024 || block % BENCH_ALIGN != 0 ||
+        size < block || size > BENCH_MAX_SIZE || size / block > BENCH_MAX_OPS ||
+        queue_depth < 1 || queue_depth > BENCH_MAX_QD) {
+        const char *error_msg = "{\"error\":\"Invalid size, block or qd\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    size -= size % block;
+    
+    struct statvfs vfs;
+    if (statvfs(dir, &vfs) != 0) {
+        const char *error_msg = "{\"error\":\"Path not found\"}";
+        send_http_response(sock, 404, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    if ((unsigned long long)vfs.f_bavail * vfs.f_frsize < size + 64ULL * 1024 * 1024) {
+        const char *error_msg = "{\"error\":\"Not enough free space\"}";
+        send_http_response(sock, 507, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    
+    if (pthread_mutex_trylock(&bench_lock) != 0) {
+        const char *error_msg = "{\"error\":\"A benchmark is already running\"}";
+        send_http_response(sock, 409, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    
+    int flags = O_RDWR | O_CREAT | O_TRUNC;
+    int fd = -1;
+    if (direct) {
+        fd = open(file, flags | O_DIRECT, 0600);
+        if (fd < 0) direct = 0;   // filesystem without direct I/O - fall back to cached
+    }
+    if (fd < 0) fd = open(file, flags, 0600);
+    
+    unsigned long long seq_ops = size / block;
+    unsigned long long rand_ops = BENCH_RAND_OPS;
+    unsigned long long lat_count = seq_ops > rand_ops ? seq_ops : rand_ops;
+    unsigned long long *lat_us = malloc(lat_count * sizeof(unsigned long long));
+    if (fd < 0 || !lat_us) {
+        if (fd >= 0) { close(fd); unlink(file); }
+        free(lat_us);
+        pthread_mutex_unlock(&bench_lock);
+        char error_msg[256];
+        snprintf(error_msg, sizeof(error_msg), "{\"error\":\"Cannot create test file (errno=%d)\"}", errno);
+        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    
+    bench_result_t seq_write, seq_read, rand_read;
+    bench_run(fd, BENCH_SEQ_WRITE, block, seq_ops, 0, queue_depth, lat_us, &seq_write);
+    
+    // Drop the freshly written pages so the reads hit the device
+    if (!direct) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    
+    // Reads only cover what the write phase managed to lay down
+    unsigned long long written_blocks = seq_write.bytes / block;
+    if (written_blocks > 0) {
+        bench_run(fd, BENCH_SEQ_READ, block, written_blocks, 0, queue_depth, lat_us, &seq_read);
+    } else {
+        memset(&seq_read, 0, sizeof(seq_read));
+    }
+    
+    if (!direct) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    unsigned long long span4k = seq_write.bytes / BENCH_ALIGN;
+    if (span4k > 0) {
+        bench_run(fd, BENCH_RAND_READ, BENCH_ALIGN, rand_ops, span4k, queue_depth, lat_us, &rand_read);
+    } else {
+        memset(&rand_read, 0, sizeof(rand_read));
+    }
+    
+    close(fd);
+    unlink(file);
+    free(lat_us);
+    pthread_mutex_unlock(&bench_lock);
+    
+    char json[4096];
+    char escaped_dir[MAX_PATH * 2];
+    json_escape(escaped_dir, sizeof(escaped_dir), dir);
+    int pos = snprintf(json, sizeof(json),
+        "{\"path\":\"%s\",\"file_size\":%llu,\"block\":%zu,\"queue_depth\":%d,\"direct\":%s,",
+        escaped_dir, size, block, queue_depth, direct ? "true" : "false");
+    pos += format_bench_result(json + pos, sizeof(json) - pos, "seq_write", &seq_write);
+    pos += snprintf(json + pos, sizeof(json) - pos, ",");
+    pos += format_bench_result(json + pos, sizeof(json) - pos, "seq_read", &seq_read);
+    pos += snprintf(json + pos, sizeof(json) - pos, ",");
+    pos += format_bench_result(json + pos, sizeof(json) - pos, "rand_read_4k", &rand_read);
+    pos += snprintf(json + pos, sizeof(json) - pos, "}");
+    send_http_response(sock, 200, "application/json", json, pos);
+}
+
+// File hashing
+// CRC32C and the XXH64 tree hash split the file into HASH_CHUNK leaves that
+// HASH_WORKERS threads hash independently before the leaves are combined.
+// SHA-256 can't be split, so a read-ahead thread keeps HASH_PIPE_DEPTH chunks
+// in flight while the caller hashes.
+static const char *hash_algo_names[HASH_ALGO_COUNT] = { "sha256", "crc32c", "xxh64tree" };
+
+static metric_counter_t hash_bytes_total;
+static metric_counter_t hash_cache_hits;
+static metric_counter_t dedup_bytes_saved;
+
+int hash_algo_from_name(const char *name) {
+    for (int i = 0; i < HASH_ALGO_COUNT; i++) {
+        if (strcmp(name, hash_algo_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+void hex_encode(char *dst, const unsigned char *src, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+        dst[i * 2] = hex[src[i] >> 4];
+        dst[i * 2 + 1] = hex[src[i] & 15];
+    }
+    dst[len * 2] = '\0';
+}
+
+// CRC32C (Castagnoli), zlib crc32() calling convention: start with 0, chain results.
+// Uses the SSE4.2 crc32 instruction when cpuid reports it, slicing-by-8 otherwise.
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32c_x2n[32];         // x^(2^n) mod P, for combining
+static int crc32c_have_hw;
+static int sha256_have_hw;
+static pthread_once_t hash_once = PTHREAD_ONCE_INIT;
+
+// a * b mod P (bit-reflected); a must be non-zero
+static uint32_t crc32c_multmodp(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31, p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+// Tables and CPU feature detection, run once
+static void hash_init(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crc32c_table[0][n] = c;
+    }
+    for (int n = 0; n < 256; n++) {
+        for (int t = 1; t < 8; t++) {
+            uint32_t prev = crc32c_table[t - 1][n];
+            crc32c_table[t][n] = (prev >> 8) ^ crc32c_table[0][prev & 0xff];
+        }
+    }
+    uint32_t p = 1u << 30;
+    crc32c_x2n[0] = p;
+    for (int n = 1; n < 32; n++) crc32c_x2n[n] = p = crc32c_multmodp(p, p);
+#if defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        crc32c_have_hw = (ecx & bit_SSE4_2) != 0;
+        int have_sse41 = (ecx & bit_SSE4_1) != 0;
+        if (have_sse41 && __get_cpuid_max(0, NULL) >= 7 && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+            sha256_have_hw = (ebx & bit_SHA) != 0;
+        }
+    }
+#endif
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len) {
+    while (len && ((uintptr_t)p & 7)) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        w ^= crc;
+        crc = crc32c_table[7][w & 0xff] ^ crc32c_table[6][(w >> 8) & 0xff] ^
+              crc32c_table[5][(w >> 16) & 0xff] ^ crc32c_table[4][(w >> 24) & 0xff] ^
+              crc32c_table[3][(w >> 32) & 0xff] ^ crc32c_table[2][(w >> 40) & 0xff] ^
+              crc32c_table[1][(w >> 48) & 0xff] ^ crc32c_table[0][w >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t c = crc;
+    while (len && ((uintptr_t)p & 7)) {
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        c = _mm_crc32_u64(c, w);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) c = _mm_crc32_u8((uint32_t)c, *p++);
+    return (uint32_t)c;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+    pthread_once(&hash_once, hash_init);
+#if defined(__x86_64__)
+    if (crc32c_have_hw) return ~crc32c_hw(~crc, buf, len);
+#endif
+    return ~crc32c_sw(~crc, buf, len);
+}
+
+// Operator that appends len zero bytes; crc32c(A||B) = shift(len(B)) * crc(A) ^ crc(B)
+uint32_t crc32c_shift(unsigned long long len) {
+    pthread_once(&hash_once, hash_init);
+    uint32_t p = 1u << 31;
+    for (unsigned k = 3; len; len >>= 1, k++) {
+        if (len & 1) p = crc32c_multmodp(crc32c_x2n[k & 31], p);
+    }
+    return p;
+}
+
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, unsigned long long len2) {
+    return crc32c_multmodp(crc32c_shift(len2), crc1) ^ crc2;
+}
+
+// XXH64 (one-shot)
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t xxh_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_P2;
+    return xxh_rotl(acc, 31) * XXH_P1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+uint64_t xxh64(const void *input, size_t len, uint64_t seed) {
+    const unsigned char *p = input, *end = p + len;
+    uint64_t h;
+    
+    if (len >= 32) {
+        const unsigned char *limit = end - 32;
+        uint64_t v1 = seed + XXH_P1 + XXH_P2, v2 = seed + XXH_P2, v3 = seed, v4 = seed - XXH_P1;
+        do {
+            v1 = xxh_round(v1, xxh_read64(p));
+            v2 = xxh_round(v2, xxh_read64(p + 8));
+            v3 = xxh_round(v3, xxh_read64(p + 16));
+            v4 = xxh_round(v4, xxh_read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + XXH_P5;
+    }
+    h += len;
+    
+    while (p + 8 <= end) {
+        h ^= xxh_round(0, xxh_read64(p));
+        h = xxh_rotl(h, 27) * XXH_P1 + XXH_P4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        h ^= (uint64_t)v * XXH_P1;
+        h = xxh_rotl(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p++) * XXH_P5;
+        h = xxh_rotl(h, 11) * XXH_P1;
+    }
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// SHA-256 (SHA extensions when available, portable rounds otherwise)
+typedef struct {
+    uint32_t state[8];
+    unsigned long long bytes;
+    unsigned char block[64];
+    size_t fill;
+} sha256_ctx_t;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_compress(uint32_t *state, const unsigned char *block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+               (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = SHA_ROTR(w[i - 15], 7) ^ SHA_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = SHA_ROTR(w[i - 2], 17) ^ SHA_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (SHA_ROTR(e, 6) ^ SHA_ROTR(e, 11) ^ SHA_ROTR(e, 25)) + ((e & f) ^ (~e & g)) +
+                      sha256_k[i] + w[i];
+        uint32_t t2 = (SHA_ROTR(a, 2) ^ SHA_ROTR(a, 13) ^ SHA_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+#if defined(__x86_64__)
+// SHA extensions: two rounds per sha256rnds2, message schedule via sha256msg1/2
+__attribute__((target("sha,sse4.1")))
+static void sha256_compress_hw(uint32_t *state, const unsigned char *data, size_t blocks) {
+    const __m128i byteswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);       // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);             // CDGH
+    
+    for (; blocks; blocks--, data += 64) {
+        __m128i abef = state0, cdgh = state1;
+        __m128i w[4];
+        for (int i = 0; i < 4; i++) {
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + i * 16)), byteswap);
+        }
+        for (int i = 0; i < 16; i++) {
+            __m128i msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)&sha256_k[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+            if (i < 12) {
+                __m128i x = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                x = _mm_add_epi32(x, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(x, w[(i + 3) & 3]);
+            }
+        }
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+    
+    tmp = _mm_shuffle_epi32(state0, 0x1B);                   // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);                // DCHG
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+#endif
+
+static void sha256_blocks(uint32_t *state, const unsigned char *data, size_t blocks) {
+#if defined(__x86_64__)
+    if (sha256_have_hw) {
+        sha256_compress_hw(state, data, blocks);
+        return;
+    }
+#endif
+    for (; blocks; blocks--, data += 64) sha256_compress(state, data);
+}
+
+void sha256_init(sha256_ctx_t *ctx) {
+    pthread_once(&hash_once, hash_init);
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, iv, sizeof(iv));
+    ctx->bytes = 0;
+    ctx->fill = 0;
+}
+
+void sha256_update(sha256_ctx_t *ctx, const void *data, size_t len) {
+    const unsigned char *p = data;
+    ctx->bytes += len;
+    if (ctx->fill) {
+        size_t take = 64 - ctx->fill < len ? 64 - ctx->fill : len;
+        memcpy(ctx->block + ctx->fill, p, take);
+        ctx->fill += take;
+        p += take;
+        len -= take;
+        if (ctx->fill < 64) return;
+        sha256_blocks(ctx->state, ctx->block, 1);
+        ctx->fill = 0;
+    }
+    sha256_blocks(ctx->state, p, len / 64);
+    p += len & ~(size_t)63;
+    len &= 63;
+    memcpy(ctx->block, p, len);
+    ctx->fill = len;
+}
+
+void sha256_final(sha256_ctx_t *ctx, unsigned char *out) {
+    unsigned long long bits = ctx->bytes * 8;
+    ctx->block[ctx->fill++] = 0x80;
+    if (ctx->fill > 56) {
+        memset(ctx->block + ctx->fill, 0, 64 - ctx->fill);
+        sha256_blocks(ctx->state, ctx->block, 1);
+        ctx->fill = 0;
+    }
+    memset(ctx->block + ctx->fill, 0, 56 - ctx->fill);
+    for (int i = 0; i < 8; i++) ctx->block[56 + i] = (unsigned char)(bits >> (56 - i * 8));
+    sha256_blocks(ctx->state, ctx->block, 1);
+    for (int i = 0; i < 8; i++) {
+        out[i * 4] = ctx->state[i] >> 24;
+        out[i * 4 + 1] = ctx->state[i] >> 16;
+        out[i * 4 + 2] = ctx->state[i] >> 8;
+        out[i * 4 + 3] = ctx->state[i];
+    }
+}
+
+// Read exactly len bytes at offset (short only at EOF); returns bytes read or -1
+ssize_t pread_full(int fd, void *buf, size_t len, off_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t r = pread(fd, (char *)buf + done, len - done, offset + done);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0) return -1;
+        if (r == 0) break;
+        done += r;
+    }
+    return done;
+}
+
+// Parallel leaf hashing for CRC32C / XXH64 tree
+typedef struct {
+    int fd;
+    int algo;
+    unsigned long long size;
+    unsigned long long chunks;
+    _Atomic unsigned long long next;
+    unsigned long long *leaves;
+    _Atomic unsigned long long *progress;   // optional
+    atomic_int *cancel;                     // optional
+    atomic_int error;
+} hash_tree_t;
+
+void* hash_tree_worker(void* arg) {
+    hash_tree_t *t = (hash_tree_t *)arg;
+    unsigned char *buf = malloc(HASH_CHUNK);
+    if (!buf) {
+        atomic_store(&t->error, ENOMEM);
+        return NULL;
+    }
+    while (!atomic_load(&t->error)) {
+        if (t->cancel && atomic_load(t->cancel)) {
+            atomic_store(&t->error, ECANCELED);
+            break;
+        }
+        unsigned long long i = atomic_fetch_add(&t->next, 1);
+        if (i >= t->chunks) break;
+        off_t offset = (off_t)(i * HASH_CHUNK);
+        size_t len = t->size - offset < HASH_CHUNK ? t->size - offset : HASH_CHUNK;
+        ssize_t r = pread_full(t->fd, buf, len, offset);
+        if (r != (ssize_t)len) {
+            atomic_store(&t->error, r < 0 ? errno : EIO);   // EIO: file shrank
+            break;
+        }
+        t->leaves[i] = (t->algo == HASH_CRC32C) ? crc32c(0, buf, len) : xxh64(buf, len, 0);
+        if (t->progress) atomic_fetch_add(t->progress, len);
+    }
+    free(buf);
+    return NULL;
+}
+
+// CRC32C: leaves combined into the CRC of the whole file (identical to a serial CRC).
+// xxh64tree: XXH64 of the little-endian 64-bit XXH64 digests of each 4 MiB
+// chunk, seeded with the file size.
+int hash_fd_tree(int fd, unsigned long long size, int algo, char *digest,
+                 _Atomic unsigned long long *progress, atomic_int *cancel) {
+    hash_tree_t t;
+    memset(&t, 0, sizeof(t));
+    t.fd = fd;
+    t.algo = algo;
+    t.size = size;
+    t.chunks = (size + HASH_CHUNK - 1) / HASH_CHUNK;
+    t.progress = progress;
+    t.cancel = cancel;
+    t.leaves = calloc(t.chunks ? t.chunks : 1, sizeof(unsigned long long));
+    if (!t.leaves) return ENOMEM;
+    
+    pthread_t threads[HASH_WORKERS];
+    int workers = t.chunks < HASH_WORKERS ? (int)t.chunks : HASH_WORKERS;
+    int started = 0;
+    for (int i = 1; i < workers; i++) {
+        if (pthread_create(&threads[started], NULL, hash_tree_worker, &t) == 0) started++;
+    }
+    hash_tree_worker(&t);
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    
+    int err = atomic_load(&t.error);
+    if (!err && algo == HASH_CRC32C) {
+        uint32_t crc = 0;
+        uint32_t chunk_shift = crc32c_shift(HASH_CHUNK);
+        for (unsigned long long i = 0; i < t.chunks; i++) {
+            size_t len = size - i * HASH_CHUNK < HASH_CHUNK ? size - i * HASH_CHUNK : HASH_CHUNK;
+            crc = (len == HASH_CHUNK ? crc32c_multmodp(chunk_shift, crc) : crc32c_combine(crc, 0, len)) ^
+                  (uint32_t)t.leaves[i];
+        }
+        sprintf(digest, "%08x", crc);
+    } else if (!err) {
+        unsigned char *packed = malloc(t.chunks * 8 + 1);
+        if (!packed) {
+            err = ENOMEM;
+        } else {
+            for (unsigned long long i = 0; i < t.chunks; i++) {
+                for (int b = 0; b < 8; b++) packed[i * 8 + b] = (unsigned char)(t.leaves[i] >> (b * 8));
+            }
+            sprintf(digest, "%016llx", (unsigned long long)xxh64(packed, t.chunks * 8, size));
+            free(packed);
+        }
+    }
+    free(t.leaves);
+    return err;
+}
+
+// Read-ahead pipeline for SHA-256
+typedef struct {
+    int fd;
+    unsigned long long size;
+    unsigned char *bufs[HASH_PIPE_DEPTH];
+    size_t lens[HASH_PIPE_DEPTH];
+    int head, count;
+    int done, stop, error;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} hash_pipe_t;
+
+void* hash_reader_thread(void* arg) {
+    hash_pipe_t *pipe = (hash_pipe_t *)arg;
+    unsigned long long offset = 0;
+    int slot = 0;
+    while (offset < pipe->size) {
+        pthread_mutex_lock(&pipe->lock);
+        while (pipe->count == HASH_PIPE_DEPTH && !pipe->stop) pthread_cond_wait(&pipe->cond, &pipe->lock);
+        int stop = pipe->stop;
+        pthread_mutex_unlock(&pipe->lock);
+        if (stop) break;
+        
+        size_t len = pipe->size - offset < HASH_CHUNK ? pipe->size - offset : HASH_CHUNK;
+        ssize_t r = pread_full(pipe->fd, pipe->bufs[slot], len, offset);
+        pthread_mutex_lock(&pipe->lock);
+        if (r != (ssize_t)len) {
+            pipe->error = r < 0 ? errno : EIO;
+            pthread_cond_broadcast(&pipe->cond);
+            pthread_mutex_unlock(&pipe->lock);
+            return NULL;
+        }
+        pipe->lens[slot] = len;
+        pipe->count++;
+        pthread_cond_broadcast(&pipe->cond);
+        pthread_mutex_unlock(&pipe->lock);
+        slot = (slot + 1) % HASH_PIPE_DEPTH;
+        offset += len;
+    }
+    pthread_mutex_lock(&pipe->lock);
+    pipe->done = 1;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->lock);
+    return NULL;
+}
+
+int hash_fd_sha256(int fd, unsigned long long size, char *digest,
+                   _Atomic unsigned long long *progress, atomic_int *cancel) {
+    hash_pipe_t pipe;
+    memset(&pipe, 0, sizeof(pipe));
+    pipe.fd = fd;
+    pipe.size = size;
+    for (int i = 0; i < HASH_PIPE_DEPTH; i++) {
+        pipe.bufs[i] = malloc(HASH_CHUNK);
+        if (!pipe.bufs[i]) {
+            for (int j = 0; j < i; j++) free(pipe.bufs[j]);
+            return ENOMEM;
+        }
+    }
+    pthread_mutex_init(&pipe.lock, NULL);
+    pthread_cond_init(&pipe.cond, NULL);
+    
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    int err = 0;
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, hash_reader_thread, &pipe) != 0) {
+        err = EAGAIN;
+    } else {
+        while (1) {
+            pthread_mutex_lock(&pipe.lock);
+            while (pipe.count == 0 && !pipe.done && !pipe.error) pthread_cond_wait(&pipe.cond, &pipe.lock);
+            if (pipe.count == 0) {
+                err = pipe.error;
+                pthread_mutex_unlock(&pipe.lock);
+                break;
+            }
+            int slot = pipe.head;
+            pthread_mutex_unlock(&pipe.lock);
+            
+            sha256_update(&ctx, pipe.bufs[slot], pipe.lens[slot]);
+            if (progress) atomic_fetch_add(progress, pipe.lens[slot]);
+            
+            pthread_mutex_lock(&pipe.lock);
+            pipe.head = (pipe.head + 1) % HASH_PIPE_DEPTH;
+            pipe.count--;
+            if (cancel && atomic_load(cancel)) {
+                err = ECANCELED;
+                pipe.stop = 1;
+            }
+            pthread_cond_broadcast(&pipe.cond);
+            pthread_mutex_unlock(&pipe.lock);
+            if (err) break;
+        }
+        pthread_join(reader, NULL);
+    }
+    
+    if (!err) {
+        unsigned char out[32];
+        sha256_final(&ctx, out);
+        hex_encode(digest, out, sizeof(out));
+    }
+    for (int i = 0; i < HASH_PIPE_DEPTH; i++) free(pipe.bufs[i]);
+    pthread_mutex_destroy(&pipe.lock);
+    pthread_cond_destroy(&pipe.cond);
+    return err;
+}
+
+// Hash cache
+// Digests keyed by (dev, ino, size, mtime, algo). Entries live in a fixed
+// table with LRU replacement and are appended to HASH_CACHE_PATH as they are
+// computed; the file is rewritten from the table once it holds twice as many
+// lines as the table. Lookups go through a chained index on (dev, ino), so
+// per-download and per-manifest-entry queries touch a handful of entries
+// instead of the whole table.
+typedef struct {
+    unsigned long long dev, ino, size;
+    long long mtime_sec;
+    long mtime_nsec;
+    int algo;
+    char digest[HASH_DIGEST_MAX];
+    char *path;                     // path the digest was computed for
+    unsigned long long last_used;   // 0 marks a free slot
+    int next;                       // next entry in the same bucket + 1, 0 at the end
+} hash_cache_entry_t;
+
+static hash_cache_entry_t hash_cache[HASH_CACHE_SLOTS];
+static int hash_cache_buckets[HASH_CACHE_BUCKETS];     // first entry + 1, 0 when empty
+static unsigned long long hash_cache_clock;
+static int hash_cache_file_lines;
+static pthread_mutex_t hash_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int hash_cache_match(const hash_cache_entry_t *e, const struct stat *st, int algo) {
+    return e->last_used && e->algo == algo && e->ino == (unsigned long long)st->st_ino &&
+           e->dev == (unsigned long long)st->st_dev && e->size == (unsigned long long)st->st_size &&
+           e->mtime_sec == (long long)st->st_mtim.tv_sec && e->mtime_nsec == st->st_mtim.tv_nsec;
+}
+
+static unsigned int hash_cache_bucket(unsigned long long dev, unsigned long long ino) {
+    return (unsigned int)(((ino ^ dev * 0x9E3779B97F4A7C15ULL) * 0x9E3779B97F4A7C15ULL) >> 40) & (HASH_CACHE_BUCKETS - 1);
+}
+
+// First entry for (dev, ino), -1 if none (caller holds hash_cache_lock)
+static int hash_cache_first_locked(unsigned long long dev, unsigned long long ino) {
+    return hash_cache_buckets[hash_cache_bucket(dev, ino)] - 1;
+}
+
+static void hash_cache_unlink_locked(hash_cache_entry_t *e) {
+    int *link = &hash_cache_buckets[hash_cache_bucket(e->dev, e->ino)];
+    int index = (int)(e - hash_cache);
+    while (*link && *link - 1 != index) link = &hash_cache[*link - 1].next;
+    if (*link) *link = e->next;
+}
+
+// Caller holds hash_cache_lock
+static hash_cache_entry_t* hash_cache_insert_locked(unsigned long long dev, unsigned long long ino,
+                                                    unsigned long long size, long long mtime_sec,
+                                                    long mtime_nsec, int algo, const char *digest,
+                                                    const char *path) {
+    hash_cache_entry_t *slot = NULL;
+    for (int i = hash_cache_first_locked(dev, ino); i >= 0; i = hash_cache[i].next - 1) {
+        hash_cache_entry_t *e = &hash_cache[i];
+        if (e->dev == dev && e->ino == ino && e->algo == algo) {
+            slot = e;   // same file, older version
+            break;
+        }
+    }
+    if (!slot) {
+        for (int i = 0; i < HASH_CACHE_SLOTS; i++) {
+            hash_cache_entry_t *e = &hash_cache[i];
+            if (!slot || e->last_used < slot->last_used) slot = e;
+            if (!e->last_used) break;
+        }
+        if (slot->last_used) hash_cache_unlink_locked(slot);
+        int *head = &hash_cache_buckets[hash_cache_bucket(dev, ino)];
+        slot->next = *head;
+        *head = (int)(slot - hash_cache) + 1;
+    }
+    free(slot->path);
+    slot->dev = dev;
+    slot->ino = ino;
+    slot->size = size;
+    slot->mtime_sec = mtime_sec;
+    slot->mtime_nsec = mtime_nsec;
+    slot->algo = algo;
+    snprintf(slot->digest, sizeof(slot->digest), "%s", digest);
+    slot->path = strdup(path);
+    slot->last_used = ++hash_cache_clock;
+    return slot;
+}
+
+static int hash_cache_write_entry(FILE *f, const hash_cache_entry_t *e) {
+    if (!e->path || strchr(e->path, '\n')) return 0;
+    return fprintf(f, "%llu %llu %llu %lld %ld %s %s %s\n", e->dev, e->ino, e->size, e->mtime_sec,
+                   e->mtime_nsec, hash_algo_names[e->algo], e->digest, e->path) > 0;
+}
+
+// Rewrite the cache file from the table (caller holds hash_cache_lock)
+static void hash_cache_compact_locked(void) {
+    FILE *f = fopen(HASH_CACHE_PATH ".tmp", "w");
+    if (!f) return;
+    int lines = 0;
+    for (int i = 0; i < HASH_CACHE_SLOTS; i++) {
+        if (hash_cache[i].last_used) lines += hash_cache_write_entry(f, &hash_cache[i]);
+    }
+    if (fclose(f) == 0 && rename(HASH_CACHE_PATH ".tmp", HASH_CACHE_PATH) == 0) {
+        hash_cache_file_lines = lines;
+    }
+}
+
+void hash_cache_load(void) {
+    FILE *f = fopen(HASH_CACHE_PATH, "r");
+    if (!f) return;
+    char line[MAX_PATH + 256];
+    pthread_mutex_lock(&hash_cache_lock);
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long dev, ino, size;
+        long long mtime_sec;
+        long mtime_nsec;
+        char algo[16], digest[HASH_DIGEST_MAX];
+        int path_at = 0;
+        hash_cache_file_lines++;
+        if (sscanf(line, "%llu %llu %llu %lld %ld %15s %64s %n", &dev, &ino, &size, &mtime_sec,
+                   &mtime_nsec, algo, digest, &path_at) < 7 || path_at == 0) continue;
+        int algo_id = hash_algo_from_name(algo);
+        if (algo_id < 0) continue;
+        line[strcspn(line, "\n")] = '\0';
+        hash_cache_insert_locked(dev, ino, size, mtime_sec, mtime_nsec, algo_id, digest, line + path_at);
+    }
+    pthread_mutex_unlock(&hash_cache_lock);
+    fclose(f);
+}
+
+int hash_cache_lookup(const struct stat *st, int algo, char *digest) {
+    int hit = 0;
+    pthread_mutex_lock(&hash_cache_lock);
+    for (int i = hash_cache_first_locked(st->st_dev, st->st_ino); i >= 0; i = hash_cache[i].next - 1) {
+        if (hash_cache_match(&hash_cache[i], st, algo)) {
+            hash_cache[i].last_used = ++hash_cache_clock;
+            strcpy(digest, hash_cache[i].digest);
+            hit = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&hash_cache_lock);
+    if (hit) metric_counter_add(&hash_cache_hits, 1);
+    return hit;
+}
+
+// Every cached digest of an unchanged file, for headers and manifests: bit
+// (1 << algo) of the result is set for each digests[algo] filled in. Not
+// counted as a hash cache hit, as no hash was asked for.
+int hash_cache_peek(const struct stat *st, char (*digests)[HASH_DIGEST_MAX]) {
+    int found = 0;
+    pthread_mutex_lock(&hash_cache_lock);
+    for (int i = hash_cache_first_locked(st->st_dev, st->st_ino); i >= 0; i = hash_cache[i].next - 1) {
+        hash_cache_entry_t *e = &hash_cache[i];
+        if (hash_cache_match(e, st, e->algo)) {
+            e->last_used = ++hash_cache_clock;
+            strcpy(digests[e->algo], e->digest);
+            found |= 1 << e->algo;
+        }
+    }
+    pthread_mutex_unlock(&hash_cache_lock);
+    return found;
+}
+
+// Paths of cached files with the given content, at most max of them. Entries
+// may be stale; callers confirm each path with stat() and hash_cache_lookup().
+int hash_cache_find_digest(int algo, unsigned long long size, const char *digest,
+                           char (*paths)[MAX_PATH], int max) {
+    int count = 0;
+    pthread_mutex_lock(&hash_cache_lock);
+    for (int i = 0; i < HASH_CACHE_SLOTS && count < max; i++) {
+        hash_cache_entry_t *e = &hash_cache[i];
+        if (e->last_used && e->algo == algo && e->size == size && e->path && strcmp(e->digest, digest) == 0) {
+            snprintf(paths[count++], MAX_PATH, "%s", e->path);
+        }
+    }
+    pthread_mutex_unlock(&hash_cache_lock);
+    return count;
+}
+
+void hash_cache_store(const struct stat *st, int algo, const char *digest, const char *path) {
+    pthread_mutex_lock(&hash_cache_lock);
+    hash_cache_entry_t *e = hash_cache_insert_locked(st->st_dev, st->st_ino, st->st_size,
+                                                     st->st_mtim.tv_sec, st->st_mtim.tv_nsec,
+                                                     algo, digest, path);
+    if (hash_cache_file_lines >= 2 * HASH_CACHE_SLOTS) {
+        hash_cache_compact_locked();
+    } else {
+        FILE *f = fopen(HASH_CACHE_PATH, "a");
+        if (f) {
+            hash_cache_file_lines += hash_cache_write_entry(f, e);
+            fclose(f);
+        }
+    }
+    pthread_mutex_unlock(&hash_cache_lock);
+}
+
+// Hash a regular file, answering from the cache when the file is unchanged.
+// Returns 0 or an errno value; st receives the file's metadata.
+int hash_path(const char *path, int algo, char *digest, struct stat *st, int *cached,
+              _Atomic unsigned long long *progress, atomic_int *cancel) {
+    *cached = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return errno;
+    if (fstat(fd, st) != 0 || !S_ISREG(st->st_mode)) {
+        close(fd);
+        return EISDIR;
+    }
+    if (hash_cache_lookup(st, algo, digest)) {
+        *cached = 1;
+        close(fd);
+        return 0;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    
+    int err = (algo == HASH_SHA256) ? hash_fd_sha256(fd, st->st_size, digest, progress, cancel)
+                                    : hash_fd_tree(fd, st->st_size, algo, digest, progress, cancel);
+    if (!err) {
+        metric_counter_add(&hash_bytes_total, st->st_size);
+        // Only cache if the file wasn't modified while we read it
+        struct stat after;
+        if (fstat(fd, &after) == 0 && after.st_size == st->st_size &&
+            after.st_mtim.tv_sec == st->st_mtim.tv_sec && after.st_mtim.tv_nsec == st->st_mtim.tv_nsec) {
+            hash_cache_store(st, algo, digest, path);
+        }
+    }
+    close(fd);
+    return err;
+}
+
+// Background jobs
+// Long operations run on their own detached thread and publish progress in a
+// slot here. Finished jobs stay visible until the slot is reused (oldest first).
+typedef enum { JOB_FREE, JOB_RUNNING, JOB_DONE, JOB_FAILED, JOB_CANCELLED } job_state_t;
+
+static const char *job_state_names[] = { "free", "running", "done", "failed", "cancelled" };
+
+typedef struct {
+    unsigned int id;
+    job_state_t state;              // guarded by job_lock
+    char kind[16];
+    char path[MAX_PATH];
+    _Atomic unsigned long long progress;
+    unsigned long long total;
+    atomic_int cancel;
+    unsigned long long start_us;
+    unsigned long long end_us;
+    char result[JOB_RESULT_MAX];    // JSON value, set when finished
+} job_t;
+
+static job_t jobs[JOB_SLOTS];
+static unsigned int job_next_id = 1;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Claim a slot; NULL if every slot holds a running job
+job_t* job_create(const char *kind, const char *path, unsigned long long total) {
+    job_t *job = NULL;
+    pthread_mutex_lock(&job_lock);
+    for (int i = 0; i < JOB_SLOTS; i++) {
+        job_t *j = &jobs[i];
+        if (j->state == JOB_RUNNING) continue;
+        if (!job || j->state == JOB_FREE || (job->state != JOB_FREE && j->id < job->id)) job = j;
+    }
+    if (job) {
+        job->id = job_next_id++;
+        job->state = JOB_RUNNING;
+        snprintf(job->kind, sizeof(job->kind), "%s", kind);
+        snprintf(job->path, sizeof(job->path), "%s", path);
+        atomic_store(&job->progress, 0);
+        job->total = total;
+        atomic_store(&job->cancel, 0);
+        job->start_us = monotonic_us();
+        job->end_us = 0;
+        strcpy(job->result, "null");
+    }
+    pthread_mutex_unlock(&job_lock);
+    return job;
+}
+
+// Publish the outcome; the job thread must not touch the slot afterwards
+void job_finish(job_t *job, job_state_t state, const char *result_json) {
+    pthread_mutex_lock(&job_lock);
+    snprintf(job->result, sizeof(job->result), "%s", result_json ? result_json : "null");
+    job->end_us = monotonic_us();
+    job->state = state;
+    pthread_mutex_unlock(&job_lock);
+}
+
+// Run fn(arg) on a detached thread
+int job_spawn(void *(*fn)(void *), void *arg) {
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&thread, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+    return err;
+}
+
+// Caller holds job_lock
+int format_job_json(char *out, size_t out_len, const job_t *job) {
+    char path[MAX_PATH * 2];
+    json_escape(path, sizeof(path), job->path);
+    unsigned long long end = job->end_us ? job->end_us : monotonic_us();
+    return snprintf(out, out_len,
+        "{\"id\":%u,\"kind\":\"%s\",\"state\":\"%s\",\"path\":\"%s\",\"progress\":%llu,\"total\":%llu,"
+        "\"elapsed_ms\":%llu,\"result\":%s}",
+        job->id, job->kind, job_state_names[job->state], path,
+        (unsigned long long)atomic_load(&job->progress), job->total,
+        (end - job->start_us) / 1000, job->result);
+}
+
+// List jobs, or one job with ?id=
+void handle_jobs(int sock, const char *id_str) {
+    size_t cap = JOB_SLOTS * (MAX_PATH * 2 + JOB_RESULT_MAX + 256) + 64;
+    char *json = malloc(cap);
+    if (!json) {
+        send_http_response(sock, 500, "text/plain", "Memory error", 12);
+        return;
+    }
+    unsigned int id = id_str ? (unsigned int)strtoul(id_str, NULL, 10) : 0;
+    int pos = 0, found = 0;
+    
+    pthread_mutex_lock(&job_lock);
+    if (!id) pos += snprintf(json + pos, cap - pos, "{\"jobs\":[");
+    for (int i = 0; i < JOB_SLOTS; i++) {
+        const job_t *job = &jobs[i];
+        if (job->state == JOB_FREE || (id && job->id != id)) continue;
+        if (found++) json[pos++] = ',';
+        pos += format_job_json(json + pos, cap - pos, job);
+    }
+    if (!id) pos += snprintf(json + pos, cap - pos, "]}");
+    pthread_mutex_unlock(&job_lock);
+    
+    if (id && !found) {
+        const char *error_msg = "{\"error\":\"No such job\"}";
+        send_http_response(sock, 404, "application/json", error_msg, strlen(error_msg));
+    } else {
+        send_http_response(sock, 200, "application/json", json, pos);
+    }
+    free(json);
+}
+
+void handle_job_cancel(int sock, const char *id_str) {
+    unsigned int id = id_str ? (unsigned int)strtoul(id_str, NULL, 10) : 0;
+    int found = 0;
+    pthread_mutex_lock(&job_lock);
+    for (int i = 0; i < JOB_SLOTS; i++) {
+        if (jobs[i].state == JOB_RUNNING && jobs[i].id == id) {
+            atomic_store(&jobs[i].cancel, 1);
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&job_lock);
+    
+    if (found) {
+        const char *success_msg = "{\"success\":true}";
+        send_http_response(sock, 200, "application/json", success_msg, strlen(success_msg));
+    } else {
+        const char *error_msg = "{\"error\":\"No running job with that id\"}";
+        send_http_response(sock, 404, "application/json", error_msg, strlen(error_msg));
+    }
+}
+
+// Hash endpoint
+typedef struct {
+    job_t *job;
+    int algo;
+} hash_job_t;
+
+int format_hash_result(char *out, size_t out_len, const char *path, int algo, const char *digest,
+                       const struct stat *st, int cached, unsigned long long elapsed_us) {
+    char escaped[MAX_PATH * 2];
+    json_escape(escaped, sizeof(escaped), path);
+    double secs = elapsed_us ? elapsed_us / 1e6 : 1e-6;
+    return snprintf(out, out_len,
+        "{\"path\":\"%s\",\"algo\":\"%s\",\"digest\":\"%s\",\"size\":%llu,\"cached\":%s,"
+        "\"elapsed_ms\":%llu,\"mb_s\":%.1f}",
+        escaped, hash_algo_names[algo], digest, (unsigned long long)st->st_size,
+        cached ? "true" : "false", elapsed_us / 1000,
+        cached ? 0.0 : st->st_size / secs / (1024.0 * 1024.0));
+}
+
+void* hash_job_thread(void* arg) {
+    hash_job_t *req = (hash_job_t *)arg;
+    job_t *job = req->job;
+    char digest[HASH_DIGEST_MAX];
+    char result[JOB_RESULT_MAX];
+    struct stat st;
+    int cached;
+    unsigned long long start = monotonic_us();
+    
+    int err = hash_path(job->path, req->algo, digest, &st, &cached, &job->progress, &job->cancel);
+    if (err == 0) {
+        format_hash_result(result, sizeof(result), job->path, req->algo, digest, &st, cached,
+                           monotonic_us() - start);
+        job_finish(job, JOB_DONE, result);
+    } else {
+        snprintf(result, sizeof(result), "{\"error\":\"%s\"}", strerror(err));
+        job_finish(job, err == ECANCELED ? JOB_CANCELLED : JOB_FAILED, result);
+    }
+    free(req);
+    return NULL;
+}
+
+// Hash a file: algo=sha256|crc32c|xxh64tree. Files of HASH_ASYNC_THRESHOLD
+// bytes or more (or async=1) run as a background job unless cached; async=0
+// forces a synchronous answer.
+void handle_hash(int sock, const char *path, const char *algo_str, const char *async_str) {
+    char reply[256];
+    if (!path || !*path) {
+        const char *msg = "{\"error\":\"Path required\"}";
+        send_http_response(sock, 400, "application/json", msg, strlen(msg));
+        return;
+    }
+    int algo = hash_algo_from_name(algo_str && *algo_str ? algo_str : "sha256");
+    if (algo < 0) {
+        const char *msg = "{\"error\":\"Unknown algo (sha256, crc32c, xxh64tree)\"}";
+        send_http_response(sock, 400, "application/json", msg, strlen(msg));
+        return;
+    }
+    
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        const char *msg = "{\"error\":\"File not found\"}";
+        send_http_response(sock, 404, "application/json", msg, strlen(msg));
+        return;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        const char *msg = "{\"error\":\"Not a regular file\"}";
+        send_http_response(sock, 400, "application/json", msg, strlen(msg));
+        return;
+    }
+    
+    char digest[HASH_DIGEST_MAX];
+    int async = async_str && *async_str ? atoi(async_str) != 0
+                                        : (unsigned long long)st.st_size >= HASH_ASYNC_THRESHOLD;
+    if (async && !hash_cache_lookup(&st, algo, digest)) {
+        job_t *job = job_create("hash", path, st.st_size);
+        if (!job) {
+            const char *msg = "{\"error\":\"Too many background jobs\"}";
+            send_http_response(sock, 503, "application/json", msg, strlen(msg));
+            return;
+        }
+        hash_job_t *req = malloc(sizeof(hash_job_t));
+        if (req) {
+            req->job = job;
+            req->algo = algo;
+        }
+        if (!req || job_spawn(hash_job_thread, req) != 0) {
+            free(req);
+            job_finish(job, JOB_FAILED, "{\"error\":\"Could not start job\"}");
+            const char *msg = "{\"error\":\"Could not start job\"}";
+            send_http_response(sock, 500, "application/json", msg, strlen(msg));
+            return;
+        }
+        snprintf(reply, sizeof(reply), "{\"job\":%u,\"status\":\"/api/jobs?id=%u\"}", job->id, job->id);
+        send_http_response(sock, 202, "application/json", reply, strlen(reply));
+        return;
+    }
+    
+    unsigned long long start = monotonic_us();
+    int cached;
+    int err = hash_path(path, algo, digest, &st, &cached, NULL, NULL);
+    if (err) {
+        snprintf(reply, sizeof(reply), "{\"error\":\"Hash failed: %s\"}", strerror(err));
+        send_http_response(sock, 500, "application/json", reply, strlen(reply));
+        return;
+    }
+    char json[MAX_PATH * 2 + 512];
+    int len = format_hash_result(json, sizeof(json), path, algo, digest, &st, cached, monotonic_us() - start);
+    send_http_response(sock, 200, "application/json", json, len);
+}
+
+// Duplicate finder
+// A scan walks root once and spills a (size, dev, ino, path) record for every
+// regular file into one of DUP_PARTITIONS files chosen by size, so only one
+// partition is held in memory at a time. Inside a partition files are grouped
+// by size, then by an XXH64 of their first and last DUP_PARTIAL bytes, and
+// only the survivors are fully hashed (xxh64tree, parallel and cached). Each
+// confirmed group is appended to an NDJSON file that clients page through
+// with ?id=&offset= while the scan is still running.
+typedef struct {
+    unsigned long long size, dev, ino;
+    unsigned int path_len;          // path bytes after the record: NUL-terminated, padded to 8
+} dup_record_t;
+
+typedef struct {
+    const dup_record_t *rec;
+    const char *path;
+    unsigned long long partial;
+    char digest[HASH_DIGEST_MAX];
+} dup_file_t;
+
+typedef struct {
+    job_t *job;
+    char root[MAX_PATH];
+    unsigned long long min_size;
+    FILE *parts[DUP_PARTITIONS];
+    FILE *out;
+    unsigned char *partial_buf;     // 2 * DUP_PARTIAL
+    unsigned long long files, candidates, groups, reclaimable, hashed_bytes;
+    int err;
+} dup_scan_t;
+
+static pthread_mutex_t dup_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int dup_running_id;     // guarded by dup_lock
+static unsigned int dup_last_id;
+
+static void dup_output_path(char *out, size_t out_len, unsigned int id) {
+    snprintf(out, out_len, "%s/duplicates-%u.ndjson", ACCESS_LOG_DIR, id);
+}
+
+static void dup_walk(dup_scan_t *scan, char *path, size_t len) {
+    DIR *dir = opendir(len ? path : "/");
+    if (!dir) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && !scan->err && !atomic_load(&scan->job->cancel)) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        size_t name_len = strlen(entry->d_name);
+        if (len + 1 + name_len >= MAX_PATH) continue;
+        path[len] = '/';
+        memcpy(path + len + 1, entry->d_name, name_len + 1);
+        
+        struct stat st;
+        if (lstat(path, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                // Skip our own state directory, which holds the spill files
+                if (strcmp(path, ACCESS_LOG_DIR) != 0) dup_walk(scan, path, len + 1 + name_len);
+            } else if (S_ISREG(st.st_mode) && (unsigned long long)st.st_size >= scan->min_size) {
+                // Path padded with NULs to keep the next record 8-byte aligned
+                static const char pad[8];
+                size_t path_len = len + 1 + name_len + 1;
+                dup_record_t rec = { st.st_size, st.st_dev, st.st_ino, (unsigned int)((path_len + 7) & ~7) };
+                FILE *part = scan->parts[(rec.size * 0x9E3779B97F4A7C15ULL) >> (64 - DUP_PARTITION_BITS)];
+                if (fwrite(&rec, sizeof(rec), 1, part) != 1 || fwrite(path, path_len, 1, part) != 1 ||
+                    (rec.path_len > path_len && fwrite(pad, rec.path_len - path_len, 1, part) != 1)) {
+                    scan->err = errno ? errno : EIO;
+                }
+                scan->files++;
+                atomic_fetch_add(&scan->job->progress, 1);
+            }
+        }
+        path[len] = '\0';
+    }
+    closedir(dir);
+}
+
+static int dup_cmp_size(const void *a, const void *b) {
+    const dup_record_t *x = ((const dup_file_t *)a)->rec, *y = ((const dup_file_t *)b)->rec;
+    if (x->size != y->size) return x->size < y->size ? -1 : 1;
+    if (x->dev != y->dev) return x->dev < y->dev ? -1 : 1;
+    return x->ino < y->ino ? -1 : x->ino > y->ino;
+}
+
+static int dup_cmp_partial(const void *a, const void *b) {
+    const dup_file_t *x = a, *y = b;
+    return x->partial < y->partial ? -1 : x->partial > y->partial;
+}
+
+static int dup_cmp_digest(const void *a, const void *b) {
+    return strcmp(((const dup_file_t *)a)->digest, ((const dup_file_t *)b)->digest);
+}
+
+// XXH64 of the first and last DUP_PARTIAL bytes (the whole file when smaller)
+static int dup_partial_hash(dup_scan_t *scan, dup_file_t *f) {
+    int fd = open(f->path, O_RDONLY);
+    if (fd < 0) return -1;
+    unsigned long long size = f->rec->size;
+    size_t head = size < DUP_PARTIAL ? size : DUP_PARTIAL;
+    size_t tail = size > DUP_PARTIAL ? (size - DUP_PARTIAL < DUP_PARTIAL ? size - DUP_PARTIAL : DUP_PARTIAL) : 0;
+    int ok = pread_full(fd, scan->partial_buf, head, 0) == (ssize_t)head &&
+             pread_full(fd, scan->partial_buf + head, tail, size - tail) == (ssize_t)tail;
+    close(fd);
+    if (!ok) return -1;
+    f->partial = xxh64(scan->partial_buf, head + tail, size);
+    return 0;
+}
+
+// Append one confirmed group to the output
+static void dup_emit_group(dup_scan_t *scan, dup_file_t *files, int count) {
+    unsigned long long size = files[0].rec->size;
+    unsigned long long reclaimable = size * (count - 1);
+    char escaped[MAX_PATH * 2];
+    fprintf(scan->out, "{\"size\":%llu,\"digest\":\"%s\",\"count\":%d,\"reclaimable\":%llu,\"paths\":[",
+            size, files[0].digest, count, reclaimable);
+    for (int i = 0; i < count && i < DUP_GROUP_PATHS; i++) {
+        json_escape(escaped, sizeof(escaped), files[i].path);
+        fprintf(scan->out, "%s\"%s\"", i ? "," : "", escaped);
+    }
+    fputs("]}\n", scan->out);
+    fflush(scan->out);
+    scan->groups++;
+    scan->reclaimable += reclaimable;
+}
+
+// Files of one size with distinct inodes: narrow by partial hash, then full hash
+static void dup_process_size(dup_scan_t *scan, dup_file_t *files, int count) {
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (dup_partial_hash(scan, &files[i]) == 0) files[kept++] = files[i];
+    }
+    qsort(files, kept, sizeof(dup_file_t), dup_cmp_partial);
+    
+    for (int start = 0, end; start < kept && !atomic_load(&scan->job->cancel); start = end) {
+        for (end = start + 1; end < kept && files[end].partial == files[start].partial; end++);
+        if (end - start < 2) continue;
+        
+        int hashed = start;
+        for (int i = start; i < end; i++) {
+            struct stat st;
+            int cached;
+            if (hash_path(files[i].path, HASH_XXH64TREE, files[i].digest, &st, &cached, NULL,
+                          &scan->job->cancel) != 0 || (unsigned long long)st.st_size != files[i].rec->size) continue;
+            if (!cached) scan->hashed_bytes += st.st_size;
+            files[hashed++] = files[i];
+        }
+        qsort(files + start, hashed - start, sizeof(dup_file_t), dup_cmp_digest);
+        for (int g = start, g_end; g < hashed; g = g_end) {
+            for (g_end = g + 1; g_end < hashed && strcmp(files[g_end].digest, files[g].digest) == 0; g_end++);
+            if (g_end - g >= 2) dup_emit_group(scan, files + g, g_end - g);
+        }
+    }
+}
+
+static void dup_process_partition(dup_scan_t *scan, FILE *part) {
+    long bytes = ftell(part);
+    if (bytes <= 0) return;
+    char *arena = malloc(bytes);
+    rewind(part);
+    if (!arena || fread(arena, bytes, 1, part) != 1) {
+        free(arena);
+        scan->err = arena ? EIO : ENOMEM;
+        return;
+    }
+    size_t count = 0;
+    for (long off = 0; off < bytes; count++) {
+        off += sizeof(dup_record_t) + ((dup_record_t *)(arena + off))->path_len;
+    }
+    dup_file_t *files = malloc(count * sizeof(dup_file_t));
+    if (!files) {
+        free(arena);
+        scan->err = ENOMEM;
+        return;
+    }
+    long off = 0;
+    for (size_t i = 0; i < count; i++) {
+        files[i].rec = (const dup_record_t *)(arena + off);
+        files[i].path = arena + off + sizeof(dup_record_t);
+        off += sizeof(dup_record_t) + files[i].rec->path_len;
+    }
+    qsort(files, count, sizeof(dup_file_t), dup_cmp_size);
+    
+    for (size_t start = 0, end; start < count && !atomic_load(&scan->job->cancel); start = end) {
+        // Collapse hardlinks: they already share their blocks
+        size_t unique = start + 1;
+        for (end = start + 1; end < count && files[end].rec->size == files[start].rec->size; end++) {
+            if (files[end].rec->ino != files[unique - 1].rec->ino || files[end].rec->dev != files[unique - 1].rec->dev) {
+                files[unique++] = files[end];
+            }
+        }
+        if (unique - start < 2) continue;
+        scan->candidates += unique - start;
+        dup_process_size(scan, files + start, unique - start);
+    }
+    free(files);
+    free(arena);
+}
+
+void* dup_job_thread(void* arg) {
+    dup_scan_t *scan = (dup_scan_t *)arg;
+    job_t *job = scan->job;
+    char path[MAX_PATH];
+    char result[JOB_RESULT_MAX];
+    
+    // Partitions are unlinked right away; they live only as long as the open files
+    for (int i = 0; i < DUP_PARTITIONS && !scan->err; i++) {
+        snprintf(path, sizeof(path), "%s/.duplicates-%u-%d.part", ACCESS_LOG_DIR, job->id, i);
+        scan->parts[i] = fopen(path, "w+b");
+        if (!scan->parts[i]) scan->err = errno;
+        else unlink(path);
+    }
+    
+    size_t len = strlen(scan->root);
+    while (len > 0 && scan->root[len - 1] == '/') len--;
+    memcpy(path, scan->root, len);
+    path[len] = '\0';
+    if (!scan->err) dup_walk(scan, path, len);
+    
+    for (int i = 0; i < DUP_PARTITIONS && !scan->err && !atomic_load(&job->cancel); i++) {
+        dup_process_partition(scan, scan->parts[i]);
+    }
+    for (int i = 0; i < DUP_PARTITIONS; i++) {
+        if (scan->parts[i]) fclose(scan->parts[i]);
+    }
+    fclose(scan->out);
+    free(scan->partial_buf);
+    
+    if (scan->err) {
+        snprintf(result, sizeof(result), "{\"error\":\"%s\"}", strerror(scan->err));
+    } else {
+        snprintf(result, sizeof(result),
+                 "{\"files\":%llu,\"candidates\":%llu,\"groups\":%llu,\"reclaimable\":%llu,\"hashed_bytes\":%llu,"
+                 "\"output\":\"/api/duplicates?id=%u\"}",
+                 scan->files, scan->candidates, scan->groups, scan->reclaimable, scan->hashed_bytes, job->id);
+    }
+    pthread_mutex_lock(&dup_lock);
+    dup_running_id = 0;
+    pthread_mutex_unlock(&dup_lock);
+    job_finish(job, scan->err ? JOB_FAILED : atomic_load(&job->cancel) ? JOB_CANCELLED : JOB_DONE, result);
+    free(scan);
+    return NULL;
+}
+
+// Start a scan with ?root=[&min=bytes]
+static void dup_start(int sock, const char *root, const char *min_str) {
+    char reply[256];
+    struct stat st;
+    if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        const char *msg = "{\"error\":\"Root is not a directory\"}";
+        send_http_response(sock, 400, "application/json", msg, strlen(msg));
+        return;
+    }
+    pthread_mutex_lock(&dup_lock);
+    if (dup_running_id) {
+        snprintf(reply, sizeof(reply), "{\"error\":\"A scan is already running\",\"job\":%u}", dup_running_id);
+        pthread_mutex_unlock(&dup_lock);
+        send_http_response(sock, 409, "application/json", reply, strlen(reply));
+        return;
+    }
+    job_t *job = job_create("duplicates", root, 0);
+    dup_scan_t *scan = job ? calloc(1, sizeof(dup_scan_t)) : NULL;
+    char out_path[MAX_PATH];
+    if (scan) {
+        scan->job = job;
+        snprintf(scan->root, sizeof(scan->root), "%s", root);
+        scan->min_size = min_str && *min_str ? strtoull(min_str, NULL, 10) : 1;
+        scan->partial_buf = malloc(2 * DUP_PARTIAL);
+        mkdir(ACCESS_LOG_DIR, 0755);
+        dup_output_path(out_path, sizeof(out_path), job->id);
+        scan->out = fopen(out_path, "w");
+    }
+    if (!scan || !scan->partial_buf || !scan->out || job_spawn(dup_job_thread, scan) != 0) {
+        if (scan) {
+            if (scan->out) fclose(scan->out);
+            free(scan->partial_buf);
+            free(scan);
+        }
+        if (job) job_finish(job, JOB_FAILED, "{\"error\":\"Could not start job\"}");
+        pthread_mutex_unlock(&dup_lock);
+        const char *msg = job ? "{\"error\":\"Could not start job\"}" : "{\"error\":\"Too many background jobs\"}";
+        send_http_response(sock, job ? 500 : 503, "application/json", msg, strlen(msg));
+        return;
+    }
+    // Only the latest scan's groups are kept on disk
+    if (dup_last_id) {
+        dup_output_path(out_path, sizeof(out_path), dup_last_id);
+        unlink(out_path);
+    }
+    dup_last_id = dup_running_id = job->id;
+    pthread_mutex_unlock(&dup_lock);
+    
+    snprintf(reply, sizeof(reply), "{\"job\":%u,\"status\":\"/api/jobs?id=%u\",\"groups\":\"/api/duplicates?id=%u\"}",
+             job->id, job->id, job->id);
+    send_http_response(sock, 202, "application/json", reply, strlen(reply));
+}
+
+// Duplicate groups: ?root= starts a scan, ?id=&offset= pages through its groups.
+// "next" is the offset for the following page; "done" is set once the scan has
+// finished and every group has been returned.
+void handle_duplicates(int sock, const char *root, const char *min_str, const char *id_str, const char *offset_str) {
+    if (!id_str || !*id_str) {
+        if (!root || !*root) {
+            const char *msg = "{\"error\":\"root or id required\"}";
+            send_http_response(sock, 400, "application/json", msg, strlen(msg));
+            return;
+        }
+        dup_start(sock, root, min_str);
+        return;
+    }
+    
+    unsigned int id = (unsigned int)strtoul(id_str, NULL, 10);
+    job_state_t state = JOB_FREE;
+    pthread_mutex_lock(&job_lock);
+    for (int i = 0; i < JOB_SLOTS; i++) {
+        if (jobs[i].state != JOB_FREE && jobs[i].id == id && strcmp(jobs[i].kind, "duplicates") == 0) {
+            state = jobs[i].state;
+        }
+    }
+    pthread_mutex_unlock(&job_lock);
+    
+    char out_path[MAX_PATH];
+    dup_output_path(out_path, sizeof(out_path), id);
+    int fd = state != JOB_FREE ? open(out_path, O_RDONLY) : -1;
+    if (fd < 0) {
+        const char *msg = "{\"error\":\"No such scan\"}";
+        send_http_response(sock, 404, "application/json", msg, strlen(msg));
+        return;
+    }
+    unsigned long long offset = offset_str ? strtoull(offset_str, NULL, 10) : 0;
+    size_t cap = DUP_PAGE + 256;
+    char *json = malloc(cap);
+    if (!json) {
+        close(fd);
+        send_http_response(sock, 500, "text/plain", "Memory error", 12);
+        return;
+    }
+    int head = snprintf(json, cap, "{\"job\":%u,\"state\":\"%s\",\"groups\":[", id, job_state_names[state]);
+    ssize_t n = pread_full(fd, json + head, DUP_PAGE, offset);
+    struct stat st;
+    int at_end = fstat(fd, &st) == 0 && offset + (n > 0 ? n : 0) >= (unsigned long long)st.st_size;
+    close(fd);
+    
+    // Whole lines only; each line is one group object
+    size_t used = 0;
+    if (n > 0) {
+        char *last = memrchr(json + head, '\n', n);
+        used = last ? (size_t)(last - (json + head)) + 1 : 0;
+        for (size_t i = 0; i + 1 < used; i++) {
+            if (json[head + i] == '\n') json[head + i] = ',';
+        }
+    }
+    int len = head + (used ? (int)used - 1 : 0);
+    len += snprintf(json + len, cap - len, "],\"next\":%llu,\"done\":%s}", offset + used,
+                    state != JOB_RUNNING && at_end && (n <= 0 || used == (size_t)n) ? "true" : "false");
+    send_http_response(sock, 200, "application/json", json, len);
+    free(json);
+}
+
+// Embedded web UI
+// web/index.html, app.css and app.js are compressed at build time by
+// tools/embed_web into web_assets.h (gzip and brotli next to the raw bytes),
+// so serving them costs no CPU beyond picking a representation.
+typedef struct {
+    const unsigned char *data;
+    size_t len;                     // 0 when the representation is not offered
+} web_blob_t;
+
+typedef struct {
+    const char *path;
+    const char *content_type;
+    const char *hash;               // content hash; ETags append the coding
+    web_blob_t identity, gzip, br;
+} web_asset_t;
+
+#include "web_assets.h"
+
+const web_asset_t* web_asset_find(const char *path) {
+    size_t len = strcspn(path, "?");
+    if (len == 1 && path[0] == '/') {
+        path = "/index.html";
+        len = 11;
+    }
+    for (int i = 0; i < WEB_ASSET_COUNT; i++) {
+        if (strlen(web_assets[i].path) == len && strncmp(web_assets[i].path, path, len) == 0) return &web_assets[i];
+    }
+    return NULL;
+}
+
+// Whether an Accept-Encoding value lists coding without q=0
+int accepts_encoding(const char *accept, const char *coding) {
+    size_t coding_len = strlen(coding);
+    for (const char *p = accept; *p; ) {
+        p += strspn(p, " \t,");
+        size_t item_len = strcspn(p, ",");
+        size_t name_len = strcspn(p, " \t;,");
+        if (name_len == coding_len && strncasecmp(p, coding, coding_len) == 0) {
+            const char *q = p + name_len;
+            while (q < p + item_len && strncasecmp(q, "q=", 2) != 0) q++;
+            return q >= p + item_len || strtod(q + 2, NULL) > 0;
+        }
+        p += item_len;
+    }
+    return 0;
+}
+
+// If-None-Match: "*" or a list of (possibly weak) entity tags; etag is quoted
+int etag_list_matches(const char *list, const char *etag) {
+    size_t etag_len = strlen(etag);
+    for (const char *p = list; *p; ) {
+        p += strspn(p, " \t,");
+        if (*p == '*') return 1;
+        if (strncmp(p, "W/", 2) == 0) p += 2;
+        size_t len = strcspn(p, " \t,");
+        if (len == etag_len && strncmp(p, etag, len) == 0) return 1;
+        p += len;
+    }
+    return 0;
+}
+
+// Serve an embedded UI asset
+// The representation follows Accept-Encoding (br, then gzip, then identity)
+// and each one has its own strong ETag; a matching If-None-Match gets 304.
+// Versioned URLs (?v=<hash>, written into index.html by tools/embed_web) are
+// cached for a year, anything else is revalidated on each use.
+void serve_web_asset(int sock, const char *request, const web_asset_t *asset, const char *version) {
+    char accept[256] = "", match[512];
+    const web_blob_t *blob = &asset->identity;
+    const char *coding = NULL;
+    http_header(request, "Accept-Encoding", accept, sizeof(accept));
+    if (asset->br.len && accepts_encoding(accept, "br")) {
+        blob = &asset->br;
+        coding = "br";
+    } else if (asset->gzip.len && accepts_encoding(accept, "gzip")) {
+        blob = &asset->gzip;
+        coding = "gzip";
+    }
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"%s%s%s\"", asset->hash, coding ? "-" : "", coding ? coding : "");
+    int not_modified = http_header(request, "If-None-Match", match, sizeof(match)) && etag_list_matches(match, etag);
+    const char *cache = version && strcmp(version, asset->hash) == 0 ? "public, max-age=31536000, immutable" : "no-cache";
+    
+    char header[512];
+    int len;
+    if (not_modified) {
+        len = snprintf(header, sizeof(header),
+            "HTTP/1.1 304 Not Modified\r\n"
+            "ETag: %s\r\n"
+            "Cache-Control: %s\r\n"
+            "Vary: Accept-Encoding\r\n"
+            "Connection: close\r\n"
+            "\r\n",
+            etag, cache);
+    } else {
+        len = snprintf(header, sizeof(header),
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %zu\r\n"
+            "%s%s%s"
+            "ETag: %s\r\n"
+            "Cache-Control: %s\r\n"
+            "Vary: Accept-Encoding\r\n"
+            "Connection: close\r\n"
+            "\r\n",
+            asset->content_type, blob->len,
+            coding ? "Content-Encoding: " : "", coding ? coding : "", coding ? "\r\n" : "",
+            etag, cache);
+    }
+    note_response_status(not_modified ? 304 : 200);
+    client_send(sock, header, len);
+    if (!not_modified) client_send(sock, blob->data, blob->len);
+}
+
+// Expected digests from Content-Digest (request body) or X-Checksum (file data)
+typedef struct {
+    int has_crc;
+    uint32_t crc;
+    int has_sha;
+    unsigned char sha[32];
+} checksum_expect_t;
+
+static int parse_hex_bytes(unsigned char *dst, size_t len, const char *hex) {
+    for (size_t i = 0; i < len; i++) {
+        if (!isxdigit((unsigned char)hex[i * 2]) || !isxdigit((unsigned char)hex[i * 2 + 1])) return -1;
+        sscanf(hex + i * 2, "%2hhx", &dst[i]);
+    }
+    return isxdigit((unsigned char)hex[len * 2]) ? -1 : 0;
+}
+
+// RFC 9530 dictionary, e.g. "sha-256=:base64:, crc32c=:base64:"; other algorithms are ignored
+void parse_content_digest(const char *value, checksum_expect_t *exp) {
+    const char *p = value;
+    while (*p) {
+        while (*p == ' ' || *p == ',') p++;
+        const char *colon = strstr(p, "=:");
+        if (!colon) break;
+        const char *end = strchr(colon + 2, ':');
+        if (!end) break;
+        unsigned char raw[32];
+        int n = base64_decode(raw, sizeof(raw), colon + 2, end - colon - 2);
+        if (strncasecmp(p, "crc32c=", 7) == 0 && n == 4) {
+            exp->has_crc = 1;
+            exp->crc = (uint32_t)raw[0] << 24 | (uint32_t)raw[1] << 16 | (uint32_t)raw[2] << 8 | raw[3];
+        } else if (strncasecmp(p, "sha-256=", 8) == 0 && n == 32) {
+            exp->has_sha = 1;
+            memcpy(exp->sha, raw, 32);
+        }
+        p = end + 1;
+    }
+}
+
+// "crc32c:<hex>", "sha256:<hex>" ('=' also accepted), or bare hex (8 digits crc32c, 64 sha256)
+void parse_x_checksum(const char *value, checksum_expect_t *exp) {
+    const char *hex = value;
+    int algo = -1;
+    if (strncasecmp(value, "crc32c", 6) == 0 && (value[6] == ':' || value[6] == '=')) {
+        algo = HASH_CRC32C;
+        hex = value + 7;
+    } else if (strncasecmp(value, "sha256", 6) == 0 && (value[6] == ':' || value[6] == '=')) {
+        algo = HASH_SHA256;
+        hex = value + 7;
+    } else if (strncasecmp(value, "sha-256", 7) == 0 && (value[7] == ':' || value[7] == '=')) {
+        algo = HASH_SHA256;
+        hex = value + 8;
+    }
+    size_t len = strspn(hex, "0123456789abcdefABCDEF");
+    if (algo < 0) algo = (len == 8) ? HASH_CRC32C : (len == 64) ? HASH_SHA256 : -1;
+    unsigned char raw[32];
+    if (algo == HASH_CRC32C && len == 8 && parse_hex_bytes(raw, 4, hex) == 0) {
+        exp->has_crc = 1;
+        exp->crc = (uint32_t)raw[0] << 24 | (uint32_t)raw[1] << 16 | (uint32_t)raw[2] << 8 | raw[3];
+    } else if (algo == HASH_SHA256 && len == 64 && parse_hex_bytes(exp->sha, 32, hex) == 0) {
+        exp->has_sha = 1;
+    }
+}
+
+// Request body as it streams off the socket
+typedef struct {
+    int sock;
+    char *buf;
+    size_t len;
+    size_t cap;
+    unsigned long long body_read;       // body bytes consumed so far
+    unsigned long long content_length;
+    uint32_t body_crc;
+    int body_sha;                       // also SHA-256 the body (Content-Digest asked for it)
+    sha256_ctx_t body_sha_ctx;
+    int transfer;
+    const char *delim;                  // CRLF "--" boundary ending the file part
+    size_t delim_len;
+    size_t consumed;                    // run returned by upload_part_next(), dropped on the next call
+    int part_done;
+    int lost;                           // set with -1 from upload_part_next(): connection dropped
+} upload_stream_t;
+
+static void upload_account(upload_stream_t *u, const char *data, size_t n) {
+    u->body_crc = crc32c(u->body_crc, data, n);
+    if (u->body_sha) sha256_update(&u->body_sha_ctx, data, n);
+    u->body_read += n;
+    transfer_progress(u->transfer, n);
+}
+
+// Read until at least want bytes are buffered or the body ends.
+// Returns bytes added (0 at end of body) or -1 if the connection failed.
+static ssize_t upload_fill(upload_stream_t *u, size_t want) {
+    client_info_t *client = current_client();
+    size_t added = 0;
+    if (want > u->cap) want = u->cap;
+    while (u->len < want && u->body_read < u->content_length) {
+        size_t room = u->cap - u->len;
+        if (room > u->content_length - u->body_read) room = u->content_length - u->body_read;
+        conn_io_mark(client, 0);
+        ssize_t r = recv(u->sock, u->buf + u->len, room, 0);
+        conn_io_done(client, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        upload_account(u, u->buf + u->len, r);
+        if (client) client->bytes_received += r;
+        u->len += r;
+        added += r;
+    }
+    return added;
+}
+
+// Next run of file data before the closing delimiter, valid until the next
+// call. Holds back delim_len - 1 bytes that could start the boundary. Returns
+// the run length, 0 once the delimiter is reached, or -1 if the body ended
+// early (u->lost when the connection failed, else the boundary is missing).
+static ssize_t upload_part_next(upload_stream_t *u, const char **data) {
+    if (u->part_done) return 0;
+    memmove(u->buf, u->buf + u->consumed, u->len - u->consumed);
+    u->len -= u->consumed;
+    u->consumed = 0;
+    while (1) {
+        char *hit = memmem(u->buf, u->len, u->delim, u->delim_len);
+        size_t out = hit ? (size_t)(hit - u->buf) : (u->len >= u->delim_len ? u->len - (u->delim_len - 1) : 0);
+        if (out) {
+            *data = u->buf;
+            u->consumed = out;
+            return out;
+        }
+        if (hit) {
+            u->part_done = 1;
+            return 0;
+        }
+        ssize_t r = upload_fill(u, u->cap / 2);
+        if (r <= 0) {
+            u->lost = r < 0;
+            return -1;
+        }
+    }
+}
+
+static int write_full(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        buf += w;
+        len -= w;
+    }
+    return 0;
+}
+
+// Large-file writes
+// Upload and copy destinations are checked against free space and
+// preallocated to their expected size before the first byte is written, so
+// the filesystem can hand out one contiguous run and a full disk fails up
+// front rather than at 39 of 40GB. Data is staged in an aligned WRITE_BUFFER
+// and written in whole buffers. Every write_behind_bytes the new range is
+// queued for writeback and the one before it is waited for and dropped from
+// the page cache, which keeps dirty memory bounded and the final close short.
+// FreeBSD's UFS clusters write-behind on its own, so there it is only the
+// preallocation and buffering.
+typedef struct {
+    int fd;
+    unsigned char *buf;                 // WRITE_BUFFER bytes, WRITE_ALIGN aligned
+    size_t len;
+    unsigned long long offset;          // file bytes written
+    unsigned long long allocated;       // preallocated size, trimmed to offset at the end
+    unsigned long long behind, prev;    // write-behind window [prev, behind) in flight
+} file_writer_t;
+
+static unsigned long long write_behind_bytes = WRITE_BEHIND_DEFAULT;
+
+// 0 if dir's filesystem can take size more bytes and keep WRITE_SPACE_RESERVE free
+int write_space_check(const char *dir, unsigned long long size) {
+    struct statvfs vfs;
+    if (statvfs(dir, &vfs) != 0) return errno;
+    return (unsigned long long)vfs.f_bavail * vfs.f_frsize < size + WRITE_SPACE_RESERVE ? ENOSPC : 0;
+}
+
+// Create path (which must not exist) for about size bytes. 0 or an errno value;
+// on failure nothing is left behind.
+int file_writer_open(file_writer_t *w, const char *path, unsigned long long size) {
+    memset(w, 0, sizeof(*w));
+    w->fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (w->fd < 0) return errno;
+    int err = 0;
+    if (size >= WRITE_PREALLOC_MIN) {
+#ifdef HOST_BUILD
+        // Not posix_fallocate(): glibc emulates it by writing every block
+        err = fallocate(w->fd, 0, 0, size) == 0 ? 0 : errno;
+#else
+        err = posix_fallocate(w->fd, 0, size);
+#endif
+        if (!err) w->allocated = size;
+        // Filesystems without it (exFAT, ZFS) just grow the file as it is written
+        if (err == EOPNOTSUPP || err == EINVAL || err == ENOSYS) err = 0;
+    }
+    if (!err && posix_memalign((void **)&w->buf, WRITE_ALIGN, WRITE_BUFFER) != 0) err = ENOMEM;
+    if (err) {
+        close(w->fd);
+        unlink(path);
+        w->fd = -1;
+    }
+    return err;
+}
+
+// Write out the staged buffer and advance write-behind
+static int file_writer_flush(file_writer_t *w) {
+    if (w->len && write_full(w->fd, (const char *)w->buf, w->len) != 0) return errno ? errno : EIO;
+    w->offset += w->len;
+    w->len = 0;
+    if (!write_behind_bytes || w->offset - w->behind < write_behind_bytes) return 0;
+#ifdef SYNC_FILE_RANGE_WRITE
+    sync_file_range(w->fd, w->behind, w->offset - w->behind, SYNC_FILE_RANGE_WRITE);
+    if (w->behind > w->prev) {
+        sync_file_range(w->fd, w->prev, w->behind - w->prev,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(w->fd, w->prev, w->behind - w->prev, POSIX_FADV_DONTNEED);
+    }
+#endif
+    w->prev = w->behind;
+    w->behind = w->offset;
+    return 0;
+}
+
+int file_writer_write(file_writer_t *w, const void *data, size_t len) {
+    const unsigned char *p = data;
+    while (len > 0) {
+        size_t n = WRITE_BUFFER - w->len;
+        if (n > len) n = len;
+        memcpy(w->buf + w->len, p, n);
+        w->len += n;
+        p += n;
+        len -= n;
+        if (w->len == WRITE_BUFFER) {
+            int err = file_writer_flush(w);
+            if (err) return err;
+        }
+    }
+    return 0;
+}
+
+// Flush the rest and give back preallocated space that wasn't used. The fd
+// stays open (for fstat); file_writer_close releases it.
+int file_writer_finish(file_writer_t *w) {
+    int err = file_writer_flush(w);
+    if (!err && w->allocated > w->offset && ftruncate(w->fd, w->offset) != 0) err = errno;
+    return err;
+}
+
+int file_writer_close(file_writer_t *w) {
+    int err = close(w->fd) == 0 ? 0 : errno;
+    free(w->buf);
+    w->buf = NULL;
+    w->fd = -1;
+    return err;
+}
+
+static _Atomic unsigned int upload_seq;
+
+// Streaming extraction (/api/upload?extract=1)
+// The uploaded archive is unpacked as it arrives instead of being stored. The
+// connection thread parses the stream (inflating .tar.gz and deflated zip
+// entries on the way) and copies member data into EXTRACT_CHUNK buffers that
+// EXTRACT_WRITERS threads pwrite() to disk, so decompression and disk writes
+// overlap. Only EXTRACT_BUFFERS buffers exist; when all of them are queued the
+// parser waits, which bounds memory whatever the size of the archive.
+#define EXTRACT_TAR_HEADER 0
+#define EXTRACT_TAR_DATA 1
+#define EXTRACT_TAR_EXT 2
+#define EXTRACT_TAR_SKIP 3
+#define EXTRACT_TAR_END 4
+
+typedef struct {
+    int fd;
+    int refs;                           // parser + queued chunks, guarded by extract_t.lock
+    long mtime;
+} extract_file_t;
+
+typedef struct extract_chunk {
+    struct extract_chunk *next;
+    extract_file_t *file;
+    unsigned long long offset;
+    size_t len;
+    unsigned char data[];
+} extract_chunk_t;
+
+typedef struct {
+    upload_stream_t *u;
+    const char *run;                    // file data from upload_part_next() not read yet
+    size_t run_len;
+    unsigned long long archive_bytes;
+    uint32_t crc;                       // CRC32C of the archive, for X-Checksum
+    sha256_ctx_t *sha;
+    unsigned char back[INFLATE_IN_BUF + 8];    // input handed back after an inflate
+    size_t back_pos, back_len;
+    unsigned char *scratch;             // INFLATE_IN_BUF + 8
+    inflate_t *z;
+    unsigned long long limit;           // compressed bytes left in the zip entry
+    int source_error;                   // the upload body failed, see u->lost
+    
+    const char *dir;
+    char made_dir[MAX_PATH];            // parent directory created last
+    extract_file_t *file;               // member being written, NULL when skipped
+    unsigned long long file_off;
+    extract_chunk_t *fill;
+    uint32_t member_crc;
+    
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    extract_chunk_t *free_list, *head, *tail;
+    int stopping;
+    int write_error;                    // first errno seen by a writer
+    pthread_t writers[EXTRACT_WRITERS];
+    int writer_count;
+    
+    const char *format;
+    char error[MAX_PATH + 64];          // parse error, empty if none
+    unsigned long long files, dirs, bytes, skipped;
+    
+    // tar parser state, fed in arbitrary pieces
+    int tar_state;
+    unsigned char header[512];
+    size_t header_len;
+    unsigned long long remaining, pad;
+    char ext_type;
+    char *ext;
+    size_t ext_len;
+    char long_name[MAX_PATH];
+    unsigned long long pax_size;
+    int has_pax_size;
+    uint32_t gz_crc;
+    unsigned long long gz_size;
+} extract_t;
+
+// Archive bytes: pushed-back input first, then the upload body
+static ssize_t extract_read(void *ctx, unsigned char *buf, size_t len) {
+    extract_t *ex = ctx;
+    size_t n;
+    if (ex->back_pos < ex->back_len) {
+        n = ex->back_len - ex->back_pos < len ? ex->back_len - ex->back_pos : len;
+        memcpy(buf, ex->back + ex->back_pos, n);
+        ex->back_pos += n;
+        return n;
+    }
+    if (!ex->run_len) {
+        ssize_t r = upload_part_next(ex->u, &ex->run);
+        if (r < 0) ex->source_error = 1;
+        if (r <= 0) return r;
+        ex->run_len = r;
+        ex->archive_bytes += r;
+        ex->crc = crc32c(ex->crc, ex->run, r);
+        if (ex->sha) sha256_update(ex->sha, ex->run, r);
+    }
+    n = ex->run_len < len ? ex->run_len : len;
+    memcpy(buf, ex->run, n);
+    ex->run += n;
+    ex->run_len -= n;
+    return n;
+}
+
+static int extract_read_exact(extract_t *ex, void *buf, size_t len) {
+    unsigned char *p = buf;
+    while (len > 0) {
+        ssize_t r = extract_read(ex, p, len);
+        if (r <= 0) return -1;
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+static int extract_skip(extract_t *ex, unsigned long long len) {
+    while (len > 0) {
+        ssize_t r = extract_read(ex, ex->scratch, len < INFLATE_IN_BUF ? len : INFLATE_IN_BUF);
+        if (r <= 0) return -1;
+        len -= r;
+    }
+    return 0;
+}
+
+// Put back bytes just read. They always came from back[] or the current run,
+// so together with what is left in back[] they fit.
+static void extract_unread(extract_t *ex, const unsigned char *data, size_t n) {
+    size_t rest = ex->back_len - ex->back_pos;
+    memmove(ex->back + n, ex->back + ex->back_pos, rest);
+    memcpy(ex->back, data, n);
+    ex->back_pos = 0;
+    ex->back_len = n + rest;
+}
+
+// Drop a reference; the last one stamps the archive mtime and closes the file
+static void extract_file_release(extract_t *ex, extract_file_t *f) {
+    pthread_mutex_lock(&ex->lock);
+    int last = --f->refs == 0;
+    pthread_mutex_unlock(&ex->lock);
+    if (!last) return;
+    if (f->mtime > 0) {
+        struct timeval times[2] = {{f->mtime, 0}, {f->mtime, 0}};
+        futimes(f->fd, times);
+    }
+    close(f->fd);
+    free(f);
+}
+
+static void* extract_writer_thread(void *arg) {
+    extract_t *ex = arg;
+    pthread_mutex_lock(&ex->lock);
+    while (1) {
+        while (!ex->head && !ex->stopping) pthread_cond_wait(&ex->cond, &ex->lock);
+        extract_chunk_t *c = ex->head;
+        if (!c) break;
+        ex->head = c->next;
+        if (!ex->head) ex->tail = NULL;
+        int failed = ex->write_error;
+        pthread_mutex_unlock(&ex->lock);
+        
+        int err = 0;
+        for (size_t done = 0; !failed && done < c->len; ) {
+            ssize_t w = pwrite(c->file->fd, c->data + done, c->len - done, c->offset + done);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                err = w < 0 ? errno : EIO;
+                break;
+            }
+            done += w;
+        }
+        extract_file_release(ex, c->file);
+        
+        pthread_mutex_lock(&ex->lock);
+        if (err && !ex->write_error) ex->write_error = err;
+        c->next = ex->free_list;
+        ex->free_list = c;
+        pthread_cond_broadcast(&ex->cond);
+    }
+    pthread_mutex_unlock(&ex->lock);
+    return NULL;
+}
+
+// Hand the buffer being filled to the writers
+static void extract_flush(extract_t *ex) {
+    extract_chunk_t *c = ex->fill;
+    if (!c) return;
+    ex->fill = NULL;
+    c->next = NULL;
+    pthread_mutex_lock(&ex->lock);
+    c->file->refs++;
+    if (ex->tail) ex->tail->next = c;
+    else ex->head = c;
+    ex->tail = c;
+    pthread_cond_broadcast(&ex->cond);
+    pthread_mutex_unlock(&ex->lock);
+}
+
+// Member data, in order. Returns -1 once a write has failed.
+static int extract_data(extract_t *ex, const unsigned char *data, size_t len) {
+    if (!ex->file) return 0;
+    while (len > 0) {
+        if (!ex->fill) {
+            pthread_mutex_lock(&ex->lock);
+            while (!ex->free_list && !ex->write_error) pthread_cond_wait(&ex->cond, &ex->lock);
+            extract_chunk_t *c = ex->write_error ? NULL : ex->free_list;
+            if (c) ex->free_list = c->next;
+            pthread_mutex_unlock(&ex->lock);
+            if (!c) return -1;
+            c->file = ex->file;
+            c->offset = ex->file_off;
+            c->len = 0;
+            ex->fill = c;
+        }
+        size_t n = EXTRACT_CHUNK - ex->fill->len;
+        if (n > len) n = len;
+        memcpy(ex->fill->data + ex->fill->len, data, n);
+        ex->fill->len += n;
+        ex->file_off += n;
+        ex->bytes += n;
+        data += n;
+        len -= n;
+        if (ex->fill->len == EXTRACT_CHUNK) extract_flush(ex);
+    }
+    return 0;
+}
+
+// Create the directories leading to path (and path itself when include_last),
+// skipping the work when the parent is the one made last time
+static void extract_mkdirs(extract_t *ex, char *path, int include_last) {
+    char *last = strrchr(path, '/');
+    size_t parent_len = last - path;
+    size_t dir_len = strlen(ex->dir);
+    if (parent_len > dir_len && !(strncmp(ex->made_dir, path, parent_len) == 0 && ex->made_dir[parent_len] == '\0')) {
+        for (char *s = path + dir_len + 1; (s = strchr(s, '/')) != NULL; s++) {
+            *s = '\0';
+            mkdir(path, 0755);
+            *s = '/';
+        }
+        memcpy(ex->made_dir, path, parent_len);
+        ex->made_dir[parent_len] = '\0';
+    }
+    if (include_last) mkdir(path, 0755);
+}
+
+// Start a member. Its name is joined to the destination one component at a
+// time: empty and "." components are dropped (so absolute names land inside
+// the destination), and a ".." component skips the member. Returns -1 with
+// ex->error set if the file cannot be created.
+static int extract_begin(extract_t *ex, const char *name, int is_dir, long mtime) {
+    ex->file = NULL;
+    ex->file_off = 0;
+    ex->member_crc = 0;
+    char path[MAX_PATH];
+    size_t len = snprintf(path, sizeof(path), "%s", ex->dir);
+    int parts = 0;
+    for (const char *p = name; *p; ) {
+        size_t n = strcspn(p, "/\\");
+        if ((n == 2 && p[0] == '.' && p[1] == '.') || len + 1 + n >= sizeof(path)) {
+            ex->skipped++;
+            return 0;
+        }
+        if (n && !(n == 1 && p[0] == '.')) {
+            path[len++] = '/';
+            memcpy(path + len, p, n);
+            len += n;
+            path[len] = '\0';
+            parts++;
+        }
+        p += n;
+        if (*p) p++;
+    }
+    if (!parts) {
+        ex->skipped++;
+        return 0;
+    }
+    if (is_dir) {
+        extract_mkdirs(ex, path, 1);
+        ex->dirs++;
+        return 0;
+    }
+    extract_mkdirs(ex, path, 0);
+    extract_file_t *f = malloc(sizeof(*f));
+    int fd = f ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    if (fd < 0) {
+        free(f);
+        snprintf(ex->error, sizeof(ex->error), "Failed to create %s (errno=%d)", path, errno);
+        return -1;
+    }
+    f->fd = fd;
+    f->refs = 1;
+    f->mtime = mtime;
+    ex->file = f;
+    ex->files++;
+    return 0;
+}
+
+static void extract_end(extract_t *ex) {
+    if (!ex->file) return;
+    extract_flush(ex);
+    extract_file_release(ex, ex->file);
+    ex->file = NULL;
+}
+
+// Move on from a finished data, extended header or padding section
+static void extract_tar_section_done(extract_t *ex) {
+    while (ex->remaining == 0) {
+        if (ex->tar_state == EXTRACT_TAR_DATA) {
+            extract_end(ex);
+        } else if (ex->tar_state == EXTRACT_TAR_EXT) {
+            tar_apply_ext(ex->ext_type, ex->ext, ex->ext_len, ex->long_name, sizeof(ex->long_name),
+                          &ex->pax_size, &ex->has_pax_size);
+        } else if (ex->tar_state == EXTRACT_TAR_SKIP) {
+            ex->tar_state = EXTRACT_TAR_HEADER;
+            return;
+        } else {
+            return;
+        }
+        ex->tar_state = EXTRACT_TAR_SKIP;
+        ex->remaining = ex->pad;
+    }
+}
+
+static int extract_tar_header(extract_t *ex) {
+    const unsigned char *h = ex->header;
+    int zero = 1;
+    for (int i = 0; i < 512 && zero; i++) zero = h[i] == 0;
+    if (zero) {
+        ex->tar_state = EXTRACT_TAR_END;
+        return 0;
+    }
+    if (!tar_header_valid(h)) {
+        snprintf(ex->error, sizeof(ex->error), "%s", ex->files || ex->dirs ? "Corrupt tar header" : "Unsupported archive format");
+        return -1;
+    }
+    unsigned long long size = ex->has_pax_size ? ex->pax_size : tar_number(h + 124, 12);
+    char type = h[156];
+    ex->pad = ((size + 511) & ~511ULL) - size;
+    ex->remaining = size;
+    if (type == 'L' || type == 'x') {
+        // GNU long name, or pax extended header for the next member
+        char *ext = size <= 65536 ? realloc(ex->ext, size + 1) : NULL;
+        if (!ext) {
+            snprintf(ex->error, sizeof(ex->error), "Extended tar header too large");
+            return -1;
+        }
+        ex->ext = ext;
+        ex->ext_len = 0;
+        ex->ext_type = type;
+        ex->tar_state = EXTRACT_TAR_EXT;
+    } else {
+        if (type == '0' || type == '\0' || type == '7' || type == '5') {
+            char name[MAX_PATH];
+            tar_member_name(h, ex->long_name, name, sizeof(name));
+            if (extract_begin(ex, name, type == '5', (long)tar_number(h + 136, 12)) != 0) return -1;
+        } else if (type != 'g') {
+            // Links, devices and fifos are not recreated
+            ex->skipped++;
+        }
+        ex->tar_state = EXTRACT_TAR_DATA;
+        ex->long_name[0] = '\0';
+        ex->has_pax_size = 0;
+    }
+    extract_tar_section_done(ex);
+    return 0;
+}
+
+// Tar stream in pieces of any size (inflate output or raw upload data)
+static int extract_tar_push(extract_t *ex, const unsigned char *data, size_t len) {
+    while (len > 0 && ex->tar_state != EXTRACT_TAR_END) {
+        if (ex->tar_state == EXTRACT_TAR_HEADER) {
+            size_t n = 512 - ex->header_len < len ? 512 - ex->header_len : len;
+            memcpy(ex->header + ex->header_len, data, n);
+            ex->header_len += n;
+            data += n;
+            len -= n;
+            if (ex->header_len == 512) {
+                ex->header_len = 0;
+                if (extract_tar_header(ex) != 0) return -1;
+            }
+            continue;
+        }
+        size_t n = ex->remaining < len ? ex->remaining : len;
+        if (ex->tar_state == EXTRACT_TAR_DATA && extract_data(ex, data, n) != 0) return -1;
+        if (ex->tar_state == EXTRACT_TAR_EXT) {
+            memcpy(ex->ext + ex->ext_len, data, n);
+            ex->ext_len += n;
+        }
+        data += n;
+        len -= n;
+        ex->remaining -= n;
+        extract_tar_section_done(ex);
+    }
+    return 0;
+}
+
+static int extract_gzip_write(void *ctx, const unsigned char *buf, size_t len) {
+    extract_t *ex = ctx;
+    ex->gz_crc = crc32_ieee(ex->gz_crc, buf, len);
+    ex->gz_size += len;
+    return extract_tar_push(ex, buf, len);
+}
+
+static int extract_tar(extract_t *ex) {
+    ssize_t r;
+    while ((r = extract_read(ex, ex->scratch, INFLATE_IN_BUF)) > 0) {
+        if (extract_tar_push(ex, ex->scratch, r) != 0) return -1;
+        if (ex->tar_state == EXTRACT_TAR_END) return 0;
+    }
+    return r;
+}
+
+static int extract_tar_gz(extract_t *ex) {
+    unsigned char h[10];
+    if (extract_read_exact(ex, h, 10) != 0) return -1;
+    if (h[2] != 8) {
+        snprintf(ex->error, sizeof(ex->error), "Unsupported gzip compression method");
+        return -1;
+    }
+    int flags = h[3];
+    if (flags & 4) {
+        // FEXTRA
+        if (extract_read_exact(ex, h, 2) != 0 || extract_skip(ex, le16(h)) != 0) return -1;
+    }
+    for (int field = 8; field <= 16; field <<= 1) {
+        // FNAME and FCOMMENT are zero-terminated
+        if (!(flags & field)) continue;
+        do {
+            if (extract_read_exact(ex, h, 1) != 0) return -1;
+        } while (h[0]);
+    }
+    if ((flags & 2) && extract_skip(ex, 2) != 0) return -1;
+    
+    inflate_init(ex->z, extract_read, extract_gzip_write, ex);
+    if (inflate_run(ex->z) != 0) {
+        if (!ex->error[0] && !ex->write_error) snprintf(ex->error, sizeof(ex->error), "Corrupt gzip data");
+        return -1;
+    }
+    extract_unread(ex, ex->scratch, inflate_unused(ex->z, ex->scratch));
+    if (extract_read_exact(ex, h, 8) != 0) return -1;
+    if (le32(h) != ex->gz_crc || le32(h + 4) != (uint32_t)ex->gz_size) {
+        snprintf(ex->error, sizeof(ex->error), "gzip CRC mismatch");
+        return -1;
+    }
+    return 0;
+}
+
+static ssize_t extract_zip_read(void *ctx, unsigned char *buf, size_t len) {
+    extract_t *ex = ctx;
+    if (len > ex->limit) len = ex->limit;
+    if (len == 0) return 0;
+    ssize_t r = extract_read(ex, buf, len);
+    if (r > 0) ex->limit -= r;
+    return r;
+}
+
+static int extract_zip_write(void *ctx, const unsigned char *buf, size_t len) {
+    extract_t *ex = ctx;
+    ex->member_crc = crc32_ieee(ex->member_crc, buf, len);
+    return extract_data(ex, buf, len);
+}
+
+// Zip read front to back through the local headers; the central directory at
+// the end is not needed. Entries with a data descriptor (flag bit 3) have no
+// sizes up front: deflate finds its own end, and the descriptor follows.
+static int extract_zip(extract_t *ex) {
+    unsigned char h[30];
+    char name[MAX_PATH];
+    while (1) {
+        if (extract_read_exact(ex, h, 4) != 0) return -1;
+        uint32_t sig = le32(h);
+        if (sig == 0x02014b50 || sig == 0x06054b50 || sig == 0x06064b50) return 0;
+        if (sig != 0x04034b50 || extract_read_exact(ex, h + 4, 26) != 0) {
+            if (!ex->error[0]) snprintf(ex->error, sizeof(ex->error), "Corrupt zip archive");
+            return -1;
+        }
+        uint16_t flags = le16(h + 6), method = le16(h + 8);
+        uint32_t crc = le32(h + 14);
+        unsigned long long csize = le32(h + 18), usize = le32(h + 22);
+        size_t name_len = le16(h + 26), extra_len = le16(h + 28);
+        size_t keep = name_len < sizeof(name) ? name_len : 0;
+        if (extract_read_exact(ex, name, keep) != 0 || extract_skip(ex, name_len - keep) != 0) return -1;
+        name[keep] = '\0';
+        if (extract_read_exact(ex, ex->scratch, extra_len) != 0) return -1;
+        int zip64 = 0;
+        for (size_t off = 0; off + 4 <= extra_len; ) {
+            size_t field_len = le16(ex->scratch + off + 2);
+            if (off + 4 + field_len > extra_len) break;
+            if (le16(ex->scratch + off) == 1) {
+                const unsigned char *v = ex->scratch + off + 4, *v_end = v + field_len;
+                zip64 = 1;
+                if (usize == 0xFFFFFFFF && v + 8 <= v_end) { usize = le64(v); v += 8; }
+                if (csize == 0xFFFFFFFF && v + 8 <= v_end) csize = le64(v);
+            }
+            off += 4 + field_len;
+        }
+        int descriptor = (flags & 8) != 0;
+        if (flags & 1) {
+            snprintf(ex->error, sizeof(ex->error), "Encrypted zip entries are not supported: %s", name);
+            return -1;
+        }
+        if (method != 0 && method != 8) {
+            if (descriptor) {
+                snprintf(ex->error, sizeof(ex->error), "Unsupported zip compression method %u", method);
+                return -1;
+            }
+            ex->skipped++;
+            if (extract_skip(ex, csize) != 0) return -1;
+            continue;
+        }
+        if (method == 0 && descriptor) {
+            snprintf(ex->error, sizeof(ex->error), "Stored zip entries with data descriptors are not supported: %s", name);
+            return -1;
+        }
+        
+        int is_dir = keep && name[keep - 1] == '/';
+        ex->member_crc = 0;
+        if (!keep) ex->skipped++;
+        else if (extract_begin(ex, name, is_dir, dos_time_to_epoch(le16(h + 12), le16(h + 10))) != 0) return -1;
+        if (method == 0) {
+            for (unsigned long long left = csize; left > 0; ) {
+                ssize_t r = extract_read(ex, ex->scratch, left < INFLATE_IN_BUF ? left : INFLATE_IN_BUF);
+                if (r <= 0 || extract_zip_write(ex, ex->scratch, r) != 0) return -1;
+                left -= r;
+            }
+        } else {
+            ex->limit = descriptor ? ~0ULL : csize;
+            inflate_init(ex->z, extract_zip_read, extract_zip_write, ex);
+            if (inflate_run(ex->z) != 0) {
+                if (!ex->error[0] && !ex->write_error) {
+                    snprintf(ex->error, sizeof(ex->error), "Corrupt data in %s", name);
+                }
+                return -1;
+            }
+            size_t unused = inflate_unused(ex->z, ex->scratch);
+            if (descriptor) extract_unread(ex, ex->scratch, unused);
+            else if (extract_skip(ex, ex->limit) != 0) return -1;
+        }
+        if (descriptor) {
+            // Optional signature, CRC-32, then 4- or 8-byte sizes
+            if (extract_read_exact(ex, h, 4) != 0) return -1;
+            if (le32(h) == 0x08074b50 && extract_read_exact(ex, h, 4) != 0) return -1;
+            crc = le32(h);
+            if (extract_skip(ex, zip64 ? 16 : 8) != 0) return -1;
+        }
+        if (ex->member_crc != crc) {
+            snprintf(ex->error, sizeof(ex->error), "CRC mismatch in %s", name);
+            return -1;
+        }
+        extract_end(ex);
+    }
+}
+
+// Unpack the upload's file part into dir. Returns 0, or an HTTP status with a
+// JSON error in error_msg. Checksums of the archive bytes end up in ex->crc
+// (and sha) as for a stored upload.
+static int extract_run(extract_t *ex, char *error_msg, size_t error_len) {
+    for (int i = 0; i < EXTRACT_WRITERS; i++) {
+        if (pthread_create(&ex->writers[ex->writer_count], NULL, extract_writer_thread, ex) == 0) ex->writer_count++;
+    }
+    int rc = -1;
+    unsigned char magic[4];
+    size_t got = 0;
+    ssize_t r = 0;
+    while (ex->writer_count && got < 4 && (r = extract_read(ex, magic + got, 4 - got)) > 0) got += r;
+    if (r >= 0 && ex->writer_count) {
+        extract_unread(ex, magic, got);
+        if (got >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+            ex->format = "tar.gz";
+            rc = extract_tar_gz(ex);
+        } else if (got == 4 && magic[0] == 'P' && magic[1] == 'K' && (magic[2] == 3 || magic[2] == 5)) {
+            ex->format = "zip";
+            rc = extract_zip(ex);
+        } else {
+            ex->format = "tar";
+            rc = extract_tar(ex);
+        }
+        if (rc == 0 && strcmp(ex->format, "zip") != 0 &&
+            (ex->tar_state != EXTRACT_TAR_END && (ex->tar_state != EXTRACT_TAR_HEADER || ex->header_len))) {
+            snprintf(ex->error, sizeof(ex->error), "Truncated tar archive");
+            rc = -1;
+        }
+        // Trailing data (the zip central directory, tar padding) still counts for the checksums
+        while (rc == 0 && (r = extract_read(ex, ex->scratch, INFLATE_IN_BUF)) > 0) {
+        }
+        if (r < 0) rc = -1;
+    }
+    extract_end(ex);
+    
+    pthread_mutex_lock(&ex->lock);
+    ex->stopping = 1;
+    pthread_cond_broadcast(&ex->cond);
+    pthread_mutex_unlock(&ex->lock);
+    for (int i = 0; i < ex->writer_count; i++) pthread_join(ex->writers[i], NULL);
+    if (rc == 0 && !ex->write_error) return 0;
+    
+    char error_json[sizeof(ex->error) * 2];
+    if (!ex->writer_count) {
+        snprintf(error_msg, error_len, "{\"error\":\"Failed to start writer threads\"}");
+        return 500;
+    }
+    if (ex->write_error) {
+        snprintf(error_msg, error_len, "{\"error\":\"%s\"}",
+                 ex->write_error == ENOSPC ? "No space left on device" : "Failed to write file");
+        return 500;
+    }
+    if (ex->source_error) {
+        snprintf(error_msg, error_len, "{\"error\":\"%s\"}",
+                 ex->u->lost ? "Connection lost during upload" : "Closing boundary missing");
+        return 400;
+    }
+    json_escape(error_json, sizeof(error_json), ex->error[0] ? ex->error : "Truncated archive");
+    snprintf(error_msg, error_len, "{\"error\":\"%s\"}", error_json);
+    return 400;
+}
+
+void extract_destroy(extract_t *ex) {
+    while (ex->free_list) {
+        extract_chunk_t *next = ex->free_list->next;
+        free(ex->free_list);
+        ex->free_list = next;
+    }
+    pthread_mutex_destroy(&ex->lock);
+    pthread_cond_destroy(&ex->cond);
+    free(ex->scratch);
+    free(ex->z);
+    free(ex->ext);
+    free(ex);
+}
+
+extract_t* extract_create(upload_stream_t *u, const char *dir, sha256_ctx_t *sha) {
+    extract_t *ex = calloc(1, sizeof(*ex));
+    if (!ex) return NULL;
+    ex->u = u;
+    ex->dir = dir;
+    ex->sha = sha;
+    ex->scratch = malloc(INFLATE_IN_BUF + 8);
+    ex->z = malloc(sizeof(inflate_t));
+    pthread_mutex_init(&ex->lock, NULL);
+    pthread_cond_init(&ex->cond, NULL);
+    int ok = ex->scratch && ex->z;
+    for (int i = 0; ok && i < EXTRACT_BUFFERS; i++) {
+        extract_chunk_t *c = malloc(sizeof(*c) + EXTRACT_CHUNK);
+        if (!c) break;
+        c->next = ex->free_list;
+        ex->free_list = c;
+    }
+    if (!ok || !ex->free_list) {
+        extract_destroy(ex);
+        return NULL;
+    }
+    return ex;
+}
+
+// Handle file upload
+// The multipart body is streamed from the socket into a temp file next to the
+// target. CRC32C (and SHA-256 when a digest asks for it) is computed as the
+// bytes pass through the buffer; Content-Digest is checked against the request
+// body and X-Checksum against the file data, and the temp file is renamed into
+// place only when everything matches.
+void handle_upload_file(int sock, const char *request) {
+    client_info_t *client = current_client();
+    char value[512];
+    
+    // Get boundary from Content-Type header
+    char *boundary = http_header(request, "Content-Type", value, sizeof(value)) ? strstr(value, "boundary=") : NULL;
+    if (!boundary) {
+        const char *error_msg = "{\"error\":\"No boundary found in headers\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    boundary += 9;
+    if (*boundary == '"') {
+        boundary++;
+        boundary[strcspn(boundary, "\"")] = '\0';
+    } else {
+        boundary[strcspn(boundary, "; \t")] = '\0';
+    }
+    if (!*boundary || strlen(boundary) > 70) {
+        const char *error_msg = "{\"error\":\"Invalid boundary\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    // The file data ends at CRLF "--" boundary
+    char delim[80];
+    size_t delim_len = snprintf(delim, sizeof(delim), "\r\n--%s", boundary);
+    
+    if (!http_header(request, "Content-Length", value, sizeof(value))) {
+        const char *error_msg = "{\"error\":\"No Content-Length\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    unsigned long long content_length = strtoull(value, NULL, 10);
+    
+    checksum_expect_t body_expect, file_expect;
+    memset(&body_expect, 0, sizeof(body_expect));
+    memset(&file_expect, 0, sizeof(file_expect));
+    if (http_header(request, "Content-Digest", value, sizeof(value))) parse_content_digest(value, &body_expect);
+    if (http_header(request, "X-Checksum", value, sizeof(value))) parse_x_checksum(value, &file_expect);
+    
+    // Find body start (after HTTP headers)
+    const char *headers_end = strstr(request, "\r\n\r\n");
+    if (!headers_end) {
+        const char *error_msg = "{\"error\":\"No body found - headers incomplete\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    size_t head_len = headers_end + 4 - request;
+    size_t request_len = client ? client->request_len : strlen(request);
+    size_t initial = request_len > head_len ? request_len - head_len : 0;
+    if (initial > content_length) initial = content_length;
+    
+    upload_stream_t u;
+    memset(&u, 0, sizeof(u));
+    u.sock = sock;
+    u.cap = BUFFER_SIZE;
+    u.content_length = content_length;
+    u.transfer = -1;
+    u.body_sha = body_expect.has_sha;
+    if (u.body_sha) sha256_init(&u.body_sha_ctx);
+    u.buf = malloc(u.cap + 1);
+    if (!u.buf) {
+        send_http_response(sock, 500, "text/plain", "Memory error", 12);
+        return;
+    }
+    memcpy(u.buf, request + head_len, initial);
+    u.len = initial;
+    upload_account(&u, u.buf, initial);
+    
+    // Part headers: "--boundary\r\n...filename=\"x\"...\r\n\r\n"
+    char *part_end;
+    while (!(part_end = memmem(u.buf, u.len, "\r\n\r\n", 4))) {
+        if (u.len >= UPLOAD_PART_HEADERS_MAX || upload_fill(&u, u.len + 1) <= 0) {
+            free(u.buf);
+            const char *error_msg = "{\"error\":\"No file data start marker\"}";
+            send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+            return;
+        }
+    }
+    *part_end = '\0';
+    char *filename_start = strstr(u.buf, "filename=\"");
+    if (strncmp(u.buf, delim + 2, delim_len - 2) != 0 || !filename_start) {
+        free(u.buf);
+        const char *error_msg = "{\"error\":\"No filename in multipart data\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    filename_start += 10;
+    char filename[MAX_PATH];
+    int j = 0;
+    while (filename_start[j] && filename_start[j] != '"' && j < MAX_PATH - 1) {
+        filename[j] = filename_start[j];
+        j++;
+    }
+    filename[j] = '\0';
     
-    // Network info
-    pos += sprintf(json + pos, "\"network\":{\"hostname\":\"%s\",\"ip\":\"%s\"},", hostname, ip_address);
+    // Sanitize filename
+    for (int k = 0; filename[k]; k++) {
+        if (filename[k] == '/' || filename[k] == '\\') {
+            filename[k] = '_';
+        }
+    }
+    if (!filename[0] || strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0) {
+        free(u.buf);
+        const char *error_msg = "{\"error\":\"Invalid filename\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    size_t data_off = part_end + 4 - u.buf;
+    memmove(u.buf, u.buf + data_off, u.len - data_off);
+    u.len -= data_off;
     
-    // Server statistics
-    pos += sprintf(json + pos, "\"server\":{\"total_requests\":%lu,\"files_transferred\":%lu,\"bytes_transferred\":%llu,\"active_connections\":%d}", 
-                   total_requests, total_files_transferred, total_bytes_transferred, active_connections);
+    // Get path from query - extract from first line only (not from body)
+    char first_line[1024];
+    const char *line_end = strstr(request, "\r\n");
+    size_t line_len = line_end ? (size_t)(line_end - request) : strlen(request);
+    if (line_len > sizeof(first_line) - 1) line_len = sizeof(first_line) - 1;
+    memcpy(first_line, request, line_len);
+    first_line[line_len] = '\0';
     
-    pos += sprintf(json + pos, "}");
+    query_t query;
+    query_parse(&query, strchr(first_line, '?'));
+    char dir[MAX_PATH];
+    char *path_param = query_get(&query, "path", dir, sizeof(dir));
+    if (!path_param || !*path_param) strcpy(dir, "/data");
+    char extract_value[8];
+    int extract = query_get(&query, "extract", extract_value, sizeof(extract_value)) && strcmp(extract_value, "1") == 0;
+    char filepath[MAX_PATH], temp_path[MAX_PATH];
+    if (snprintf(filepath, sizeof(filepath), "%s/%s", dir, filename) >= (int)sizeof(filepath) ||
+        snprintf(temp_path, sizeof(temp_path), "%s/.ps5wm-upload-%u.part", dir,
+                 atomic_fetch_add(&upload_seq, 1)) >= (int)sizeof(temp_path)) {
+        free(u.buf);
+        const char *msg = "{\"error\":\"Path too long\"}";
+        send_http_response(sock, 400, "application/json", msg, strlen(msg));
+        return;
+    }
     
-    send_http_response(sock, 200, "application/json", json, pos);
+    // The file is the rest of the body less the closing "\r\n--boundary--\r\n"
+    unsigned long long consumed = u.body_read - u.len, trailer = delim_len + 4;
+    unsigned long long expected = content_length > consumed + trailer ? content_length - consumed - trailer : 0;
+    if (write_space_check(dir, expected) == ENOSPC) {
+        free(u.buf);
+        char space_msg[128];
+        snprintf(space_msg, sizeof(space_msg), "{\"error\":\"Not enough free space for %llu bytes\"}", expected);
+        send_http_response(sock, 507, "application/json", space_msg, strlen(space_msg));
+        return;
+    }
+    
+    if (client) {
+        client->transfer = transfer_begin(TRANSFER_UPLOAD, filepath, content_length);
+        u.transfer = client->transfer;
+        transfer_progress(u.transfer, u.body_read);
+    }
+    
+    uint32_t file_crc = 0;
+    sha256_ctx_t file_sha;
+    if (file_expect.has_sha) sha256_init(&file_sha);
+    unsigned long long file_size = 0;
+    char error_msg[(MAX_PATH + 64) * 2 + 16];      // fits an escaped extract_t error plus the JSON around it
+    int status = 0;
+    int fd = -1;
+    file_writer_t writer;
+    extract_t *ex = NULL;
+    u.delim = delim;
+    u.delim_len = delim_len;
+    if (extract) {
+        ex = extract_create(&u, dir, file_expect.has_sha ? &file_sha : NULL);
+        if (!ex) {
+            free(u.buf);
+            send_http_response(sock, 500, "text/plain", "Memory error", 12);
+            return;
+        }
+        status = extract_run(ex, error_msg, sizeof(error_msg));
+        hot_file_invalidate(dir);
+        file_crc = ex->crc;
+        file_size = ex->archive_bytes;
+    } else {
+        int err = file_writer_open(&writer, temp_path, expected);
+        if (err) {
+            free(u.buf);
+            snprintf(error_msg, sizeof(error_msg), "{\"error\":\"Failed to create file: %s (errno=%d)\"}", filepath, err);
+            send_http_response(sock, err == ENOSPC ? 507 : 500, "application/json", error_msg, strlen(error_msg));
+            return;
+        }
+        fd = writer.fd;
+        const char *data;
+        ssize_t out;
+        while ((out = upload_part_next(&u, &data)) > 0) {
+            file_crc = crc32c(file_crc, data, out);
+            if (file_expect.has_sha) sha256_update(&file_sha, data, out);
+            if ((err = file_writer_write(&writer, data, out)) != 0) break;
+            file_size += out;
+        }
+        if (!err && out == 0) err = file_writer_finish(&writer);
+        if (err) {
+            status = err == ENOSPC ? 507 : 500;
+            snprintf(error_msg, sizeof(error_msg), "{\"error\":\"%s\"}",
+                     err == ENOSPC ? "No space left on device" : "Failed to write file");
+        }
+        if (out < 0) {
+            status = 400;
+            snprintf(error_msg, sizeof(error_msg), "{\"error\":\"%s\"}",
+                     u.lost ? "Connection lost during upload" : "Closing boundary missing");
+        }
+    }
+    
+    // Consume whatever follows the closing boundary so the body digest covers it all
+    while (!status && u.body_read < u.content_length) {
+        u.len = 0;
+        if (upload_fill(&u, u.cap) <= 0) {
+            status = 400;
+            snprintf(error_msg, sizeof(error_msg), "{\"error\":\"Connection lost during upload\"}");
+        }
+    }
+    free(u.buf);
+    
+    unsigned char sha[32];
+    char expected_hex[HASH_DIGEST_MAX], sha_hex[HASH_DIGEST_MAX] = "";
+    if (!status && body_expect.has_crc && u.body_crc != body_expect.crc) {
+        status = 400;
+        snprintf(error_msg, sizeof(error_msg),
+                 "{\"error\":\"Checksum mismatch: crc32c expected %08x, got %08x\"}", body_expect.crc, u.body_crc);
+    }
+    if (!status && body_expect.has_sha) {
+        sha256_final(&u.body_sha_ctx, sha);
+        if (memcmp(sha, body_expect.sha, 32) != 0) {
+            status = 400;
+            hex_encode(expected_hex, body_expect.sha, 32);
+            hex_encode(sha_hex, sha, 32);
+            snprintf(error_msg, sizeof(error_msg),
+                     "{\"error\":\"Checksum mismatch: sha256 expected %s, got %s\"}", expected_hex, sha_hex);
+        }
+    }
+    if (!status && file_expect.has_crc && file_crc != file_expect.crc) {
+        status = 400;
+        snprintf(error_msg, sizeof(error_msg),
+                 "{\"error\":\"Checksum mismatch: crc32c expected %08x, got %08x\"}", file_expect.crc, file_crc);
+    }
+    if (!status && file_expect.has_sha) {
+        sha256_final(&file_sha, sha);
+        hex_encode(sha_hex, sha, 32);
+        if (memcmp(sha, file_expect.sha, 32) != 0) {
+            status = 400;
+            hex_encode(expected_hex, file_expect.sha, 32);
+            snprintf(error_msg, sizeof(error_msg),
+                     "{\"error\":\"Checksum mismatch: sha256 expected %s, got %s\"}", expected_hex, sha_hex);
+        }
+    }
+    
+    char crc_hex[16];
+    snprintf(crc_hex, sizeof(crc_hex), "%08x", file_crc);
+    if (ex) {
+        // Members are already in place; a checksum mismatch still fails the request
+        char response[MAX_PATH * 4 + 512];
+        if (!status) {
+            char name_json[MAX_PATH * 2], path_json[MAX_PATH * 2];
+            json_escape(name_json, sizeof(name_json), filename);
+            json_escape(path_json, sizeof(path_json), dir);
+            snprintf(response, sizeof(response),
+                     "{\"success\":true,\"filename\":\"%s\",\"size\":%llu,\"path\":\"%s\",\"crc32c\":\"%s\",\"verified\":%s,"
+                     "\"extracted\":{\"format\":\"%s\",\"files\":%llu,\"dirs\":%llu,\"bytes\":%llu,\"skipped\":%llu}}",
+                     name_json, file_size, path_json, crc_hex,
+                     (body_expect.has_crc || body_expect.has_sha || file_expect.has_crc || file_expect.has_sha) ? "true" : "false",
+                     ex->format, ex->files, ex->dirs, ex->bytes, ex->skipped);
+            metric_counter_add(&total_files_transferred, ex->files);
+            metric_counter_add(&total_bytes_transferred, file_size);
+        }
+        extract_destroy(ex);
+        if (status) send_http_response(sock, status, "application/json", error_msg, strlen(error_msg));
+        else send_http_response(sock, 200, "application/json", response, strlen(response));
+        return;
+    }
+    
+    struct stat st;
+    int stat_ok = !status && fstat(fd, &st) == 0;
+    file_writer_close(&writer);
+    if (!status && rename(temp_path, filepath) != 0) {
+        status = 500;
+        snprintf(error_msg, sizeof(error_msg), "{\"error\":\"Failed to move file into place (errno=%d)\"}", errno);
+    }
+    if (status) {
+        unlink(temp_path);
+        send_http_response(sock, status, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    hot_file_invalidate(filepath);
+    
+    // The rename keeps dev/inode/mtime, so later downloads can send the digest without reading
+    if (stat_ok) {
+        hash_cache_store(&st, HASH_CRC32C, crc_hex, filepath);
+        if (sha_hex[0]) hash_cache_store(&st, HASH_SHA256, sha_hex, filepath);
+    }
+    
+    // Update stats
+    metric_counter_add(&total_files_transferred, 1);
+    metric_counter_add(&total_bytes_transferred, file_size);
+    
+    char name_json[MAX_PATH * 2], path_json[MAX_PATH * 2];
+    json_escape(name_json, sizeof(name_json), filename);
+    json_escape(path_json, sizeof(path_json), filepath);
+    char response[MAX_PATH * 4 + 256];
+    snprintf(response, sizeof(response),
+             "{\"success\":true,\"filename\":\"%s\",\"size\":%llu,\"path\":\"%s\",\"crc32c\":\"%s\",\"verified\":%s}",
+             name_json, file_size, path_json, crc_hex,
+             (body_expect.has_crc || body_expect.has_sha || file_expect.has_crc || file_expect.has_sha) ? "true" : "false");
+    send_http_response(sock, 200, "application/json", response, strlen(response));
+}
+
+// Copy a file into dst through a preallocated temp file in the same directory,
+// renamed into place once complete. Returns 0 or an errno value (ENOSPC when
+// the destination can't hold it).
+int copy_file_atomic(const char *src, const char *dst) {
+    int src_fd = open(src, O_RDONLY);
+    struct stat st;
+    if (src_fd < 0 || fstat(src_fd, &st) != 0) {
+        int err = errno;
+        if (src_fd >= 0) close(src_fd);
+        return err;
+    }
+    char dir[MAX_PATH], temp_path[MAX_PATH + 32];
+    const char *slash = strrchr(dst, '/');
+    snprintf(dir, sizeof(dir), "%.*s", slash ? (slash == dst ? 1 : (int)(slash - dst)) : 1, slash ? dst : ".");
+    snprintf(temp_path, sizeof(temp_path), "%s/.ps5wm-upload-%u.part", dir, atomic_fetch_add(&upload_seq, 1));
+    file_writer_t w;
+    int err = write_space_check(dir, st.st_size);
+    if (!err) err = file_writer_open(&w, temp_path, st.st_size);
+    if (err) {
+        close(src_fd);
+        return err;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(src_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    // Read straight into the writer's aligned buffer
+    while (!err) {
+        ssize_t n = read(src_fd, w.buf + w.len, WRITE_BUFFER - w.len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) err = errno;
+        if (n <= 0) break;
+        w.len += n;
+        if (w.len == WRITE_BUFFER) err = file_writer_flush(&w);
+    }
+    if (!err) err = file_writer_finish(&w);
+    close(src_fd);
+    int close_err = file_writer_close(&w);
+    if (!err) err = close_err;
+    if (!err && rename(temp_path, dst) != 0) err = errno;
+    if (err) unlink(temp_path);
+    else hot_file_invalidate(dst);
+    return err;
+}
+
+// Upload preflight
+// The client sends the size and digest of a file it is about to upload. If the
+// hash cache knows an unchanged file with that content, the upload is
+// satisfied locally (hardlink, or a server-side copy across filesystems) and
+// the existing copies are listed so the space they take can be reclaimed.
+void handle_upload_preflight(int sock, const char *dir, const char *name, const char *size_str,
+                             const char *algo_str, const char *hash_str, const char *mode) {
+    int algo = hash_algo_from_name(algo_str && *algo_str ? algo_str : "sha256");
+    size_t digest_len = algo == HASH_SHA256 ? 64 : algo == HASH_XXH64TREE ? 16 : 0;
+    if (!digest_len) {
+        // CRC32C is too short to identify content
+        const char *error_msg = "{\"error\":\"algo must be sha256 or xxh64tree\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    char digest[HASH_DIGEST_MAX];
+    if (!hash_str || strlen(hash_str) != digest_len || strspn(hash_str, "0123456789abcdefABCDEF") != digest_len ||
+        !size_str || !isdigit((unsigned char)*size_str)) {
+        const char *error_msg = "{\"error\":\"size and hash required\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    for (size_t i = 0; i <= digest_len; i++) digest[i] = tolower((unsigned char)hash_str[i]);
+    unsigned long long size = strtoull(size_str, NULL, 10);
+    if (!mode || !*mode) mode = "link";
+    int check_only = strcmp(mode, "check") == 0;
+    if (!check_only && (!name || !*name || strchr(name, '/') || strcmp(name, ".") == 0 || strcmp(name, "..") == 0)) {
+        const char *error_msg = "{\"error\":\"Valid name required\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    const char *target_dir = dir && *dir ? dir : "/data";
+    char target[MAX_PATH] = "", temp_path[MAX_PATH];
+    if (!check_only &&
+        (snprintf(target, sizeof(target), "%s/%s", target_dir, name) >= (int)sizeof(target) ||
+         snprintf(temp_path, sizeof(temp_path), "%s/.ps5wm-upload-%u.part", target_dir,
+                  atomic_fetch_add(&upload_seq, 1)) >= (int)sizeof(temp_path))) {
+        const char *error_msg = "{\"error\":\"Path too long\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    
+    // Candidates from the cache, kept only if the file on disk is still the one hashed
+    char (*paths)[MAX_PATH] = malloc(DEDUP_MAX_CANDIDATES * sizeof(*paths));
+    if (!paths) {
+        send_http_response(sock, 500, "text/plain", "Memory error", 12);
+        return;
+    }
+    int found = hash_cache_find_digest(algo, size, digest, paths, DEDUP_MAX_CANDIDATES);
+    int count = 0, source = -1, target_is_dup = 0;
+    struct stat source_st = {0}, target_st;
+    int target_exists = target[0] && stat(target, &target_st) == 0;
+    for (int i = 0; i < found; i++) {
+        struct stat st;
+        char current[HASH_DIGEST_MAX];
+        if (stat(paths[i], &st) != 0 || !S_ISREG(st.st_mode) ||
+            !hash_cache_lookup(&st, algo, current) || strcmp(current, digest) != 0) continue;
+        if (target_exists && st.st_dev == target_st.st_dev && st.st_ino == target_st.st_ino) target_is_dup = 1;
+        // Prefer a source on the target's filesystem so a hardlink works
+        if (source < 0 || (target_exists && st.st_dev == target_st.st_dev && source_st.st_dev != target_st.st_dev)) {
+            source = count;
+            source_st = st;
+        }
+        if (count != i) memcpy(paths[count], paths[i], MAX_PATH);
+        count++;
+    }
+    
+    const char *method = NULL;
+    int err = 0;
+    if (count > 0 && !check_only) {
+        if (target_is_dup) {
+            method = "exists";
+        } else {
+            if (strcmp(mode, "copy") != 0) {
+                // link() refuses to replace, so link to a temp name and rename over the target
+                if (link(paths[source], temp_path) == 0) {
+                    if (rename(temp_path, target) == 0) {
+                        hot_file_invalidate(target);
+                        method = "hardlink";
+                    } else {
+                        err = errno;
+                        unlink(temp_path);
+                    }
+                } else if (errno != EXDEV && errno != EPERM && errno != ENOTSUP && errno != EMLINK) {
+                    err = errno;
+                }
+            }
+            if (!method && !err) {
+                err = copy_file_atomic(paths[source], target);
+                if (!err) {
+                    method = "copy";
+                    struct stat st;
+                    if (stat(target, &st) == 0) hash_cache_store(&st, algo, digest, target);
+                }
+            }
+            if (method) metric_counter_add(&dedup_bytes_saved, size);
+        }
+    }
+    
+    size_t cap = 512 + (size_t)count * (MAX_PATH * 2 + 4);
+    char *json = malloc(cap);
+    if (!json) {
+        free(paths);
+        send_http_response(sock, 500, "text/plain", "Memory error", 12);
+        return;
+    }
+    char escaped[MAX_PATH * 2];
+    int len = snprintf(json, cap, "{\"satisfied\":%s", method ? "true" : "false");
+    if (method) {
+        len += snprintf(json + len, cap - len, ",\"method\":\"%s\"", method);
+        json_escape(escaped, sizeof(escaped), paths[source]);
+        len += snprintf(json + len, cap - len, ",\"source\":\"%s\"", escaped);
+        json_escape(escaped, sizeof(escaped), target);
+        len += snprintf(json + len, cap - len, ",\"path\":\"%s\"", escaped);
+    } else if (err) {
+        len += snprintf(json + len, cap - len, ",\"error\":\"%s\"", strerror(err));
+    }
+    len += snprintf(json + len, cap - len, ",\"size\":%llu,\"algo\":\"%s\",\"hash\":\"%s\",\"duplicates\":[",
+                    size, hash_algo_names[algo], digest);
+    for (int i = 0; i < count; i++) {
+        json_escape(escaped, sizeof(escaped), paths[i]);
+        len += snprintf(json + len, cap - len, "%s\"%s\"", i ? "," : "", escaped);
+    }
+    // Every copy beyond the first is space that hardlinking or deleting would give back
+    snprintf(json + len, cap - len, "],\"reclaimable\":%llu}", count > 1 ? size * (count - 1) : 0);
+    send_http_response(sock, 200, "application/json", json, strlen(json));
+    free(json);
+    free(paths);
+}
+
+// Batch operations
+// POST /api/batch takes a JSON array of operations and runs them in order, in
+// groups: consecutive operations whose paths don't overlap (neither equal nor
+// one inside the other) form a group that runs on up to `parallel` threads, so
+// "mkdir a" always finishes before "move x -> a/x" starts. Every operation gets
+// its own result; with stop=1 the first failure skips all that haven't started.
+#define BATCH_DELETE 0
+#define BATCH_RENAME 1
+#define BATCH_MOVE 2
+#define BATCH_MKDIR 3
+#define BATCH_COPY 4
+
+#define BATCH_PENDING 0
+#define BATCH_OK 1
+#define BATCH_FAILED 2
+#define BATCH_SKIPPED 3
+
+static const char *batch_op_names[] = { "delete", "rename", "move", "mkdir", "copy" };
+
+typedef struct {
+    int kind;
+    char *path;         // delete/mkdir target, or rename/move/copy source
+    char *dst;          // rename/move/copy destination
+    int status;
+    int err;
+} batch_op_t;
+
+typedef struct {
+    batch_op_t *ops;
+    int end;                        // one past the last op of the running group
+    _Atomic int next;
+    _Atomic int failed;
+    int stop_on_error;
+} batch_t;
+
+static const char* json_skip_ws(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+    return p;
+}
+
+// Value of the 4 hex digits of a \u escape, -1 if they aren't
+static int json_hex4(const char *s, const char *end) {
+    int v = 0;
+    for (int i = 0; i < 4; i++) {
+        if (s + i >= end || !isxdigit((unsigned char)s[i])) return -1;
+        v = v * 16 + (isdigit((unsigned char)s[i]) ? s[i] - '0' : tolower((unsigned char)s[i]) - 'a' + 10);
+    }
+    return v;
+}
+
+// Decode the JSON string at *p (which points at the opening quote) into out,
+// which must hold at least as many bytes as the literal. Advances *p past it.
+static int json_read_string(const char **p, const char *end, char *out) {
+    const char *s = *p + 1;
+    size_t o = 0;
+    while (s < end && *s != '"') {
+        unsigned char c = *s++;
+        if (c < 0x20) return -1;
+        if (c != '\\') {
+            out[o++] = c;
+            continue;
+        }
+        if (s >= end) return -1;
+        switch (*s++) {
+            case '"': out[o++] = '"'; break;
+            case '\\': out[o++] = '\\'; break;
+            case '/': out[o++] = '/'; break;
+            case 'b': out[o++] = '\b'; break;
+            case 'f': out[o++] = '\f'; break;
+            case 'n': out[o++] = '\n'; break;
+            case 'r': out[o++] = '\r'; break;
+            case 't': out[o++] = '\t'; break;
+            case 'u': {
+                int cp = json_hex4(s, end), lo;
+                if (cp < 0) return -1;
+                s += 4;
+                if (cp >= 0xD800 && cp < 0xDC00 && end - s >= 6 && s[0] == '\\' && s[1] == 'u' &&
+                    (lo = json_hex4(s + 2, end)) >= 0xDC00 && lo < 0xE000) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    s += 6;
+                }
+                if (cp == 0) return -1;     // no NULs in paths
+                o += utf8_put(out + o, cp);
+                break;
+            }
+            default: return -1;
+        }
+    }
+    if (s >= end) return -1;
+    out[o] = '\0';
+    *p = s + 1;
+    return 0;
+}
+
+// Parse [{"op":"...","path":"..."|"src":"...","dst":"..."}, ...]. Strings
+// are decoded into strings (at least as big as the body). Returns the op
+// count, or -1 with *error set.
+static int batch_parse(const char *body, const char *end, batch_op_t *ops, int max_ops, char *strings,
+                       const char **error) {
+    const char *p = json_skip_ws(body, end);
+    int count = 0;
+    *error = "Body must be a JSON array of operations";
+    if (p >= end || *p++ != '[') return -1;
+    p = json_skip_ws(p, end);
+    if (p < end && *p == ']') return 0;
+    while (1) {
+        if (count == max_ops) {
+            *error = "Too many operations";
+            return -1;
+        }
+        batch_op_t *op = &ops[count];
+        char *name = NULL, *src = NULL, *dst = NULL, *path = NULL;
+        p = json_skip_ws(p, end);
+        if (p >= end || *p++ != '{') return -1;
+        p = json_skip_ws(p, end);
+        while (p < end && *p != '}') {
+            char *key = strings;
+            if (*p != '"' || json_read_string(&p, end, key) != 0) return -1;
+            strings += strlen(key) + 1;
+            p = json_skip_ws(p, end);
+            if (p >= end || *p++ != ':') return -1;
+            p = json_skip_ws(p, end);
+            char *value = strings;
+            if (p >= end || *p != '"' || json_read_string(&p, end, value) != 0) return -1;
+            strings += strlen(value) + 1;
+            if (strcmp(key, "op") == 0) name = value;
+            else if (strcmp(key, "path") == 0) path = value;
+            else if (strcmp(key, "src") == 0) src = value;
+            else if (strcmp(key, "dst") == 0) dst = value;
+            p = json_skip_ws(p, end);
+            if (p < end && *p == ',') p = json_skip_ws(p + 1, end);
+        }
+        if (p >= end) return -1;
+        p++;
+        
+        op->kind = -1;
+        for (int k = 0; name && k < (int)(sizeof(batch_op_names) / sizeof(batch_op_names[0])); k++) {
+            if (strcmp(name, batch_op_names[k]) == 0) op->kind = k;
+        }
+        int two_paths = op->kind == BATCH_RENAME || op->kind == BATCH_MOVE || op->kind == BATCH_COPY;
+        op->path = two_paths ? src : path;
+        op->dst = two_paths ? dst : NULL;
+        if (op->kind < 0 || !op->path || !*op->path || (two_paths && (!op->dst || !*op->dst))) {
+            *error = "Each operation needs a known op and its paths";
+            return -1;
+        }
+        // Trailing slashes would defeat the overlap check
+        for (char *s = op->path; s; s = s == op->path ? op->dst : NULL) {
+            size_t len = strlen(s);
+            while (len > 1 && s[len - 1] == '/') s[--len] = '\0';
+        }
+        op->status = BATCH_PENDING;
+        op->err = 0;
+        count++;
+        
+        p = json_skip_ws(p, end);
+        if (p < end && *p == ',') {
+            p++;
+            continue;
+        }
+        if (p < end && *p == ']') return count;
+        *error = "Body must be a JSON array of operations";
+        return -1;
+    }
+}
+
+// Equal, or one is a directory holding the other
+static int batch_paths_overlap(const char *a, const char *b) {
+    size_t la = strlen(a), lb = strlen(b);
+    size_t n = la < lb ? la : lb;
+    if (strncmp(a, b, n) != 0) return 0;
+    if (la == lb) return 1;
+    const char *longer = la > lb ? a : b;
+    return longer[n] == '/' || (n == 1 && longer[0] == '/');
+}
+
+static int batch_ops_conflict(const batch_op_t *x, const batch_op_t *y) {
+    const char *xp[2] = { x->path, x->dst }, *yp[2] = { y->path, y->dst };
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            if (xp[i] && yp[j] && batch_paths_overlap(xp[i], yp[j])) return 1;
+        }
+    }
+    return 0;
+}
+
+// Run one operation; 0 or an errno value
+static int batch_run_op(const batch_op_t *op) {
+    struct stat st;
+    switch (op->kind) {
+        case BATCH_DELETE:
+            if (lstat(op->path, &st) != 0) return errno;
+            return (S_ISDIR(st.st_mode) ? rmdir(op->path) : unlink(op->path)) == 0 ? 0 : errno;
+        case BATCH_RENAME:
+            return rename(op->path, op->dst) == 0 ? 0 : errno;
+        case BATCH_MOVE:
+            if (rename(op->path, op->dst) == 0) return 0;
+            // Across filesystems a file is copied, then the source removed
+            if (errno != EXDEV) return errno;
+            if (stat(op->path, &st) != 0) return errno;
+            if (!S_ISREG(st.st_mode)) return EXDEV;
+            int err = copy_file_atomic(op->path, op->dst);
+            if (!err && unlink(op->path) != 0) err = errno;
+            return err;
+        case BATCH_MKDIR:
+            return mkdir(op->path, 0755) == 0 ? 0 : errno;
+        case BATCH_COPY:
+            if (stat(op->path, &st) != 0) return errno;
+            if (S_ISDIR(st.st_mode)) return EISDIR;
+            return copy_file_atomic(op->path, op->dst);
+    }
+    return EINVAL;
+}
+
+void* batch_worker_thread(void* arg) {
+    batch_t *b = (batch_t *)arg;
+    int i;
+    while ((i = atomic_fetch_add(&b->next, 1)) < b->end) {
+        batch_op_t *op = &b->ops[i];
+        if (b->stop_on_error && atomic_load(&b->failed)) {
+            op->status = BATCH_SKIPPED;
+            continue;
+        }
+        op->err = batch_run_op(op);
+        hot_file_invalidate(op->path);
+        if (op->dst) hot_file_invalidate(op->dst);
+        op->status = op->err ? BATCH_FAILED : BATCH_OK;
+        if (op->err) atomic_store(&b->failed, 1);
+    }
+    return NULL;
+}
+
+void handle_batch(int sock, const char *request, const char *stop_str, const char *parallel_str) {
+    const char *body = strstr(request, "\r\n\r\n");
+    client_info_t *client = current_client();
+    size_t request_len = client && client->request_len ? client->request_len : strlen(request);
+    if (!body || (size_t)(body + 4 - request) > request_len) {
+        const char *error_msg = "{\"error\":\"Body required\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    body += 4;
+    const char *end = request + request_len;
+    
+    batch_op_t *ops = malloc(BATCH_MAX_OPS * sizeof(batch_op_t));
+    char *strings = malloc(end - body + 1);
+    if (!ops || !strings) {
+        free(ops);
+        free(strings);
+        const char *error_msg = "{\"error\":\"Memory error\"}";
+        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    const char *parse_error;
+    int count = batch_parse(body, end, ops, BATCH_MAX_OPS, strings, &parse_error);
+    if (count < 0) {
+        char error_msg[128];
+        snprintf(error_msg, sizeof(error_msg), "{\"error\":\"%s\"}", parse_error);
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+        free(ops);
+        free(strings);
+        return;
+    }
+    int parallel = parallel_str ? atoi(parallel_str) : BATCH_DEFAULT_PARALLEL;
+    if (parallel < 1) parallel = 1;
+    if (parallel > BATCH_WORKERS) parallel = BATCH_WORKERS;
+    
+    batch_t b = { ops, 0, 0, 0, stop_str && strcmp(stop_str, "1") == 0 };
+    for (int start = 0; start < count; start = b.end) {
+        // Grow the group until an operation touches a path the group already does
+        int group_end = start + 1;
+        while (group_end < count) {
+            int conflict = 0;
+            for (int i = start; i < group_end && !conflict; i++) conflict = batch_ops_conflict(&ops[i], &ops[group_end]);
+            if (conflict) break;
+            group_end++;
+        }
+        b.end = group_end;
+        atomic_store(&b.next, start);
+        
+        pthread_t threads[BATCH_WORKERS];
+        int spawned = 0;
+        for (int t = 1; t < parallel && t < group_end - start; t++) {
+            if (pthread_create(&threads[spawned], NULL, batch_worker_thread, &b) == 0) spawned++;
+        }
+        batch_worker_thread(&b);
+        for (int t = 0; t < spawned; t++) pthread_join(threads[t], NULL);
+    }
+    
+    size_t cap = 256 + (size_t)count * 96;
+    char *json = malloc(cap);
+    if (!json) {
+        free(ops);
+        free(strings);
+        const char *error_msg = "{\"error\":\"Memory error\"}";
+        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    int done = 0, failed = 0, skipped = 0;
+    size_t len = snprintf(json, cap, "{\"results\":[");
+    for (int i = 0; i < count; i++) {
+        const char *status = ops[i].status == BATCH_OK ? "ok" : ops[i].status == BATCH_FAILED ? "error" : "skipped";
+        done += ops[i].status == BATCH_OK;
+        failed += ops[i].status == BATCH_FAILED;
+        skipped += ops[i].status == BATCH_SKIPPED;
+        len += snprintf(json + len, cap - len, "%s{\"op\":\"%s\",\"status\":\"%s\"", i ? "," : "",
+                        batch_op_names[ops[i].kind], status);
+        if (ops[i].status == BATCH_FAILED) len += snprintf(json + len, cap - len, ",\"error\":\"%s\"", strerror(ops[i].err));
+        len += snprintf(json + len, cap - len, "}");
+    }
+    len += snprintf(json + len, cap - len, "],\"success\":%s,\"done\":%d,\"failed\":%d,\"skipped\":%d}",
+                    failed ? "false" : "true", done, failed, skipped);
+    send_compressible_response(sock, request, 200, "application/json", json, len);
+    free(json);
+    free(ops);
+    free(strings);
+}
+
+// Delta sync
+// rsync-style transfer of changed files. The side holding the old copy sends
+// block signatures (a rolling weak checksum and an XXH64 per block); the side
+// holding the new copy slides a window over it byte by byte and answers with
+// references to matching blocks and literal runs for the rest; the old side
+// rebuilds the file into a temp file that replaces the original once the
+// SHA-256 carried at the end of the delta checks out.
+//
+// Signature: "PSDS", u32 block, u64 file size, then per block u32 weak, u64 XXH64
+// Delta:     "PSDD", u32 block, u64 result size, then commands:
+//            1, u64 first block, u32 count   copy blocks of the old file
+//            2, u32 length, bytes            literal data
+//            0, SHA-256 of the result        end
+// Integers are little-endian.
+#define DELTA_CMD_END 0
+#define DELTA_CMD_COPY 1
+#define DELTA_CMD_LITERAL 2
+
+typedef struct {
+    uint32_t weak;
+    uint64_t strong;
+} delta_block_t;
+
+// Parsed signature with a hash table over the weak checksums
+typedef struct {
+    uint32_t block;
+    unsigned long long size;
+    unsigned long long count;
+    const unsigned char *entries;       // count * 12 bytes, as received
+    int32_t *slots;                     // first block per weak hash, -1 for none
+    int32_t *chain;                     // next block with the same weak hash
+    uint32_t mask;
+} delta_sig_t;
+
+typedef struct {
+    unsigned long long literal;         // bytes sent (or written) as literal data
+    unsigned long long copied;          // bytes taken from the old file
+} delta_stats_t;
+
+// Buffered output for signatures and deltas
+typedef struct {
+    int (*write)(void *ctx, const unsigned char *buf, size_t len);
+    void *ctx;
+    unsigned char buf[64 * 1024];
+    size_t len;
+    int error;
+} delta_out_t;
+
+static void delta_out_flush(delta_out_t *o) {
+    if (o->len && !o->error && o->write(o->ctx, o->buf, o->len) != 0) o->error = EIO;
+    o->len = 0;
+}
+
+static void delta_out_put(delta_out_t *o, const void *data, size_t len) {
+    const unsigned char *p = data;
+    while (len > 0 && !o->error) {
+        size_t n = sizeof(o->buf) - o->len;
+        if (n > len) n = len;
+        memcpy(o->buf + o->len, p, n);
+        o->len += n;
+        p += n;
+        len -= n;
+        if (o->len == sizeof(o->buf)) delta_out_flush(o);
+    }
+}
+
+static void delta_put_le(unsigned char *p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) p[i] = v >> (8 * i);
+}
+
+// Block size for a file: about sqrt(size), a power of two in [MIN, MAX],
+// larger only when the file would need more than DELTA_MAX_BLOCKS
+uint32_t delta_block_size(unsigned long long size) {
+    uint32_t block = DELTA_BLOCK_MIN;
+    while (block < DELTA_READ && (((unsigned long long)block * block < size && block < DELTA_BLOCK_MAX) ||
+                                  (size + block - 1) / block > DELTA_MAX_BLOCKS)) {
+        block *= 2;
+    }
+    return block;
+}
+
+// Block sizes are powers of two up to DELTA_READ, so reads split into whole blocks
+static int delta_block_valid(unsigned long long block) {
+    return block >= DELTA_BLOCK_MIN && block <= DELTA_READ && (block & (block - 1)) == 0;
+}
+
+// rsync's rolling checksum: a is the byte sum, b the sum of the running a's
+static uint32_t delta_weak(const unsigned char *p, size_t len, uint32_t *a_out, uint32_t *b_out) {
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; i++) {
+        a += p[i];
+        b += (uint32_t)(len - i) * p[i];
+    }
+    *a_out = a;
+    *b_out = b;
+    return (a & 0xFFFF) | b << 16;
+}
+
+// Write the signature of fd (size bytes) in blocks of `block`. 0 or an errno value.
+int delta_signature(int fd, unsigned long long size, uint32_t block,
+                    int (*write_fn)(void *, const unsigned char *, size_t), void *ctx) {
+    delta_out_t *o = malloc(sizeof(delta_out_t));
+    unsigned char *buf = malloc(DELTA_READ);
+    if (!o || !buf) {
+        free(o);
+        free(buf);
+        return ENOMEM;
+    }
+    o->write = write_fn;
+    o->ctx = ctx;
+    o->len = 0;
+    o->error = 0;
+    unsigned char head[16] = "PSDS";
+    delta_put_le(head + 4, block, 4);
+    delta_put_le(head + 8, size, 8);
+    delta_out_put(o, head, sizeof(head));
+    
+    int err = 0;
+    for (unsigned long long off = 0; off < size && !err && !o->error; off += DELTA_READ) {
+        size_t want = size - off < DELTA_READ ? size - off : DELTA_READ;
+        if (pread_full(fd, buf, want, off) != (ssize_t)want) {
+            err = EIO;
+            break;
+        }
+        for (size_t i = 0; i < want; i += block) {
+            size_t len = want - i < block ? want - i : block;
+            uint32_t a, b;
+            unsigned char entry[12];
+            delta_put_le(entry, delta_weak(buf + i, len, &a, &b), 4);
+            delta_put_le(entry + 4, xxh64(buf + i, len, 0), 8);
+            delta_out_put(o, entry, sizeof(entry));
+        }
+    }
+    delta_out_flush(o);
+    if (!err) err = o->error;
+    free(o);
+    free(buf);
+    return err;
+}
+
+// Bytes a signature for size bytes in blocks of block takes
+unsigned long long delta_signature_len(unsigned long long size, uint32_t block) {
+    return 16 + (size + block - 1) / block * 12;
+}
+
+void delta_sig_free(delta_sig_t *sig) {
+    free(sig->slots);
+    free(sig->chain);
+    sig->slots = sig->chain = NULL;
+}
+
+// Check a received signature and index its weak checksums. 0, EINVAL or ENOMEM.
+int delta_sig_parse(delta_sig_t *sig, const unsigned char *data, size_t len) {
+    memset(sig, 0, sizeof(*sig));
+    if (len < 16 || memcmp(data, "PSDS", 4) != 0) return EINVAL;
+    sig->block = le32(data + 4);
+    sig->size = le64(data + 8);
+    if (!delta_block_valid(sig->block)) return EINVAL;
+    sig->count = (sig->size + sig->block - 1) / sig->block;
+    if (sig->count > DELTA_MAX_BLOCKS || len != delta_signature_len(sig->size, sig->block)) return EINVAL;
+    sig->entries = data + 16;
+    
+    uint32_t slots = 1024;
+    while (slots < sig->count * 2) slots *= 2;
+    sig->mask = slots - 1;
+    sig->slots = malloc(slots * sizeof(int32_t));
+    sig->chain = malloc((sig->count ? sig->count : 1) * sizeof(int32_t));
+    if (!sig->slots || !sig->chain) {
+        delta_sig_free(sig);
+        return ENOMEM;
+    }
+    memset(sig->slots, 0xFF, slots * sizeof(int32_t));
+    // Insert backwards so chains list blocks in file order
+    for (long long i = (long long)sig->count - 1; i >= 0; i--) {
+        uint32_t h = (le32(sig->entries + i * 12) * 0x9E3779B1u) >> 8 & sig->mask;
+        sig->chain[i] = sig->slots[h];
+        sig->slots[h] = (int32_t)i;
+    }
+    return 0;
+}
+
+// Block of the old file holding exactly p[0..len), or -1. A block shorter
+// than sig->block (the last one) only matches an equally short tail.
+static long long delta_find(const delta_sig_t *sig, uint32_t weak, const unsigned char *p, size_t len,
+                            long long hint) {
+    uint64_t strong = 0;
+    int have_strong = 0;
+    uint32_t h = (weak * 0x9E3779B1u) >> 8 & sig->mask;
+    // Blocks tend to match in sequence, so try the one after the last match first
+    for (long long i = hint >= 0 && hint < (long long)sig->count ? hint : sig->slots[h]; i >= 0; ) {
+        const unsigned char *e = sig->entries + i * 12;
+        size_t block_len = (unsigned long long)i == sig->count - 1 ? sig->size - (unsigned long long)i * sig->block : sig->block;
+        if (le32(e) == weak && block_len == len) {
+            if (!have_strong) {
+                strong = xxh64(p, len, 0);
+                have_strong = 1;
+            }
+            if (le64(e + 4) == strong) return i;
+        }
+        if (i == hint) {
+            hint = -1;
+            i = sig->slots[h];
+        } else {
+            i = sig->chain[i];
+        }
+    }
+    return -1;
+}
+
+typedef struct {
+    delta_out_t out;
+    long long copy_first;
+    unsigned long long copy_count;
+    delta_stats_t *stats;
+    uint32_t block;
+} delta_gen_t;
+
+static void delta_flush_copy(delta_gen_t *g) {
+    if (!g->copy_count) return;
+    unsigned char cmd[13];
+    cmd[0] = DELTA_CMD_COPY;
+    delta_put_le(cmd + 1, g->copy_first, 8);
+    delta_put_le(cmd + 9, g->copy_count, 4);
+    delta_out_put(&g->out, cmd, sizeof(cmd));
+    g->copy_count = 0;
+}
+
+static void delta_emit_literal(delta_gen_t *g, const unsigned char *p, size_t len) {
+    if (!len) return;
+    delta_flush_copy(g);
+    unsigned char cmd[5];
+    cmd[0] = DELTA_CMD_LITERAL;
+    delta_put_le(cmd + 1, len, 4);
+    delta_out_put(&g->out, cmd, sizeof(cmd));
+    delta_out_put(&g->out, p, len);
+    if (g->stats) g->stats->literal += len;
+}
+
+static void delta_emit_copy(delta_gen_t *g, long long index, size_t len) {
+    if (g->copy_count && g->copy_first + (long long)g->copy_count == index && g->copy_count < 0xFFFFFFFFu) {
+        g->copy_count++;
+    } else {
+        delta_flush_copy(g);
+        g->copy_first = index;
+        g->copy_count = 1;
+    }
+    if (g->stats) g->stats->copied += len;
+}
+
+// Write the delta turning the file sig describes into fd (size bytes).
+// 0 or an errno value.
+int delta_generate(const delta_sig_t *sig, int fd, unsigned long long size,
+                   int (*write_fn)(void *, const unsigned char *, size_t), void *ctx, delta_stats_t *stats) {
+    delta_gen_t *g = malloc(sizeof(delta_gen_t));
+    size_t cap = DELTA_READ + DELTA_LITERAL_MAX + sig->block;
+    unsigned char *buf = malloc(cap);
+    if (!g || !buf) {
+        free(g);
+        free(buf);
+        return ENOMEM;
+    }
+    memset(g, 0, sizeof(*g));
+    g->out.write = write_fn;
+    g->out.ctx = ctx;
+    g->stats = stats;
+    g->block = sig->block;
+    sha256_ctx_t sha;
+    sha256_init(&sha);
+    unsigned char head[16] = "PSDD";
+    delta_put_le(head + 4, sig->block, 4);
+    delta_put_le(head + 8, size, 8);
+    delta_out_put(&g->out, head, sizeof(head));
+    
+    // buf[lit..pos) is pending literal data, buf[pos..len) not yet matched
+    size_t lit = 0, pos = 0, len = 0;
+    unsigned long long file_off = 0;
+    uint32_t a = 0, b = 0;
+    int rolling = 0;
+    long long hint = -1;
+    int err = 0;
+    size_t block = sig->block;
+    while (!err && !g->out.error) {
+        if (len - pos <= block && file_off < size) {
+            // Keep only the pending literal and the unmatched tail, then refill
+            memmove(buf, buf + lit, len - lit);
+            pos -= lit;
+            len -= lit;
+            lit = 0;
+            size_t want = cap - len;
+            if (want > size - file_off) want = size - file_off;
+            if (pread_full(fd, buf + len, want, file_off) != (ssize_t)want) {
+                err = EIO;
+                break;
+            }
+            sha256_update(&sha, buf + len, want);
+            len += want;
+            file_off += want;
+        }
+        size_t avail = len - pos;
+        if (avail == 0) break;
+        if (avail < block) {
+            // Tail: matches only the old file's last (short) block
+            uint32_t ta, tb;
+            long long hit = sig->count ? delta_find(sig, delta_weak(buf + pos, avail, &ta, &tb), buf + pos, avail,
+                                                    (long long)sig->count - 1) : -1;
+            if (hit >= 0) {
+                delta_emit_literal(g, buf + lit, pos - lit);
+                delta_emit_copy(g, hit, avail);
+            } else {
+                delta_emit_literal(g, buf + lit, len - lit);
+            }
+            lit = pos = len;
+            break;
+        }
+        if (!rolling) {
+            delta_weak(buf + pos, block, &a, &b);
+            rolling = 1;
+        }
+        long long hit = sig->count ? delta_find(sig, (a & 0xFFFF) | b << 16, buf + pos, block, hint) : -1;
+        if (hit >= 0) {
+            delta_emit_literal(g, buf + lit, pos - lit);
+            delta_emit_copy(g, hit, block);
+            pos += block;
+            lit = pos;
+            hint = hit + 1;
+            rolling = 0;
+            continue;
+        }
+        // Slide one byte
+        if (avail > block) {
+            unsigned char out = buf[pos], in = buf[pos + block];
+            a += in - out;
+            b += a - (uint32_t)block * out;
+        } else {
+            rolling = 0;
+        }
+        pos++;
+        if (pos - lit >= DELTA_LITERAL_MAX) {
+            delta_emit_literal(g, buf + lit, pos - lit);
+            lit = pos;
+        }
+    }
+    delta_flush_copy(g);
+    unsigned char end[33];
+    end[0] = DELTA_CMD_END;
+    sha256_final(&sha, end + 1);
+    delta_out_put(&g->out, end, sizeof(end));
+    delta_out_flush(&g->out);
+    if (!err) err = g->out.error;
+    free(g);
+    free(buf);
+    return err;
 }
 
-// Handle rename
-void handle_rename(int sock, const char *old_path, const char *new_path) {
-    char decoded_old[MAX_PATH], decoded_new[MAX_PATH];
-    url_decode(decoded_old, old_path);
-    url_decode(decoded_new, new_path);
-    
-    const char *success_msg = "{\"success\":true}";
-    const char *error_msg = "{\"error\":\"Rename failed\"}";
-    if (rename(decoded_old, decoded_new) == 0) {
-        send_http_response(sock, 200, "application/json", success_msg, strlen(success_msg));
-    } else {
-        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+static int delta_read_exact(ssize_t (*read_fn)(void *, unsigned char *, size_t), void *ctx,
+                            unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read_fn(ctx, buf, len);
+        if (n <= 0) return n < 0 ? EIO : EINVAL;
+        buf += n;
+        len -= n;
     }
+    return 0;
 }
 
-// Handle copy
-void handle_copy(int sock, const char *src_path, const char *dst_path) {
-    char decoded_src[MAX_PATH], decoded_dst[MAX_PATH];
-    url_decode(decoded_src, src_path);
-    url_decode(decoded_dst, dst_path);
+// Rebuild a file from a delta read through read_fn: copies come from
+// basis_fd (basis_size bytes, -1 if there is no old file), output goes to
+// out_fd. 0, EINVAL for a malformed or truncated delta, EBADMSG if the result
+// doesn't hash to the SHA-256 in the delta, or another errno value.
+int delta_apply(ssize_t (*read_fn)(void *, unsigned char *, size_t), void *ctx, int basis_fd,
+                unsigned long long basis_size, int out_fd, delta_stats_t *stats) {
+    unsigned char head[16];
+    int err = delta_read_exact(read_fn, ctx, head, sizeof(head));
+    if (err) return err;
+    uint32_t block = le32(head + 4);
+    unsigned long long result_size = le64(head + 8), written = 0;
+    if (memcmp(head, "PSDD", 4) != 0 || !delta_block_valid(block)) return EINVAL;
+    unsigned char *buf = malloc(DELTA_READ);
+    if (!buf) return ENOMEM;
+    sha256_ctx_t sha;
+    sha256_init(&sha);
     
-    struct stat src_stat;
-    if (stat(decoded_src, &src_stat) != 0) {
-        char error_msg[256];
-        snprintf(error_msg, sizeof(error_msg), "{\"error\":\"Source not found: %s\"}", decoded_src);
-        send_http_response(sock, 404, "application/json", error_msg, strlen(error_msg));
-        return;
+    while (!err) {
+        unsigned char cmd;
+        if ((err = delta_read_exact(read_fn, ctx, &cmd, 1))) break;
+        unsigned long long off, len;
+        if (cmd == DELTA_CMD_END) {
+            unsigned char want[32], got[32];
+            if ((err = delta_read_exact(read_fn, ctx, want, sizeof(want)))) break;
+            sha256_final(&sha, got);
+            if (written != result_size) err = EINVAL;
+            else if (memcmp(want, got, 32) != 0) err = EBADMSG;
+            break;
+        } else if (cmd == DELTA_CMD_COPY) {
+            unsigned char arg[12];
+            if ((err = delta_read_exact(read_fn, ctx, arg, sizeof(arg)))) break;
+            uint64_t first = le64(arg), count = le32(arg + 8);
+            if (basis_fd < 0 || count == 0 || first >= (basis_size + block - 1) / block) {
+                err = EINVAL;
+                break;
+            }
+            off = first * block;
+            len = count * block;
+            if (len > basis_size - off) len = basis_size - off;
+            if (stats) stats->copied += len;
+        } else if (cmd == DELTA_CMD_LITERAL) {
+            unsigned char arg[4];
+            if ((err = delta_read_exact(read_fn, ctx, arg, sizeof(arg)))) break;
+            off = 0;
+            len = le32(arg);
+            if (stats) stats->literal += len;
+        } else {
+            err = EINVAL;
+            break;
+        }
+        if (written + len > result_size) {
+            err = EINVAL;
+            break;
+        }
+        while (len > 0 && !err) {
+            size_t n = len < DELTA_READ ? len : DELTA_READ;
+            if (cmd == DELTA_CMD_COPY) err = pread_full(basis_fd, buf, n, off) == (ssize_t)n ? 0 : EIO;
+            else err = delta_read_exact(read_fn, ctx, buf, n);
+            if (!err && write_full(out_fd, (const char *)buf, n) != 0) err = errno ? errno : EIO;
+            if (err) break;
+            sha256_update(&sha, buf, n);
+            written += n;
+            off += n;
+            len -= n;
+        }
     }
-    
-    int src_fd = open(decoded_src, O_RDONLY);
-    if (src_fd < 0) {
-        const char *error_msg = "{\"error\":\"Cannot open source\"}";
+    free(buf);
+    return err;
+}
+
+static int delta_sock_write(void *ctx, const unsigned char *buf, size_t len) {
+    return client_send(*(int *)ctx, buf, len) == (ssize_t)len ? 0 : -1;
+}
+
+static int delta_chunk_write(void *ctx, const unsigned char *buf, size_t len) {
+    return send_chunk(*(int *)ctx, buf, len);
+}
+
+// Signature of a file: GET /api/delta/signature?path=&block=
+void handle_delta_signature(int sock, const char *path, const char *block_str) {
+    int fd = path ? open(path, O_RDONLY) : -1;
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        const char *error_msg = "{\"error\":\"File not found\"}";
         send_http_response(sock, 404, "application/json", error_msg, strlen(error_msg));
         return;
     }
-    
-    int dst_fd = open(decoded_dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (dst_fd < 0) {
-        close(src_fd);
-        char error_msg[256];
-        snprintf(error_msg, sizeof(error_msg), "{\"error\":\"Cannot create: %s\"}", decoded_dst);
-        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+    uint32_t block = block_str ? (uint32_t)strtoul(block_str, NULL, 10) : delta_block_size(st.st_size);
+    if (!delta_block_valid(block) || ((unsigned long long)st.st_size + block - 1) / block > DELTA_MAX_BLOCKS) {
+        close(fd);
+        const char *error_msg = "{\"error\":\"Invalid block size\"}";
+        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
         return;
     }
-    
-    char *buffer = malloc(BUFFER_SIZE);
-    if (buffer) {
-        ssize_t n;
-        while ((n = read(src_fd, buffer, BUFFER_SIZE)) > 0) {
-            write(dst_fd, buffer, n);
-        }
-        free(buffer);
-    }
-    
-    close(src_fd);
-    close(dst_fd);
-    
-    const char *success_msg = "{\"success\":true}";
-    send_http_response(sock, 200, "application/json", success_msg, strlen(success_msg));
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/octet-stream\r\n"
+        "Content-Length: %llu\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Connection: close\r\n"
+        "\r\n",
+        delta_signature_len(st.st_size, block));
+    note_response_status(200);
+    client_send(sock, header, header_len);
+    if (!request_is_head()) delta_signature(fd, st.st_size, block, delta_sock_write, &sock);
+    close(fd);
 }
 
-// Serve web interface
-void serve_web_interface(int sock) {
-    const char *html = 
-"<!DOCTYPE html>\n"
-"<html>\n"
-"<head>\n"
-"<meta charset='UTF-8'>\n"
-"<meta name='viewport' content='width=device-width, initial-scale=1.0'>\n"
-"<title>PS5 Web Manager - By Manos</title>\n"
-"<style>\n"
-"* { margin: 0; padding: 0; box-sizing: border-box; }\n"
-"body { font-family: Arial, sans-serif; background: #1a1a1a; color: #fff; }\n"
-"header { background: #2563eb; padding: 20px; text-align: center; }\n"
-"h1 { font-size: 24px; }\n"
-".container { max-width: 1200px; margin: 20px auto; padding: 0 20px; }\n"
-".tabs { display: flex; gap: 10px; margin-bottom: 20px; }\n"
-".tab { padding: 10px 20px; background: #333; border: none; color: #fff; cursor: pointer; border-radius: 5px; }\n"
-".tab.active { background: #2563eb; }\n"
-".panel { display: none; background: #2a2a2a; padding: 20px; border-radius: 10px; }\n"
-".panel.active { display: block; }\n"
-".path-bar { display: flex; gap: 10px; margin-bottom: 20px; align-items: center; }\n"
-".path-bar input { flex: 1; padding: 10px; background: #333; border: 1px solid #555; color: #fff; border-radius: 5px; }\n"
-".path-bar button { padding: 10px 20px; background: #2563eb; border: none; color: #fff; cursor: pointer; border-radius: 5px; }\n"
-".file-list { background: #333; border-radius: 5px; overflow: hidden; }\n"
-".file-item { display: flex; justify-content: space-between; padding: 15px; border-bottom: 1px solid #444; cursor: pointer; }\n"
-".file-item:hover { background: #3a3a3a; }\n"
-".file-info { display: flex; gap: 20px; align-items: center; }\n"
-".file-icon { font-size: 24px; }\n"
-".file-actions { display: flex; gap: 5px; }\n"
-".file-actions button { padding: 5px 10px; border: none; color: #fff; cursor: pointer; border-radius: 3px; font-size: 12px; }\n"
-".rename-btn { background: #2563eb; }\n"
-".copy-btn { background: #16a34a; }\n"
-".move-btn { background: #f59e0b; }\n"
-".delete-btn { background: #dc2626; }\n"
-".stats { display: grid; grid-template-columns: repeat(auto-fit, minmax(250px, 1fr)); gap: 20px; }\n"
-".stat-card { background: #333; padding: 20px; border-radius: 10px; }\n"
-".stat-card h3 { margin-bottom: 10px; color: #2563eb; }\n"
-".stat-value { font-size: 32px; font-weight: bold; }\n"
-".loading { text-align: center; padding: 40px; }\n"
-".modal { display: none; position: fixed; top: 0; left: 0; width: 100%; height: 100%; background: rgba(0,0,0,0.8); z-index: 1000; }\n"
-".modal.active { display: flex; align-items: center; justify-content: center; }\n"
-".modal-content { background: #2a2a2a; padding: 30px; border-radius: 10px; max-width: 600px; width: 90%; max-height: 80vh; overflow-y: auto; }\n"
-".modal-header { display: flex; justify-content: space-between; align-items: center; margin-bottom: 20px; }\n"
-".modal-header h2 { margin: 0; }\n"
-".modal-close { background: #dc2626; border: none; color: #fff; padding: 5px 15px; cursor: pointer; border-radius: 5px; }\n"
-".modal-path { padding: 10px; background: #333; border: 1px solid #555; color: #fff; border-radius: 5px; margin-bottom: 15px; }\n"
-".modal-actions { display: flex; gap: 10px; margin-top: 20px; }\n"
-".modal-actions button { flex: 1; padding: 10px; border: none; color: #fff; cursor: pointer; border-radius: 5px; }\n"
-".btn-select { background: #2563eb; }\n"
-".btn-cancel { background: #666; }\n"
-"</style>\n"
-"</head>\n"
-"<body>\n"
-"<header>\n"
-"<h1>🌐 PS5 Web Manager - By Manos</h1>\n"
-"</header>\n"
-"<div class='container'>\n"
-"<div class='tabs'>\n"
-"<button class='tab active' onclick='showTab(0)'>📁 File Manager</button>\n"
-"<button class='tab' onclick='showTab(1)'>📊 System Monitor</button>\n"
-"</div>\n"
-"<div class='panel active' id='panel0'>\n"
-"<div class='path-bar'>\n"
-"<input type='text' id='currentPath' value='/data' />\n"
-"<button onclick='loadFiles()'>Go</button>\n"
-"<button onclick='goUp()'>⬆️ Up</button>\n"
-"<input type='file' id='fileUpload' style='display:none' onchange='uploadFile()' />\n"
-"<button onclick='document.getElementById(\"fileUpload\").click()' style='background:#16a34a;'>📤 Upload File</button>\n"
-"</div>\n"
-"<div id='uploadProgress' style='display:none;background:#333;padding:10px;border-radius:5px;margin-bottom:10px;'>\n"
-"<div style='margin-bottom:5px;'>Uploading: <span id='uploadFilename'></span></div>\n"
-"<div style='background:#555;height:20px;border-radius:10px;overflow:hidden;'>\n"
-"<div id='uploadBar' style='background:#16a34a;height:100%;width:0%;transition:width 0.3s;'></div>\n"
-"</div>\n"
-"<div style='margin-top:5px;font-size:12px;'><span id='uploadStatus'>Preparing...</span></div>\n"
-"</div>\n"
-"<div id='fileList' class='loading'>Loading...</div>\n"
-"</div>\n"
-"<div class='panel' id='panel1'>\n"
-"<div class='stats' id='systemStats'>\n"
-"<div class='loading'>Loading system info...</div>\n"
-"</div>\n"
-"</div>\n"
-"</div>\n"
-"<div class='modal' id='copyModal'>\n"
-"<div class='modal-content'>\n"
-"<div class='modal-header'>\n"
-"<h2 id='modalTitle'>Select Destination Folder</h2>\n"
-"<button class='modal-close' onclick='closeModal()'>✕</button>\n"
-"</div>\n"
-"<div class='modal-path' id='modalPath'>/data</div>\n"
-"<button onclick='modalGoUp()' style='width:100%; padding:10px; background:#2563eb; border:none; color:#fff; cursor:pointer; border-radius:5px; margin-bottom:10px;'>⬆️ Up</button>\n"
-"<div id='modalFileList' class='file-list'></div>\n"
-"<div class='modal-actions'>\n"
-"<button class='btn-select' onclick='selectDestination()'>Select This Folder</button>\n"
-"<button class='btn-cancel' onclick='closeModal()'>Cancel</button>\n"
-"</div>\n"
-"</div>\n"
-"</div>\n"
-"<script>\n"
-"let currentPath = '/data';\n"
-"function showTab(n) {\n"
-"  document.querySelectorAll('.tab').forEach((t,i) => t.classList.toggle('active', i===n));\n"
-"  document.querySelectorAll('.panel').forEach((p,i) => p.classList.toggle('active', i===n));\n"
-"  if(n===0) loadFiles();\n"
-"  if(n===1) loadSystemInfo();\n"
-"}\n"
-"function loadFiles() {\n"
-"  currentPath = document.getElementById('currentPath').value;\n"
-"  console.log('Loading files from:', currentPath);\n"
-"  let url = '/api/list?path=' + encodeURIComponent(currentPath);\n"
-"  console.log('Fetching:', url);\n"
-"  fetch(url)\n"
-"    .then(r => {\n"
-"      console.log('Response status:', r.status);\n"
-"      if (!r.ok) throw new Error('HTTP ' + r.status);\n"
-"      return r.json();\n"
-"    })\n"
-"    .then(data => {\n"
-"      console.log('Data received:', data);\n"
-"      if (data.error) {\n"
-"        document.getElementById('fileList').innerHTML = '<div class=\"loading\">Error: ' + data.error + '</div>';\n"
-"        return;\n"
-"      }\n"
-"      let html = '<div class=\"file-list\">';\n"
-"      if (!data.files || data.files.length === 0) {\n"
-"        html += '<div class=\"loading\">Empty directory</div>';\n"
-"      } else {\n"
-"        data.files.forEach((f, idx) => {\n"
-"          let icon = f.type === 'dir' ? '📁' : '📄';\n"
-"          let size = f.type === 'dir' ? '' : formatSize(f.size);\n"
-"          html += '<div class=\"file-item\">';\n"
-"          html += '<div class=\"file-info\" data-name=\"' + f.name + '\" data-type=\"' + f.type + '\" data-idx=\"' + idx + '\">';\n"
-"          html += '<span class=\"file-icon\">' + icon + '</span>';\n"
-"          html += '<span>' + f.name + '</span>';\n"
-"          html += '<span>' + size + '</span>';\n"
-"          html += '</div>';\n"
-"          html += '<div class=\"file-actions\">';\n"
-"          if (f.type === 'file') {\n"
-"            html += '<button class=\"download-btn\" data-name=\"' + f.name + '\" style=\"background:#2563eb;\">⬇️ Download</button>';\n"
-"          }\n"
-"          html += '<button class=\"rename-btn\" data-name=\"' + f.name + '\">Rename</button>';\n"
-"          html += '<button class=\"copy-btn\" data-name=\"' + f.name + '\">Copy</button>';\n"
-"          html += '<button class=\"move-btn\" data-name=\"' + f.name + '\">Move</button>';\n"
-"          html += '<button class=\"delete-btn\" data-name=\"' + f.name + '\">Delete</button>';\n"
-"          html += '</div></div>';\n"
-"        });\n"
-"      }\n"
-"      html += '</div>';\n"
-"      document.getElementById('fileList').innerHTML = html;\n"
-"      document.querySelectorAll('.file-info').forEach(el => {\n"
-"        el.addEventListener('click', () => {\n"
-"          let name = el.getAttribute('data-name');\n"
-"          let type = el.getAttribute('data-type');\n"
-"          if (type === 'dir') openDir(name); else downloadFile(name);\n"
-"        });\n"
-"      });\n"
-"      document.querySelectorAll('.download-btn').forEach(el => {\n"
-"        el.addEventListener('click', () => downloadFile(el.getAttribute('data-name')));\n"
-"      });\n"
-"      document.querySelectorAll('.rename-btn').forEach(el => {\n"
-"        el.addEventListener('click', () => renameFile(el.getAttribute('data-name')));\n"
-"      });\n"
-"      document.querySelectorAll('.copy-btn').forEach(el => {\n"
-"        el.addEventListener('click', () => copyFile(el.getAttribute('data-name')));\n"
-"      });\n"
-"      document.querySelectorAll('.move-btn').forEach(el => {\n"
-"        el.addEventListener('click', () => moveFile(el.getAttribute('data-name')));\n"
-"      });\n"
-"      document.querySelectorAll('.delete-btn').forEach(el => {\n"
-"        el.addEventListener('click', () => deleteFile(el.getAttribute('data-name')));\n"
-"      });\n"
-"    })\n"
-"    .catch(e => {\n"
-"      console.error('Error:', e);\n"
-"      document.getElementById('fileList').innerHTML = '<div class=\"loading\">Error: ' + e.message + '<br>Check browser console (F12) for details</div>';\n"
-"    });\n"
-"}\n"
-"function normalizePath(path) {\n"
-"  path = path.replace(/\\/+/g, '/');\n"
-"  let parts = path.split('/').filter(p => p && p !== '.');\n"
-"  let result = [];\n"
-"  for (let part of parts) {\n"
-"    if (part === '..') {\n"
-"      if (result.length > 0) result.pop();\n"
-"    } else {\n"
-"      result.push(part);\n"
-"    }\n"
-"  }\n"
-"  return '/' + result.join('/');\n"
-"}\n"
-"function openDir(name) {\n"
-"  currentPath = normalizePath(currentPath + '/' + name);\n"
-"  document.getElementById('currentPath').value = currentPath;\n"
-"  loadFiles();\n"
-"}\n"
-"function goUp() {\n"
-"  let parts = currentPath.split('/').filter(p => p);\n"
-"  parts.pop();\n"
-"  currentPath = '/' + parts.join('/');\n"
-"  document.getElementById('currentPath').value = currentPath;\n"
-"  loadFiles();\n"
-"}\n"
-"function downloadFile(name) {\n"
-"  let path = normalizePath(currentPath + '/' + name);\n"
-"  window.location.href = '/api/download?path=' + encodeURIComponent(path);\n"
-"}\n"
-"function renameFile(name) {\n"
-"  let newName = prompt('Rename to:', name);\n"
-"  if(!newName || newName === name) return;\n"
-"  let oldPath = normalizePath(currentPath + '/' + name);\n"
-"  let newPath = normalizePath(currentPath + '/' + newName);\n"
-"  fetch('/api/rename?old=' + encodeURIComponent(oldPath) + '&new=' + encodeURIComponent(newPath))\n"
-"    .then(r => r.json())\n"
-"    .then(() => loadFiles())\n"
-"    .catch(e => alert('Rename failed'));\n"
-"}\n"
-"let modalSourceFile = '';\n"
-"let modalCurrentPath = '/data';\n"
-"let modalOperation = 'copy';\n"
-"function copyFile(name) {\n"
-"  modalSourceFile = name;\n"
-"  modalCurrentPath = currentPath;\n"
-"  modalOperation = 'copy';\n"
-"  document.getElementById('modalTitle').textContent = 'Copy: Select Destination';\n"
-"  document.getElementById('copyModal').classList.add('active');\n"
-"  loadModalFiles();\n"
-"}\n"
-"function moveFile(name) {\n"
-"  modalSourceFile = name;\n"
-"  modalCurrentPath = currentPath;\n"
-"  modalOperation = 'move';\n"
-"  document.getElementById('modalTitle').textContent = 'Move: Select Destination';\n"
-"  document.getElementById('copyModal').classList.add('active');\n"
-"  loadModalFiles();\n"
-"}\n"
-"function closeModal() {\n"
-"  document.getElementById('copyModal').classList.remove('active');\n"
-"}\n"
-"function loadModalFiles() {\n"
-"  document.getElementById('modalPath').textContent = modalCurrentPath;\n"
-"  fetch('/api/list?path=' + encodeURIComponent(modalCurrentPath))\n"
-"    .then(r => r.json())\n"
-"    .then(data => {\n"
-"      let html = '';\n"
-"      if (data.files) {\n"
-"        data.files.filter(f => f.type === 'dir').forEach(f => {\n"
-"          html += '<div class=\"file-item\" data-dirname=\"' + f.name + '\" style=\"cursor:pointer;\">';\n"
-"          html += '<div class=\"file-info\"><span class=\"file-icon\">📁</span><span>' + f.name + '</span></div>';\n"
-"          html += '</div>';\n"
-"        });\n"
-"      }\n"
-"      document.getElementById('modalFileList').innerHTML = html || '<div class=\"loading\">No folders</div>';\n"
-"      document.querySelectorAll('#modalFileList .file-item').forEach(el => {\n"
-"        el.addEventListener('click', () => modalOpenDir(el.getAttribute('data-dirname')));\n"
-"      });\n"
-"    });\n"
-"}\n"
-"function modalOpenDir(name) {\n"
-"  modalCurrentPath = normalizePath(modalCurrentPath + '/' + name);\n"
-"  loadModalFiles();\n"
-"}\n"
-"function modalGoUp() {\n"
-"  let parts = modalCurrentPath.split('/').filter(p => p);\n"
-"  parts.pop();\n"
-"  modalCurrentPath = '/' + parts.join('/');\n"
-"  loadModalFiles();\n"
-"}\n"
-"function selectDestination() {\n"
-"  let newName = prompt('File name in destination:', modalSourceFile);\n"
-"  if(!newName) return;\n"
-"  let src = normalizePath(currentPath + '/' + modalSourceFile);\n"
-"  let dst = normalizePath(modalCurrentPath + '/' + newName);\n"
-"  console.log('Copy operation:');\n"
-"  console.log('  Source:', src);\n"
-"  console.log('  Destination:', dst);\n"
-"  if (modalOperation === 'copy') {\n"
-"    let url = '/api/copy?src=' + encodeURIComponent(src) + '&dst=' + encodeURIComponent(dst);\n"
-"    console.log('  URL:', url);\n"
-"    fetch(url)\n"
-"      .then(r => {\n"
-"        console.log('  Response status:', r.status);\n"
-"        return r.text();\n"
-"      })\n"
-"      .then(text => {\n"
-"        console.log('  Response body:', text);\n"
-"        try {\n"
-"          let data = JSON.parse(text);\n"
-"          if (data.error) {\n"
-"            alert('Copy failed: ' + data.error);\n"
-"          } else {\n"
-"            closeModal();\n"
-"            loadFiles();\n"
-"          }\n"
-"        } catch(e) {\n"
-"          alert('Copy failed: Invalid response');\n"
-"        }\n"
-"      })\n"
-"      .catch(e => {\n"
-"        console.error('Copy error:', e);\n"
-"        alert('Copy failed: ' + e.message);\n"
-"      });\n"
-"  } else if (modalOperation === 'move') {\n"
-"    let url = '/api/copy?src=' + encodeURIComponent(src) + '&dst=' + encodeURIComponent(dst);\n"
-"    console.log('  URL:', url);\n"
-"    fetch(url)\n"
-"      .then(r => r.json())\n"
-"      .then(() => fetch('/api/delete?path=' + encodeURIComponent(src)))\n"
-"      .then(r => r.json())\n"
-"      .then(() => { closeModal(); loadFiles(); })\n"
-"      .catch(e => alert('Move failed: ' + e.message));\n"
-"  }\n"
-"}\n"
-"function deleteFile(name) {\n"
-"  if(!confirm('Delete ' + name + '?')) return;\n"
-"  let path = normalizePath(currentPath + '/' + name);\n"
-"  fetch('/api/delete?path=' + encodeURIComponent(path))\n"
-"    .then(r => r.json())\n"
-"    .then(() => loadFiles())\n"
-"    .catch(e => alert('Delete failed'));\n"
-"}\n"
-"function formatSize(bytes) {\n"
-"  if(bytes < 1024) return bytes + ' B';\n"
-"  if(bytes < 1024*1024) return (bytes/1024).toFixed(1) + ' KB';\n"
-"  if(bytes < 1024*1024*1024) return (bytes/1024/1024).toFixed(1) + ' MB';\n"
-"  return (bytes/1024/1024/1024).toFixed(1) + ' GB';\n"
-"}\n"
-"function uploadFile() {\n"
-"  let fileInput = document.getElementById('fileUpload');\n"
-"  let file = fileInput.files[0];\n"
-"  if (!file) return;\n"
-"  let progressDiv = document.getElementById('uploadProgress');\n"
-"  let filenameSpan = document.getElementById('uploadFilename');\n"
-"  let statusSpan = document.getElementById('uploadStatus');\n"
-"  let progressBar = document.getElementById('uploadBar');\n"
-"  filenameSpan.textContent = file.name;\n"
-"  statusSpan.textContent = 'Uploading...';\n"
-"  progressDiv.style.display = 'block';\n"
-"  progressBar.style.width = '0%';\n"
-"  let formData = new FormData();\n"
-"  formData.append('file', file);\n"
-"  let currentPath = document.getElementById('currentPath').value;\n"
-"  let xhr = new XMLHttpRequest();\n"
-"  xhr.upload.addEventListener('progress', function(e) {\n"
-"    if (e.lengthComputable) {\n"
-"      let percent = (e.loaded / e.total) * 100;\n"
-"      progressBar.style.width = percent + '%';\n"
-"      statusSpan.textContent = 'Uploading... ' + Math.round(percent) + '%';\n"
-"    }\n"
-"  });\n"
-"  xhr.addEventListener('load', function() {\n"
-"    if (xhr.status === 200) {\n"
-"      try {\n"
-"        let response = JSON.parse(xhr.responseText);\n"
-"        if (response.success) {\n"
-"          progressBar.style.width = '100%';\n"
-"          statusSpan.textContent = 'Upload complete! (' + formatSize(response.size) + ')';\n"
-"          setTimeout(function() {\n"
-"            progressDiv.style.display = 'none';\n"
-"            fileInput.value = '';\n"
-"            loadFiles();\n"
-"          }, 2000);\n"
-"        } else {\n"
-"          statusSpan.textContent = 'Upload failed: ' + (response.error || 'Unknown error');\n"
-"          console.error('Upload error:', response.error);\n"
-"        }\n"
-"      } catch(e) {\n"
-"        statusSpan.textContent = 'Upload failed: Invalid response - ' + xhr.responseText;\n"
-"        console.error('Parse error:', e, 'Response:', xhr.responseText);\n"
-"      }\n"
-"    } else {\n"
-"      try {\n"
-"        let response = JSON.parse(xhr.responseText);\n"
-"        statusSpan.textContent = 'Upload failed: ' + (response.error || 'Server error');\n"
-"        console.error('Server error:', xhr.status, response);\n"
-"      } catch(e) {\n"
-"        statusSpan.textContent = 'Upload failed: Server error ' + xhr.status;\n"
-"        console.error('Server error:', xhr.status, xhr.responseText);\n"
-"      }\n"
-"    }\n"
-"  });\n"
-"  xhr.addEventListener('error', function() {\n"
-"    statusSpan.textContent = 'Upload failed: Network error';\n"
-"  });\n"
-"  xhr.open('POST', '/api/upload?path=' + encodeURIComponent(currentPath));\n"
-"  xhr.send(formData);\n"
-"}\n"
-"function loadSystemInfo() {\n"
-"  console.log('Loading system info...');\n"
-"  fetch('/api/sysinfo')\n"
-"    .then(r => {\n"
-"      console.log('Sysinfo response status:', r.status);\n"
-"      if (!r.ok) throw new Error('HTTP ' + r.status);\n"
-"      return r.json();\n"
-"    })\n"
-"    .then(data => {\n"
-"      console.log('System info received:', data);\n"
-"      let html = '';\n"
-"      html += '<div class=\"stat-card\"><h3>💾 /data Storage</h3><div class=\"stat-value\">' + formatSize(data.storage.data.used) + ' / ' + formatSize(data.storage.data.total) + '</div><div style=\"font-size:14px;margin-top:5px;\">Free: ' + formatSize(data.storage.data.free) + '</div></div>';\n"
-"      if (data.storage.system) {\n"
-"        html += '<div class=\"stat-card\"><h3>⚙️ /system Storage</h3><div class=\"stat-value\">' + formatSize(data.storage.system.used) + ' / ' + formatSize(data.storage.system.total) + '</div></div>';\n"
-"      }\n"
-"      html += '<div class=\"stat-card\"><h3>🧠 RAM Usage</h3><div class=\"stat-value\">' + formatSize(data.ram.used) + ' / ' + formatSize(data.ram.total) + '</div><div style=\"font-size:14px;margin-top:5px;\">' + Math.round(data.ram.used/data.ram.total*100) + '% used</div></div>';\n"
-"      html += '<div class=\"stat-card\"><h3>⏱️ Uptime</h3><div class=\"stat-value\">' + data.uptime.days + 'd ' + data.uptime.hours + 'h ' + data.uptime.minutes + 'm</div><div style=\"font-size:14px;margin-top:5px;\">' + data.uptime.secs + ' seconds</div></div>';\n"
-"      html += '<div class=\"stat-card\"><h3>🌐 Network</h3><div class=\"stat-value\">' + data.network.ip + '</div><div style=\"font-size:14px;margin-top:5px;\">' + data.network.hostname + '</div></div>';\n"
-"      html += '<div class=\"stat-card\"><h3>📊 Total Requests</h3><div class=\"stat-value\">' + data.server.total_requests + '</div></div>';\n"
-"      html += '<div class=\"stat-card\"><h3>📁 Files Transferred</h3><div class=\"stat-value\">' + data.server.files_transferred + '</div></div>';\n"
-"      html += '<div class=\"stat-card\"><h3>📦 Data Transferred</h3><div class=\"stat-value\">' + formatSize(data.server.bytes_transferred) + '</div></div>';\n"
-"      html += '<div class=\"stat-card\"><h3>🔗 Active Connections</h3><div class=\"stat-value\">' + data.server.active_connections + '</div></div>';\n"
-"      document.getElementById('systemStats').innerHTML = html;\n"
-"    })\n"
-"    .catch(e => {\n"
-"      console.error('Sysinfo error:', e);\n"
-"      document.getElementById('systemStats').innerHTML = '<div class=\"loading\">Error: ' + e.message + '</div>';\n"
-"    });\n"
-"}\n"
-"loadFiles();\n"
-"// Manual refresh only - no auto-refresh spam\n"
-"</script>\n"
-"</body>\n"
-"</html>";
-    
-    send_http_response(sock, 200, "text/html", html, strlen(html));
+// Delta body of /api/delta/apply, read off the socket
+static ssize_t delta_upload_read(void *ctx, unsigned char *buf, size_t len) {
+    upload_stream_t *u = ctx;
+    if (u->len == 0) {
+        if (u->body_read >= u->content_length) return 0;
+        if (upload_fill(u, 1) <= 0) return -1;
+    }
+    if (len > u->len) len = u->len;
+    memcpy(buf, u->buf + u->consumed, len);
+    u->consumed += len;
+    u->len -= len;
+    if (u->len == 0) u->consumed = 0;
+    return len;
 }
 
-// Handle file upload
-void handle_upload_file(int sock, const char *request) {
-    // Get boundary from Content-Type header
-    char *boundary = strstr(request, "boundary=");
-    if (!boundary) {
-        const char *error_msg = "{\"error\":\"No boundary found in headers\"}";
+// Apply an uploaded delta to path: POST /api/delta/apply?path=
+// The result is built next to the file and renamed over it, so readers see
+// the old or the new version, never a mix.
+void handle_delta_apply(int sock, const char *request, const char *path) {
+    client_info_t *client = current_client();
+    char value[64];
+    const char *headers_end = strstr(request, "\r\n\r\n");
+    if (!path || !*path || !headers_end || !http_header(request, "Content-Length", value, sizeof(value))) {
+        const char *error_msg = "{\"error\":\"path and a Content-Length body required\"}";
         send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
         return;
     }
-    boundary += 9;
-    
-    // Skip any leading dashes in the boundary value
-    while (*boundary == '-') boundary++;
-    
-    char boundary_str[256];
-    int i = 0;
-    while (boundary[i] && boundary[i] != '\r' && boundary[i] != '\n' && boundary[i] != ';' && i < 255) {
-        boundary_str[i] = boundary[i];
-        i++;
-    }
-    boundary_str[i] = '\0';
-    
-    // Find body start (after HTTP headers)
-    char *body = strstr(request, "\r\n\r\n");
-    if (!body) {
-        const char *error_msg = "{\"error\":\"No body found - headers incomplete\"}";
+    char temp_path[MAX_PATH];
+    const char *slash = strrchr(path, '/');
+    if (snprintf(temp_path, sizeof(temp_path), "%.*s/.ps5wm-delta-%u.part", slash ? (int)(slash - path) : 1,
+                 slash ? path : ".", atomic_fetch_add(&upload_seq, 1)) >= (int)sizeof(temp_path)) {
+        const char *error_msg = "{\"error\":\"Path too long\"}";
         send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
         return;
     }
-    body += 4;
-    
-    // Find filename in multipart data
-    char *filename_start = strstr(body, "filename=\"");
-    if (!filename_start) {
-        const char *error_msg = "{\"error\":\"No filename in multipart data\"}";
-        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+    upload_stream_t u;
+    memset(&u, 0, sizeof(u));
+    u.sock = sock;
+    u.cap = DELTA_READ;
+    u.content_length = strtoull(value, NULL, 10);
+    size_t head_len = headers_end + 4 - request;
+    size_t request_len = client ? client->request_len : strlen(request);
+    size_t initial = request_len > head_len ? request_len - head_len : 0;
+    if (initial > u.content_length) initial = u.content_length;
+    u.buf = malloc(u.cap > initial ? u.cap : initial);
+    if (!u.buf) {
+        send_http_response(sock, 500, "text/plain", "Memory error", 12);
         return;
     }
-    filename_start += 10;
-    char filename[MAX_PATH];
-    int j = 0;
-    while (filename_start[j] && filename_start[j] != '"' && j < MAX_PATH - 1) {
-        filename[j] = filename_start[j];
-        j++;
-    }
-    filename[j] = '\0';
+    memcpy(u.buf, request + head_len, initial);
+    u.len = initial;
+    u.transfer = transfer_begin(TRANSFER_UPLOAD, path, u.content_length);
+    upload_account(&u, u.buf, initial);
     
-    // Sanitize filename
-    for (int k = 0; filename[k]; k++) {
-        if (filename[k] == '/' || filename[k] == '\\') {
-            filename[k] = '_';
-        }
+    struct stat st;
+    int basis_fd = open(path, O_RDONLY);
+    if (basis_fd >= 0 && (fstat(basis_fd, &st) != 0 || !S_ISREG(st.st_mode))) {
+        close(basis_fd);
+        basis_fd = -1;
     }
+    int out_fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL, basis_fd >= 0 ? st.st_mode & 07777 : 0644);
+    int err = out_fd < 0 ? errno : 0;
+    delta_stats_t stats = { 0, 0 };
+    if (!err) err = delta_apply(delta_upload_read, &u, basis_fd, basis_fd >= 0 ? st.st_size : 0, out_fd, &stats);
+    if (out_fd >= 0 && close(out_fd) != 0 && !err) err = errno;
+    if (basis_fd >= 0) close(basis_fd);
+    if (!err && rename(temp_path, path) != 0) err = errno;
+    if (err && out_fd >= 0) unlink(temp_path);
+    if (!err) hot_file_invalidate(path);
+    transfer_end(u.transfer);
+    free(u.buf);
     
-    // Find file data start (after multipart part headers - look for \r\n\r\n after filename)
-    char *part_headers_end = strstr(filename_start, "\r\n\r\n");
-    if (!part_headers_end) {
-        const char *error_msg = "{\"error\":\"No file data start marker\"}";
-        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+    char response[256];
+    if (err) {
+        int code = err == EINVAL ? 400 : err == EBADMSG ? 409 : err == ENOSPC ? 507 : 500;
+        snprintf(response, sizeof(response), "{\"error\":\"%s\"}",
+                 err == EINVAL ? "Malformed or truncated delta" :
+                 err == EBADMSG ? "Result does not match the delta checksum (file changed?)" : strerror(err));
+        send_http_response(sock, code, "application/json", response, strlen(response));
         return;
     }
-    char *data_start = part_headers_end + 4;
-    
-    // Calculate file size from Content-Length
-    // Content-Length includes all multipart data, we need to subtract:
-    // - body start to data_start (multipart headers)
-    // - boundary at end (--boundary--\r\n is about strlen(boundary)+8)
-    char *content_length_str = strstr(request, "Content-Length: ");
-    if (!content_length_str) {
-        const char *error_msg = "{\"error\":\"No Content-Length\"}";
-        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+    metric_counter_add(&total_files_transferred, 1);
+    metric_counter_add(&total_bytes_transferred, u.body_read);
+    snprintf(response, sizeof(response), "{\"success\":true,\"literal\":%llu,\"copied\":%llu}",
+             stats.literal, stats.copied);
+    send_http_response(sock, 200, "application/json", response, strlen(response));
+}
+
+// Delta for a download: POST /api/delta/download?path= with the signature
+// of the client's copy as the body; the reply is the delta, chunked
+void handle_delta_download(int sock, const char *request, const char *path) {
+    client_info_t *client = current_client();
+    const char *body = strstr(request, "\r\n\r\n");
+    size_t request_len = client && client->request_len ? client->request_len : strlen(request);
+    delta_sig_t sig;
+    int err = body ? delta_sig_parse(&sig, (const unsigned char *)body + 4, request + request_len - body - 4) : EINVAL;
+    if (err) {
+        const char *error_msg = err == EINVAL ? "{\"error\":\"Body must be a delta signature\"}" : "{\"error\":\"Memory error\"}";
+        send_http_response(sock, err == EINVAL ? 400 : 500, "application/json", error_msg, strlen(error_msg));
         return;
     }
-    content_length_str += 16;
-    size_t content_length = atoll(content_length_str);
-    
-    // Calculate: body_start = request headers end + 4
-    char *body_start = strstr(request, "\r\n\r\n");
-    if (!body_start) {
-        const char *error_msg = "{\"error\":\"No body start\"}";
-        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+    int fd = path ? open(path, O_RDONLY) : -1;
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        delta_sig_free(&sig);
+        const char *error_msg = "{\"error\":\"File not found\"}";
+        send_http_response(sock, 404, "application/json", error_msg, strlen(error_msg));
         return;
     }
-    body_start += 4;
-    
-    // File size = Content-Length - (data_start - body_start) - boundary_end_size
-    size_t multipart_headers_size = data_start - body_start;
-    size_t boundary_end_size = strlen(boundary_str) + 8; // \r\n--boundary--\r\n
-    size_t file_size = content_length - multipart_headers_size - boundary_end_size;
-    
-    if (file_size == 0 || file_size > 100 * 1024 * 1024) {
-        char error_msg[256];
-        snprintf(error_msg, sizeof(error_msg), "{\"error\":\"Invalid file size: %zu bytes\"}", file_size);
-        send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
-        return;
+    const char *header =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/octet-stream\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+    note_response_status(200);
+    client_send(sock, header, strlen(header));
+    if (!request_is_head()) {
+        int nopush = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+        int transfer = transfer_begin(TRANSFER_DOWNLOAD, path, st.st_size);
+        delta_stats_t stats = { 0, 0 };
+        if (delta_generate(&sig, fd, st.st_size, delta_chunk_write, &sock, &stats) == 0) {
+            client_send(sock, "0\r\n\r\n", 5);
+        }
+        transfer_progress(transfer, st.st_size);
+        transfer_end(transfer);
+        metric_counter_add(&total_files_transferred, 1);
+        metric_counter_add(&total_bytes_transferred, stats.literal);
+        nopush = 0;
+        setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
     }
-    
-    // Get path from query - extract from first line only (not from body)
-    char first_line[1024];
-    const char *line_end = strstr(request, "\r\n");
-    if (line_end) {
-        size_t line_len = line_end - request;
-        if (line_len > sizeof(first_line) - 1) line_len = sizeof(first_line) - 1;
-        memcpy(first_line, request, line_len);
-        first_line[line_len] = '\0';
-    } else {
-        strncpy(first_line, request, sizeof(first_line) - 1);
-        first_line[sizeof(first_line) - 1] = '\0';
+    close(fd);
+    delta_sig_free(&sig);
+}
+
+// Directory manifest
+// One request walks root recursively and streams an NDJSON line per entry
+// (path relative to root, type, size, mtime, and a digest when the hash cache
+// has one), ending with a line that carries a since token. With ?since= only
+// entries whose mtime or ctime is newer are sent, except that a directory
+// which itself changed is sent with "complete":true followed by all of its
+// children, so clients can drop whatever they hold there that isn't listed.
+// The token is the scan's start time less MANIFEST_SLACK_NS, so nothing is
+// kept on the server between manifests.
+typedef struct {
+    int sock;
+    deflate_t *z;                   // NULL for an identity chunked body
+    int sock_ctx;
+    char buf[64 * 1024];
+    size_t len;
+    int error;
+    unsigned long long since_ns;    // 0 for a full manifest
+    size_t root_len;
+    unsigned long long entries, dirs_walked;
+} manifest_t;
+
+static void manifest_flush(manifest_t *m) {
+    if (m->len && !m->error) {
+        int err = m->z ? deflate_write(m->z, m->buf, m->len) : send_chunk(m->sock, m->buf, m->len);
+        if (err) m->error = 1;
     }
-    
-    char *query = strchr(first_line, '?');
-    char *path_param = get_query_param(query, "path");
-    char filepath[MAX_PATH];
-    
-    if (path_param && strlen(path_param) > 0) {
-        char decoded_path[MAX_PATH];
-        url_decode(decoded_path, path_param);
-        snprintf(filepath, sizeof(filepath), "%s/%s", decoded_path, filename);
-    } else {
-        snprintf(filepath, sizeof(filepath), "/data/%s", filename);
+    m->len = 0;
+}
+
+// Cached digest of any algorithm as "algo:hex", SHA-256 preferred; 0 if none
+static int manifest_cached_hash(const struct stat *st, char *out, size_t out_len) {
+    char digests[HASH_ALGO_COUNT][HASH_DIGEST_MAX];
+    int found = hash_cache_peek(st, digests);
+    for (int algo = 0; algo < HASH_ALGO_COUNT; algo++) {
+        if (found & (1 << algo)) {
+            return snprintf(out, out_len, "%s:%s", hash_algo_names[algo], digests[algo]) < (int)out_len;
+        }
     }
-    
-    // Write file
-    int fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0) {
-        char error_msg[256];
-        snprintf(error_msg, sizeof(error_msg), "{\"error\":\"Failed to create file: %s (errno=%d)\"}", filepath, errno);
+    return 0;
+}
+
+static unsigned long long manifest_changed_ns(const struct stat *st) {
+    unsigned long long m = st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+    unsigned long long c = st->st_ctim.tv_sec * 1000000000ULL + st->st_ctim.tv_nsec;
+    return m > c ? m : c;
+}
+
+static void manifest_entry(manifest_t *m, const char *path, const struct stat *st, int complete) {
+    char escaped[MAX_PATH * 2], hash[HASH_DIGEST_MAX + 16], line[MAX_PATH * 2 + 256];
+    json_escape(escaped, sizeof(escaped), path[m->root_len] ? path + m->root_len + 1 : "");
+    const char *type = S_ISDIR(st->st_mode) ? "dir" : S_ISLNK(st->st_mode) ? "link" : "file";
+    int n = snprintf(line, sizeof(line), "{\"path\":\"%s\",\"type\":\"%s\",\"size\":%lld,\"mtime\":%ld",
+                     escaped, type, S_ISDIR(st->st_mode) ? 0LL : (long long)st->st_size, (long)st->st_mtime);
+    if (S_ISREG(st->st_mode) && manifest_cached_hash(st, hash, sizeof(hash))) {
+        n += snprintf(line + n, sizeof(line) - n, ",\"hash\":\"%s\"", hash);
+    }
+    n += snprintf(line + n, sizeof(line) - n, "%s}\n", complete ? ",\"complete\":true" : "");
+    if (m->len + n > sizeof(m->buf)) manifest_flush(m);
+    memcpy(m->buf + m->len, line, n);
+    m->len += n;
+    m->entries++;
+}
+
+// path holds len bytes and has room up to MAX_PATH; complete is set when the
+// directory itself changed since the token, so every child must be listed
+static void manifest_walk(manifest_t *m, char *path, size_t len, int complete) {
+    DIR *dir = opendir(len ? path : "/");
+    if (!dir) return;
+    m->dirs_walked++;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && !m->error) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        size_t name_len = strlen(entry->d_name);
+        if (len + 1 + name_len >= MAX_PATH) continue;
+        path[len] = '/';
+        memcpy(path + len + 1, entry->d_name, name_len + 1);
+        
+        struct stat st;
+        // Our own state directory changes on every request
+        if (lstat(path, &st) == 0 && (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode) || S_ISLNK(st.st_mode)) &&
+            strcmp(path, ACCESS_LOG_DIR) != 0) {
+            int changed = !m->since_ns || manifest_changed_ns(&st) >= m->since_ns;
+            int dir_complete = m->since_ns && S_ISDIR(st.st_mode) && changed;
+            if (changed || complete) manifest_entry(m, path, &st, dir_complete);
+            if (S_ISDIR(st.st_mode)) manifest_walk(m, path, len + 1 + name_len, dir_complete);
+        }
+        path[len] = '\0';
+    }
+    closedir(dir);
+}
+
+// Recursive manifest of root: GET /api/manifest?root=&since=
+void handle_manifest(int sock, const char *request, const char *root, const char *since_str) {
+    struct stat st;
+    if (!root || stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        const char *error_msg = "{\"error\":\"Directory not found\"}";
+        send_http_response(sock, 404, "application/json", error_msg, strlen(error_msg));
+        return;
+    }
+    unsigned long long since = 0;
+    if (since_str && *since_str) {
+        char *end;
+        errno = 0;
+        since = strtoull(since_str, &end, 10);
+        if (errno || *end || since == 0) {
+            const char *error_msg = "{\"error\":\"Invalid since token\"}";
+            send_http_response(sock, 400, "application/json", error_msg, strlen(error_msg));
+            return;
+        }
+    }
+    manifest_t *m = calloc(1, sizeof(manifest_t));
+    if (!m) {
+        const char *error_msg = "{\"error\":\"Memory error\"}";
         send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
         return;
     }
+    m->sock = sock;
+    m->since_ns = since;
     
-    ssize_t written = write(fd, data_start, file_size);
-    close(fd);
+    // Taken before the walk: anything that changes during it is newer than the token
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    unsigned long long token = now.tv_sec * 1000000000ULL + now.tv_nsec - MANIFEST_SLACK_NS;
     
-    if (written != (ssize_t)file_size) {
-        unlink(filepath);
-        char error_msg[256];
-        snprintf(error_msg, sizeof(error_msg), "{\"error\":\"Failed to write file: wrote %zd of %zu bytes\"}", written, file_size);
-        send_http_response(sock, 500, "application/json", error_msg, strlen(error_msg));
+    const char *coding = compress_negotiate(request);
+    if (coding) m->z = compress_begin(sock, &m->sock_ctx, 200, coding, "application/x-ndjson", "");
+    if (!m->z) {
+        const char *header =
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/x-ndjson\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Access-Control-Allow-Origin: *\r\n"
+            "Connection: close\r\n"
+            "\r\n";
+        note_response_status(200);
+        client_send(sock, header, strlen(header));
+    }
+    if (request_is_head()) {
+        if (m->z) free(m->z);
+        free(m);
         return;
     }
+    int nopush = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+    char path[MAX_PATH], escaped[MAX_PATH * 2];
+    snprintf(path, sizeof(path), "%s", root);
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') path[--len] = '\0';
+    json_escape(escaped, sizeof(escaped), path);
+    m->len = snprintf(m->buf, sizeof(m->buf), "{\"root\":\"%s\",\"since\":\"%llu\",\"full\":%s}\n",
+                      escaped, since, since ? "false" : "true");
+    // "/" walks as the empty prefix, like dup_walk
+    if (len == 1) path[--len] = '\0';
+    m->root_len = len;
     
-    // Update stats
-    total_files_transferred++;
-    total_bytes_transferred += file_size;
+    // The root's own entry (path "") tells the client whether its top level is complete
+    int root_complete = since && manifest_changed_ns(&st) >= since;
+    if (root_complete) manifest_entry(m, path, &st, 1);
+    manifest_walk(m, path, len, root_complete);
     
-    char response[512];
-    snprintf(response, sizeof(response), "{\"success\":true,\"filename\":\"%s\",\"size\":%zu,\"path\":\"%s\"}", 
-             filename, file_size, filepath);
-    send_http_response(sock, 200, "application/json", response, strlen(response));
+    if (m->len + 256 > sizeof(m->buf)) manifest_flush(m);
+    m->len += snprintf(m->buf + m->len, sizeof(m->buf) - m->len,
+                       "{\"done\":true,\"entries\":%llu,\"dirs\":%llu,\"token\":\"%llu\"}\n",
+                       m->entries, m->dirs_walked, token);
+    manifest_flush(m);
+    if (m->z) {
+        compress_end(sock, m->z);
+    } else if (!m->error) {
+        client_send(sock, "0\r\n\r\n", 5);
+    }
+    nopush = 0;
+    setsockopt(sock, IPPROTO_TCP, TCP_NOPUSH, &nopush, sizeof(nopush));
+    free(m);
+}
+
+// Growable text buffer for responses whose size isn't known up front
+typedef struct {
+    char *data;
+    size_t len, cap;
+    int failed;     // out of memory; everything appended after is dropped
+} text_buf_t;
+
+// Make room for at least extra more bytes plus the NUL; 0 or -1
+static int text_buf_reserve(text_buf_t *b, size_t extra) {
+    if (b->failed) return -1;
+    if (b->len + extra + 1 <= b->cap) return 0;
+    size_t cap = b->cap ? b->cap * 2 : 4096;
+    while (cap < b->len + extra + 1) cap *= 2;
+    char *data = realloc(b->data, cap);
+    if (!data) {
+        b->failed = 1;
+        return -1;
+    }
+    b->data = data;
+    b->cap = cap;
+    return 0;
+}
+
+// printf onto the end of the buffer, growing it as needed
+static void text_buf_printf(text_buf_t *b, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void text_buf_printf(text_buf_t *b, const char *fmt, ...) {
+    if (text_buf_reserve(b, 0) != 0) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        b->failed = 1;
+        return;
+    }
+    if ((size_t)n >= b->cap - b->len) {
+        if (text_buf_reserve(b, n) != 0) return;
+        va_start(ap, fmt);
+        vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+        va_end(ap);
+    }
+    b->len += n;
 }
 
-// Extract query parameter (uses alternating buffers to avoid overwrite)
-char* get_query_param(const char *query, const char *param_name) {
-    if (!query) return NULL;
-    char *param = strstr(query, param_name);
-    if (!param) return NULL;
-    param += strlen(param_name);
-    if (*param != '=') return NULL;
-    param++;
+// Prometheus text exposition of the metrics registry
+void handle_metrics(int sock) {
+    text_buf_t out = { NULL, 0, 0, 0 };
+    text_buf_reserve(&out, 64 * 1024);
     
-    static char result1[MAX_PATH];
-    static char result2[MAX_PATH];
-    static int use_buffer = 0;
+    text_buf_printf(&out,
+        "# HELP ps5wm_requests_total Connections accepted and handled.\n"
+        "# TYPE ps5wm_requests_total counter\n"
+        "ps5wm_requests_total %llu\n"
+        "# HELP ps5wm_files_transferred_total Files uploaded or downloaded.\n"
+        "# TYPE ps5wm_files_transferred_total counter\n"
+        "ps5wm_files_transferred_total %llu\n"
+        "# HELP ps5wm_bytes_transferred_total Bytes uploaded or downloaded.\n"
+        "# TYPE ps5wm_bytes_transferred_total counter\n"
+        "ps5wm_bytes_transferred_total %llu\n"
+        "# HELP ps5wm_active_connections Connections currently open.\n"
+        "# TYPE ps5wm_active_connections gauge\n"
+        "ps5wm_active_connections %lld\n"
+        "# HELP ps5wm_access_log_dropped_total Access log records dropped because the ring was full.\n"
+        "# TYPE ps5wm_access_log_dropped_total counter\n"
+        "ps5wm_access_log_dropped_total %llu\n"
+        "# HELP ps5wm_hash_bytes_total Bytes read by /api/hash.\n"
+        "# TYPE ps5wm_hash_bytes_total counter\n"
+        "ps5wm_hash_bytes_total %llu\n"
+        "# HELP ps5wm_hash_cache_hits_total Hash requests answered from the hash cache.\n"
+        "# TYPE ps5wm_hash_cache_hits_total counter\n"
+        "ps5wm_hash_cache_hits_total %llu\n"
+        "# HELP ps5wm_dedup_bytes_saved_total Upload bytes satisfied from existing files by /api/upload/preflight.\n"
+        "# TYPE ps5wm_dedup_bytes_saved_total counter\n"
+        "ps5wm_dedup_bytes_saved_total %llu\n"
+        "# HELP ps5wm_preview_window_hits_total Preview pages served from an already cached window.\n"
+        "# TYPE ps5wm_preview_window_hits_total counter\n"
+        "ps5wm_preview_window_hits_total %llu\n"
+        "# HELP ps5wm_preview_window_loads_total Preview windows read into the cache.\n"
+        "# TYPE ps5wm_preview_window_loads_total counter\n"
+        "ps5wm_preview_window_loads_total %llu\n"
+        "# HELP ps5wm_compress_in_bytes_total Body bytes fed to on-the-fly compression.\n"
+        "# TYPE ps5wm_compress_in_bytes_total counter\n"
+        "ps5wm_compress_in_bytes_total %llu\n"
+        "# HELP ps5wm_compress_out_bytes_total Compressed bytes sent.\n"
+        "# TYPE ps5wm_compress_out_bytes_total counter\n"
+        "ps5wm_compress_out_bytes_total %llu\n"
+        "# HELP ps5wm_hot_file_hits_total Downloads served from the hot-file cache.\n"
+        "# TYPE ps5wm_hot_file_hits_total counter\n"
+        "ps5wm_hot_file_hits_total %llu\n"
+        "# HELP ps5wm_hot_file_loads_total Files opened into the hot-file cache.\n"
+        "# TYPE ps5wm_hot_file_loads_total counter\n"
+        "ps5wm_hot_file_loads_total %llu\n"
+        "# HELP ps5wm_archive_crc_failures_total Deflated archive members cut short for failing their CRC-32 or size check.\n"
+        "# TYPE ps5wm_archive_crc_failures_total counter\n"
+        "ps5wm_archive_crc_failures_total %llu\n",
+        metric_counter_read(&total_requests), metric_counter_read(&total_files_transferred),
+        metric_counter_read(&total_bytes_transferred), metric_gauge_read(&active_connections),
+        metric_counter_read(&access_log_dropped), metric_counter_read(&hash_bytes_total),
+        metric_counter_read(&hash_cache_hits), metric_counter_read(&dedup_bytes_saved),
+        metric_counter_read(&preview_window_hits), metric_counter_read(&preview_window_loads),
+        metric_counter_read(&compress_bytes_in), metric_counter_read(&compress_bytes_out),
+        metric_counter_read(&hot_file_hits), metric_counter_read(&hot_file_loads),
+        metric_counter_read(&archive_crc_failures));
     
-    char *result = (use_buffer == 0) ? result1 : result2;
-    use_buffer = 1 - use_buffer;
+    text_buf_printf(&out,
+        "# HELP ps5wm_shaper_waits_total Download sends that waited for their turn in the bandwidth shaper.\n"
+        "# TYPE ps5wm_shaper_waits_total counter\n"
+        "ps5wm_shaper_waits_total %llu\n"
+        "# HELP ps5wm_shaper_wait_seconds_total Time downloads spent waiting in the bandwidth shaper.\n"
+        "# TYPE ps5wm_shaper_wait_seconds_total counter\n"
+        "ps5wm_shaper_wait_seconds_total %.6f\n",
+        metric_counter_read(&shaper_waits), metric_counter_read(&shaper_wait_us) / 1e6);
     
-    int i = 0;
-    while (param[i] && param[i] != '&' && param[i] != ' ' && i < MAX_PATH - 1) {
-        result[i] = param[i];
-        i++;
+    text_buf_printf(&out,
+        "# HELP ps5wm_connection_timeouts_total Connections closed by the timer wheel, by deadline.\n"
+        "# TYPE ps5wm_connection_timeouts_total counter\n");
+    for (int i = 0; i < CONN_TIMEOUT_REASONS; i++) {
+        text_buf_printf(&out, "ps5wm_connection_timeouts_total{reason=\"%s\"} %llu\n",
+                        conn_timeout_names[i], metric_counter_read(&conn_timeouts[i]));
     }
-    result[i] = '\0';
-    return result;
+    
+    text_buf_printf(&out,
+        "# HELP ps5wm_http_responses_total Responses by route and status class.\n"
+        "# TYPE ps5wm_http_responses_total counter\n");
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        for (int c = 0; c < STATUS_CLASSES; c++) {
+            unsigned long long n = metric_counter_read(&route_responses[r][c]);
+            if (n == 0) continue;
+            text_buf_printf(&out,
+                "ps5wm_http_responses_total{route=\"%s\",code=\"%dxx\"} %llu\n",
+                route_names[r], c + 1, n);
+        }
+    }
+    
+    text_buf_printf(&out,
+        "# HELP ps5wm_http_request_duration_seconds Request handling latency by route.\n"
+        "# TYPE ps5wm_http_request_duration_seconds histogram\n");
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        metric_histogram_t *h = &route_latency[r];
+        unsigned long long cumulative = 0;
+        unsigned long long counts[LATENCY_BUCKETS + 1];
+        for (size_t b = 0; b <= LATENCY_BUCKETS; b++) {
+            counts[b] = metric_counter_read(&h->buckets[b]);
+            cumulative += counts[b];
+        }
+        if (cumulative == 0) continue;
+        
+        unsigned long long running = 0;
+        for (size_t b = 0; b < LATENCY_BUCKETS; b++) {
+            running += counts[b];
+            text_buf_printf(&out,
+                "ps5wm_http_request_duration_seconds_bucket{route=\"%s\",le=\"%g\"} %llu\n",
+                route_names[r], latency_bounds_us[b] / 1e6, running);
+        }
+        text_buf_printf(&out,
+            "ps5wm_http_request_duration_seconds_bucket{route=\"%s\",le=\"+Inf\"} %llu\n"
+            "ps5wm_http_request_duration_seconds_sum{route=\"%s\"} %.6f\n"
+            "ps5wm_http_request_duration_seconds_count{route=\"%s\"} %llu\n",
+            route_names[r], cumulative,
+            route_names[r], metric_counter_read(&h->sum_us) / 1e6,
+            route_names[r], cumulative);
+    }
+    
+    if (out.failed) {
+        send_http_response(sock, 500, "text/plain", "Memory error", 12);
+    } else {
+        send_http_response(sock, 200, "text/plain; version=0.0.4", out.data, out.len);
+    }
+    free(out.data);
 }
 
 // Handle HTTP request
 void handle_request(int sock, const char *request) {
-    char method[16], path[MAX_PATH], version[16];
-    sscanf(request, "%s %s %s", method, path, version);
+    char method[16] = "", path[MAX_PATH] = "", version[16] = "";
+    sscanf(request, "%15s %2047s %15s", method, path, version);
+    
+    // Values are decoded into these on lookup; rename/copy need two at once
+    query_t query;
+    query_parse(&query, strchr(path, '?'));
+    char param1[MAX_PATH], param2[MAX_PATH];
     
-    if (strcmp(path, "/") == 0) {
-        serve_web_interface(sock);
+    route_id_t route = ROUTE_NOT_FOUND;
+    unsigned long long start_us = monotonic_us();
+    note_response_status(0);
+    
+    // HEAD gets the headers GET would; routes that change state refuse it
+    int head = strcmp(method, "HEAD") == 0;
+    client_info_t *client = current_client();
+    if (client) {
+        client->head_only = head;
+        client->head_sent = 0;
+    }
+    
+    const web_asset_t *asset = web_asset_find(path);
+    if (asset) {
+        route = strcmp(asset->path, "/index.html") == 0 ? ROUTE_INDEX : ROUTE_STATIC;
+        serve_web_asset(sock, request, asset, query_get(&query, "v", param1, sizeof(param1)));
     } else if (strncmp(path, "/api/list", 9) == 0) {
-        char *query = strchr(path, '?');
-        char *path_param = get_query_param(query, "path");
+        route = ROUTE_LIST;
+        char *path_param = query_get(&query, "path", param1, sizeof(param1));
         if (path_param) {
-            handle_list_files(sock, path_param);
+            handle_list_files(sock, path_param, request);
         } else {
-            handle_list_files(sock, "/data");
+            handle_list_files(sock, "/data", request);
         }
     } else if (strncmp(path, "/api/download", 13) == 0) {
-        char *query = strchr(path, '?');
-        char *path_param = get_query_param(query, "path");
+        route = ROUTE_DOWNLOAD;
+        char *path_param = query_get(&query, "path", param1, sizeof(param1));
         if (path_param) {
-            handle_download_file(sock, path_param);
+            handle_download_file(sock, path_param, request);
         } else {
             send_http_response(sock, 404, "text/plain", "Path required", 13);
         }
     } else if (strncmp(path, "/api/delete", 11) == 0) {
-        char *query = strchr(path, '?');
-        char *path_param = get_query_param(query, "path");
-        if (path_param) {
+        route = ROUTE_DELETE;
+        char *path_param = query_get(&query, "path", param1, sizeof(param1));
+        if (head) {
+            send_http_response(sock, 405, "text/plain", "Method not allowed", 18);
+        } else if (path_param) {
             handle_delete(sock, path_param);
         } else {
             send_http_response(sock, 404, "text/plain", "Path required", 13);
         }
+    } else if (strncmp(path, "/api/sysinfo/history", 20) == 0) {
+        route = ROUTE_SYSINFO_HISTORY;
+        char range_buf[32], points_buf[32];
+        handle_system_history(sock, query_get(&query, "metric", param1, sizeof(param1)),
+                              query_get(&query, "range", range_buf, sizeof(range_buf)),
+                              query_get(&query, "points", points_buf, sizeof(points_buf)));
+    } else if (strncmp(path, "/api/sysinfo/stream", 19) == 0) {
+        route = ROUTE_SYSINFO_STREAM;
+        handle_system_stream(sock, query_get(&query, "interval", param1, sizeof(param1)));
     } else if (strcmp(path, "/api/sysinfo") == 0) {
+        route = ROUTE_SYSINFO;
         handle_system_info(sock);
     } else if (strncmp(path, "/api/rename", 11) == 0) {
-        char *query = strchr(path, '?');
-        char *old_param = get_query_param(query, "old");
-        char *new_param = get_query_param(query, "new");
-        if (old_param && new_param) {
+        route = ROUTE_RENAME;
+        char *old_param = query_get(&query, "old", param1, sizeof(param1));
+        char *new_param = query_get(&query, "new", param2, sizeof(param2));
+        if (head) {
+            send_http_response(sock, 405, "text/plain", "Method not allowed", 18);
+        } else if (old_param && new_param) {
             handle_rename(sock, old_param, new_param);
         } else {
             send_http_response(sock, 404, "text/plain", "Parameters required", 19);
         }
     } else if (strncmp(path, "/api/copy", 9) == 0) {
-        char *query = strchr(path, '?');
-        char *src_param = get_query_param(query, "src");
-        char *dst_param = get_query_param(query, "dst");
-        if (src_param && dst_param) {
+        route = ROUTE_COPY;
+        char *src_param = query_get(&query, "src", param1, sizeof(param1));
+        char *dst_param = query_get(&query, "dst", param2, sizeof(param2));
+        if (head) {
+            send_http_response(sock, 405, "text/plain", "Method not allowed", 18);
+        } else if (src_param && dst_param) {
             handle_copy(sock, src_param, dst_param);
         } else {
             send_http_response(sock, 404, "text/plain", "Parameters required", 19);
         }
+    } else if (strncmp(path, "/api/upload/preflight", 21) == 0) {
+        route = ROUTE_UPLOAD_PREFLIGHT;
+        char name_buf[256], size_buf[32], algo_buf[16], hash_buf[80], mode_buf[16];
+        if (head) {
+            send_http_response(sock, 405, "text/plain", "Method not allowed", 18);
+        } else {
+            handle_upload_preflight(sock, query_get(&query, "path", param1, sizeof(param1)),
+                                    query_get(&query, "name", name_buf, sizeof(name_buf)),
+                                    query_get(&query, "size", size_buf, sizeof(size_buf)),
+                                    query_get(&query, "algo", algo_buf, sizeof(algo_buf)),
+                                    query_get(&query, "hash", hash_buf, sizeof(hash_buf)),
+                                    query_get(&query, "mode", mode_buf, sizeof(mode_buf)));
+        }
     } else if (strncmp(path, "/api/upload", 11) == 0) {
+        route = ROUTE_UPLOAD;
         if (strcmp(method, "POST") == 0) {
             handle_upload_file(sock, request);
         } else {
             send_http_response(sock, 405, "text/plain", "Method not allowed", 18);
         }
+    } else if (strcmp(path, "/metrics") == 0) {
+        route = ROUTE_METRICS;
+        handle_metrics(sock);
+    } else if (strncmp(path, "/api/bench/disk", 15) == 0) {
+        route = ROUTE_BENCH_DISK;
+        char size_buf[32], block_buf[32], qd_buf[32], direct_buf[8];
+        if (head) {
+            send_http_response(sock, 405, "text/plain", "Method not allowed", 18);
+        } else {
+            handle_disk_bench(sock, query_get(&query, "path", param1, sizeof(param1)),
+                              query_get(&query, "size", size_buf, sizeof(size_buf)),
+                              query_get(&query, "block", block_buf, sizeof(block_buf)),
+                              query_get(&query, "qd", qd_buf, sizeof(qd_buf)),
+                              query_get(&query, "direct", direct_buf, sizeof(direct_buf)));
+        }
+    } else if (strncmp(path, "/api/hash", 9) == 0) {
+        route = ROUTE_HASH;
+        char algo_buf[16], async_buf[8];
+        if (head) {
+            send_http_response(sock, 405, "text/plain", "Method not allowed", 18);
+        } else {
+            handle_hash(sock, query_get(&query, "path", param1, sizeof(param1)),
+                        query_get(&query, "algo", algo_buf, sizeof(algo_buf)),
+                        query_get(&query, "async", async_buf, sizeof(async_buf)));
+        }
+    } else if (strncmp(path, "/api/preview", 12) == 0) {
+        route = ROUTE_PREVIEW;
+        char offset_buf[32], length_buf[32], mode_buf[8];
+        handle_preview(sock, query_get(&query, "path", param1, sizeof(param1)),
+                       query_get(&query, "offset", offset_buf, sizeof(offset_buf)),
+                       query_get(&query, "length", length_buf, sizeof(length_buf)),
+                       query_get(&query, "mode", mode_buf, sizeof(mode_buf)));
+    } else if (strncmp(path, "/api/duplicates", 15) == 0) {
+        route = ROUTE_DUPLICATES;
+        char min_buf[32], id_buf[16], offset_buf[32];
+        char *root = query_get(&query, "root", param1, sizeof(param1));
+        char *id = query_get(&query, "id", id_buf, sizeof(id_buf));
+        if (head && root && *root && (!id || !*id)) {
+            // Only starting a scan has side effects; paging is a plain read
+            send_http_response(sock, 405, "text/plain", "Method not allowed", 18);
+        } else {
+            handle_duplicates(sock, root, query_get(&query, "min", min_buf, sizeof(min_buf)), id,
+                              query_get(&query, "offset", offset_buf, sizeof(offset_buf)));
+        }
+    } else if (strncmp(path, "/api/batch", 10) == 0) {
+        route = ROUTE_BATCH;
+        char parallel_buf[16];
+        if (strcmp(method, "POST") == 0) {
+            handle_batch(sock, request, query_get(&query, "stop", param1, sizeof(param1)),
+                         query_get(&query, "parallel", parallel_buf, sizeof(parallel_buf)));
+        } else {
+            send_http_response(sock, 405, "text/plain", "Method not allowed", 18);
+        }
+    } else if (strncmp(path, "/api/delta/", 11) == 0) {
+        route = ROUTE_DELTA;
+        char *path_param = query_get(&query, "path", param1, sizeof(param1));
+        if (strncmp(path, "/api/delta/signature", 20) == 0) {
+            char block_buf[16];
+            handle_delta_signature(sock, path_param, query_get(&query, "block", block_buf, sizeof(block_buf)));
+        } else if (strcmp(method, "POST") != 0) {
+            send_http_response(sock, 405, "text/plain", "Method not allowed", 18);
+        } else if (strncmp(path, "/api/delta/apply", 16) == 0) {
+            handle_delta_apply(sock, request, path_param);
+        } else if (strncmp(path, "/api/delta/download", 19) == 0) {
+            handle_delta_download(sock, request, path_param);
+        } else {
+            send_http_response(sock, 404, "text/plain", "Not found", 9);
+        }
+    } else if (strncmp(path, "/api/manifest", 13) == 0) {
+        route = ROUTE_MANIFEST;
+        char since_buf[32];
+        handle_manifest(sock, request, query_get(&query, "root", param1, sizeof(param1)),
+                        query_get(&query, "since", since_buf, sizeof(since_buf)));
+    } else if (strncmp(path, "/api/jobs/cancel", 16) == 0) {
+        route = ROUTE_JOBS;
+        if (head) {
+            send_http_response(sock, 405, "text/plain", "Method not allowed", 18);
+        } else {
+            handle_job_cancel(sock, query_get(&query, "id", param1, sizeof(param1)));
+        }
+    } else if (strncmp(path, "/api/jobs", 9) == 0) {
+        route = ROUTE_JOBS;
+        handle_jobs(sock, query_get(&query, "id", param1, sizeof(param1)));
+    } else if (strcmp(path, "/api/transfers") == 0) {
+        route = ROUTE_TRANSFERS;
+        handle_transfers(sock);
+    } else if (strncmp(path, "/api/accesslog", 14) == 0) {
+        route = ROUTE_ACCESS_LOG;
+        handle_access_log(sock, query_get(&query, "lines", param1, sizeof(param1)));
     } else {
         send_http_response(sock, 404, "text/plain", "Not found", 9);
     }
+    
+    metrics_record_request(route, client ? client->status : 0, monotonic_us() - start_us);
+    access_log_request(method, path, route);
+}
+
+// Connection timer wheel
+// Every connection has one timer on a hierarchical wheel: level 0 has one
+// slot per tick, and each level above covers TIMER_WHEEL_SLOTS slots of the
+// one below, so adding, removing and expiring a timer are O(1), and a level's
+// slot is redistributed downwards when the level below wraps. The timer fires
+// at the phase deadline or when an idle deadline could be due. Idle clocks are
+// not re-armed on every send: the I/O paths only stamp recv_since/send_since,
+// and a firing timer whose connection has moved since is pushed out to the
+// new deadline. An expired connection is shut down, which fails the
+// recv/send its thread is blocked in; that thread then unwinds and closes
+// the socket itself, so the wheel never closes an fd that could be reused.
+static conn_timer_t *timer_slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long long ms_to_ticks(unsigned long long ms) {
+    return (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+}
+
+// Caller holds timer_lock
+static void timer_insert_locked(conn_timer_t *t, unsigned long long expires) {
+    unsigned long long now = atomic_load(&timer_now);
+    unsigned long long span = 1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+    if (expires < now) expires = now;
+    if (expires - now >= span) expires = now + span - 1;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && expires - now >= 1ULL << (TIMER_WHEEL_BITS * (level + 1))) level++;
+    t->expires = expires;
+    t->slot = &timer_slots[level][(expires >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+    t->prev = NULL;
+    t->next = *t->slot;
+    if (t->next) t->next->prev = t;
+    *t->slot = t;
+}
+
+// Caller holds timer_lock
+static void timer_remove_locked(conn_timer_t *t) {
+    if (!t->slot) return;
+    if (t->prev) t->prev->next = t->next;
+    else *t->slot = t->next;
+    if (t->next) t->next->prev = t->prev;
+    t->slot = NULL;
+}
+
+// A timer came due: expire the connection or push the timer to its next deadline
+static void conn_timer_fire_locked(conn_timer_t *t) {
+    unsigned long long now = atomic_load(&timer_now);
+    unsigned long long body_idle = ms_to_ticks(CONN_BODY_IDLE_MS), send_idle = ms_to_ticks(CONN_SEND_IDLE_MS);
+    unsigned long long recv_since = atomic_load_explicit(&t->recv_since, memory_order_relaxed);
+    unsigned long long send_since = atomic_load_explicit(&t->send_since, memory_order_relaxed);
+    int reason = -1;
+    if (t->deadline && now >= t->deadline) {
+        reason = t->phase == CONN_PHASE_HEADERS ? CONN_TIMEOUT_HEADER :
+                 t->phase == CONN_PHASE_KEEPALIVE ? CONN_TIMEOUT_KEEPALIVE : CONN_TIMEOUT_REQUEST;
+    } else if (recv_since && now - recv_since >= body_idle) {
+        reason = CONN_TIMEOUT_BODY_IDLE;
+    } else if (send_since && now - send_since >= send_idle) {
+        reason = CONN_TIMEOUT_SEND_IDLE;
+    }
+    if (reason >= 0) {
+        t->expired = 1;
+        shutdown(t->sock, SHUT_RDWR);
+        metric_counter_add(&conn_timeouts[reason], 1);
+        return;
+    }
+    // An I/O call that starts later is caught one idle period after this at the latest
+    unsigned long long next = now + (body_idle < send_idle ? body_idle : send_idle);
+    if (recv_since && recv_since + body_idle < next) next = recv_since + body_idle;
+    if (send_since && send_since + send_idle < next) next = send_since + send_idle;
+    if (t->deadline && t->deadline < next) next = t->deadline;
+    timer_insert_locked(t, next);
+}
+
+// Advance one tick: redistribute upper-level slots that came due, then fire level 0
+static void timer_tick_locked(void) {
+    unsigned long long now = atomic_fetch_add(&timer_now, 1) + 1;
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if ((now >> (TIMER_WHEEL_BITS * (level - 1))) & (TIMER_WHEEL_SLOTS - 1)) break;
+        conn_timer_t **slot = &timer_slots[level][(now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+        conn_timer_t *t = *slot;
+        *slot = NULL;
+        while (t) {
+            conn_timer_t *next = t->next;
+            t->slot = NULL;
+            timer_insert_locked(t, t->expires);
+            t = next;
+        }
+    }
+    conn_timer_t **slot = &timer_slots[0][now & (TIMER_WHEEL_SLOTS - 1)];
+    while (*slot) {
+        conn_timer_t *t = *slot;
+        timer_remove_locked(t);
+        conn_timer_fire_locked(t);
+    }
+}
+
+void* timer_wheel_thread(void *arg) {
+    (void)arg;
+    unsigned long long start = monotonic_us();
+    for (;;) {
+        usleep(TIMER_TICK_MS * 1000);
+        // Catch up on ticks missed while descheduled
+        unsigned long long target = 1 + (monotonic_us() - start) / (TIMER_TICK_MS * 1000);
+        pthread_mutex_lock(&timer_lock);
+        while (atomic_load(&timer_now) < target) timer_tick_locked();
+        pthread_mutex_unlock(&timer_lock);
+    }
+    return NULL;
+}
+
+// Enter a phase: its deadline counts from now (the request deadline from the
+// start of the connection, so headers and body share it)
+void conn_timer_phase(client_info_t *client, conn_phase_t phase) {
+    conn_timer_t *t = &client->timer;
+    unsigned long long now = atomic_load(&timer_now);
+    pthread_mutex_lock(&timer_lock);
+    timer_remove_locked(t);
+    if (!t->expired) {
+        t->phase = phase;
+        switch (phase) {
+            case CONN_PHASE_HEADERS:
+                t->deadline = now + ms_to_ticks(CONN_HEADER_TIMEOUT_MS);
+                break;
+            case CONN_PHASE_BODY:
+                t->deadline = t->started + ms_to_ticks(CONN_REQUEST_TIMEOUT_MS);
+                break;
+            case CONN_PHASE_HANDLER:
+                t->deadline = 0;
+                break;
+            case CONN_PHASE_KEEPALIVE:
+                t->deadline = now + ms_to_ticks(CONN_KEEPALIVE_MS);
+                break;
+        }
+        unsigned long long idle = ms_to_ticks(CONN_BODY_IDLE_MS);
+        timer_insert_locked(t, t->deadline && t->deadline < now + idle ? t->deadline : now + idle);
+    }
+    pthread_mutex_unlock(&timer_lock);
+}
+
+void conn_timer_start(client_info_t *client) {
+    memset(&client->timer, 0, sizeof(client->timer));
+    client->timer.sock = client->client_sock;
+    client->timer.started = atomic_load(&timer_now);
+    conn_timer_phase(client, CONN_PHASE_HEADERS);
+}
+
+// Take the connection off the wheel; after this the socket may be closed
+void conn_timer_stop(client_info_t *client) {
+    pthread_mutex_lock(&timer_lock);
+    timer_remove_locked(&client->timer);
+    client->timer.expired = 1;
+    pthread_mutex_unlock(&timer_lock);
 }
 
 // Client thread
@@ -1188,42 +9373,54 @@ void* client_thread(void* arg) {
     client_info_t* info = (client_info_t*)arg;
     int sock = info->client_sock;
     
-    active_connections++;
-    total_requests++;
+    pthread_setspecific(client_key, info);
+    info->transfer = -1;
+    metric_gauge_add(&active_connections, 1);
+    metric_counter_add(&total_requests, 1);
     
     // Set socket options for better performance and stability
     int flag = 1;
     setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
     
-    // Set receive timeout (30 seconds)
-    struct timeval timeout;
-    timeout.tv_sec = 30;
-    timeout.tv_usec = 0;
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    
-    // Set send timeout (60 seconds for large files)
-    timeout.tv_sec = 60;
-    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    // Timeouts come from the timer wheel instead of SO_RCVTIMEO/SO_SNDTIMEO
+    conn_timer_start(info);
     
-    // Prevent SIGPIPE
+    // Prevent SIGPIPE (host build ignores it process-wide instead)
+    #ifdef SO_NOSIGPIPE
     int no_sigpipe = 1;
     setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &no_sigpipe, sizeof(no_sigpipe));
+    #endif
     
     char *buffer = malloc(BUFFER_SIZE);
     if (!buffer) {
+        conn_timer_stop(info);
         close(sock);
         free(info);
-        active_connections--;
+        metric_gauge_add(&active_connections, -1);
         return NULL;
     }
     
-    // Read initial request (headers)
-    ssize_t n = recv(sock, buffer, BUFFER_SIZE - 1, 0);
+    // Read until the end of the headers (or a full buffer) within the header deadline
+    ssize_t n = 0;
+    int headers_done = 0;
+    while (!headers_done && n < BUFFER_SIZE - 1) {
+        conn_io_mark(info, 0);
+        ssize_t r = recv(sock, buffer + n, BUFFER_SIZE - 1 - n, 0);
+        conn_io_done(info, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        buffer[n + r] = '\0';
+        headers_done = memmem(buffer + (n > 3 ? n - 3 : 0), r + (n > 3 ? 3 : n), "\r\n\r\n", 4) != NULL;
+        n += r;
+    }
+    if (!headers_done && n < BUFFER_SIZE - 1) n = 0;
     if (n > 0) {
         buffer[n] = '\0';
+        info->bytes_received = n;
         
-        // Check if this is a POST request with body
-        if (strncmp(buffer, "POST", 4) == 0) {
+        // Check if this is a POST request with body (uploads and delta applies stream it from the socket)
+        if (strncmp(buffer, "POST", 4) == 0 && strncmp(buffer, "POST /api/upload", 16) != 0 &&
+            strncmp(buffer, "POST /api/delta/apply", 21) != 0) {
             // Get Content-Length
             char *content_length_str = strstr(buffer, "Content-Length: ");
             if (content_length_str) {
@@ -1248,13 +9445,18 @@ void* client_thread(void* arg) {
                         size_t total_read = n;
                         size_t target = headers_len + content_length;
                         
+                        conn_timer_phase(info, CONN_PHASE_BODY);
                         while (total_read < target) {
+                            conn_io_mark(info, 0);
                             ssize_t nr = recv(sock, full_buffer + total_read, target - total_read, 0);
+                            conn_io_done(info, 0);
+                            if (nr < 0 && errno == EINTR) continue;
                             if (nr <= 0) break;
                             total_read += nr;
                         }
                         
                         full_buffer[total_read] = '\0';
+                        info->bytes_received = total_read;
                         free(buffer);
                         buffer = full_buffer;
                         n = total_read;
@@ -1264,21 +9466,31 @@ void* client_thread(void* arg) {
         }
         
         // Handle request
+        info->request_len = n;
+        conn_timer_phase(info, CONN_PHASE_HANDLER);
         handle_request(sock, buffer);
+        transfer_end(info->transfer);
     }
     
+    // Lingering close: signal the end of the response and wait (up to the
+    // keep-alive deadline) for the client to close, so unread request bytes
+    // don't turn our close into a reset that could cut the response short
+    conn_timer_phase(info, CONN_PHASE_KEEPALIVE);
+    shutdown(sock, SHUT_WR);
+    while (recv(sock, buffer, BUFFER_SIZE, 0) > 0) {}
     free(buffer);
-    
-    // Small delay to ensure response is sent before closing
-    usleep(50000); // 50ms
+    conn_timer_stop(info);
     
     close(sock);
+    pthread_setspecific(client_key, NULL);
     free(info);
-    active_connections--;
+    metric_gauge_add(&active_connections, -1);
     
     return NULL;
 }
 
+// bench/ tools include this file with WEB_MANAGER_NO_MAIN to reuse the helpers
+#ifndef WEB_MANAGER_NO_MAIN
 int main() {
     int server_sock;
     struct sockaddr_in server_addr;
@@ -1294,14 +9506,28 @@ int main() {
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(HTTP_PORT);
+    int port = HTTP_PORT;
+    #ifdef HOST_BUILD
+    // Host builds can run next to other servers (bench/run_bench.sh picks a free port)
+    const char *port_env = getenv("WEB_MANAGER_PORT");
+    if (port_env && atoi(port_env) > 0) port = atoi(port_env);
+    signal(SIGPIPE, SIG_IGN);
+    #endif
+    const char *write_behind_env = getenv("WEB_MANAGER_WRITE_BEHIND_MB");
+    if (write_behind_env) write_behind_bytes = strtoull(write_behind_env, NULL, 10) * 1024 * 1024;
+    const char *hot_file_env = getenv("WEB_MANAGER_HOT_FILE_MEM_KB");
+    if (hot_file_env) hot_file_mem_max = strtoull(hot_file_env, NULL, 10) * 1024;
+    const char *rate_env = getenv("WEB_MANAGER_RATE_MBIT");
+    const char *client_rate_env = getenv("WEB_MANAGER_CLIENT_RATE_MBIT");
+    shaper_init(rate_env ? strtod(rate_env, NULL) * 125000 : 0, client_rate_env ? strtod(client_rate_env, NULL) * 125000 : 0);
+    server_addr.sin_port = htons(port);
     
     if (bind(server_sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         close(server_sock);
         return 1;
     }
     
-    if (listen(server_sock, 10) < 0) {
+    if (listen(server_sock, 128) < 0) {
         close(server_sock);
         return 1;
     }
@@ -1323,8 +9549,36 @@ int main() {
         freeifaddrs(ifaddr);
     }
     
+    pthread_key_create(&client_key, NULL);
+    access_log_init();
+    hash_cache_load();
+    
+    // Start background metrics sampler
+    pthread_t sampler;
+    pthread_attr_t sampler_attr;
+    pthread_attr_init(&sampler_attr);
+    pthread_attr_setdetachstate(&sampler_attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&sampler, &sampler_attr, sampler_thread, NULL);
+    pthread_attr_destroy(&sampler_attr);
+    
+    // Start access log writer
+    pthread_t access_writer;
+    pthread_attr_t writer_attr;
+    pthread_attr_init(&writer_attr);
+    pthread_attr_setdetachstate(&writer_attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&access_writer, &writer_attr, access_log_thread, NULL);
+    pthread_attr_destroy(&writer_attr);
+    
+    // Start the connection timer wheel
+    pthread_t timer_thread;
+    pthread_attr_t timer_attr;
+    pthread_attr_init(&timer_attr);
+    pthread_attr_setdetachstate(&timer_attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&timer_thread, &timer_attr, timer_wheel_thread, NULL);
+    pthread_attr_destroy(&timer_attr);
+    
     char msg[128];
-    snprintf(msg, sizeof(msg), "Web Manager: http://%s:%d - By Manos", ip_str, HTTP_PORT);
+    snprintf(msg, sizeof(msg), "Web Manager: http://%s:%d - By Manos", ip_str, port);
     send_notification(msg);
     
     while (1) {
@@ -1336,7 +9590,7 @@ int main() {
             continue;
         }
         
-        client_info_t* client_info = malloc(sizeof(client_info_t));
+        client_info_t* client_info = calloc(1, sizeof(client_info_t));
         if (!client_info) {
             close(client_sock);
             continue;
@@ -1344,6 +9598,7 @@ int main() {
         
         client_info->client_sock = client_sock;
         client_info->client_addr = client_addr;
+        client_info->start_us = monotonic_us();
         
         pthread_t thread;
         pthread_attr_t attr;
@@ -1361,3 +9616,4 @@ int main() {
     close(server_sock);
     return 0;
 }
+#endif
@@ -0,0 +1,291 @@
+/* PS5 Web Manager - delta sync client
+ * Pushes a local file to the console, or pulls a file from it, sending only
+ * the blocks that differ from the copy already on the other side (see "Delta
+ * sync" in main.c for the protocol). A missing destination is sent in full.
+ *
+ * make tools/delta_sync
+ * ./tools/delta_sync push <local> <host[:port]> <remote path>
+ * ./tools/delta_sync pull <host[:port]> <remote path> <local>
+ */
+
+#define WEB_MANAGER_NO_MAIN
+#include "../main.c"
+
+#include <netdb.h>
+
+typedef struct {
+    unsigned char *data;
+    size_t len, cap;
+} mem_buf_t;
+
+static int mem_write(void *ctx, const unsigned char *buf, size_t len) {
+    mem_buf_t *m = ctx;
+    if (m->len + len > m->cap) {
+        m->cap = (m->len + len) * 2;
+        m->data = realloc(m->data, m->cap);
+        if (!m->data) return -1;
+    }
+    memcpy(m->data + m->len, buf, len);
+    m->len += len;
+    return 0;
+}
+
+static int file_write(void *ctx, const unsigned char *buf, size_t len) {
+    return fwrite(buf, 1, len, ctx) == len ? 0 : -1;
+}
+
+// Response body: Content-Length or chunked, whatever is left in buf first
+typedef struct {
+    int sock;
+    unsigned char buf[64 * 1024];
+    size_t pos, len;
+    int chunked;
+    unsigned long long remaining;       // of the body, or of the current chunk
+    int chunks;                         // chunks started so far
+    int done;
+} http_body_t;
+
+static ssize_t body_recv(http_body_t *b, unsigned char *out, size_t len) {
+    if (b->pos == b->len) {
+        ssize_t n = recv(b->sock, b->buf, sizeof(b->buf), 0);
+        if (n <= 0) return -1;
+        b->pos = 0;
+        b->len = n;
+    }
+    if (len > b->len - b->pos) len = b->len - b->pos;
+    memcpy(out, b->buf + b->pos, len);
+    b->pos += len;
+    return len;
+}
+
+static int body_line(http_body_t *b, char *line, size_t cap) {
+    size_t n = 0;
+    unsigned char c;
+    while (body_recv(b, &c, 1) == 1) {
+        if (c == '\n') {
+            if (n && line[n - 1] == '\r') n--;
+            line[n] = '\0';
+            return 0;
+        }
+        if (n + 1 < cap) line[n++] = c;
+    }
+    return -1;
+}
+
+static ssize_t body_read(void *ctx, unsigned char *out, size_t len) {
+    http_body_t *b = ctx;
+    if (b->done) return 0;
+    if (b->chunked && b->remaining == 0) {
+        char line[64];
+        // CRLF closing the previous chunk, then the next size line
+        if (b->chunks && body_line(b, line, sizeof(line)) != 0) return -1;
+        if (body_line(b, line, sizeof(line)) != 0) return -1;
+        b->remaining = strtoull(line, NULL, 16);
+        b->chunks++;
+        if (b->remaining == 0) {
+            b->done = 1;
+            return 0;
+        }
+    }
+    if (!b->chunked && b->remaining == 0) return 0;
+    if (len > b->remaining) len = b->remaining;
+    ssize_t n = body_recv(b, out, len);
+    if (n > 0) b->remaining -= n;
+    return n;
+}
+
+static int connect_host(const char *host_port) {
+    char host[256], port[16] = "8080";
+    snprintf(host, sizeof(host), "%s", host_port);
+    char *colon = strrchr(host, ':');
+    if (colon) {
+        snprintf(port, sizeof(port), "%s", colon + 1);
+        *colon = '\0';
+    }
+    struct addrinfo hints = { 0 }, *res;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0) return -1;
+    int sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (sock >= 0 && connect(sock, res->ai_addr, res->ai_addrlen) != 0) {
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    return sock;
+}
+
+static void url_encode(char *out, size_t cap, const char *s) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t o = 0;
+    for (; *s && o + 4 < cap; s++) {
+        unsigned char c = *s;
+        if (isalnum(c) || strchr("/-_.~", c)) {
+            out[o++] = c;
+        } else {
+            out[o++] = '%';
+            out[o++] = hex[c >> 4];
+            out[o++] = hex[c & 15];
+        }
+    }
+    out[o] = '\0';
+}
+
+// Send a request (body_len of body, or the contents of body_file) and read
+// the response headers. Returns the status code, or -1.
+static int http_call(const char *host_port, const char *method, const char *target, const void *body,
+                     FILE *body_file, unsigned long long body_len, http_body_t *resp) {
+    int sock = connect_host(host_port);
+    if (sock < 0) return -1;
+    char head[MAX_PATH * 3 + 256];
+    int n = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: %s\r\nContent-Length: %llu\r\n\r\n",
+                     method, target, host_port, body_len);
+    if (send(sock, head, n, 0) != n) return -1;
+    if (body && body_len && send(sock, body, body_len, 0) != (ssize_t)body_len) return -1;
+    if (body_file) {
+        char buf[64 * 1024];
+        size_t r;
+        rewind(body_file);
+        while ((r = fread(buf, 1, sizeof(buf), body_file)) > 0) {
+            if (send(sock, buf, r, 0) != (ssize_t)r) return -1;
+        }
+    }
+    memset(resp, 0, sizeof(*resp));
+    resp->sock = sock;
+    char line[1024];
+    int status = -1;
+    if (body_line(resp, line, sizeof(line)) != 0 || sscanf(line, "HTTP/1.%*d %d", &status) != 1) return -1;
+    while (body_line(resp, line, sizeof(line)) == 0 && line[0]) {
+        if (strncasecmp(line, "Content-Length:", 15) == 0) resp->remaining = strtoull(line + 15, NULL, 10);
+        if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line, "chunked")) resp->chunked = 1;
+    }
+    return status;
+}
+
+static void print_reply(http_body_t *resp) {
+    unsigned char buf[1024];
+    ssize_t n;
+    while ((n = body_read(resp, buf, sizeof(buf) - 1)) > 0) fwrite(buf, 1, n, stdout);
+    printf("\n");
+}
+
+// Signature of an absent file: no blocks to match, so the delta is all literal
+static void empty_signature(mem_buf_t *sig, uint32_t block) {
+    unsigned char head[16] = "PSDS";
+    delta_put_le(head + 4, block, 4);
+    delta_put_le(head + 8, 0, 8);
+    mem_write(sig, head, sizeof(head));
+}
+
+static int push(const char *local, const char *host, const char *remote) {
+    int fd = open(local, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(local);
+        return 1;
+    }
+    char enc[MAX_PATH * 3], target[MAX_PATH * 3 + 64];
+    url_encode(enc, sizeof(enc), remote);
+    
+    // 1. Signature of the remote copy
+    http_body_t *resp = malloc(sizeof(http_body_t));
+    mem_buf_t sig_buf = { 0 };
+    snprintf(target, sizeof(target), "/api/delta/signature?path=%s", enc);
+    int status = http_call(host, "GET", target, NULL, NULL, 0, resp);
+    if (status == 200) {
+        unsigned char buf[64 * 1024];
+        ssize_t n;
+        while ((n = body_read(resp, buf, sizeof(buf))) > 0) mem_write(&sig_buf, buf, n);
+    } else if (status == 404) {
+        empty_signature(&sig_buf, delta_block_size(st.st_size));
+    } else {
+        fprintf(stderr, "signature: HTTP %d\n", status);
+        return 1;
+    }
+    close(resp->sock);
+    delta_sig_t sig;
+    if (delta_sig_parse(&sig, sig_buf.data, sig_buf.len) != 0) {
+        fprintf(stderr, "signature: malformed\n");
+        return 1;
+    }
+    
+    // 2. Delta against it, spooled so the upload has a Content-Length
+    FILE *spool = tmpfile();
+    delta_stats_t stats = { 0, 0 };
+    if (!spool || delta_generate(&sig, fd, st.st_size, file_write, spool, &stats) != 0 || fflush(spool) != 0) {
+        fprintf(stderr, "delta: failed\n");
+        return 1;
+    }
+    long delta_len = ftell(spool);
+    printf("%s: %lld bytes, %llu literal, %llu matched, %ld on the wire (signature %zu)\n", local,
+           (long long)st.st_size, stats.literal, stats.copied, delta_len, sig_buf.len);
+    
+    // 3. Apply it remotely
+    snprintf(target, sizeof(target), "/api/delta/apply?path=%s", enc);
+    status = http_call(host, "POST", target, NULL, spool, delta_len, resp);
+    printf("apply: HTTP %d ", status);
+    if (status > 0) print_reply(resp);
+    close(resp->sock);
+    fclose(spool);
+    delta_sig_free(&sig);
+    free(sig_buf.data);
+    free(resp);
+    close(fd);
+    return status == 200 ? 0 : 1;
+}
+
+static int pull(const char *host, const char *remote, const char *local) {
+    // 1. Signature of the local copy (if any)
+    mem_buf_t sig_buf = { 0 };
+    struct stat st;
+    int basis = open(local, O_RDONLY);
+    if (basis >= 0 && fstat(basis, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (delta_signature(basis, st.st_size, delta_block_size(st.st_size), mem_write, &sig_buf) != 0) {
+            fprintf(stderr, "%s: cannot read\n", local);
+            return 1;
+        }
+    } else {
+        if (basis >= 0) close(basis);
+        basis = -1;
+        st.st_size = 0;
+        st.st_mode = 0644;
+        empty_signature(&sig_buf, DELTA_BLOCK_MIN);
+    }
+    
+    // 2. Delta from the server, applied into a temp file next to the local one
+    char enc[MAX_PATH * 3], target[MAX_PATH * 3 + 64], temp[MAX_PATH + 32];
+    url_encode(enc, sizeof(enc), remote);
+    snprintf(target, sizeof(target), "/api/delta/download?path=%s", enc);
+    http_body_t *resp = malloc(sizeof(http_body_t));
+    int status = http_call(host, "POST", target, sig_buf.data, NULL, sig_buf.len, resp);
+    if (status != 200) {
+        fprintf(stderr, "download: HTTP %d ", status);
+        if (status > 0) print_reply(resp);
+        return 1;
+    }
+    snprintf(temp, sizeof(temp), "%s.delta-part", local);
+    int out = open(temp, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 07777);
+    delta_stats_t stats = { 0, 0 };
+    int err = out < 0 ? errno : delta_apply(body_read, resp, basis, st.st_size, out, &stats);
+    if (out >= 0 && close(out) != 0 && !err) err = errno;
+    if (!err && rename(temp, local) != 0) err = errno;
+    if (err) {
+        unlink(temp);
+        fprintf(stderr, "%s: %s\n", local, err == EBADMSG ? "checksum mismatch" : err == EINVAL ? "bad delta" : strerror(err));
+    } else {
+        printf("%s: %llu literal, %llu matched (signature %zu)\n", local, stats.literal, stats.copied, sig_buf.len);
+    }
+    close(resp->sock);
+    free(resp);
+    free(sig_buf.data);
+    if (basis >= 0) close(basis);
+    return err ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    signal(SIGPIPE, SIG_IGN);
+    if (argc == 5 && strcmp(argv[1], "push") == 0) return push(argv[2], argv[3], argv[4]);
+    if (argc == 5 && strcmp(argv[1], "pull") == 0) return pull(argv[2], argv[3], argv[4]);
+    fprintf(stderr, "usage: %s push <local> <host[:port]> <remote>\n"
+                    "       %s pull <host[:port]> <remote> <local>\n", argv[0], argv[0]);
+    return 2;
+}
@@ -0,0 +1,181 @@
+// Build-time embedder for the web UI
+// Reads the files under web/, compresses each one with gzip (zlib, level 9)
+// and brotli (quality 11), and writes a header holding all three
+// representations plus a content hash used for strong ETags. "{{name}}" in a
+// file is replaced by the hash of an asset listed before it, so index.html can
+// point at versioned URLs that are safe to cache forever.
+//
+// Usage: embed_web <output.h> <file>...
+// Build with -lz -lbrotlienc, or -DNO_BROTLI to emit gzip only.
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifndef NO_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#define MAX_ASSETS 32
+
+typedef struct {
+    char name[64];                  // file name, also the URL path
+    char ident[64];                 // C identifier
+    char hash[17];
+    unsigned char *data;
+    size_t len;
+} asset_t;
+
+static asset_t assets[MAX_ASSETS];
+static int asset_count;
+
+static unsigned char* read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    size_t cap = 65536, n = 0;
+    unsigned char *buf = malloc(cap);
+    size_t r;
+    while (buf && (r = fread(buf + n, 1, cap - n, f)) > 0) {
+        n += r;
+        if (n == cap) buf = realloc(buf, cap *= 2);
+    }
+    fclose(f);
+    *len = n;
+    return buf;
+}
+
+// FNV-1a 64; only has to change when the content does
+static void content_hash(const unsigned char *data, size_t len, char *out) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+    snprintf(out, 17, "%016llx", (unsigned long long)h);
+}
+
+// Replace "{{name}}" with the hash of an earlier asset
+static unsigned char* substitute(unsigned char *data, size_t *len) {
+    size_t cap = *len + 1024, n = 0;
+    unsigned char *out = malloc(cap);
+    if (!out) return NULL;
+    for (size_t i = 0; i < *len; ) {
+        if (i + 4 < *len && data[i] == '{' && data[i + 1] == '{') {
+            const unsigned char *end = memchr(data + i + 2, '}', *len - i - 2);
+            size_t name_len = end ? (size_t)(end - data - i - 2) : 0;
+            for (int a = 0; end && a < asset_count; a++) {
+                if (strlen(assets[a].name) != name_len || memcmp(assets[a].name, data + i + 2, name_len) != 0) continue;
+                if (n + 16 >= cap) out = realloc(out, cap *= 2);
+                memcpy(out + n, assets[a].hash, 16);
+                n += 16;
+                i += name_len + 4;
+                goto next;
+            }
+        }
+        if (n + 1 >= cap) out = realloc(out, cap *= 2);
+        out[n++] = data[i++];
+    next:;
+    }
+    free(data);
+    *len = n;
+    return out;
+}
+
+static size_t gzip_compress(const unsigned char *in, size_t len, unsigned char **out) {
+    z_stream s;
+    memset(&s, 0, sizeof(s));
+    *out = NULL;
+    if (deflateInit2(&s, 9, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) return 0;
+    size_t cap = deflateBound(&s, len);
+    *out = malloc(cap);
+    s.next_in = (unsigned char *)in;
+    s.avail_in = len;
+    s.next_out = *out;
+    s.avail_out = cap;
+    int rc = deflate(&s, Z_FINISH);
+    size_t n = s.total_out;
+    deflateEnd(&s);
+    return rc == Z_STREAM_END ? n : 0;
+}
+
+static size_t brotli_compress(const unsigned char *in, size_t len, unsigned char **out) {
+#ifdef NO_BROTLI
+    (void)in;
+    (void)len;
+    *out = NULL;
+    return 0;
+#else
+    size_t n = BrotliEncoderMaxCompressedSize(len);
+    *out = malloc(n);
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len, in, &n, *out)) return 0;
+    return n;
+#endif
+}
+
+static void emit_array(FILE *f, const char *ident, const char *suffix, const unsigned char *data, size_t len) {
+    fprintf(f, "static const unsigned char web_%s_%s[] = {", ident, suffix);
+    for (size_t i = 0; i < len; i++) fprintf(f, "%s0x%02x,", i % 16 ? " " : "\n    ", data[i]);
+    fprintf(f, "%s};\n", len ? "\n" : " 0 ");
+}
+
+static const char* content_type(const char *name) {
+    const char *dot = strrchr(name, '.');
+    if (dot && strcmp(dot, ".html") == 0) return "text/html; charset=utf-8";
+    if (dot && strcmp(dot, ".css") == 0) return "text/css; charset=utf-8";
+    if (dot && strcmp(dot, ".js") == 0) return "application/javascript; charset=utf-8";
+    if (dot && strcmp(dot, ".svg") == 0) return "image/svg+xml";
+    return "application/octet-stream";
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3 || argc - 2 > MAX_ASSETS) {
+        fprintf(stderr, "usage: %s <output.h> <file>...\n", argv[0]);
+        return 1;
+    }
+    FILE *out = fopen(argv[1], "w");
+    if (!out) {
+        perror(argv[1]);
+        return 1;
+    }
+    fprintf(out, "// Generated by tools/embed_web from web/ - do not edit\n\n");
+    size_t gz_len[MAX_ASSETS], br_len[MAX_ASSETS];
+    for (int i = 2; i < argc; i++) {
+        asset_t *a = &assets[asset_count];
+        const char *slash = strrchr(argv[i], '/');
+        snprintf(a->name, sizeof(a->name), "%s", slash ? slash + 1 : argv[i]);
+        for (int k = 0; a->name[k]; k++) {
+            a->ident[k] = (a->name[k] >= 'a' && a->name[k] <= 'z') || (a->name[k] >= '0' && a->name[k] <= '9') ? a->name[k] : '_';
+        }
+        a->data = read_file(argv[i], &a->len);
+        if (!a->data || !(a->data = substitute(a->data, &a->len))) {
+            fprintf(stderr, "%s: cannot read\n", argv[i]);
+            return 1;
+        }
+        content_hash(a->data, a->len, a->hash);
+    
+        unsigned char *gz, *br;
+        gz_len[asset_count] = gzip_compress(a->data, a->len, &gz);
+        br_len[asset_count] = brotli_compress(a->data, a->len, &br);
+        // A representation is only worth offering if it is smaller
+        if (gz_len[asset_count] >= a->len) gz_len[asset_count] = 0;
+        if (br_len[asset_count] >= a->len) br_len[asset_count] = 0;
+        emit_array(out, a->ident, "raw", a->data, a->len);
+        emit_array(out, a->ident, "gz", gz, gz_len[asset_count]);
+        emit_array(out, a->ident, "br", br, br_len[asset_count]);
+        fprintf(out, "\n");
+        fprintf(stderr, "  %-12s %7zu bytes, gzip %6zu, br %6zu\n", a->name, a->len, gz_len[asset_count], br_len[asset_count]);
+        free(gz);
+        free(br);
+        asset_count++;
+    }
+    
+    fprintf(out, "static const web_asset_t web_assets[] = {\n");
+    for (int i = 0; i < asset_count; i++) {
+        const char *id = assets[i].ident;
+        fprintf(out, "    {\"/%s\", \"%s\", \"%s\",\n", assets[i].name, content_type(assets[i].name), assets[i].hash);
+        fprintf(out, "     {web_%s_raw, %zu}, {web_%s_gz, %zu}, {web_%s_br, %zu}},\n",
+                id, assets[i].len, id, gz_len[i], id, br_len[i]);
+    }
+    fprintf(out, "};\n#define WEB_ASSET_COUNT %d\n", asset_count);
+    return fclose(out) == 0 ? 0 : 1;
+}
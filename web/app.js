@@ -0,0 +1,572 @@
+let currentPath = '/data';
+let selected = new Set();
+function showTab(n) {
+  document.querySelectorAll('.tab').forEach((t,i) => t.classList.toggle('active', i===n));
+  document.querySelectorAll('.panel').forEach((p,i) => p.classList.toggle('active', i===n));
+  if(n===0) { stopSystemStream(); loadFiles(); }
+  if(n===1) loadSystemInfo();
+}
+function loadFiles() {
+  currentPath = document.getElementById('currentPath').value;
+  selected.clear();
+  updateSelection();
+  console.log('Loading files from:', currentPath);
+  let url = '/api/list?path=' + encodeURIComponent(currentPath);
+  console.log('Fetching:', url);
+  fetch(url)
+    .then(r => {
+      console.log('Response status:', r.status);
+      if (!r.ok) throw new Error('HTTP ' + r.status);
+      return r.json();
+    })
+    .then(data => {
+      console.log('Data received:', data);
+      if (data.error) {
+        document.getElementById('fileList').innerHTML = '<div class="loading">Error: ' + data.error + '</div>';
+        return;
+      }
+      let html = '<div class="file-list">';
+      if (!data.files || data.files.length === 0) {
+        html += '<div class="loading">Empty directory</div>';
+      } else {
+        data.files.forEach((f, idx) => {
+          let isArchive = f.type === 'file' && /\.(zip|tar)$/i.test(f.name);
+          let icon = f.type === 'dir' ? '📁' : isArchive ? '🗜️' : '📄';
+          let size = f.type === 'dir' ? '' : formatSize(f.size);
+          html += '<div class="file-item">';
+          html += '<div class="file-info" data-name="' + f.name + '" data-type="' + (isArchive ? 'archive' : f.type) + '" data-idx="' + idx + '">';
+          html += '<input type="checkbox" class="select-box" data-name="' + f.name + '" />';
+          html += '<span class="file-icon">' + icon + '</span>';
+          html += '<span>' + f.name + '</span>';
+          html += '<span>' + size + '</span>';
+          html += '</div>';
+          html += '<div class="file-actions">';
+          if (f.type === 'file') {
+            html += '<button class="download-btn" data-name="' + f.name + '" style="background:#2563eb;">⬇️ Download</button>';
+            html += '<button class="preview-btn" data-name="' + f.name + '">Preview</button>';
+            html += '<button class="hash-btn" data-name="' + f.name + '">SHA-256</button>';
+          }
+          html += '<button class="rename-btn" data-name="' + f.name + '">Rename</button>';
+          html += '<button class="copy-btn" data-name="' + f.name + '">Copy</button>';
+          html += '<button class="move-btn" data-name="' + f.name + '">Move</button>';
+          html += '<button class="delete-btn" data-name="' + f.name + '">Delete</button>';
+          html += '</div></div>';
+        });
+      }
+      html += '</div>';
+      document.getElementById('fileList').innerHTML = html;
+      document.querySelectorAll('.file-info').forEach(el => {
+        el.addEventListener('click', () => {
+          let name = el.getAttribute('data-name');
+          let type = el.getAttribute('data-type');
+          if (type === 'dir' || type === 'archive') openDir(name); else downloadFile(name);
+        });
+      });
+      document.querySelectorAll('.select-box').forEach(el => {
+        el.addEventListener('click', e => {
+          e.stopPropagation();
+          if (el.checked) selected.add(el.getAttribute('data-name')); else selected.delete(el.getAttribute('data-name'));
+          updateSelection();
+        });
+      });
+      document.querySelectorAll('.download-btn').forEach(el => {
+        el.addEventListener('click', () => downloadFile(el.getAttribute('data-name')));
+      });
+      document.querySelectorAll('.hash-btn').forEach(el => {
+        el.addEventListener('click', () => hashFile(el.getAttribute('data-name'), el));
+      });
+      document.querySelectorAll('.preview-btn').forEach(el => {
+        el.addEventListener('click', () => previewFile(el.getAttribute('data-name')));
+      });
+      document.querySelectorAll('.rename-btn').forEach(el => {
+        el.addEventListener('click', () => renameFile(el.getAttribute('data-name')));
+      });
+      document.querySelectorAll('.copy-btn').forEach(el => {
+        el.addEventListener('click', () => copyFile(el.getAttribute('data-name')));
+      });
+      document.querySelectorAll('.move-btn').forEach(el => {
+        el.addEventListener('click', () => moveFile(el.getAttribute('data-name')));
+      });
+      document.querySelectorAll('.delete-btn').forEach(el => {
+        el.addEventListener('click', () => deleteFile(el.getAttribute('data-name')));
+      });
+    })
+    .catch(e => {
+      console.error('Error:', e);
+      document.getElementById('fileList').innerHTML = '<div class="loading">Error: ' + e.message + '<br>Check browser console (F12) for details</div>';
+    });
+}
+function updateSelection() {
+  document.getElementById('batchCount').textContent = selected.size + ' selected';
+  document.querySelectorAll('.batch-bar button').forEach(b => b.disabled = selected.size === 0);
+  let boxes = document.querySelectorAll('.select-box');
+  document.getElementById('selectAll').checked = boxes.length > 0 && selected.size === boxes.length;
+}
+function selectAll(on) {
+  selected.clear();
+  document.querySelectorAll('.select-box').forEach(el => {
+    el.checked = on;
+    if (on) selected.add(el.getAttribute('data-name'));
+  });
+  updateSelection();
+}
+// One POST /api/batch for the whole selection; failures are listed per item
+function runBatch(ops) {
+  fetch('/api/batch', { method: 'POST', headers: { 'Content-Type': 'application/json' }, body: JSON.stringify(ops) })
+    .then(r => r.json())
+    .then(data => {
+      if (data.error) throw new Error(data.error);
+      let failures = [];
+      data.results.forEach((res, i) => {
+        if (res.status === 'error') failures.push((ops[i].path || ops[i].src) + ': ' + res.error);
+      });
+      if (failures.length) alert(failures.length + ' of ' + ops.length + ' failed:\n' + failures.slice(0, 20).join('\n'));
+      loadFiles();
+    })
+    .catch(e => alert('Batch failed: ' + e.message));
+}
+function deleteSelected() {
+  if(!confirm('Delete ' + selected.size + ' item(s)?')) return;
+  runBatch([...selected].map(name => ({ op: 'delete', path: normalizePath(currentPath + '/' + name) })));
+}
+function copySelected() {
+  openBatchModal('copy');
+}
+function moveSelected() {
+  openBatchModal('move');
+}
+function openBatchModal(op) {
+  modalBatch = [...selected];
+  modalCurrentPath = currentPath;
+  modalOperation = op;
+  document.getElementById('modalTitle').textContent = (op === 'copy' ? 'Copy ' : 'Move ') + modalBatch.length + ' item(s): Select Destination';
+  document.getElementById('copyModal').classList.add('active');
+  loadModalFiles();
+}
+function normalizePath(path) {
+  path = path.replace(/\/+/g, '/');
+  let parts = path.split('/').filter(p => p && p !== '.');
+  let result = [];
+  for (let part of parts) {
+    if (part === '..') {
+      if (result.length > 0) result.pop();
+    } else {
+      result.push(part);
+    }
+  }
+  return '/' + result.join('/');
+}
+function openDir(name) {
+  currentPath = normalizePath(currentPath + '/' + name);
+  document.getElementById('currentPath').value = currentPath;
+  loadFiles();
+}
+function goUp() {
+  let parts = currentPath.split('/').filter(p => p);
+  parts.pop();
+  currentPath = '/' + parts.join('/');
+  document.getElementById('currentPath').value = currentPath;
+  loadFiles();
+}
+function downloadFile(name) {
+  let path = normalizePath(currentPath + '/' + name);
+  window.location.href = '/api/download?path=' + encodeURIComponent(path);
+}
+function hashFile(name, btn) {
+  let path = normalizePath(currentPath + '/' + name);
+  let label = btn.textContent;
+  btn.disabled = true;
+  btn.textContent = 'Hashing...';
+  let done = r => {
+    btn.disabled = false;
+    btn.textContent = label;
+    if (r.error) alert('Hash failed: ' + r.error);
+    else prompt('SHA-256 of ' + name + (r.cached ? ' (cached)' : ''), r.digest);
+  };
+  let poll = id => fetch('/api/jobs?id=' + id).then(r => r.json()).then(j => {
+    if (j.state === 'running') {
+      btn.textContent = Math.floor(j.progress * 100 / Math.max(j.total, 1)) + '%';
+      setTimeout(() => poll(id), 1000);
+    } else {
+      done(j.result || { error: j.state });
+    }
+  });
+  fetch('/api/hash?algo=sha256&path=' + encodeURIComponent(path))
+    .then(r => r.json())
+    .then(r => r.job ? poll(r.job) : done(r))
+    .catch(e => done({ error: e.message }));
+}
+let preview = null;
+function previewFile(name) {
+  preview = { path: normalizePath(currentPath + '/' + name), gen: 0 };
+  document.getElementById('previewTitle').textContent = name;
+  document.getElementById('previewMode').value = 'text';
+  document.getElementById('previewModal').classList.add('active');
+  openPreviewAt(0);
+}
+function openPreviewAt(offset) {
+  let mode = document.getElementById('previewMode').value;
+  if (mode === 'hex') offset -= offset % 16;
+  Object.assign(preview, { mode: mode, next: offset, eof: false, busy: false, gen: preview.gen + 1 });
+  document.getElementById('previewPre').textContent = '';
+  document.getElementById('previewBody').scrollTop = 0;
+  loadPreviewPage();
+}
+// Pages are fetched one at a time as the viewer scrolls near its end
+function loadPreviewPage() {
+  let p = preview;
+  if (!p || p.busy || p.eof) return;
+  p.busy = true;
+  let gen = p.gen;
+  let info = document.getElementById('previewInfo');
+  fetch('/api/preview?mode=' + p.mode + '&offset=' + p.next + '&path=' + encodeURIComponent(p.path))
+    .then(r => r.json())
+    .then(d => {
+      if (gen !== p.gen) return;
+      p.busy = false;
+      if (d.error) { info.textContent = d.error; return; }
+      let text = p.mode === 'hex' ? formatHexRows(d.offset, d.hex) : d.text;
+      document.getElementById('previewPre').appendChild(document.createTextNode(text));
+      p.next = d.next;
+      p.eof = d.eof;
+      info.textContent = formatSize(d.size) + (d.encoding ? ' · ' + d.encoding : '') + ' · ' + (d.eof ? 'end of file' : 'at ' + d.next);
+      fillPreview();
+    })
+    .catch(e => { p.busy = false; info.textContent = e.message; });
+}
+function fillPreview() {
+  let body = document.getElementById('previewBody');
+  if (body.scrollTop + body.clientHeight >= body.scrollHeight - 200) loadPreviewPage();
+}
+function formatHexRows(offset, hex) {
+  let out = '';
+  for (let i = 0; i < hex.length; i += 32) {
+    let row = hex.substr(i, 32), bytes = [], ascii = '';
+    for (let j = 0; j < row.length; j += 2) {
+      let b = parseInt(row.substr(j, 2), 16);
+      bytes.push(row.substr(j, 2));
+      ascii += b >= 32 && b < 127 ? String.fromCharCode(b) : '.';
+    }
+    out += (offset + i / 2).toString(16).padStart(10, '0') + '  ' + bytes.join(' ').padEnd(47) + '  ' + ascii + '\n';
+  }
+  return out;
+}
+function closePreview() {
+  document.getElementById('previewModal').classList.remove('active');
+  if (preview) preview.gen++;
+  preview = null;
+}
+document.getElementById('previewBody').addEventListener('scroll', fillPreview);
+function renameFile(name) {
+  let newName = prompt('Rename to:', name);
+  if(!newName || newName === name) return;
+  let oldPath = normalizePath(currentPath + '/' + name);
+  let newPath = normalizePath(currentPath + '/' + newName);
+  fetch('/api/rename?old=' + encodeURIComponent(oldPath) + '&new=' + encodeURIComponent(newPath))
+    .then(r => r.json())
+    .then(() => loadFiles())
+    .catch(e => alert('Rename failed'));
+}
+let modalSourceFile = '';
+let modalCurrentPath = '/data';
+let modalOperation = 'copy';
+let modalBatch = null;
+function copyFile(name) {
+  modalSourceFile = name;
+  modalBatch = null;
+  modalCurrentPath = currentPath;
+  modalOperation = 'copy';
+  document.getElementById('modalTitle').textContent = 'Copy: Select Destination';
+  document.getElementById('copyModal').classList.add('active');
+  loadModalFiles();
+}
+function moveFile(name) {
+  modalSourceFile = name;
+  modalBatch = null;
+  modalCurrentPath = currentPath;
+  modalOperation = 'move';
+  document.getElementById('modalTitle').textContent = 'Move: Select Destination';
+  document.getElementById('copyModal').classList.add('active');
+  loadModalFiles();
+}
+function closeModal() {
+  document.getElementById('copyModal').classList.remove('active');
+}
+function loadModalFiles() {
+  document.getElementById('modalPath').textContent = modalCurrentPath;
+  fetch('/api/list?path=' + encodeURIComponent(modalCurrentPath))
+    .then(r => r.json())
+    .then(data => {
+      let html = '';
+      if (data.files) {
+        data.files.filter(f => f.type === 'dir').forEach(f => {
+          html += '<div class="file-item" data-dirname="' + f.name + '" style="cursor:pointer;">';
+          html += '<div class="file-info"><span class="file-icon">📁</span><span>' + f.name + '</span></div>';
+          html += '</div>';
+        });
+      }
+      document.getElementById('modalFileList').innerHTML = html || '<div class="loading">No folders</div>';
+      document.querySelectorAll('#modalFileList .file-item').forEach(el => {
+        el.addEventListener('click', () => modalOpenDir(el.getAttribute('data-dirname')));
+      });
+    });
+}
+function modalOpenDir(name) {
+  modalCurrentPath = normalizePath(modalCurrentPath + '/' + name);
+  loadModalFiles();
+}
+function modalGoUp() {
+  let parts = modalCurrentPath.split('/').filter(p => p);
+  parts.pop();
+  modalCurrentPath = '/' + parts.join('/');
+  loadModalFiles();
+}
+function selectDestination() {
+  if (modalBatch) {
+    let ops = modalBatch.map(name => ({ op: modalOperation, src: normalizePath(currentPath + '/' + name), dst: normalizePath(modalCurrentPath + '/' + name) }));
+    modalBatch = null;
+    closeModal();
+    runBatch(ops);
+    return;
+  }
+  let newName = prompt('File name in destination:', modalSourceFile);
+  if(!newName) return;
+  let src = normalizePath(currentPath + '/' + modalSourceFile);
+  let dst = normalizePath(modalCurrentPath + '/' + newName);
+  console.log('Copy operation:');
+  console.log('  Source:', src);
+  console.log('  Destination:', dst);
+  if (modalOperation === 'copy') {
+    let url = '/api/copy?src=' + encodeURIComponent(src) + '&dst=' + encodeURIComponent(dst);
+    console.log('  URL:', url);
+    fetch(url)
+      .then(r => {
+        console.log('  Response status:', r.status);
+        return r.text();
+      })
+      .then(text => {
+        console.log('  Response body:', text);
+        try {
+          let data = JSON.parse(text);
+          if (data.error) {
+            alert('Copy failed: ' + data.error);
+          } else {
+            closeModal();
+            loadFiles();
+          }
+        } catch(e) {
+          alert('Copy failed: Invalid response');
+        }
+      })
+      .catch(e => {
+        console.error('Copy error:', e);
+        alert('Copy failed: ' + e.message);
+      });
+  } else if (modalOperation === 'move') {
+    let url = '/api/copy?src=' + encodeURIComponent(src) + '&dst=' + encodeURIComponent(dst);
+    console.log('  URL:', url);
+    fetch(url)
+      .then(r => r.json())
+      .then(() => fetch('/api/delete?path=' + encodeURIComponent(src)))
+      .then(r => r.json())
+      .then(() => { closeModal(); loadFiles(); })
+      .catch(e => alert('Move failed: ' + e.message));
+  }
+}
+function deleteFile(name) {
+  if(!confirm('Delete ' + name + '?')) return;
+  let path = normalizePath(currentPath + '/' + name);
+  fetch('/api/delete?path=' + encodeURIComponent(path))
+    .then(r => r.json())
+    .then(() => loadFiles())
+    .catch(e => alert('Delete failed'));
+}
+function formatSize(bytes) {
+  if(bytes < 1024) return bytes + ' B';
+  if(bytes < 1024*1024) return (bytes/1024).toFixed(1) + ' KB';
+  if(bytes < 1024*1024*1024) return (bytes/1024/1024).toFixed(1) + ' MB';
+  return (bytes/1024/1024/1024).toFixed(1) + ' GB';
+}
+function uploadFile() {
+  let fileInput = document.getElementById('fileUpload');
+  let file = fileInput.files[0];
+  if (!file) return;
+  let progressDiv = document.getElementById('uploadProgress');
+  let filenameSpan = document.getElementById('uploadFilename');
+  let statusSpan = document.getElementById('uploadStatus');
+  let progressBar = document.getElementById('uploadBar');
+  filenameSpan.textContent = file.name;
+  statusSpan.textContent = 'Uploading...';
+  progressDiv.style.display = 'block';
+  progressBar.style.width = '0%';
+  let formData = new FormData();
+  formData.append('file', file);
+  let currentPath = document.getElementById('currentPath').value;
+  let xhr = new XMLHttpRequest();
+  xhr.upload.addEventListener('progress', function(e) {
+    if (e.lengthComputable) {
+      let percent = (e.loaded / e.total) * 100;
+      progressBar.style.width = percent + '%';
+      statusSpan.textContent = 'Uploading... ' + Math.round(percent) + '%';
+    }
+  });
+  xhr.addEventListener('load', function() {
+    if (xhr.status === 200) {
+      try {
+        let response = JSON.parse(xhr.responseText);
+        if (response.success) {
+          progressBar.style.width = '100%';
+          statusSpan.textContent = response.extracted
+            ? 'Extracted ' + response.extracted.files + ' files (' + formatSize(response.extracted.bytes) + ')'
+            : 'Upload complete! (' + formatSize(response.size) + ')';
+          setTimeout(function() {
+            progressDiv.style.display = 'none';
+            fileInput.value = '';
+            loadFiles();
+          }, 2000);
+        } else {
+          statusSpan.textContent = 'Upload failed: ' + (response.error || 'Unknown error');
+          console.error('Upload error:', response.error);
+        }
+      } catch(e) {
+        statusSpan.textContent = 'Upload failed: Invalid response - ' + xhr.responseText;
+        console.error('Parse error:', e, 'Response:', xhr.responseText);
+      }
+    } else {
+      try {
+        let response = JSON.parse(xhr.responseText);
+        statusSpan.textContent = 'Upload failed: ' + (response.error || 'Server error');
+        console.error('Server error:', xhr.status, response);
+      } catch(e) {
+        statusSpan.textContent = 'Upload failed: Server error ' + xhr.status;
+        console.error('Server error:', xhr.status, xhr.responseText);
+      }
+    }
+  });
+  xhr.addEventListener('error', function() {
+    statusSpan.textContent = 'Upload failed: Network error';
+  });
+  let extract = document.getElementById('uploadExtract').checked ? '&extract=1' : '';
+  xhr.open('POST', '/api/upload?path=' + encodeURIComponent(currentPath) + extract);
+  xhr.send(formData);
+}
+let sysStream = null;
+let sysState = {};
+let sysPrev = null;
+let sysSeries = { ram_used: [], req_rate: [], byte_rate: [] };
+function loadSystemInfo() {
+  if (sysStream) return;
+  sysStream = new EventSource('/api/sysinfo/stream?interval=1000');
+  sysStream.addEventListener('snapshot', e => {
+    sysState = JSON.parse(e.data);
+    sysPrev = null;
+    document.getElementById('streamStatus').textContent = 'Live';
+    updateSystemInfo();
+  });
+  sysStream.onmessage = e => {
+    Object.assign(sysState, JSON.parse(e.data));
+    updateSystemInfo();
+  };
+  sysStream.onerror = () => {
+    document.getElementById('streamStatus').textContent = 'Reconnecting...';
+  };
+}
+function runDiskBench() {
+  let btn = document.getElementById('benchRun');
+  let out = document.getElementById('benchResult');
+  let url = '/api/bench/disk?path=' + encodeURIComponent(document.getElementById('benchPath').value) +
+    '&size=' + document.getElementById('benchSize').value +
+    '&block=' + document.getElementById('benchBlock').value +
+    '&qd=' + document.getElementById('benchQd').value +
+    '&direct=' + (document.getElementById('benchDirect').checked ? 1 : 0);
+  btn.disabled = true;
+  out.innerHTML = '<div class="loading">Running benchmark...</div>';
+  fetch(url)
+    .then(r => r.json())
+    .then(d => {
+      if (d.error) { out.innerHTML = '<div>Error: ' + d.error + '</div>'; return; }
+      let row = (name, t) => '<tr><td>' + name + '</td><td>' + t.mb_s.toFixed(1) + ' MB/s</td><td>' + Math.round(t.iops) + '</td><td>' + t.lat_us.p50 + ' / ' + t.lat_us.p99 + ' / ' + t.lat_us.max + ' µs</td></tr>';
+      let html = '<div style="font-size:13px;margin-bottom:5px;">' + d.path + ' - ' + formatSize(d.file_size) + ', ' + formatSize(d.block) + ' blocks, QD ' + d.queue_depth + (d.direct ? ', cache bypassed' : ', cached') + '</div>';
+      html += '<table class="xfer-table"><tr><th>Test</th><th>Throughput</th><th>IOPS</th><th>Latency p50 / p99 / max</th></tr>';
+      html += row('Sequential write', d.seq_write) + row('Sequential read', d.seq_read) + row('Random 4K read', d.rand_read_4k);
+      html += '</table>';
+      out.innerHTML = html;
+    })
+    .catch(e => { out.innerHTML = '<div>Error: ' + e.message + '</div>'; })
+    .finally(() => { btn.disabled = false; });
+}
+function stopSystemStream() {
+  if (sysStream) { sysStream.close(); sysStream = null; }
+}
+function pushSeries(name, v) {
+  let a = sysSeries[name];
+  a.push(v);
+  if (a.length > 120) a.shift();
+}
+function drawGraph(id, data, color) {
+  let c = document.getElementById(id);
+  if (!c || data.length < 2) return;
+  c.width = c.clientWidth; c.height = c.clientHeight;
+  let g = c.getContext('2d');
+  let max = Math.max.apply(null, data) || 1;
+  g.strokeStyle = color; g.lineWidth = 2; g.beginPath();
+  data.forEach((v, i) => {
+    let x = i * c.width / (data.length - 1);
+    let y = c.height - 2 - v / max * (c.height - 4);
+    if (i === 0) g.moveTo(x, y); else g.lineTo(x, y);
+  });
+  g.stroke();
+}
+function updateSystemInfo() {
+  let s = sysState;
+  if (sysPrev) {
+    let dt = Math.max(1, s.t - sysPrev.t);
+    pushSeries('req_rate', (s.total_requests - sysPrev.total_requests) / dt);
+    pushSeries('byte_rate', (s.bytes_transferred - sysPrev.bytes_transferred) / dt);
+  }
+  pushSeries('ram_used', s.ram_used);
+  sysPrev = { t: s.t, total_requests: s.total_requests, bytes_transferred: s.bytes_transferred };
+  let up = s.uptime;
+  let days = Math.floor(up / 86400), hours = Math.floor(up % 86400 / 3600), minutes = Math.floor(up % 3600 / 60);
+  let last = a => a.length ? a[a.length - 1] : 0;
+  let html = '';
+  html += '<div class="stat-card"><h3>💾 /data Storage</h3><div class="stat-value">' + formatSize(s.data_used) + ' / ' + formatSize(s.data_total) + '</div><div style="font-size:14px;margin-top:5px;">Free: ' + formatSize(s.data_free) + '</div></div>';
+  if (s.system_total) {
+    html += '<div class="stat-card"><h3>⚙️ /system Storage</h3><div class="stat-value">' + formatSize(s.system_used) + ' / ' + formatSize(s.system_total) + '</div></div>';
+  }
+  html += '<div class="stat-card"><h3>🧠 RAM Usage</h3><div class="stat-value">' + formatSize(s.ram_used) + ' / ' + formatSize(s.ram_total) + '</div><div style="font-size:14px;margin-top:5px;">' + Math.round(s.ram_used/s.ram_total*100) + '% used</div><canvas id="graphRam"></canvas></div>';
+  html += '<div class="stat-card"><h3>⏱️ Uptime</h3><div class="stat-value">' + days + 'd ' + hours + 'h ' + minutes + 'm</div><div style="font-size:14px;margin-top:5px;">' + up % 60 + ' seconds</div></div>';
+  html += '<div class="stat-card"><h3>🌐 Network</h3><div class="stat-value">' + s.ip + '</div><div style="font-size:14px;margin-top:5px;">' + s.hostname + '</div></div>';
+  html += '<div class="stat-card"><h3>📊 Total Requests</h3><div class="stat-value">' + s.total_requests + '</div><div style="font-size:14px;margin-top:5px;">' + last(sysSeries.req_rate).toFixed(1) + ' req/s</div><canvas id="graphReq"></canvas></div>';
+  html += '<div class="stat-card"><h3>📁 Files Transferred</h3><div class="stat-value">' + s.files_transferred + '</div></div>';
+  html += '<div class="stat-card"><h3>📦 Data Transferred</h3><div class="stat-value">' + formatSize(s.bytes_transferred) + '</div><div style="font-size:14px;margin-top:5px;">' + formatSize(Math.round(last(sysSeries.byte_rate))) + '/s</div><canvas id="graphBytes"></canvas></div>';
+  html += '<div class="stat-card"><h3>🔗 Active Connections</h3><div class="stat-value">' + s.active_connections + '</div></div>';
+  let ifs = s.interfaces || [];
+  html += '<div class="stat-card"><h3>📡 Interfaces</h3>';
+  if (!ifs.length) html += '<div style="font-size:14px;">No interfaces</div>';
+  ifs.forEach(f => {
+    html += '<div style="font-size:14px;margin-top:5px;">' + f.name + ': ⬇️ ' + formatSize(f.rx_rate) + '/s ⬆️ ' + formatSize(f.tx_rate) + '/s</div>';
+  });
+  html += '</div>';
+  let xs = s.transfers || [];
+  html += '<div class="stat-card" style="grid-column:1/-1;"><h3>🚚 Active Transfers</h3>';
+  if (!xs.length) {
+    html += '<div style="font-size:14px;">No active transfers</div>';
+  } else {
+    html += '<table class="xfer-table"><tr><th></th><th>Client</th><th>File</th><th>Progress</th><th>Rate</th></tr>';
+    xs.forEach(x => {
+      let pct = x.total ? Math.round(x.bytes / x.total * 100) : 0;
+      html += '<tr><td>' + (x.direction === 'upload' ? '⬆️' : '⬇️') + '</td><td>' + x.client + '</td><td>' + x.path + '</td>';
+      html += '<td>' + formatSize(x.bytes) + ' / ' + formatSize(x.total) + ' (' + pct + '%)</td>';
+      html += '<td>' + formatSize(x.rate) + '/s (avg ' + formatSize(x.avg_rate) + '/s)</td></tr>';
+    });
+    html += '</table>';
+  }
+  html += '</div>';
+  document.getElementById('systemStats').innerHTML = html;
+  drawGraph('graphRam', sysSeries.ram_used, '#2563eb');
+  drawGraph('graphReq', sysSeries.req_rate, '#16a34a');
+  drawGraph('graphBytes', sysSeries.byte_rate, '#f59e0b');
+}
+loadFiles();
+// System Monitor updates over one shared event stream - no polling